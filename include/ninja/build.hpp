@@ -51,6 +51,12 @@ struct Plan {
   Edge*
   FindWork();
 
+  /// Pop up to |max| more ready edges of |rule| that can run in a batch and
+  /// append them to |edges|, in the order FindWork() would have returned
+  /// them.
+  void
+  FindBatchWork(const Rule* rule, size_t max, std::vector<Edge*>* edges);
+
   /// Returns true if there's more work to be done.
   bool
   more_to_do() const {
@@ -127,6 +133,12 @@ private:
 
   void
   EdgeWanted(const Edge* edge);
+  /// Add |edge| to ready_, and to ready_batches_ if it can run in a batch.
+  void
+  AddReadyEdge(Edge* edge);
+  /// Move the edges that |pool| no longer delays to ready_.
+  void
+  RetrieveReadyEdges(Pool* pool);
   bool
   EdgeMaybeReady(std::map<Edge*, Want>::iterator want_e, std::string* err);
 
@@ -143,6 +155,9 @@ private:
   std::map<Edge*, Want> want_;
 
   EdgeSet ready_;
+  /// The edges of ready_ which can run in a batch, by rule, so that starting
+  /// a batch doesn't have to look through all of ready_.
+  std::map<const Rule*, EdgeSet> ready_batches_;
 
   Builder* builder_;
 
@@ -158,17 +173,31 @@ private:
 /// RealCommandRunner is an implementation that actually runs commands.
 struct CommandRunner {
   virtual ~CommandRunner() {}
+  /// Not const: a runner may sample the load of the system to decide.
   virtual bool
-  CanRunMore() const = 0;
+  CanRunMore() = 0;
   virtual bool
   StartCommand(Edge* edge) = 0;
 
+  /// Start the commands of |edges|, which share a rule, in one go if the
+  /// runner knows how.  Their results are still waited for one by one.
+  virtual bool
+  StartCommands(const std::vector<Edge*>& edges) {
+    for (Edge* edge : edges) {
+      if (!StartCommand(edge))
+        return false;
+    }
+    return true;
+  }
+
   /// The result of waiting for a command.
   struct Result {
     Result() : edge(nullptr) {}
     Edge* edge;
     ExitStatus status;
     std::string output;
+    /// The rest of the output, if it went over BuildConfig::max_output_size.
+    std::shared_ptr<FILE> spilled_output;
     bool
     success() const {
       return status == ExitSuccess;
@@ -190,7 +219,8 @@ struct CommandRunner {
 struct BuildConfig {
   BuildConfig()
       : verbosity(NORMAL), dry_run(false), parallelism(1), failures_allowed(1),
-        max_load_average(-0.0f) {}
+        max_load_average(-0.0f), max_output_size(64 << 20),
+        drain_grace_millis(1000), pressure_floor(0) {}
 
   enum Verbosity {
     QUIET, // No output -- used when testing.
@@ -205,6 +235,15 @@ struct BuildConfig {
   /// The maximum load average we must not exceed. A negative value
   /// means that we do not have any limit.
   double max_load_average;
+  /// How many bytes of the output of a command to keep in memory.  The rest
+  /// waits in a temporary file until it's printed.  0 means no limit.
+  size_t max_output_size;
+  /// With -d pidfd, how long to keep reading the output of a command after
+  /// it exits, in case it left a process behind that still holds it open.
+  int drain_grace_millis;
+  /// If not 0, run between this many jobs and |parallelism| in parallel,
+  /// fewer as Linux reports more tasks stalling on the CPU, memory or IO.
+  int pressure_floor;
   DepfileParserOptions depfile_parser_options;
 };
 
@@ -238,8 +277,9 @@ struct Builder {
   bool
   Build(std::string* err);
 
+  /// Start |edges|, which share a rule, as a batch: see the "batch" binding.
   bool
-  StartEdge(Edge* edge, std::string* err);
+  StartEdges(const std::vector<Edge*>& edges, std::string* err);
 
   /// Update status ninja logs following a command termination.
   /// @return false if the build can not proceed further due to a fatal error.
@@ -263,6 +303,15 @@ struct Builder {
   Status* status_;
 
 private:
+  /// Record the start of |edge| and get its outputs' directories and its
+  /// response file ready, adding the descriptor of the latter to
+  /// |memory_files| if it lives in memory.  Sets |*done| if the edge needs no
+  /// command to run, because it's phony or builtin.
+  bool
+  PrepareEdge(
+      Edge* edge, bool* done, std::vector<int>* memory_files, std::string* err
+  );
+
   bool
   ExtractDeps(
       CommandRunner::Result* result, const std::string& deps_type,
@@ -274,6 +323,17 @@ private:
   using RunningEdgeMap = std::map<const Edge*, int>;
   RunningEdgeMap running_edges_;
 
+  /// Results of builtin commands, which StartEdges() runs itself, waiting to
+  /// be handled like those of the command runner.
+  std::queue<CommandRunner::Result> builtin_results_;
+
+  /// Edges whose response file lives in memory, so that there's none to
+  /// remove from the disk.
+  std::set<const Edge*> memory_rspfiles_;
+
+  /// Descriptors of the depfiles in memory of running edges.
+  std::map<const Edge*, int> memory_depfiles_;
+
   /// Time the build started.
   int64_t start_time_millis_;
 
@@ -24,9 +24,12 @@
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <vector>
 
 struct DiskInterface;
 struct Edge;
+struct Node;
+struct StatProgress;
 
 /// Can answer questions about the manifest for the BuildLog.
 struct BuildLogUser {
@@ -34,6 +37,14 @@ struct BuildLogUser {
   /// This is only called during recompaction and doesn't have to be fast.
   [[nodiscard]] virtual bool
   IsPathDead(std::string_view s) const = 0;
+
+  /// Set (*dead)[i] to IsPathDead(paths[i]) for every path.  Recompaction
+  /// asks about all outputs at once, so that users that have to stat() them
+  /// can use DiskInterface::StatMany().
+  virtual void
+  ArePathsDead(
+      const std::vector<std::string_view>& paths, std::vector<bool>* dead
+  ) const;
 };
 
 /// Store a log of every command ran for every build.
@@ -48,7 +59,8 @@ struct BuildLog {
   ~BuildLog();
 
   /// Prepares writing to the log file without actually opening it - that will
-  /// happen when/if it's needed
+  /// happen when/if it's needed.  If the log needs recompaction, it is
+  /// rewritten on a background thread, and replaced on Close().
   bool
   OpenForWrite(
       const std::string& path, const BuildLogUser& user, std::string* err
@@ -58,26 +70,46 @@ struct BuildLog {
   void
   Close();
 
-  /// Load the on-disk log.
+  /// Load the on-disk log.  Large logs are parsed by several threads.
   LoadStatus
   Load(const std::string& path, std::string* err);
 
+  /// Parse the log with at most \a threads threads, or with one per
+  /// processor if 0 (the default).
+  void
+  set_load_threads(unsigned threads) {
+    load_threads_ = threads;
+  }
+
   struct LogEntry {
     std::string output;
     uint64_t command_hash;
     int start_time;
     int end_time;
     TimeStamp mtime;
+    /// Whether |command_hash| was computed by LegacyHashCommand(), as it was
+    /// loaded from a v5 log.
+    bool legacy_hash = false;
 
+    /// The hash of commands, see CommandHasher.
     static uint64_t
     HashCommand(std::string_view command);
+    /// The hash of commands in v5 logs: MurmurHash64A.
+    static uint64_t
+    LegacyHashCommand(std::string_view command);
+
+    /// @return whether the entry was recorded for the command of \a edge,
+    /// whose Edge::HashCommand() is \a command_hash.  A legacy hash that
+    /// matches is replaced by \a command_hash.
+    bool
+    MatchesCommand(const Edge* edge, uint64_t command_hash);
 
     // Used by tests.
     bool
     operator==(const LogEntry& o) const {
       return output == o.output && command_hash == o.command_hash
              && start_time == o.start_time && end_time == o.end_time
-             && mtime == o.mtime;
+             && mtime == o.mtime && legacy_hash == o.legacy_hash;
     }
 
     explicit LogEntry(const std::string& output);
@@ -90,6 +122,11 @@ struct BuildLog {
   /// Lookup a previously-run command by its output path.
   LogEntry*
   LookupByOutput(const std::string& path);
+  /// Lookup a previously-run command by its output node.  The entry found is
+  /// remembered by Node::index(), so only the first lookup of each output
+  /// hashes its path.
+  LogEntry*
+  LookupByOutput(const Node* node);
 
   /// Serialize an entry into a log file.
   bool
@@ -101,11 +138,14 @@ struct BuildLog {
       const std::string& path, const BuildLogUser& user, std::string* err
   );
 
-  /// Restat all outputs in the log
+  /// Restat all outputs in the log, or only |outputs| if |output_count| is
+  /// non-zero.  The outputs are stat()ed with DiskInterface::StatMany(),
+  /// which reports to |progress| if not null.
   bool
   Restat(
       std::string_view path, const DiskInterface& disk_interface,
-      int output_count, char** outputs, std::string* err
+      int output_count, char** outputs, StatProgress* progress,
+      std::string* err
   );
 
   using Entries =
@@ -121,10 +161,29 @@ private:
   bool
   OpenForWriteIfNeeded();
 
+  void
+  AttachEntry(const Node* node, LogEntry* entry);
+
+  /// Drop the entries of dead outputs, and start writing the others to a new
+  /// log on a background thread.
+  void
+  StartRecompaction(const std::string& path, const BuildLogUser& user);
+  /// Wait for the background recompaction, if any, and replace the log with
+  /// its result.
+  bool
+  FinishRecompaction(std::string* err);
+
   Entries entries_;
+  /// The entry of each output by Node::index(), once looked up or recorded.
+  /// |entries_| remains the complete log, including the entries of outputs
+  /// that have no node, such as dead outputs.
+  std::vector<LogEntry*> node_entries_;
   FILE* log_file_;
   std::string log_file_path_;
   bool needs_recompaction_;
+  unsigned load_threads_;
+  struct Recompaction;
+  std::unique_ptr<Recompaction> recompaction_;
 };
 
 #endif // NINJA_BUILD_LOG_H_
@@ -0,0 +1,40 @@
+// Copyright 2021 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_BUILTIN_H_
+#define NINJA_BUILTIN_H_
+
+#include "exit_status.hpp"
+
+#include <string>
+
+struct DiskInterface;
+
+/// Run |command| in ninja itself if it is one of these commands, written as
+/// plain words that don't need a shell:
+///   touch FILE...
+///   cp SOURCE DEST
+///   mkdir -p DIR...
+///   ln -sf TARGET LINK
+/// These make up many steps of a typical build, and take far less time
+/// than starting a shell and a program to run them.  Store whether it
+/// worked in |status|, and any error in |output|.
+/// @return false if |command| must run in a process instead.
+bool
+RunBuiltinCommand(
+    const std::string& command, DiskInterface* disk, ExitStatus* status,
+    std::string* output
+);
+
+#endif // NINJA_BUILTIN_H_
@@ -44,6 +44,8 @@ struct CLParser {
   /// Parse the full output of cl, filling filtered_output with the text that
   /// should be printed (if any). Returns true on success, or false with err
   /// filled. output must not be the same object as filtered_object.
+  /// A huge output may also be parsed a few whole lines at a time, by
+  /// calling this again with the lines that follow.
   bool
   Parse(
       const std::string& output, const std::string& deps_prefix,
@@ -51,6 +53,10 @@ struct CLParser {
   );
 
   std::set<std::string> includes_;
+
+private:
+  /// Whether an earlier line was a /showIncludes line.
+  bool seen_show_includes_ = false;
 };
 
 #endif // NINJA_CLPARSER_H_
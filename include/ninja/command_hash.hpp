@@ -0,0 +1,64 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_COMMAND_HASH_H_
+#define NINJA_COMMAND_HASH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/// Computes the 64-bit hash of commands stored in the build log (from v6 on).
+///
+/// The hash follows the design of XXH3: eight 64-bit accumulators take in
+/// the input 64 bytes at a time with 32x32->64 bit multiplies, which SSE2
+/// does two lanes at a time, and are folded together at the end.  Input can
+/// be fed in pieces: the hash only depends on the concatenation of all the
+/// pieces passed to Update().
+class CommandHasher {
+public:
+  CommandHasher();
+
+  void
+  Update(std::string_view data);
+
+  /// @return the hash of everything passed to Update() so far.  More data
+  /// may still be added afterwards.
+  uint64_t
+  Finish() const;
+
+  static uint64_t
+  Hash(std::string_view data) {
+    CommandHasher hasher;
+    hasher.Update(data);
+    return hasher.Finish();
+  }
+
+  static constexpr size_t kStripeSize = 64;
+
+private:
+  /// Mix whole stripes into |acc_|.
+  void
+  Consume(const char* data, size_t stripes);
+
+  alignas(16) uint64_t acc_[8];
+  /// The trailing partial stripe.
+  char buffer_[kStripeSize];
+  size_t buffered_ = 0;
+  /// The position of the next stripe in the current block.
+  size_t stripe_ = 0;
+  uint64_t length_ = 0;
+};
+
+#endif // NINJA_COMMAND_HASH_H_
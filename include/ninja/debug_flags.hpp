@@ -31,4 +31,14 @@ extern bool g_keep_rsp;
 
 extern bool g_experimental_statcache;
 
+extern bool g_freeze_graph;
+
+extern bool g_verify_reload;
+
+extern bool g_use_io_uring;
+
+extern bool g_use_spawner;
+
+extern bool g_use_pidfd;
+
 #endif // NINJA_EXPLAIN_H_
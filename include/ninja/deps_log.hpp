@@ -19,6 +19,7 @@
 #include "timestamp.hpp"
 
 #include <cstdio>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -65,10 +66,12 @@ struct State;
 /// wins, allowing updates to just be appended to the file.  A separate
 /// repacking step can run occasionally to remove dead records.
 struct DepsLog {
-  DepsLog() : needs_recompaction_(false), file_(nullptr) {}
+  DepsLog();
   ~DepsLog();
 
   // Writing (build-time) interface.
+  /// If the log needs recompaction, it is rewritten on a background thread,
+  /// and replaced on Close().
   bool
   OpenForWrite(const std::string& path, std::string* err);
   bool
@@ -79,6 +82,9 @@ struct DepsLog {
   Close();
 
   // Reading (startup-time) interface.
+  /// A deps record.  Records are never modified once added to the log;
+  /// recording new deps for a node replaces its record instead, so an Edge
+  /// can share a record (see Edge::loaded_deps_) rather than copying it.
   struct Deps {
     Deps(int64_t mtime, int node_count)
         : mtime(mtime), node_count(node_count), nodes(new Node*[node_count]) {}
@@ -91,6 +97,10 @@ struct DepsLog {
   Load(const std::string& path, State* state, std::string* err);
   Deps*
   GetDeps(Node* node);
+  /// Like GetDeps(), but the returned record stays valid after new deps are
+  /// recorded for \a node.
+  std::shared_ptr<const Deps>
+  ShareDeps(Node* node);
   Node*
   GetFirstReverseDepsNode(Node* node);
 
@@ -112,16 +122,16 @@ struct DepsLog {
   nodes() const {
     return nodes_;
   }
-  const std::vector<Deps*>&
+  const std::vector<std::shared_ptr<Deps>>&
   deps() const {
     return deps_;
   }
 
 private:
-  // Updates the in-memory representation.  Takes ownership of |deps|.
-  // Returns true if a prior deps record was deleted.
+  // Updates the in-memory representation.
+  // Returns true if a prior deps record was replaced.
   bool
-  UpdateDeps(int out_id, Deps* deps);
+  UpdateDeps(int out_id, std::shared_ptr<Deps> deps);
   // Write a node name record, assigning it an id.
   bool
   RecordId(Node* node);
@@ -131,14 +141,24 @@ private:
   bool
   OpenForWriteIfNeeded();
 
+  /// Start writing the live records to a new log on a background thread.
+  void
+  StartRecompaction(const std::string& path);
+  /// Wait for the background recompaction, if any, and replace the log with
+  /// its result.
+  bool
+  FinishRecompaction(std::string* err);
+
   bool needs_recompaction_;
   FILE* file_;
   std::string file_path_;
+  struct Recompaction;
+  std::unique_ptr<Recompaction> recompaction_;
 
   /// Maps id -> Node.
   std::vector<Node*> nodes_;
   /// Maps id -> deps of that id.
-  std::vector<Deps*> deps_;
+  std::vector<std::shared_ptr<Deps>> deps_;
 
   friend struct DepsLogTest;
 };
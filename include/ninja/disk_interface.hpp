@@ -17,8 +17,54 @@
 
 #include "timestamp.hpp"
 
+#include <cstddef>
 #include <map>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
+
+/// The contents of a file, either copied into memory or mapped.  The data is
+/// always followed by a NUL byte, which the lexers rely on to stop scanning.
+struct FileContents {
+  FileContents() : map_(nullptr), map_size_(0) {}
+  FileContents(const FileContents&) = delete;
+  FileContents&
+  operator=(const FileContents&) = delete;
+  ~FileContents() {
+    Clear();
+  }
+
+  std::string_view
+  view() const {
+    return view_;
+  }
+
+  /// Take ownership of a buffer holding the file's contents.
+  void
+  Assign(std::string&& buffer);
+
+  /// Map the first |size| bytes of the file open as |fd| read-only.
+  /// The mapping stays valid after |fd| is closed.
+  /// Returns false and sets errno on failure.
+  bool
+  Map(int fd, size_t size);
+
+  void
+  Clear();
+
+  /// Whether the contents are mapped rather than copied.
+  bool
+  mapped() const {
+    return map_ != nullptr;
+  }
+
+private:
+  std::string buffer_;
+  void* map_;
+  size_t map_size_;
+  std::string_view view_;
+};
 
 /// Interface for reading files from disk.  See DiskInterface for details.
 /// This base offers the minimum interface needed just to read files.
@@ -34,6 +80,23 @@ struct FileReader {
   ReadFile(
       const std::string& path, std::string* contents, std::string* err
   ) = 0;
+
+  /// Like ReadFile, but implementations may avoid copying the file by
+  /// mapping it into memory.  The default reads it with ReadFile.
+  virtual Status
+  ReadFileContents(
+      const std::string& path, FileContents* contents, std::string* err
+  );
+};
+
+/// Receives progress reports from DiskInterface::StatMany().
+struct StatProgress {
+  virtual ~StatProgress() {}
+
+  /// Called on the thread that called StatMany(), after |done| of |total|
+  /// paths were stat()ed.  The last call has |done| == |total|.
+  virtual void
+  StatProgressed(size_t done, size_t total) = 0;
 };
 
 /// Interface for accessing the disk.
@@ -46,6 +109,17 @@ struct DiskInterface : public FileReader {
   virtual TimeStamp
   Stat(const std::string& path, std::string* err) const = 0;
 
+  /// Stat() every path in |paths|, storing the results in |mtimes| in the
+  /// same order.  All paths are stat()ed even if some fail; returns false
+  /// and fills |err| with the error of the first failing path.
+  /// |progress| may be null.  The default calls Stat() for each path in turn.
+  virtual bool
+  StatMany(
+      const std::vector<std::string_view>& paths,
+      std::vector<TimeStamp>* mtimes, StatProgress* progress,
+      std::string* err
+  ) const;
+
   /// Create a directory, returning false on failure.
   virtual bool
   MakeDir(const std::string& path) = 0;
@@ -67,27 +141,115 @@ struct DiskInterface : public FileReader {
   /// `basename path`.
   bool
   MakeDirs(const std::string& path);
+
+  /// @return whether |path| exists and is a directory.  The default
+  /// doesn't know, and returns false.
+  virtual bool
+  IsDirectory(const std::string& path) const;
+
+  /// Update the mtime of |path|, creating it if missing; like touch.
+  /// The default rewrites the file with its own contents.
+  virtual bool
+  Touch(const std::string& path, std::string* err);
+
+  /// Copy the file |from| to |to|, or into |to| if it's a directory; like cp.
+  /// The default reads and writes the contents.
+  virtual bool
+  CopyFile(const std::string& from, const std::string& to, std::string* err);
+
+  /// Replace |path|, or make an entry in it if it's a directory, with a
+  /// symbolic link to |target|; like ln -sf.  The default fails.
+  virtual bool
+  MakeSymlink(
+      const std::string& target, const std::string& path, std::string* err
+  );
+
+  /// Put |contents| in a file which only lives in memory, and which commands
+  /// started before CloseMemoryFile() or UnshareMemoryFile() can open at
+  /// |*path|, to read or write.  The default doesn't support it.
+  /// @return a descriptor for the other memory file methods, or -1.
+  virtual int
+  CreateMemoryFile(const std::string& contents, std::string* path);
+  virtual void
+  UnshareMemoryFile(int fd);
+  virtual bool
+  ReadMemoryFile(int fd, std::string* contents, std::string* err);
+  virtual void
+  CloseMemoryFile(int fd);
 };
 
+struct StatRing;
+
 /// Implementation of DiskInterface that actually hits the disk.
 struct RealDiskInterface : public DiskInterface {
-  RealDiskInterface()
-#ifdef _WIN32
-      : use_cache_(false)
-#endif
-  {
-  }
-  virtual ~RealDiskInterface() {}
+  RealDiskInterface();
+  virtual ~RealDiskInterface();
   virtual TimeStamp
   Stat(const std::string& path, std::string* err) const;
+  /// Batches the paths through a StatRing where io_uring is available, and
+  /// otherwise spreads them over several threads: stat() is mostly waiting
+  /// on the file system, more so on network storage.
+  virtual bool
+  StatMany(
+      const std::vector<std::string_view>& paths,
+      std::vector<TimeStamp>* mtimes, StatProgress* progress,
+      std::string* err
+  ) const;
   virtual bool
   MakeDir(const std::string& path);
   virtual bool
   WriteFile(const std::string& path, const std::string& contents);
   virtual Status
   ReadFile(const std::string& path, std::string* contents, std::string* err);
+  virtual Status
+  ReadFileContents(
+      const std::string& path, FileContents* contents, std::string* err
+  );
   virtual int
   RemoveFile(const std::string& path);
+  virtual bool
+  IsDirectory(const std::string& path) const;
+  virtual bool
+  Touch(const std::string& path, std::string* err);
+  virtual bool
+  CopyFile(const std::string& from, const std::string& to, std::string* err);
+  virtual bool
+  MakeSymlink(
+      const std::string& target, const std::string& path, std::string* err
+  );
+  /// Uses memfd_create() on Linux: commands inherit the descriptor and open
+  /// the file again through /dev/fd.
+  virtual int
+  CreateMemoryFile(const std::string& contents, std::string* path);
+  virtual void
+  UnshareMemoryFile(int fd);
+  virtual bool
+  ReadMemoryFile(int fd, std::string* contents, std::string* err);
+  virtual void
+  CloseMemoryFile(int fd);
+
+  /// Set how many threads StatMany() may use, including the calling one.
+  void
+  set_stat_threads(unsigned threads) {
+    stat_threads_ = threads ? threads : 1;
+  }
+
+  /// Set whether StatMany() may use io_uring.  It falls back to threads
+  /// when the kernel doesn't support it anyway.
+  void
+  set_use_io_uring(bool use) {
+    use_io_uring_ = use;
+  }
+
+private:
+  unsigned stat_threads_ = kDefaultStatThreads;
+  static constexpr unsigned kDefaultStatThreads = 16;
+
+  bool use_io_uring_ = true;
+  /// Created by the first StatMany() that needs it, and null if io_uring is
+  /// unavailable.
+  mutable std::unique_ptr<StatRing> stat_ring_;
+  mutable bool stat_ring_probed_ = false;
 };
 
 #endif // NINJA_DISK_INTERFACE_H_
@@ -15,10 +15,13 @@
 #ifndef NINJA_EVAL_ENV_H_
 #define NINJA_EVAL_ENV_H_
 
+#include <cstdint>
 #include <map>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+struct BindingEnv;
 struct Rule;
 
 /// An interface for a scope for variable (e.g. "$foo") lookups.
@@ -26,6 +29,14 @@ struct Env {
   virtual ~Env() {}
   virtual std::string
   LookupVariable(const std::string& var) = 0;
+
+  /// @return true if LookupVariable() may give @a var a value of its own
+  ///         instead of the one of the enclosing scopes, so that it mustn't
+  ///         be memoized in them.  Must not depend on the state of the Env.
+  virtual bool
+  OverridesScopeVariable(const std::string&) const {
+    return false;
+  }
 };
 
 /// A tokenized string that contains variable references.
@@ -54,6 +65,19 @@ struct EvalString {
   void
   AddSpecial(std::string_view text);
 
+  /// @return true if any variable referenced by this string is bound
+  ///         directly in @a env (ignoring its parents).
+  bool
+  ReferencesBindingsOf(const BindingEnv& env) const;
+
+  /// @return A copy of this string in which every variable reference that is
+  ///         neither overridden by @a env (like $in and $out) nor a binding
+  ///         of @a rule has been replaced by its value in @a scope.
+  EvalString
+  ExpandScopeVariables(
+      const Rule& rule, BindingEnv* scope, const Env& env
+  ) const;
+
   /// Construct a human-readable representation of the parsed state,
   /// for use in tests.
   std::string
@@ -95,8 +119,12 @@ private:
 /// An Env which contains a mapping of variables to values
 /// as well as a pointer to a parent scope.
 struct BindingEnv : public Env {
-  BindingEnv() : parent_(nullptr) {}
-  explicit BindingEnv(BindingEnv* parent) : parent_(parent) {}
+  BindingEnv() : parent_(nullptr), root_(this) {}
+  explicit BindingEnv(BindingEnv* parent)
+      : parent_(parent), root_(parent->root_) {}
+  BindingEnv(const BindingEnv&) = delete;
+  BindingEnv&
+  operator=(const BindingEnv&) = delete;
 
   virtual ~BindingEnv() {}
   virtual std::string
@@ -114,18 +142,52 @@ struct BindingEnv : public Env {
   void
   AddBinding(const std::string& key, const std::string& val);
 
+  bool
+  HasLocalBinding(const std::string& key) const {
+    return bindings_.count(key) != 0;
+  }
+
   /// This is tricky.  Edges want lookup scope to go in this order:
   /// 1) value set on edge itself (edge_->env_)
   /// 2) value set on rule, with expansion in the edge's scope
   /// 3) value set on enclosing scope of edge (edge_->env_->parent_)
   /// This function takes as parameters the necessary info to do (2).
+  /// The scope variables referenced by a rule binding are expanded once per
+  /// scope and memoized, so that only $in, $out and the like are evaluated
+  /// for every edge.
   std::string
-  LookupWithFallback(const std::string& var, const EvalString* eval, Env* env);
+  LookupWithFallback(
+      const std::string& var, const EvalString* eval, const Rule* rule,
+      Env* env
+  );
 
 private:
+  /// @return @a eval with all scope variables expanded, memoized in the
+  ///         outermost scope that binds the same values for them.
+  const EvalString&
+  LookupScopeExpansion(
+      const EvalString* eval, const Rule* rule, const Env& env
+  );
+
   std::map<std::string, std::string> bindings_;
   std::map<std::string, const Rule*> rules_;
   BindingEnv* parent_;
+  /// The outermost scope, which holds the generation of the whole tree.
+  BindingEnv* root_;
+
+  /// Bumped in the root scope whenever a binding is added to any scope of
+  /// its tree, which invalidates all memoized scope expansions.  Bindings
+  /// are only added while parsing, so in practice expansions computed during
+  /// the build are never recomputed.
+  uint64_t bindings_generation_ = 1;
+
+  /// A memoized result of EvalString::ExpandScopeVariables, valid as long as
+  /// no binding has been added to any scope since it was computed.
+  struct ScopeExpansion {
+    uint64_t generation = 0;
+    EvalString value;
+  };
+  std::unordered_map<const EvalString*, ScopeExpansion> scope_expansions_;
 };
 
 #endif // NINJA_EVAL_ENV_H_
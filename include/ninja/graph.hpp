@@ -15,13 +15,18 @@
 #ifndef NINJA_GRAPH_H_
 #define NINJA_GRAPH_H_
 
+#include "deps_log.hpp"
 #include "dyndep.hpp"
 #include "eval_env.hpp"
 #include "timestamp.hpp"
 #include "util.hpp"
 
 #include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <optional>
 #include <set>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -34,18 +39,150 @@ struct Node;
 struct Pool;
 struct State;
 
+/// The part of the Nodes of a State that dependency scanning reads and
+/// writes for every node it visits.  It is kept in dense arrays indexed by
+/// Node::index() rather than in the Nodes themselves, so that a scan over a
+/// large graph doesn't pull the paths and edge lists of all nodes into cache.
+/// The arrays are split into fixed-size chunks which never move, so a Node
+/// can refer to its chunk directly.
+struct NodeTable {
+  static constexpr uint32_t kChunkSize = 4096;
+
+  /// Bits of Chunk::flags.
+  enum {
+    kExistenceMask = 3,
+    kDirty = 4,
+    kDyndepPending = 8,
+  };
+
+  struct Chunk {
+    TimeStamp mtimes[kChunkSize];
+    Edge* in_edges[kChunkSize];
+    uint8_t flags[kChunkSize];
+    /// The node at each index, or NULL once it has been destroyed.
+    Node* nodes[kChunkSize];
+  };
+
+  NodeTable() : size_(0) {}
+
+  /// Add the state of a new node and return its index.
+  uint32_t
+  Add(Node* node);
+
+  /// The chunk holding the state of the node at \a index.
+  Chunk*
+  chunk(uint32_t index) const {
+    return chunks_[index / kChunkSize].get();
+  }
+
+  /// The node at \a index, or NULL if it has been destroyed.
+  Node*
+  node(uint32_t index) const {
+    return chunk(index)->nodes[index % kChunkSize];
+  }
+
+  /// Mark all nodes as not-yet-stat()ed and not dirty.
+  void
+  Reset();
+
+  /// The number of indices handed out by Add().
+  uint32_t
+  size() const {
+    return size_;
+  }
+
+private:
+  std::vector<std::unique_ptr<Chunk>> chunks_;
+  uint32_t size_;
+};
+
+/// The edges adjacent to a Node.  While the graph is being built, a list
+/// owns its elements like a std::vector.  State::FreezeGraph() packs the
+/// lists of all nodes into a single array, after which each list borrows its
+/// elements from there.  Adding to a borrowed list copies it back to the
+/// heap, so edges found later (dyndep files, deps) can still be added.
+struct EdgeList {
+  using const_iterator = Edge* const*;
+
+  EdgeList() : data_(nullptr), size_(0), capacity_(0) {}
+  EdgeList(const EdgeList&) = delete;
+  EdgeList&
+  operator=(const EdgeList&) = delete;
+  ~EdgeList() {
+    if (capacity_)
+      delete[] data_;
+  }
+
+  const_iterator
+  begin() const {
+    return data_;
+  }
+  const_iterator
+  end() const {
+    return data_ + size_;
+  }
+  size_t
+  size() const {
+    return size_;
+  }
+  bool
+  empty() const {
+    return size_ == 0;
+  }
+  Edge*
+  operator[](size_t i) const {
+    return data_[i];
+  }
+
+  void
+  Add(Edge* edge);
+
+  /// Remove the edges for which \a pred holds, keeping the order of the rest.
+  template <typename Pred>
+  void
+  RemoveIf(Pred pred) {
+    size_ = std::remove_if(data_, data_ + size_, pred) - data_;
+  }
+
+  /// Sort the edges by id, which is the order in which they appear in the
+  /// manifest.
+  void
+  Sort();
+
+  /// Copy the edges to \a storage and borrow them from there from now on.
+  /// Returns the end of the copy.
+  Edge**
+  MoveTo(Edge** storage);
+
+private:
+  Edge** data_;
+  uint32_t size_;
+  /// The size of |data_|, or 0 if it is borrowed.
+  uint32_t capacity_;
+};
+
 /// Information about a node in the dependency graph: the file, whether
 /// it's dirty, mtime, etc.
 struct Node {
-  Node(const std::string& path, uint64_t slash_bits)
-      : path_(path), slash_bits_(slash_bits), mtime_(-1),
-        exists_(ExistenceStatusUnknown), dirty_(false), dyndep_pending_(false),
-        in_edge_(nullptr), id_(-1) {}
+  Node(const std::string& path, uint64_t slash_bits, NodeTable* table)
+      : index_(table->Add(this)), id_(-1), chunk_(table->chunk(index_)),
+        path_(path), slash_bits_(slash_bits) {}
+  ~Node() {
+    chunk_->nodes[slot()] = nullptr;
+  }
 
   /// Return false on error.
   bool
   Stat(DiskInterface* disk_interface, std::string* err);
 
+  /// Record the result of a successful stat() of the file, as from
+  /// DiskInterface::StatMany().
+  void
+  SetStatResult(TimeStamp mtime) {
+    mtime_ref() = mtime;
+    set_existence(mtime != 0 ? ExistenceStatusExists : ExistenceStatusMissing);
+  }
+
   /// If the file doesn't exist, set the mtime_ from its dependencies
   void
   UpdatePhonyMtime(TimeStamp mtime);
@@ -61,28 +198,27 @@ struct Node {
   /// Mark as not-yet-stat()ed and not dirty.
   void
   ResetState() {
-    mtime_ = -1;
-    exists_ = ExistenceStatusUnknown;
-    dirty_ = false;
+    mtime_ref() = -1;
+    flags_ref() &= NodeTable::kDyndepPending;
   }
 
   /// Mark the Node as already-stat()ed and missing.
   void
   MarkMissing() {
-    if (mtime_ == -1) {
-      mtime_ = 0;
+    if (mtime_ref() == -1) {
+      mtime_ref() = 0;
     }
-    exists_ = ExistenceStatusMissing;
+    set_existence(ExistenceStatusMissing);
   }
 
   bool
   exists() const {
-    return exists_ == ExistenceStatusExists;
+    return existence() == ExistenceStatusExists;
   }
 
   bool
   status_known() const {
-    return exists_ != ExistenceStatusUnknown;
+    return existence() != ExistenceStatusUnknown;
   }
 
   const std::string&
@@ -101,40 +237,47 @@ struct Node {
     return slash_bits_;
   }
 
+  /// Possible values of mtime():
+  ///   -1: file hasn't been examined
+  ///   0:  we looked, and file doesn't exist
+  ///   >0: actual file's mtime, or the latest mtime of its dependencies if it
+  ///   doesn't exist
   TimeStamp
   mtime() const {
-    return mtime_;
+    return chunk_->mtimes[slot()];
   }
 
   bool
   dirty() const {
-    return dirty_;
+    return chunk_->flags[slot()] & NodeTable::kDirty;
   }
   void
   set_dirty(bool dirty) {
-    dirty_ = dirty;
+    set_flag(NodeTable::kDirty, dirty);
   }
   void
   MarkDirty() {
-    dirty_ = true;
+    set_flag(NodeTable::kDirty, true);
   }
 
   bool
   dyndep_pending() const {
-    return dyndep_pending_;
+    return chunk_->flags[slot()] & NodeTable::kDyndepPending;
   }
   void
   set_dyndep_pending(bool pending) {
-    dyndep_pending_ = pending;
+    set_flag(NodeTable::kDyndepPending, pending);
   }
 
+  /// The Edge that produces this Node, or NULL when there is no
+  /// known edge to produce it.
   Edge*
   in_edge() const {
-    return in_edge_;
+    return chunk_->in_edges[slot()];
   }
   void
   set_in_edge(Edge* edge) {
-    in_edge_ = edge;
+    chunk_->in_edges[slot()] = edge;
   }
 
   int
@@ -146,72 +289,119 @@ struct Node {
     id_ = id;
   }
 
-  const std::vector<Edge*>&
+  /// The index of the state of this node in its NodeTable.
+  uint32_t
+  index() const {
+    return index_;
+  }
+
+  const EdgeList&
   out_edges() const {
     return out_edges_;
   }
-  const std::vector<Edge*>&
+  const EdgeList&
   validation_out_edges() const {
     return validation_out_edges_;
   }
   void
   AddOutEdge(Edge* edge) {
-    out_edges_.push_back(edge);
+    out_edges_.Add(edge);
   }
   void
   AddValidationOutEdge(Edge* edge) {
-    validation_out_edges_.push_back(edge);
+    validation_out_edges_.Add(edge);
+  }
+  /// Remove the edges for which \a pred holds from out_edges().
+  template <typename Pred>
+  void
+  RemoveOutEdgesIf(Pred pred) {
+    out_edges_.RemoveIf(pred);
+  }
+  /// Remove the edges for which \a pred holds from validation_out_edges().
+  template <typename Pred>
+  void
+  RemoveValidationOutEdgesIf(Pred pred) {
+    validation_out_edges_.RemoveIf(pred);
+  }
+  /// Sort out_edges() and validation_out_edges() by edge id, which is the
+  /// order in which they appear in the manifest.
+  void
+  SortOutEdges() {
+    out_edges_.Sort();
+    validation_out_edges_.Sort();
+  }
+
+  /// Copy out_edges() and validation_out_edges() to \a storage, see
+  /// State::FreezeGraph().  Returns the end of the copy.
+  Edge**
+  FreezeOutEdges(Edge** storage) {
+    return validation_out_edges_.MoveTo(out_edges_.MoveTo(storage));
   }
 
   void
   Dump(const char* prefix = "") const;
 
 private:
-  std::string path_;
-
-  /// Set bits starting from lowest for backslashes that were normalized to
-  /// forward slashes by CanonicalizePath. See |PathDecanonicalized|.
-  uint64_t slash_bits_;
-
-  /// Possible values of mtime_:
-  ///   -1: file hasn't been examined
-  ///   0:  we looked, and file doesn't exist
-  ///   >0: actual file's mtime, or the latest mtime of its dependencies if it
-  ///   doesn't exist
-  TimeStamp mtime_;
-
   enum ExistenceStatus {
     /// The file hasn't been examined.
     ExistenceStatusUnknown,
-    /// The file doesn't exist. mtime_ will be the latest mtime of its
+    /// The file doesn't exist. mtime() will be the latest mtime of its
     /// dependencies.
     ExistenceStatusMissing,
-    /// The path is an actual file. mtime_ will be the file's mtime.
+    /// The path is an actual file. mtime() will be the file's mtime.
     ExistenceStatusExists
   };
-  ExistenceStatus exists_;
 
-  /// Dirty is true when the underlying file is out-of-date.
-  /// But note that Edge::outputs_ready_ is also used in judging which
-  /// edges to build.
-  bool dirty_;
+  uint32_t
+  slot() const {
+    return index_ % NodeTable::kChunkSize;
+  }
+  ExistenceStatus
+  existence() const {
+    return static_cast<ExistenceStatus>(
+        chunk_->flags[slot()] & NodeTable::kExistenceMask
+    );
+  }
+  void
+  set_existence(ExistenceStatus status) {
+    uint8_t& flags = flags_ref();
+    flags = (flags & ~NodeTable::kExistenceMask) | status;
+  }
+  void
+  set_flag(uint8_t flag, bool value) {
+    uint8_t& flags = flags_ref();
+    flags = value ? (flags | flag) : (flags & ~flag);
+  }
+  TimeStamp&
+  mtime_ref() {
+    return chunk_->mtimes[slot()];
+  }
+  uint8_t&
+  flags_ref() {
+    return chunk_->flags[slot()];
+  }
 
-  /// Store whether dyndep information is expected from this node but
-  /// has not yet been loaded.
-  bool dyndep_pending_;
+  /// The index of this node in the NodeTable of its State.
+  uint32_t index_;
 
-  /// The Edge that produces this Node, or NULL when there is no
-  /// known edge to produce it.
-  Edge* in_edge_;
+  /// A dense integer id for the node, assigned and used by DepsLog.
+  int id_;
+
+  /// The chunk holding the mtime, existence, dirty and dyndep pending
+  /// states and the in-edge of this node.
+  NodeTable::Chunk* chunk_;
+
+  std::string path_;
+
+  /// Set bits starting from lowest for backslashes that were normalized to
+  /// forward slashes by CanonicalizePath. See |PathDecanonicalized|.
+  uint64_t slash_bits_;
 
   /// All Edges that use this Node as an input.
-  std::vector<Edge*> out_edges_;
+  EdgeList out_edges_;
 
   /// All Edges that use this Node as a validation.
-  std::vector<Edge*> validation_out_edges_;
-
-  /// A dense integer id for the node, assigned and used by DepsLog.
-  int id_;
+  EdgeList validation_out_edges_;
 };
 
 /// An edge in the dependency graph; links between Nodes using Rules.
@@ -231,10 +421,16 @@ struct Edge {
 
   /// Expand all variables in a command and return it as a string.
   /// If incl_rsp_file is enabled, the string will also contain the
-  /// full contents of a response file (if applicable)
+  /// full contents of a response file (if applicable), and the worker
+  /// which runs the command, since both change what the command does.
   std::string
   EvaluateCommand(bool incl_rsp_file = false) const;
 
+  /// @return BuildLog::LogEntry::HashCommand(EvaluateCommand(true)), without
+  /// concatenating the command and the response file contents.
+  uint64_t
+  HashCommand() const;
+
   /// Returns the shell-escaped value of |key|.
   std::string
   GetBinding(const std::string& key) const;
@@ -272,6 +468,11 @@ struct Edge {
   bool deps_missing_;
   bool generated_by_dep_loader_;
   TimeStamp command_start_time_;
+  /// What "rspfile" and "depfile" expand to while the command starts, if
+  /// these files live in memory rather than on disk: see
+  /// Builder::PrepareEdge().
+  std::string rspfile_memory_path_;
+  std::string depfile_memory_path_;
 
   [[nodiscard]] const Rule&
   rule() const {
@@ -310,6 +511,20 @@ struct Edge {
     return index >= inputs_.size() - order_only_deps_;
   }
 
+  // Implicit deps found while building, in the deps log or a depfile, are
+  // not copied into inputs_.  The edge shares the deps log record they were
+  // read from instead (a depfile gets a record of its own).  Records are
+  // never modified, so new deps replace the record rather than changing it.
+  // These deps come after the implicit deps in inputs_ and before the
+  // order-only ones.
+  std::shared_ptr<const DepsLog::Deps> loaded_deps_;
+  std::span<Node* const>
+  loaded_deps() const {
+    if (!loaded_deps_)
+      return {};
+    return {loaded_deps_->nodes, (size_t)loaded_deps_->node_count};
+  }
+
   // There are two types of outputs.
   // 1) explicit outs, which show up as $out on the command line;
   // 2) implicit outs, which the target generates but are not part of $out.
@@ -377,10 +592,9 @@ protected:
   bool
   LoadDepsFromLog(Edge* edge, std::string* err);
 
-  /// Preallocate \a count spaces in the input array on \a edge, returning
-  /// an iterator pointing at the first new space.
-  std::vector<Node*>::iterator
-  PreallocateSpace(Edge* edge, int count);
+  /// Make \a deps the loaded deps of \a edge and link them into the graph.
+  void
+  SetLoadedDeps(Edge* edge, std::shared_ptr<const DepsLog::Deps> deps);
 
   /// If we don't have a edge that generates this input already,
   /// create one; this makes us not abort if the input is missing,
@@ -449,26 +663,87 @@ struct DependencyScan {
   LoadDyndeps(Node* node, DyndepFile* ddf, std::string* err) const;
 
 private:
+  /// An edge being visited by RecomputeNodeDirty(), reached through |node|.
+  struct Frame {
+    explicit Frame(Node* node) : node(node) {}
+
+    enum Step {
+      /// Just pushed.
+      Start,
+      /// The pending dyndep file of the edge was pushed.
+      LoadDyndep,
+      /// Visiting the inputs, in the order of NextInput().
+      VisitInputs,
+    };
+
+    Node* node;
+    Step step = Start;
+    /// The input pushed last, which is being visited.
+    Node* visiting = nullptr;
+    bool visiting_order_only = false;
+    size_t next_input = 0;
+    size_t order_only_begin = 0;
+    Node* most_recent_input = nullptr;
+    bool dirty = false;
+  };
+
+  /// Visit |node| and everything it depends on, depth first.  The edges
+  /// being visited are kept on |stack| rather than the call stack, so that
+  /// long chains of edges can't overflow it.
   bool
   RecomputeNodeDirty(
-      Node* node, std::vector<Node*>* stack,
+      Node* node, std::vector<Frame>* stack,
       std::vector<Node*>* validation_nodes, std::string* err
   );
+  /// Start visiting |node|.  Source files and edges visited already are
+  /// done with right away; other edges get a Frame on |stack|.
+  bool
+  PushNode(Node* node, std::vector<Frame>* stack, std::string* err);
+  /// Load what the edge of |frame| needs before its inputs are visited.
   bool
-  VerifyDAG(Node* node, std::vector<Node*>* stack, std::string* err);
+  PrepareEdge(
+      Frame* frame, std::vector<Node*>* validation_nodes, std::string* err
+  );
+  /// @return the next input of the edge of |frame| to visit, or null.
+  /// The loaded deps go between the implicit and the order-only inputs.
+  Node*
+  NextInput(Frame* frame, bool* order_only);
+  /// Account for an input of the edge of |frame| that was visited.
+  void
+  InputVisited(Frame* frame, Node* input, bool order_only);
+  bool
+  FinishEdge(Frame* frame, std::string* err);
+  bool
+  VerifyDAG(Node* node, const std::vector<Frame>& stack, std::string* err);
+
+  /// Stat all inputs and loaded deps of |edge| that no edge builds and weren't
+  /// visited yet with a single DiskInterface::StatMany(), rather than one at a
+  /// time as they are visited, and mark the missing ones dirty.
+  void
+  StatSourceInputs(Edge* edge);
 
   /// Recompute whether a given single output should be marked dirty.
   /// Returns true if so.
+  /// |command_hash| caches the hash of the command of |edge|, which is only
+  /// computed once an output is found in the build log.
   bool
   RecomputeOutputDirty(
       const Edge* edge, const Node* most_recent_input,
-      const std::string& command, Node* output
+      std::optional<uint64_t>* command_hash, Node* output
   );
 
   BuildLog* build_log_;
   DiskInterface* disk_interface_;
   ImplicitDepLoader dep_loader_;
   DyndepLoader dyndep_loader_;
+
+  /// Scratch space for StatSourceInputs().
+  std::vector<Node*> stat_nodes_;
+  std::vector<std::string_view> stat_paths_;
+  std::vector<TimeStamp> stat_mtimes_;
+  /// Missing inputs stat()ed by StatSourceInputs() whose explanation waits
+  /// for PushNode() to visit them.
+  std::set<const Node*> missing_to_explain_;
 };
 
 #endif // NINJA_GRAPH_H_
@@ -15,6 +15,7 @@
 #ifndef NINJA_JSON_H_
 #define NINJA_JSON_H_
 
+#include <map>
 #include <string>
 
 // Encode a string in JSON format without encolsing quotes
@@ -25,4 +26,13 @@ EncodeJSONString(const std::string& in);
 void
 PrintJSONString(const std::string& in);
 
+// Decode a JSON object whose values are all strings, numbers, booleans or
+// null into |values|, mapping each key to its string, or to the text of any
+// other value.  Nested objects and arrays are not supported.
+bool
+DecodeJSONObject(
+    const std::string& in, std::map<std::string, std::string>* values,
+    std::string* err
+);
+
 #endif
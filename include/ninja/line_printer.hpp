@@ -17,6 +17,7 @@
 
 #include <cstddef>
 #include <string>
+#include <string_view>
 
 /// Prints lines of text, possibly overprinting previously printed lines
 /// if the terminal supports it.
@@ -45,7 +46,7 @@ struct LinePrinter {
 
   /// Prints a string on a new line, not overprinting previous output.
   void
-  PrintOnNewLine(const std::string& to_print);
+  PrintOnNewLine(std::string_view to_print);
 
   /// Lock or unlock the console.  Any output sent to the LinePrinter while the
   /// console is locked will not be printed until it is unlocked.
@@ -19,6 +19,7 @@
 
 struct BindingEnv;
 struct EvalString;
+struct ManifestReloader;
 
 enum DupeEdgeAction {
   kDupeEdgeActionWarn,
@@ -52,12 +53,19 @@ struct ManifestParser : public Parser {
     return Parse("input", input, err);
   }
 
+  /// Report the files loaded and scopes created to \a reloader, so that
+  /// it can reload the manifest later.
+  void
+  set_reloader(ManifestReloader* reloader) {
+    reloader_ = reloader;
+  }
+
 private:
+  friend struct ManifestReloader;
+
   /// Parse a file, given its contents as a string.
   bool
-  Parse(
-      const std::string& filename, const std::string& input, std::string* err
-  );
+  Parse(const std::string& filename, std::string_view input, std::string* err);
 
   /// Parse various statement types.
   bool
@@ -78,6 +86,7 @@ private:
   BindingEnv* env_;
   ManifestParserOptions options_;
   bool quiet_;
+  ManifestReloader* reloader_;
 };
 
 #endif // NINJA_MANIFEST_PARSER_H_
@@ -0,0 +1,180 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_MANIFEST_RELOAD_H_
+#define NINJA_MANIFEST_RELOAD_H_
+
+#include "manifest_parser.hpp"
+#include "timestamp.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct BindingEnv;
+struct DiskInterface;
+struct Node;
+struct State;
+
+/// Remembers which manifest files produced which part of a State, so that
+/// after the manifest has been regenerated only the subninja files that
+/// actually changed need to be parsed again.
+///
+/// The ManifestParser reports to the reloader while loading; see
+/// ManifestParser::set_reloader().  Reload() then brings the State up to
+/// date with the files on disk, producing the same State that parsing the
+/// manifest from scratch would, or gives up when it can't guarantee that.
+struct ManifestReloader {
+  ManifestReloader(
+      State* state, DiskInterface* disk_interface,
+      ManifestParserOptions options
+  );
+  ~ManifestReloader();
+
+  /// Called by the parser for every manifest file it parses.
+  void
+  FileLoaded(const std::string& path, std::string_view contents);
+  /// Called by the parser around loading a file with 'subninja'.
+  void
+  SubninjaBegin(BindingEnv* env);
+  void
+  SubninjaEnd();
+  /// Called by the parser whenever a binding or rule is added to |env|.
+  void
+  ScopeChanged(BindingEnv* env);
+  /// Called by the parser whenever a pool is declared.
+  void
+  PoolAdded();
+  /// Called by the parser when it drops an output which another edge already
+  /// generates, with -w dupbuild=warn.
+  void
+  DuplicateOutput();
+  /// Called once the whole manifest has been parsed, before the State is
+  /// modified by a build.
+  void
+  ParseFinished();
+
+  /// Re-parse the subninja files that changed since they were loaded and
+  /// splice the result into the State in place of what they produced before.
+  /// Everything the build added to the graph (dependencies loaded from
+  /// depfiles and the deps log) is removed again.
+  /// @return false if the manifest has to be parsed from scratch instead,
+  ///         e.g. because the top-level file changed, or because several
+  ///         edges generate the same output (with -w dupbuild=warn).  The State may have
+  ///         been modified then and must be discarded.  |err| is only
+  ///         informational.
+  bool
+  Reload(std::string* err);
+
+  /// Parse the manifest from scratch and compare the result with the State.
+  /// @return false and fill |err| if they differ.
+  bool
+  Verify(std::string* err) const;
+
+  /// Number of manifest files parsed by the initial load or, after
+  /// Reload(), by the last reload.
+  int
+  parsed_files() const {
+    return parsed_files_;
+  }
+
+private:
+  struct File {
+    std::string path;
+    TimeStamp mtime;
+    uint64_t hash;
+  };
+
+  /// A file loaded via 'subninja' (or the top-level manifest) together with
+  /// the files it includes.  Its edges, including those of nested subninjas,
+  /// are a contiguous range of State::edges_.
+  struct Unit {
+    Unit* parent = nullptr;
+    BindingEnv* env = nullptr;
+    std::vector<File> files;
+    std::vector<std::unique_ptr<Unit>> children;
+    size_t edges_begin = 0;
+    size_t edges_end = 0;
+    /// Value of |version_| when the subninja statement was parsed.
+    uint64_t version = 0;
+    /// False if the unit added pools or default targets, which belong to
+    /// the State as a whole.
+    bool self_contained = true;
+    size_t pools_at_begin = 0;
+    size_t defaults_at_begin = 0;
+  };
+
+  /// Collect the topmost units with a changed file into |changed|.
+  void
+  CollectChangedUnits(Unit* unit, std::vector<Unit*>* changed) const;
+  bool
+  FileChanged(const File& file) const;
+  bool
+  CanReparse(const Unit* unit, std::string* err) const;
+
+  /// Undo what the build added to the graph since ParseFinished().
+  void
+  RevertBuildChanges(std::set<Node*>* touched);
+  /// Replace the edges of |unit| by parsing its file again.
+  bool
+  Reparse(Unit* unit, std::set<Node*>* touched, std::string* err);
+  void
+  RemoveEdges(size_t begin, size_t end, std::set<Node*>* touched);
+  /// Move the edge ranges of |unit| and its children by |shift|.
+  void
+  ShiftEdges(Unit* unit, ptrdiff_t shift);
+  /// Move the edge ranges of the units following |replaced| by |shift|.
+  void
+  ShiftFollowingEdges(
+      Unit* unit, const Unit* replaced, ptrdiff_t shift, bool* after
+  );
+  /// Restore the manifest order of the edge lists of the touched nodes and
+  /// delete the ones that are no longer referenced.
+  bool
+  FixNodes(const std::set<Node*>& touched, std::string* err);
+
+  State* state_;
+  DiskInterface* disk_interface_;
+  ManifestParserOptions options_;
+
+  std::unique_ptr<Unit> root_;
+  Unit* current_;
+
+  /// Incremented every time a scope changes; see |scope_versions_|.
+  uint64_t version_;
+  /// The |version_| at which each scope was last changed.
+  std::map<BindingEnv*, uint64_t> scope_versions_;
+  /// The |version_| at which the last pool was declared.
+  uint64_t pools_version_;
+
+  /// Number of edges created by parsing; edges after these were added
+  /// by the build.
+  size_t parsed_edges_;
+  /// The implicit dependency count of every parsed edge, to tell them apart
+  /// from the dependencies loaded during the build.
+  std::vector<int> parsed_implicit_deps_;
+
+  int parsed_files_;
+
+  /// Whether a parse dropped a duplicate output.  Which edge keeps it
+  /// depends on the order the files are parsed in, so Reload() gives up.
+  bool duplicate_outputs_;
+};
+
+#endif // NINJA_MANIFEST_RELOAD_H_
@@ -17,19 +17,23 @@
 
 #include "util.hpp" // For int64_t.
 
+#include <atomic>
+#include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 
 /// The Metrics module is used for the debug mode that dumps timing stats of
 /// various actions.  To use, see METRIC_RECORD below.
 
-/// A single metrics we're tracking, like "depfile load time".
+/// A single metrics we're tracking, like "depfile load time".  Code paths
+/// may be hit from several threads at once, e.g. by DiskInterface::StatMany().
 struct Metric {
   std::string name;
   /// Number of times we've hit the code path.
-  int count;
+  std::atomic<int> count;
   /// Total time (in micros) we've spent on the code path.
-  int64_t sum;
+  std::atomic<int64_t> sum;
 };
 
 /// A scoped object for recording a metric across the body of a function.
@@ -47,15 +51,32 @@ private:
 
 /// The singleton that stores metrics and prints the report.
 struct Metrics {
+  Metrics();
+
   Metric*
   NewMetric(const std::string& name);
 
+  /// Record that a value which changes over the build, like the number of
+  /// jobs to run in parallel, is now |value|.
+  void
+  RecordValue(const std::string& name, int64_t value);
+
   /// Print a summary report to stdout.
   void
   Report();
 
 private:
+  std::mutex mutex_;
   std::vector<Metric*> metrics_;
+
+  /// The values of a name, with the milliseconds since start_millis_ when
+  /// each was recorded.
+  struct Series {
+    std::string name;
+    std::vector<std::pair<int64_t, int64_t>> values;
+  };
+  std::vector<Series> series_;
+  int64_t start_millis_;
 };
 
 /// Get the current time as relative to some epoch.
@@ -18,6 +18,7 @@
 #include "lexer.hpp"
 
 #include <string>
+#include <string_view>
 
 struct FileReader;
 struct State;
@@ -45,7 +46,7 @@ private:
   /// Parse a file, given its contents as a string.
   virtual bool
   Parse(
-      const std::string& filename, const std::string& input, std::string* err
+      const std::string& filename, std::string_view input, std::string* err
   ) = 0;
 };
 
@@ -0,0 +1,320 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_PATH_MAP_H_
+#define NINJA_PATH_MAP_H_
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <utility>
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+/// Hash a path for PathMap.  Reads the path eight bytes at a time, which
+/// keeps hashing a path that was just canonicalized (and so is still in the
+/// cache) much cheaper than the lookup itself.
+inline uint64_t
+HashPath(std::string_view path) {
+  const uint64_t kMul = 0x9e3779b97f4a7c15ULL;
+  const char* p = path.data();
+  size_t len = path.size();
+  uint64_t h = len * kMul;
+  for (; len >= 8; p += 8, len -= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    h = (h ^ word) * kMul;
+    h ^= h >> 32;
+  }
+  if (len) {
+    uint64_t word = 0;
+    memcpy(&word, p, len);
+    h = (h ^ word) * kMul;
+  }
+  // The finalizer of MurmurHash3, so that every bit of the result depends on
+  // every bit of the input.
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/// A hash map from paths to \a Value, used for State::paths_.
+///
+/// The map is an open-addressing table in the style of Swiss tables: a
+/// control byte per slot holds seven bits of the hash of its key, so a probe
+/// checks 16 slots at once (with SSE2) without touching the entries, and
+/// usually compares a single key.  Each entry also keeps the full hash of its
+/// key, so growing the table never hashes a path again.
+///
+/// Keys are views: the strings must outlive their entries.
+template <typename Value>
+class PathMap {
+public:
+  /// Named like std::pair, so that an entry can stand in for the value_type
+  /// of a std::unordered_map.
+  struct Entry {
+    std::string_view first;
+    Value second{};
+    uint64_t hash = 0;
+  };
+
+  template <typename E>
+  class Iterator {
+  public:
+    Iterator(E* entry, const int8_t* ctrl, const int8_t* end)
+        : entry_(entry), ctrl_(ctrl), end_(end) {
+      SkipFree();
+    }
+
+    E&
+    operator*() const {
+      return *entry_;
+    }
+    E*
+    operator->() const {
+      return entry_;
+    }
+    Iterator&
+    operator++() {
+      ++entry_;
+      ++ctrl_;
+      SkipFree();
+      return *this;
+    }
+    bool
+    operator==(const Iterator& other) const {
+      return ctrl_ == other.ctrl_;
+    }
+    bool
+    operator!=(const Iterator& other) const {
+      return ctrl_ != other.ctrl_;
+    }
+
+  private:
+    void
+    SkipFree() {
+      while (ctrl_ != end_ && *ctrl_ < 0) {
+        ++entry_;
+        ++ctrl_;
+      }
+    }
+
+    E* entry_;
+    const int8_t* ctrl_;
+    const int8_t* end_;
+  };
+  using iterator = Iterator<Entry>;
+  using const_iterator = Iterator<const Entry>;
+
+  PathMap() = default;
+  PathMap(const PathMap&) = delete;
+  PathMap&
+  operator=(const PathMap&) = delete;
+
+  /// @return the entry for \a key, whose HashPath() is \a hash, or nullptr.
+  Entry*
+  Find(std::string_view key, uint64_t hash) const {
+    if (!capacity_)
+      return nullptr;
+    const size_t mask = capacity_ - 1;
+    const int8_t h2 = H2(hash);
+    for (size_t pos = H1(hash) & mask;; pos = (pos + kGroupSize) & mask) {
+      const int8_t* group = ctrl_.get() + pos;
+      for (uint32_t match = Match(group, h2); match; match &= match - 1) {
+        Entry* entry = &entries_[(pos + std::countr_zero(match)) & mask];
+        if (entry->hash == hash && entry->first == key)
+          return entry;
+      }
+      if (Match(group, kEmpty))
+        return nullptr;
+    }
+  }
+
+  /// Add an entry for \a key, whose HashPath() is \a hash.  The key must not
+  /// be in the map yet.  @return the new entry, whose value is default
+  /// constructed.
+  Entry&
+  Insert(std::string_view key, uint64_t hash) {
+    if (!growth_left_)
+      Rehash();
+    size_t slot = FindFree(hash);
+    if (ctrl_[slot] == kEmpty)
+      --growth_left_;
+    SetCtrl(slot, H2(hash));
+    Entry& entry = entries_[slot];
+    entry.first = key;
+    entry.hash = hash;
+    ++size_;
+    return entry;
+  }
+
+  /// Remove the entry for \a key, if any.  @return whether there was one.
+  bool
+  Erase(std::string_view key, uint64_t hash) {
+    Entry* entry = Find(key, hash);
+    if (!entry)
+      return false;
+    // The slot may sit in the middle of a probe sequence, so it becomes a
+    // tombstone rather than empty.  Rehash() clears tombstones out.
+    SetCtrl(entry - entries_.get(), kDeleted);
+    *entry = Entry();
+    --size_;
+    return true;
+  }
+
+  size_t
+  size() const {
+    return size_;
+  }
+  bool
+  empty() const {
+    return size_ == 0;
+  }
+  /// The number of slots, for load statistics.
+  size_t
+  capacity() const {
+    return capacity_;
+  }
+
+  iterator
+  begin() {
+    return iterator(entries_.get(), ctrl_.get(), ctrl_.get() + capacity_);
+  }
+  iterator
+  end() {
+    const int8_t* end = ctrl_.get() + capacity_;
+    return iterator(entries_.get() + capacity_, end, end);
+  }
+  const_iterator
+  begin() const {
+    return const_iterator(entries_.get(), ctrl_.get(), ctrl_.get() + capacity_);
+  }
+  const_iterator
+  end() const {
+    const int8_t* end = ctrl_.get() + capacity_;
+    return const_iterator(entries_.get() + capacity_, end, end);
+  }
+
+private:
+  static constexpr size_t kGroupSize = 16;
+  static constexpr int8_t kEmpty = -128;
+  static constexpr int8_t kDeleted = -2;
+
+  /// The hash selects the first slot to probe with its high bits, and fills
+  /// the control byte with its low seven bits.
+  static size_t
+  H1(uint64_t hash) {
+    return static_cast<size_t>(hash >> 7);
+  }
+  static int8_t
+  H2(uint64_t hash) {
+    return static_cast<int8_t>(hash & 0x7f);
+  }
+
+  /// @return a mask with bit i set when byte i of \a group is \a value.
+  static uint32_t
+  Match(const int8_t* group, int8_t value) {
+#ifdef __SSE2__
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(value)));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < kGroupSize; ++i)
+      mask |= static_cast<uint32_t>(group[i] == value) << i;
+    return mask;
+#endif
+  }
+
+  /// @return a mask with bit i set when slot i of \a group is empty or
+  /// deleted, i.e. when the sign bit of its control byte is set.
+  static uint32_t
+  MatchFree(const int8_t* group) {
+#ifdef __SSE2__
+    return _mm_movemask_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(group))
+    );
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < kGroupSize; ++i)
+      mask |= static_cast<uint32_t>(group[i] < 0) << i;
+    return mask;
+#endif
+  }
+
+  /// @return the first empty or deleted slot on the probe sequence of
+  /// \a hash.  There always is one, as the table is never full.
+  size_t
+  FindFree(uint64_t hash) const {
+    const size_t mask = capacity_ - 1;
+    for (size_t pos = H1(hash) & mask;; pos = (pos + kGroupSize) & mask) {
+      if (uint32_t free = MatchFree(ctrl_.get() + pos))
+        return (pos + std::countr_zero(free)) & mask;
+    }
+  }
+
+  /// Set the control byte of \a slot, and its copy past the end of the table
+  /// that lets a group starting near the end wrap around.
+  void
+  SetCtrl(size_t slot, int8_t value) {
+    ctrl_[slot] = value;
+    if (slot < kGroupSize)
+      ctrl_[capacity_ + slot] = value;
+  }
+
+  /// Make room for at least one more entry: double the table if it is at
+  /// least half full, else rebuild it at the same size to drop tombstones.
+  void
+  Rehash() {
+    size_t capacity = kGroupSize;
+    if (capacity_)
+      capacity = size_ >= capacity_ / 2 ? capacity_ * 2 : capacity_;
+
+    std::unique_ptr<int8_t[]> old_ctrl = std::move(ctrl_);
+    std::unique_ptr<Entry[]> old_entries = std::move(entries_);
+    const size_t old_capacity = capacity_;
+
+    ctrl_ = std::make_unique<int8_t[]>(capacity + kGroupSize);
+    memset(ctrl_.get(), kEmpty, capacity + kGroupSize);
+    entries_ = std::make_unique<Entry[]>(capacity);
+    capacity_ = capacity;
+    growth_left_ = capacity - capacity / 8 - size_;
+
+    for (size_t i = 0; i < old_capacity; ++i) {
+      if (old_ctrl[i] < 0)
+        continue;
+      size_t slot = FindFree(old_entries[i].hash);
+      SetCtrl(slot, old_ctrl[i]);
+      entries_[slot] = std::move(old_entries[i]);
+    }
+  }
+
+  /// One control byte per slot, then copies of the first kGroupSize.
+  std::unique_ptr<int8_t[]> ctrl_;
+  std::unique_ptr<Entry[]> entries_;
+  size_t capacity_ = 0;
+  size_t size_ = 0;
+  /// How many more empty slots may be filled before the table has to grow,
+  /// which keeps at most 7/8 of the slots in use.
+  size_t growth_left_ = 0;
+};
+
+#endif // NINJA_PATH_MAP_H_
@@ -0,0 +1,76 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_PRESSURE_H_
+#define NINJA_PRESSURE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/// Parse the contents of a pressure file of Linux, like /proc/pressure/cpu.
+/// @return false if it has no "some" line, else the total time in
+/// microseconds that some tasks stalled, in |some_total|.
+bool
+ParsePressure(const std::string& text, int64_t* some_total);
+
+/// Picks how many jobs to run in parallel, between a floor and -j, from how
+/// long tasks stall on the CPU, memory and IO according to the pressure stall
+/// information of Linux.  The files of ninja's cgroup are used if it has
+/// them, else those of the whole system.  Linux only: elsewhere Create()
+/// always fails.
+struct PressureLimiter {
+  /// @return a new limiter, or null if the kernel doesn't provide pressure
+  /// stall information.
+  static std::unique_ptr<PressureLimiter>
+  Create(int floor, int ceiling);
+
+  PressureLimiter(int floor, int ceiling);
+  PressureLimiter(const PressureLimiter&) = delete;
+  PressureLimiter&
+  operator=(const PressureLimiter&) = delete;
+  ~PressureLimiter();
+
+  /// @return how many jobs to run in parallel.  The pressure files are read
+  /// again, and the limit adjusted, only every kSampleMillis.
+  int
+  Limit();
+
+  /// Adjust the limit to the fractions of time that some tasks stalled on
+  /// the CPU, memory and IO since the last reading.
+  void
+  Adjust(double cpu, double memory, double io);
+
+  int
+  limit() const {
+    return limit_;
+  }
+
+  static const int64_t kSampleMillis = 500;
+
+private:
+  /// Which of the files below is which.
+  enum { kCpu, kMemory, kIo, kResources };
+
+  int floor_;
+  int ceiling_;
+  int limit_;
+  /// The pressure files, kept open to read them again, or -1 if missing.
+  int fds_[kResources];
+  /// The stall totals of the last reading, in microseconds.
+  int64_t totals_[kResources];
+  int64_t last_read_millis_;
+};
+
+#endif // NINJA_PRESSURE_H_
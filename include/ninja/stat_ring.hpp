@@ -0,0 +1,77 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_STAT_RING_H_
+#define NINJA_STAT_RING_H_
+
+#include "timestamp.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct StatProgress;
+struct io_uring_cqe;
+struct io_uring_sqe;
+
+/// Stats files with statx() through an io_uring, which takes one system call
+/// per batch of files rather than one per file.  Only the mtime and the file
+/// type are requested.  Linux only: elsewhere Create() always fails.
+struct StatRing {
+  /// @return a new ring, or null if the kernel lacks io_uring or its statx
+  /// operation, or a sandbox blocks them.
+  static std::unique_ptr<StatRing>
+  Create();
+
+  StatRing(const StatRing&) = delete;
+  StatRing&
+  operator=(const StatRing&) = delete;
+  ~StatRing();
+
+  /// Works like DiskInterface::StatMany(), and gives the same results as
+  /// RealDiskInterface::Stat().
+  bool
+  StatMany(
+      const std::vector<std::string_view>& paths,
+      std::vector<TimeStamp>* mtimes, StatProgress* progress,
+      std::string* err
+  );
+
+private:
+  StatRing() {}
+
+  int fd_ = -1;
+
+  void* sq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0;
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+
+  /// Null if the completion queue shares the mapping of the submission queue.
+  void* cq_ring_ = nullptr;
+  size_t cq_ring_size_ = 0;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+};
+
+#endif // NINJA_STAT_RING_H_
@@ -17,13 +17,13 @@
 
 #include "eval_env.hpp"
 #include "graph.hpp"
+#include "path_map.hpp"
 #include "util.hpp"
 
 #include <map>
 #include <memory>
 #include <set>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 struct Edge;
@@ -133,6 +133,8 @@ struct State {
   Node*
   LookupNode(std::string_view path) const;
   Node*
+  LookupNode(std::string_view path, uint64_t hash) const;
+  Node*
   SpellcheckNode(const std::string& path);
 
   void
@@ -149,6 +151,12 @@ struct State {
   void
   Reset();
 
+  /// Pack the out-edge lists of all nodes into |frozen_out_edges_|, in node
+  /// index order, so that traversing the graph doesn't chase a separate heap
+  /// block per node.  Edges may still be added and removed afterwards.
+  void
+  FreezeGraph();
+
   /// Dump the nodes and Pools (useful for debugging).
   void
   Dump();
@@ -160,8 +168,12 @@ struct State {
   std::vector<Node*>
   DefaultNodes(std::string* error) const;
 
+  /// The scan state of all the nodes in |paths_|.  Declared first so that it
+  /// outlives the nodes.
+  NodeTable node_table_;
+
   /// Mapping of path -> Node.
-  using Paths = std::unordered_map<std::string_view, std::unique_ptr<Node>>;
+  using Paths = PathMap<std::unique_ptr<Node>>;
   Paths paths_;
 
   /// All the pools used in the graph.
@@ -170,6 +182,9 @@ struct State {
   /// All the edges of the graph.
   std::vector<std::unique_ptr<Edge>> edges_;
 
+  /// The storage of the out-edge lists of the nodes, see FreezeGraph().
+  std::unique_ptr<Edge*[]> frozen_out_edges_;
+
   BindingEnv bindings_;
   std::vector<Node*> defaults_;
 };
@@ -28,10 +28,11 @@ struct Status {
   PlanHasTotalEdges(int total) = 0;
   virtual void
   BuildEdgeStarted(const Edge* edge, int64_t start_time_millis) = 0;
+  /// |spilled_output|, if not null, holds the rest of |output|.
   virtual void
   BuildEdgeFinished(
       Edge* edge, int64_t end_time_millis, bool success,
-      const std::string& output
+      const std::string& output, FILE* spilled_output
   ) = 0;
   virtual void
   BuildLoadDyndeps() = 0;
@@ -61,7 +62,7 @@ struct StatusPrinter : Status {
   virtual void
   BuildEdgeFinished(
       Edge* edge, int64_t end_time_millis, bool success,
-      const std::string& output
+      const std::string& output, FILE* spilled_output
   );
   virtual void
   BuildLoadDyndeps();
@@ -92,6 +93,10 @@ private:
   void
   PrintStatus(const Edge* edge, int64_t time_millis);
 
+  /// Print the output of a command, from |output| and then |spilled_output|.
+  void
+  PrintCommandOutput(const std::string& output, FILE* spilled_output);
+
   const BuildConfig& config_;
 
   int started_edges_, finished_edges_, total_edges_, running_edges_;
@@ -15,6 +15,8 @@
 #ifndef NINJA_SUBPROCESS_H_
 #define NINJA_SUBPROCESS_H_
 
+#include <cstdint>
+#include <cstdio>
 #include <queue>
 #include <string>
 #include <vector>
@@ -35,6 +37,8 @@
 
 #include "exit_status.hpp"
 
+struct PersistentWorker;
+
 /// Subprocess wraps a single async subprocess.  It is entirely
 /// passive: it expects the caller to notify it when its fds are ready
 /// for reading, as well as call Finish() to reap the child once done()
@@ -53,14 +57,34 @@ struct Subprocess {
   const std::string&
   GetOutput() const;
 
+  /// Move the output out of the subprocess.
+  std::string
+  TakeOutput();
+
+  /// @return the output beyond SubprocessSet::max_output_size_, in a
+  /// temporary file which the caller must fclose(), or null if it all fit.
+  FILE*
+  TakeSpilledOutput();
+
 private:
-  Subprocess(bool use_console);
+  Subprocess(bool use_console, bool use_shell);
   bool
   Start(struct SubprocessSet* set, const std::string& command);
   void
   OnPipeReady();
+  void
+  AppendOutput(const char* data, size_t size);
+#ifndef _WIN32
+  /// Reap the process once its pidfd_ is ready, and give its output
+  /// |grace_millis| more to reach end of file.
+  void
+  OnExited(int grace_millis);
+#endif
 
   std::string buf_;
+  /// Output which didn't fit in buf_.
+  FILE* spill_;
+  size_t max_output_size_;
 
 #ifdef _WIN32
   /// Set up pipe_ as the parent-side pipe of the subprocess; return the
@@ -76,8 +100,27 @@ private:
 #else
   int fd_;
   pid_t pid_;
+  /// With -d pidfd, a pidfd for the process until it's reaped.
+  int pidfd_;
+  /// The wait status of the process, if OnExited() reaped it.
+  bool reaped_;
+  int wait_status_;
+  /// When to stop reading the output of a process that exited, or -1.
+  int64_t drain_deadline_;
+
+  /// A request to a persistent worker rather than a process of its own:
+  /// the command that starts the worker, and the framed request.
+  std::string worker_command_;
+  std::string request_;
+  int request_id_;
+  /// The worker handling the request, until it responds.
+  PersistentWorker* worker_;
+  /// Whether the request already went to a worker which then crashed.
+  bool request_retried_;
+  int worker_exit_code_;
 #endif
   bool use_console_;
+  bool use_shell_;
 
   friend struct SubprocessSet;
 };
@@ -89,8 +132,18 @@ struct SubprocessSet {
   SubprocessSet();
   ~SubprocessSet();
 
+  /// Start running |command|.  Commands that are just a program and its
+  /// arguments are run directly, and others with /bin/sh -c, unless
+  /// |use_shell| is set: a shell is slower to start than the command itself
+  /// for most compiler invocations.
+  /// If |worker_command| is set and |command| can run directly, send its
+  /// arguments to a persistent worker started with |worker_command|
+  /// instead, starting a new worker only if all are busy.
   Subprocess*
-  Add(const std::string& command, bool use_console = false);
+  Add(
+      const std::string& command, bool use_console = false,
+      bool use_shell = false, const std::string& worker_command = ""
+  );
   bool
   DoWork();
   Subprocess*
@@ -101,11 +154,28 @@ struct SubprocessSet {
   std::vector<Subprocess*> running_;
   std::queue<Subprocess*> finished_;
 
+  /// How much of the output of each subprocess to keep in memory, the rest
+  /// going to a temporary file, or 0 for no limit.
+  size_t max_output_size_;
+
+  /// With -d pidfd, how long to keep reading the output of a command after
+  /// it exits, in milliseconds.
+  int drain_grace_millis_;
+
 #ifdef _WIN32
   static BOOL WINAPI
   NotifyInterrupted(DWORD dwCtrlType);
   static HANDLE ioport_;
 #else
+  /// Fork a small helper process that spawns all later commands, so that
+  /// starting a command doesn't slow down as ninja grows.  Call this early,
+  /// while ninja is still small.
+  static void
+  StartSpawner();
+  /// Stop the helper process.  No command may be running.
+  static void
+  StopSpawner();
+
   static void
   SetInterruptedFlag(int signum);
   static void
@@ -119,6 +189,42 @@ struct SubprocessSet {
     return interrupted_ != 0;
   }
 
+  /// Persistent workers, busy or idle.
+  std::vector<PersistentWorker*> workers_;
+  int next_request_id_;
+
+  /// With -d pidfd, wait for the pipes, pidfds and the signalfd with poll().
+  /// Used by DoWork() when use_pidfd_ is set.
+  bool
+  DoWorkWithPidfds();
+  /// Whether to track commands with pidfds and receive signals with a
+  /// signalfd, which is only possible on Linux.
+  bool use_pidfd_;
+  int signal_fd_;
+
+  /// Move the subprocesses which are done from running_ to finished_.
+  /// @return whether there were any.
+  bool
+  CollectFinished();
+
+  PersistentWorker*
+  StartWorker(const std::string& command);
+  /// Send the request of |subproc| to an idle worker.
+  void
+  SendRequest(Subprocess* subproc);
+  void
+  OnWorkerOutput(PersistentWorker* worker);
+  void
+  OnWorkerErrors(PersistentWorker* worker);
+  /// Retry the request of a worker which exited or misbehaved, or fail it
+  /// with |error|, or a description of the worker's exit if that's empty.
+  void
+  WorkerFailed(PersistentWorker* worker, const std::string& error);
+  /// Close the input of |worker|, send |signal| to it and reap it.
+  /// @return its wait status.
+  int
+  StopWorker(PersistentWorker* worker, int signal);
+
   struct sigaction old_int_act_;
   struct sigaction old_term_act_;
   struct sigaction old_hup_act_;
@@ -126,4 +232,80 @@ struct SubprocessSet {
 #endif
 };
 
+#ifndef _WIN32
+/// Split |command| into the arguments of a program if running it doesn't
+/// need any shell feature: the command must be plain words separated by
+/// blanks, without quotes, expansions, redirections, etc, and not start
+/// with a variable assignment, a reserved word or a builtin.
+/// @return false if the command needs a shell.
+bool
+SplitSimpleCommand(const std::string& command, std::vector<std::string>* args);
+
+/// Join |commands| into one shell script which runs each of them in turn, in
+/// a subshell of its own, and prints |marker| with the command's index and
+/// exit code after its output.  |marker| must be made of letters, digits and
+/// dashes, and should be unlikely to be printed by the commands themselves.
+/// The script stops after a command that is interrupted, or that fails if
+/// |stop_on_failure| is set.
+std::string
+MakeBatchScript(
+    const std::vector<std::string>& commands, const std::string& marker,
+    bool stop_on_failure
+);
+
+/// Splits the output of a script from MakeBatchScript() running |count|
+/// commands into the output of each, as it's fed a piece at a time.  Only
+/// what could be the start of a marker waits for the next piece.  If the
+/// script stopped early, what it printed after the last marker is the output
+/// of the first unfinished command, and those after it have none.
+struct BatchOutputSplitter {
+  /// Keep at most |max_output_size| bytes of the outputs of all commands
+  /// together in memory, and the rest of each in a temporary file of its
+  /// own, or everything in memory if it's 0.
+  BatchOutputSplitter(
+      const std::string& marker, size_t count, size_t max_output_size
+  );
+  BatchOutputSplitter(const BatchOutputSplitter&) = delete;
+  BatchOutputSplitter&
+  operator=(const BatchOutputSplitter&) = delete;
+  ~BatchOutputSplitter();
+
+  void
+  Feed(const char* data, size_t size);
+  /// Call after the last piece.
+  /// @return the number of commands that finished.
+  size_t
+  Finish();
+
+  /// The output of each command, and the rest of it if it didn't fit in
+  /// memory, which the caller may take and must then fclose().
+  std::vector<std::string> outputs_;
+  std::vector<FILE*> spills_;
+  /// The status of each command that finished.
+  std::vector<ExitStatus> statuses_;
+
+private:
+  void
+  AppendOutput(const char* data, size_t size);
+
+  std::string marker_;
+  /// The marker which ends the output of the current command.
+  std::string tag_;
+  size_t count_;
+  size_t memory_left_;
+  bool limited_;
+  /// What was fed but may be part of a marker.
+  std::string pending_;
+};
+
+/// Split the whole output of a script from MakeBatchScript() with a
+/// BatchOutputSplitter, into |outputs| and |statuses|.
+/// @return the number of commands that finished.
+size_t
+SplitBatchOutput(
+    const std::string& output, const std::string& marker, size_t count,
+    std::vector<std::string>* outputs, std::vector<ExitStatus>* statuses
+);
+#endif
+
 #endif // NINJA_SUBPROCESS_H_
@@ -202,10 +202,24 @@ struct VirtualFileSystem : public DiskInterface {
   WriteFile(const std::string& path, const std::string& contents);
   virtual bool
   MakeDir(const std::string& path);
+  virtual bool
+  IsDirectory(const std::string& path) const;
   virtual Status
   ReadFile(const std::string& path, std::string* contents, std::string* err);
   virtual int
   RemoveFile(const std::string& path);
+  /// Create |path| as an empty file, and remember its target.
+  virtual bool
+  MakeSymlink(
+      const std::string& target, const std::string& path, std::string* err
+  );
+  /// Create "/dev/fd/N" with |contents| until CloseMemoryFile(N).
+  virtual int
+  CreateMemoryFile(const std::string& contents, std::string* path);
+  virtual bool
+  ReadMemoryFile(int fd, std::string* contents, std::string* err);
+  virtual void
+  CloseMemoryFile(int fd);
 
   /// An entry for a single in-memory file.
   struct Entry {
@@ -220,6 +234,10 @@ struct VirtualFileSystem : public DiskInterface {
   FileMap files_;
   std::set<std::string> files_removed_;
   std::set<std::string> files_created_;
+  std::map<std::string, std::string> symlinks_;
+  /// Memory files not closed yet, by descriptor.
+  std::map<int, std::string> memory_files_;
+  int next_memory_fd_ = 3;
 
   /// A simple fake timestamp for file operations.
   int now_;
@@ -24,6 +24,7 @@
 #include <cstdarg>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #ifdef _MSC_VER
@@ -97,7 +98,7 @@ islatinalpha(int c);
 
 /// Removes all Ansi escape codes (http://www.termsys.demon.co.uk/vtansi.htm).
 std::string
-StripAnsiEscapeCodes(const std::string& in);
+StripAnsiEscapeCodes(std::string_view in);
 
 /// @return the number of processors on the machine.  Useful for an initial
 /// guess for how many jobs to run in parallel.  @return 0 on error.
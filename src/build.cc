@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <cstdio>
@@ -25,6 +26,7 @@
 #endif
 
 #include <ninja/build_log.hpp>
+#include <ninja/builtin.hpp>
 #include <ninja/clparser.hpp>
 #include <ninja/debug_flags.hpp>
 #include <ninja/depfile_parser.hpp>
@@ -33,6 +35,7 @@
 #include <ninja/graph.hpp>
 #include <memory>
 #include <ninja/metrics.hpp>
+#include <ninja/pressure.hpp>
 #include <ninja/state.hpp>
 #include <ninja/status.hpp>
 #include <ninja/subprocess.hpp>
@@ -46,7 +49,7 @@ struct DryRunCommandRunner : public CommandRunner {
 
   // Overridden from CommandRunner:
   virtual bool
-  CanRunMore() const;
+  CanRunMore();
   virtual bool
   StartCommand(Edge* edge);
   virtual bool
@@ -57,7 +60,7 @@ private:
 };
 
 bool
-DryRunCommandRunner::CanRunMore() const {
+DryRunCommandRunner::CanRunMore() {
   return true;
 }
 
@@ -78,6 +81,69 @@ DryRunCommandRunner::WaitForCommand(Result* result) {
   return true;
 }
 
+/// @return how many ready edges like |edge| may run together in one batch,
+/// from its "batch" binding; 1 if it can't be batched.
+size_t
+MaxBatchSize(const Edge* edge) {
+  if (edge->is_phony() || edge->use_console()
+      || edge->GetBindingBool("generator")
+      || !edge->GetBinding("worker").empty())
+    return 1;
+  int batch = atoi(edge->GetBinding("batch").c_str());
+  return batch > 1 ? static_cast<size_t>(batch) : 1;
+}
+
+/// Run the output of |result| through |parser|, replacing it with the text
+/// to print.  Spilled output is streamed through a line at a time into a
+/// new spill, so that /showIncludes lines past the limit aren't lost.
+bool
+ParseCLOutput(
+    CLParser* parser, CommandRunner::Result* result,
+    const std::string& deps_prefix, std::string* err
+) {
+  std::string pending;
+  pending.swap(result->output);
+  std::shared_ptr<FILE> spill = std::move(result->spilled_output);
+  if (!spill)
+    return parser->Parse(pending, deps_prefix, &result->output, err);
+
+  // The last line in memory continues in the spill.
+  size_t lines = pending.rfind('\n') + 1;
+  if (!parser->Parse(
+          pending.substr(0, lines), deps_prefix, &result->output, err
+      ))
+    return false;
+  pending.erase(0, lines);
+
+  FILE* filtered_spill = tmpfile();
+  if (!filtered_spill) {
+    *err = std::string("tmpfile: ") + strerror(errno);
+    return false;
+  }
+  result->spilled_output.reset(filtered_spill, fclose);
+  rewind(spill.get());
+  char buf[64 << 10];
+  std::string filtered;
+  size_t len;
+  do {
+    len = fread(buf, 1, sizeof(buf), spill.get());
+    pending.append(buf, len);
+    lines = len ? pending.rfind('\n') + 1 : pending.size();
+    filtered.clear();
+    if (!parser->Parse(pending.substr(0, lines), deps_prefix, &filtered, err))
+      return false;
+    if (fwrite(filtered.data(), 1, filtered.size(), filtered_spill)
+        != filtered.size()) {
+      *err = std::string("write: ") + strerror(errno);
+      return false;
+    }
+    pending.erase(0, lines);
+  } while (len);
+  if (ftell(filtered_spill) == 0)
+    result->spilled_output.reset();
+  return true;
+}
+
 } // namespace
 
 Plan::Plan(Builder* builder)
@@ -88,6 +154,7 @@ Plan::Reset() {
   command_edges_ = 0;
   wanted_edges_ = 0;
   ready_.clear();
+  ready_batches_.clear();
   want_.clear();
 }
 
@@ -145,6 +212,10 @@ Plan::AddSubTarget(
     if (!AddSubTarget(input, node, err, dyndep_walk) && !err->empty())
       return false;
   }
+  for (const Node* input : edge->loaded_deps()) {
+    if (!AddSubTarget(input, node, err, dyndep_walk) && !err->empty())
+      return false;
+  }
 
   return true;
 }
@@ -163,9 +234,44 @@ Plan::FindWork() {
   EdgeSet::iterator e = ready_.begin();
   Edge* edge = *e;
   ready_.erase(e);
+  std::map<const Rule*, EdgeSet>::iterator batch =
+      ready_batches_.find(&edge->rule());
+  if (batch != ready_batches_.end() && batch->second.erase(edge)
+      && batch->second.empty())
+    ready_batches_.erase(batch);
   return edge;
 }
 
+void
+Plan::FindBatchWork(const Rule* rule, size_t max, std::vector<Edge*>* edges) {
+  std::map<const Rule*, EdgeSet>::iterator batch = ready_batches_.find(rule);
+  if (batch == ready_batches_.end())
+    return;
+  EdgeSet& ready = batch->second;
+  for (EdgeSet::iterator e = ready.begin(); e != ready.end() && max; --max) {
+    edges->push_back(*e);
+    ready_.erase(*e);
+    e = ready.erase(e);
+  }
+  if (ready.empty())
+    ready_batches_.erase(batch);
+}
+
+void
+Plan::AddReadyEdge(Edge* edge) {
+  ready_.insert(edge);
+  if (MaxBatchSize(edge) > 1)
+    ready_batches_[&edge->rule()].insert(edge);
+}
+
+void
+Plan::RetrieveReadyEdges(Pool* pool) {
+  EdgeSet ready;
+  pool->RetrieveReadyEdges(&ready);
+  for (Edge* edge : ready)
+    AddReadyEdge(edge);
+}
+
 void
 Plan::ScheduleWork(std::map<Edge*, Want>::iterator want_e) {
   if (want_e->second == kWantToFinish) {
@@ -183,10 +289,10 @@ Plan::ScheduleWork(std::map<Edge*, Want>::iterator want_e) {
   Pool* pool = edge->pool();
   if (pool->ShouldDelayEdge()) {
     pool->DelayEdge(edge);
-    pool->RetrieveReadyEdges(&ready_);
+    RetrieveReadyEdges(pool);
   } else {
     pool->EdgeScheduled(*edge);
-    ready_.insert(edge);
+    AddReadyEdge(edge);
   }
 }
 
@@ -199,7 +305,7 @@ Plan::EdgeFinished(Edge* edge, EdgeResult result, std::string* err) {
   // See if this job frees up any delayed jobs.
   if (directly_wanted)
     edge->pool()->EdgeFinished(*edge);
-  edge->pool()->RetrieveReadyEdges(&ready_);
+  RetrieveReadyEdges(edge->pool());
 
   // The rest of this function only applies to successful commands.
   if (result != kEdgeSucceeded)
@@ -275,13 +381,18 @@ Plan::CleanNode(DependencyScan* scan, Node* node, std::string* err) {
     // we might have changed the dirty state of the outputs.
     std::vector<Node*>::iterator begin = oe->inputs_.begin(),
                                  end = oe->inputs_.end() - oe->order_only_deps_;
-    if (find_if(begin, end, std::mem_fn(&Node::dirty)) == end) {
+    if (find_if(begin, end, std::mem_fn(&Node::dirty)) == end
+        && std::ranges::none_of(oe->loaded_deps(), &Node::dirty)) {
       // Recompute most_recent_input.
       Node* most_recent_input = nullptr;
       for (std::vector<Node*>::iterator i = begin; i != end; ++i) {
         if (!most_recent_input || (*i)->mtime() > most_recent_input->mtime())
           most_recent_input = *i;
       }
+      for (Node* input : oe->loaded_deps()) {
+        if (!most_recent_input || input->mtime() > most_recent_input->mtime())
+          most_recent_input = input;
+      }
 
       // Now, this edge is dirty if any of the outputs are dirty.
       // If the edge isn't dirty, clean the outputs and mark the edge as not
@@ -360,7 +471,7 @@ Plan::DyndepsLoaded(
 
   // Add out edges from this node that are in the plan (just as
   // Plan::NodeFinished would have without taking the dyndep code path).
-  for (std::vector<Edge*>::const_iterator oe = node->out_edges().begin();
+  for (EdgeList::const_iterator oe = node->out_edges().begin();
        oe != node->out_edges().end(); ++oe) {
     std::map<Edge*, Want>::iterator want_e = want_.find(*oe);
     if (want_e == want_.end())
@@ -429,7 +540,7 @@ Plan::RefreshDyndepDependents(
 
 void
 Plan::UnmarkDependents(const Node* node, std::set<Node*>* dependents) {
-  for (std::vector<Edge*>::const_iterator oe = node->out_edges().begin();
+  for (EdgeList::const_iterator oe = node->out_edges().begin();
        oe != node->out_edges().end(); ++oe) {
     Edge* edge = *oe;
 
@@ -461,13 +572,26 @@ Plan::Dump() const {
 }
 
 struct RealCommandRunner : public CommandRunner {
-  explicit RealCommandRunner(const BuildConfig& config) : config_(config) {}
+  explicit RealCommandRunner(const BuildConfig& config)
+      : config_(config),
+        batch_marker_("ninja-batch-" + std::to_string(GetTimeMillis())) {
+    subprocs_.max_output_size_ = config.max_output_size;
+    subprocs_.drain_grace_millis_ = config.drain_grace_millis;
+    if (config.pressure_floor > 0) {
+      pressure_ =
+          PressureLimiter::Create(config.pressure_floor, config.parallelism);
+      if (!pressure_)
+        Warning("no pressure stall information; ignoring --pressure");
+    }
+  }
   virtual ~RealCommandRunner() {}
   virtual bool
-  CanRunMore() const;
+  CanRunMore();
   virtual bool
   StartCommand(Edge* edge);
   virtual bool
+  StartCommands(const std::vector<Edge*>& edges);
+  virtual bool
   WaitForCommand(Result* result);
   virtual std::vector<Edge*>
   GetActiveEdges();
@@ -477,6 +601,14 @@ struct RealCommandRunner : public CommandRunner {
   const BuildConfig& config_;
   SubprocessSet subprocs_;
   std::map<const Subprocess*, Edge*> subproc_to_edge_;
+  /// Batches of edges run by a single shell, and the results of those of a
+  /// finished batch that WaitForCommand() hasn't returned yet.
+  std::map<const Subprocess*, std::vector<Edge*>> subproc_to_batch_;
+  std::queue<Result> batch_results_;
+  /// Printed after each command of a batch; see MakeBatchScript().
+  std::string batch_marker_;
+  /// With --pressure, what limits the number of jobs instead of -j.
+  std::unique_ptr<PressureLimiter> pressure_;
 };
 
 std::vector<Edge*>
@@ -484,19 +616,29 @@ RealCommandRunner::GetActiveEdges() {
   std::vector<Edge*> edges;
   for (const auto& e : subproc_to_edge_)
     edges.push_back(e.second);
+  for (const auto& b : subproc_to_batch_)
+    edges.insert(edges.end(), b.second.begin(), b.second.end());
+  // The commands of an interrupted batch which didn't finish.
+  for (std::queue<Result> results = batch_results_; !results.empty();
+       results.pop()) {
+    if (results.front().status == ExitInterrupted)
+      edges.push_back(results.front().edge);
+  }
   return edges;
 }
 
 void
 RealCommandRunner::Abort() {
   subprocs_.Clear();
+  batch_results_ = std::queue<Result>();
 }
 
 bool
-RealCommandRunner::CanRunMore() const {
+RealCommandRunner::CanRunMore() {
   size_t subproc_number =
       subprocs_.running_.size() + subprocs_.finished_.size();
-  return (int)subproc_number < config_.parallelism
+  int parallelism = pressure_ ? pressure_->Limit() : config_.parallelism;
+  return (int)subproc_number < parallelism
          && ((subprocs_.running_.empty() || config_.max_load_average <= 0.0f)
              || GetLoadAverage() < config_.max_load_average);
 }
@@ -504,7 +646,10 @@ RealCommandRunner::CanRunMore() const {
 bool
 RealCommandRunner::StartCommand(Edge* edge) {
   std::string command = edge->EvaluateCommand();
-  Subprocess* subproc = subprocs_.Add(command, edge->use_console());
+  Subprocess* subproc = subprocs_.Add(
+      command, edge->use_console(), edge->GetBindingBool("shell"),
+      edge->GetBinding("worker")
+  );
   if (!subproc)
     return false;
   subproc_to_edge_.insert(std::make_pair(subproc, edge));
@@ -512,8 +657,41 @@ RealCommandRunner::StartCommand(Edge* edge) {
   return true;
 }
 
+bool
+RealCommandRunner::StartCommands(const std::vector<Edge*>& edges) {
+#ifdef _WIN32
+  return CommandRunner::StartCommands(edges);
+#else
+  if (edges.size() == 1)
+    return StartCommand(edges[0]);
+
+  std::vector<std::string> commands;
+  for (Edge* edge : edges)
+    commands.push_back(edge->EvaluateCommand());
+  // With -k 1, the build stops at the first failure, so the rest of the
+  // batch mustn't run.
+  Subprocess* subproc = subprocs_.Add(
+      MakeBatchScript(
+          commands, batch_marker_, config_.failures_allowed == 1
+      ),
+      false, true
+  );
+  if (!subproc)
+    return false;
+  subproc_to_batch_.insert(std::make_pair(subproc, edges));
+
+  return true;
+#endif
+}
+
 bool
 RealCommandRunner::WaitForCommand(Result* result) {
+  if (!batch_results_.empty()) {
+    *result = std::move(batch_results_.front());
+    batch_results_.pop();
+    return true;
+  }
+
   Subprocess* subproc;
   while ((subproc = subprocs_.NextFinished()) == nullptr) {
     bool interrupted = subprocs_.DoWork();
@@ -522,7 +700,66 @@ RealCommandRunner::WaitForCommand(Result* result) {
   }
 
   result->status = subproc->Finish();
-  result->output = subproc->GetOutput();
+  result->output = subproc->TakeOutput();
+  if (FILE* spill = subproc->TakeSpilledOutput())
+    result->spilled_output.reset(spill, fclose);
+
+#ifndef _WIN32
+  std::map<const Subprocess*, std::vector<Edge*>>::iterator b =
+      subproc_to_batch_.find(subproc);
+  if (b != subproc_to_batch_.end()) {
+    const std::vector<Edge*>& edges = b->second;
+    // Markers may lie past the limit, so the spilled output is split too,
+    // as it's read back, and each edge gets a spilled output of its own.
+    BatchOutputSplitter splitter(
+        batch_marker_, edges.size(), config_.max_output_size
+    );
+    splitter.Feed(result->output.data(), result->output.size());
+    result->output = std::string();
+    if (FILE* spill = result->spilled_output.get()) {
+      rewind(spill);
+      char buf[64 << 10];
+      while (size_t len = fread(buf, 1, sizeof(buf), spill))
+        splitter.Feed(buf, len);
+      result->spilled_output.reset();
+    }
+    size_t finished = splitter.Finish();
+    // The status of the command after which the script stopped itself, if
+    // it did, before the rest started.
+    ExitStatus stopped = ExitSuccess;
+    if (finished > 0 && finished < edges.size()
+        && (config_.failures_allowed == 1
+            || splitter.statuses_[finished - 1] == ExitInterrupted))
+      stopped = splitter.statuses_[finished - 1];
+    for (size_t i = 0; i < edges.size(); ++i) {
+      Result edge_result;
+      edge_result.edge = edges[i];
+      edge_result.output = std::move(splitter.outputs_[i]);
+      if (FILE* spill = splitter.spills_[i]) {
+        edge_result.spilled_output.reset(spill, fclose);
+        splitter.spills_[i] = nullptr;
+      }
+      if (i < finished) {
+        edge_result.status = splitter.statuses_[i];
+      } else if (result->status == ExitInterrupted
+                 || stopped == ExitInterrupted) {
+        edge_result.status = ExitInterrupted;
+      } else {
+        edge_result.status = ExitFailure;
+        if (stopped == ExitFailure)
+          edge_result.output = "ninja: not run, as an earlier command of its "
+                               "batch failed\n";
+      }
+      batch_results_.push(std::move(edge_result));
+    }
+    subproc_to_batch_.erase(b);
+    delete subproc;
+
+    *result = std::move(batch_results_.front());
+    batch_results_.pop();
+    return true;
+  }
+#endif
 
   std::map<const Subprocess*, Edge*>::iterator e =
       subproc_to_edge_.find(subproc);
@@ -580,6 +817,12 @@ Builder::Cleanup() {
     }
   }
 
+  builtin_results_ = std::queue<CommandRunner::Result>();
+  memory_rspfiles_.clear();
+  for (const auto& depfile : memory_depfiles_)
+    disk_interface_->CloseMemoryFile(depfile.second);
+  memory_depfiles_.clear();
+
   std::string err;
   if (disk_interface_->Stat(lock_file_path_, &err) > 0)
     disk_interface_->RemoveFile(lock_file_path_);
@@ -661,7 +904,11 @@ Builder::Build(std::string* err) {
           scan_.build_log()->Close();
         }
 
-        if (!StartEdge(edge, err)) {
+        std::vector<Edge*> edges(1, edge);
+        if (size_t batch = MaxBatchSize(edge); batch > 1)
+          plan_.FindBatchWork(&edge->rule(), batch - 1, &edges);
+
+        if (!StartEdges(edges, err)) {
           Cleanup();
           status_->BuildFinished();
           return false;
@@ -674,7 +921,7 @@ Builder::Build(std::string* err) {
             return false;
           }
         } else {
-          ++pending_commands;
+          pending_commands += static_cast<int>(edges.size());
         }
 
         // We made some progress; go back to the main loop.
@@ -685,8 +932,15 @@ Builder::Build(std::string* err) {
     // See if we can reap any finished commands.
     if (pending_commands) {
       CommandRunner::Result result;
-      if (!command_runner_->WaitForCommand(&result)
-          || result.status == ExitInterrupted) {
+      bool interrupted = false;
+      if (!builtin_results_.empty()) {
+        result = std::move(builtin_results_.front());
+        builtin_results_.pop();
+      } else {
+        interrupted = !command_runner_->WaitForCommand(&result)
+                      || result.status == ExitInterrupted;
+      }
+      if (interrupted) {
         Cleanup();
         status_->BuildFinished();
         *err = "interrupted by user";
@@ -729,10 +983,50 @@ Builder::Build(std::string* err) {
 }
 
 bool
-Builder::StartEdge(Edge* edge, std::string* err) {
+Builder::StartEdges(const std::vector<Edge*>& edges, std::string* err) {
   METRIC_RECORD("StartEdge");
-  if (edge->is_phony())
+  std::vector<Edge*> commands;
+  std::vector<int> memory_files;
+  bool ok = true;
+  for (Edge* edge : edges) {
+    bool done = false;
+    if (!(ok = PrepareEdge(edge, &done, &memory_files, err)))
+      break;
+    if (!done)
+      commands.push_back(edge);
+  }
+
+  // start command computing and run it
+  if (ok && !commands.empty() && !command_runner_->StartCommands(commands)) {
+    err->assign("command '" + commands[0]->EvaluateCommand() + "' failed.");
+    ok = false;
+  }
+
+  // The commands have their own descriptors for the files in memory now,
+  // and the build log must see the paths from the manifest.  Depfiles stay
+  // open until FinishCommand() reads them, but later commands mustn't
+  // inherit them.
+  for (int fd : memory_files)
+    disk_interface_->CloseMemoryFile(fd);
+  for (Edge* edge : edges) {
+    edge->rspfile_memory_path_.clear();
+    edge->depfile_memory_path_.clear();
+    std::map<const Edge*, int>::iterator d = memory_depfiles_.find(edge);
+    if (d != memory_depfiles_.end())
+      disk_interface_->UnshareMemoryFile(d->second);
+  }
+
+  return ok;
+}
+
+bool
+Builder::PrepareEdge(
+    Edge* edge, bool* done, std::vector<int>* memory_files, std::string* err
+) {
+  if (edge->is_phony()) {
+    *done = true;
     return true;
+  }
 
   int64_t start_time_millis = GetTimeMillis() - start_time_millis_;
   running_edges_.insert(std::make_pair(edge, start_time_millis));
@@ -757,19 +1051,50 @@ Builder::StartEdge(Edge* edge, std::string* err) {
 
   edge->command_start_time_ = build_start;
 
-  // Create response file, if needed
+  // Create response file, if needed, in memory if the rule asks for it and
+  // the command will be able to inherit the file: commands from the spawner
+  // or a persistent worker wouldn't.
   // XXX: this may also block; do we care?
   std::string rspfile = edge->GetUnescapedRspfile();
   if (!rspfile.empty()) {
     std::string content = edge->GetBinding("rspfile_content");
-    if (!disk_interface_->WriteFile(rspfile, content))
+    int fd = -1;
+    if (edge->GetBindingBool("rspfile_memfd") && !g_keep_rsp
+        && !g_use_spawner && edge->GetBinding("worker").empty()) {
+      fd = disk_interface_->CreateMemoryFile(
+          content, &edge->rspfile_memory_path_
+      );
+    }
+    if (fd >= 0) {
+      memory_files->push_back(fd);
+      memory_rspfiles_.insert(edge);
+    } else if (!disk_interface_->WriteFile(rspfile, content)) {
       return false;
+    }
   }
 
-  // start command computing and run it
-  if (!command_runner_->StartCommand(edge)) {
-    err->assign("command '" + edge->EvaluateCommand() + "' failed.");
-    return false;
+  // Likewise, the command may write its depfile to memory, for
+  // ExtractDeps() to read.
+  if (edge->GetBindingBool("depfile_memfd") && edge->GetBinding("deps") == "gcc"
+      && !g_keep_depfile && !g_use_spawner && edge->GetBinding("worker").empty()
+      && !edge->GetUnescapedDepfile().empty()) {
+    int fd = disk_interface_->CreateMemoryFile("", &edge->depfile_memory_path_);
+    if (fd >= 0)
+      memory_depfiles_[edge] = fd;
+  }
+
+  // Run builtin commands right away: they take less time than starting a
+  // process would.
+  if (!config_.dry_run && edge->GetBindingBool("builtin")) {
+    CommandRunner::Result result;
+    if (RunBuiltinCommand(
+            edge->EvaluateCommand(), disk_interface_, &result.status,
+            &result.output
+        )) {
+      result.edge = edge;
+      builtin_results_.push(std::move(result));
+      *done = true;
+    }
   }
 
   return true;
@@ -780,6 +1105,7 @@ Builder::FinishCommand(CommandRunner::Result* result, std::string* err) {
   METRIC_RECORD("FinishCommand");
 
   Edge* edge = result->edge;
+  const bool memory_rspfile = memory_rspfiles_.erase(edge) != 0;
 
   // First try to extract dependencies from the result, if any.
   // This must happen first as it filters the command output (we want
@@ -807,7 +1133,8 @@ Builder::FinishCommand(CommandRunner::Result* result, std::string* err) {
   running_edges_.erase(it);
 
   status_->BuildEdgeFinished(
-      edge, end_time_millis, result->success(), result->output
+      edge, end_time_millis, result->success(), result->output,
+      result->spilled_output.get()
   );
 
   // The rest of this function only applies to successful commands.
@@ -860,7 +1187,7 @@ Builder::FinishCommand(CommandRunner::Result* result, std::string* err) {
 
   // Delete any left over response file.
   std::string rspfile = edge->GetUnescapedRspfile();
-  if (!rspfile.empty() && !g_keep_rsp)
+  if (!rspfile.empty() && !g_keep_rsp && !memory_rspfile)
     disk_interface_->RemoveFile(rspfile);
 
   if (scan_.build_log()) {
@@ -896,10 +1223,8 @@ Builder::ExtractDeps(
 ) {
   if (deps_type == "msvc") {
     CLParser parser;
-    std::string output;
-    if (!parser.Parse(result->output, deps_prefix, &output, err))
+    if (!ParseCLOutput(&parser, result, deps_prefix, err))
       return false;
-    result->output = output;
     for (const std::string& include : parser.includes_) {
       // ~0 is assuming that with MSVC-parsed headers, it's ok to always make
       // all backslashes (as some of the slashes will certainly be backslashes
@@ -916,14 +1241,26 @@ Builder::ExtractDeps(
 
     // Read depfile content.  Treat a missing depfile as empty.
     std::string content;
-    switch (disk_interface_->ReadFile(depfile, &content, err)) {
-      case DiskInterface::Okay:
-        break;
-      case DiskInterface::NotFound:
-        err->clear();
-        break;
-      case DiskInterface::OtherError:
+    std::map<const Edge*, int>::iterator memory =
+        memory_depfiles_.find(result->edge);
+    const bool in_memory = memory != memory_depfiles_.end();
+    if (in_memory) {
+      const int fd = memory->second;
+      memory_depfiles_.erase(memory);
+      const bool read = disk_interface_->ReadMemoryFile(fd, &content, err);
+      disk_interface_->CloseMemoryFile(fd);
+      if (!read)
         return false;
+    } else {
+      switch (disk_interface_->ReadFile(depfile, &content, err)) {
+        case DiskInterface::Okay:
+          break;
+        case DiskInterface::NotFound:
+          err->clear();
+          break;
+        case DiskInterface::OtherError:
+          return false;
+      }
     }
     if (content.empty())
       return true;
@@ -945,7 +1282,7 @@ Builder::ExtractDeps(
       deps_nodes->push_back(state_->GetNode(*i, slash_bits));
     }
 
-    if (!g_keep_depfile) {
+    if (!g_keep_depfile && !in_memory) {
       if (disk_interface_->RemoveFile(depfile) < 0) {
         *err = std::string("deleting depfile: ") + strerror(errno)
                + std::string("\n");
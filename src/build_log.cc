@@ -20,21 +20,23 @@
 #  endif
 #endif
 
+#include <algorithm>
 #include <cassert>
+#include <charconv>
 #include <cerrno>
 #include <cinttypes>
 #include <cstdlib>
 #include <cstring>
 #include <ninja/build.hpp>
 #include <ninja/build_log.hpp>
+#include <ninja/command_hash.hpp>
 #include <ninja/disk_interface.hpp>
 #include <ninja/graph.hpp>
 #include <ninja/metrics.hpp>
 #include <ninja/util.hpp>
 #include <unistd.h>
-#if defined(_MSC_VER) && (_MSC_VER < 1800)
-#  define strtoll _strtoi64
-#endif
+#include <thread>
+#include <unordered_set>
 
 // Implementation details:
 // Each run's log appends to the log file.
@@ -45,9 +47,13 @@
 
 namespace {
 
+// Version 6 replaced MurmurHash64A with CommandHasher for the hashes of
+// commands.  Hashes carried over from a v5 log are written with a leading
+// kLegacyHashPrefix, until the command of their edge is seen again.
 const char kFileSignature[] = "# ninja log v%d\n";
 const int kOldestSupportedVersion = 4;
-const int kCurrentVersion = 5;
+const int kCurrentVersion = 6;
+const char kLegacyHashPrefix[] = "m";
 
 // 64bit MurmurHash2, by Austin Appleby
 #define BIG_CONSTANT(x) (x##LLU)
@@ -99,14 +105,104 @@ MurmurHash64A(const void* key, size_t len) {
 }
 #undef BIG_CONSTANT
 
+/// A line of the log: either parsed but not merged into the entries yet, or
+/// a copy of an entry to write out.
+struct LogLine {
+  std::string_view output;
+  uint64_t command_hash;
+  TimeStamp mtime;
+  int start_time;
+  int end_time;
+  bool legacy_hash;
+};
+
+LogLine
+ToLogLine(const BuildLog::LogEntry& entry) {
+  return { entry.output,     entry.command_hash, entry.mtime,
+           entry.start_time, entry.end_time,     entry.legacy_hash };
+}
+
+bool
+WriteLogLine(FILE* f, const LogLine& line) {
+  return fprintf(
+             f, "%d\t%d\t%" PRId64 "\t%.*s\t%s%" PRIx64 "\n", line.start_time,
+             line.end_time, line.mtime, static_cast<int>(line.output.size()),
+             line.output.data(), line.legacy_hash ? kLegacyHashPrefix : "",
+             line.command_hash
+         )
+         > 0;
+}
+
+/// Write a log holding |lines| to |path|.
+bool
+WriteLogFile(
+    const std::string& path, const std::vector<LogLine>& lines,
+    std::string* err
+) {
+  FILE* f = fopen(path.c_str(), "wb");
+  if (!f) {
+    *err = strerror(errno);
+    return false;
+  }
+  bool ok = fprintf(f, kFileSignature, kCurrentVersion) >= 0;
+  for (size_t i = 0; ok && i < lines.size(); ++i)
+    ok = WriteLogLine(f, lines[i]);
+  if (fclose(f) != 0)
+    ok = false;
+  if (!ok)
+    *err = strerror(errno);
+  return ok;
+}
+
 } // namespace
 
+/// A recompaction of the log running on a background thread.  The thread
+/// writes a snapshot of the entries to a temporary file, while the entries
+/// recorded meanwhile still go to the old log and are remembered in |tail|.
+/// Once the thread is done, the tail is appended to the new log, which then
+/// replaces the old one.
+struct BuildLog::Recompaction {
+  std::string path;
+  std::string temp_path;
+  std::vector<LogLine> snapshot;
+  std::vector<const LogEntry*> tail;
+  std::thread thread;
+  bool ok = false;
+  std::string err;
+};
+
 // static
 uint64_t
 BuildLog::LogEntry::HashCommand(std::string_view command) {
+  return CommandHasher::Hash(command);
+}
+
+// static
+uint64_t
+BuildLog::LogEntry::LegacyHashCommand(std::string_view command) {
   return MurmurHash64A(command.data(), command.size());
 }
 
+bool
+BuildLog::LogEntry::MatchesCommand(const Edge* edge, uint64_t command_hash) {
+  if (!legacy_hash)
+    return this->command_hash == command_hash;
+  if (LegacyHashCommand(edge->EvaluateCommand(true)) != this->command_hash)
+    return false;
+  this->command_hash = command_hash;
+  legacy_hash = false;
+  return true;
+}
+
+void
+BuildLogUser::ArePathsDead(
+    const std::vector<std::string_view>& paths, std::vector<bool>* dead
+) const {
+  dead->resize(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i)
+    (*dead)[i] = IsPathDead(paths[i]);
+}
+
 BuildLog::LogEntry::LogEntry(const std::string& output) : output(output) {}
 
 BuildLog::LogEntry::LogEntry(
@@ -116,7 +212,8 @@ BuildLog::LogEntry::LogEntry(
     : output(output), command_hash(command_hash), start_time(start_time),
       end_time(end_time), mtime(mtime) {}
 
-BuildLog::BuildLog() : log_file_(nullptr), needs_recompaction_(false) {}
+BuildLog::BuildLog()
+    : log_file_(nullptr), needs_recompaction_(false), load_threads_(0) {}
 
 BuildLog::~BuildLog() { Close(); }
 
@@ -125,8 +222,8 @@ BuildLog::OpenForWrite(
     const std::string& path, const BuildLogUser& user, std::string* err
 ) {
   if (needs_recompaction_) {
-    if (!Recompact(path, user, err))
-      return false;
+    Close();
+    StartRecompaction(path, user);
   }
 
   assert(!log_file_);
@@ -139,20 +236,17 @@ bool
 BuildLog::RecordCommand(
     Edge* edge, int start_time, int end_time, TimeStamp mtime
 ) {
-  std::string command = edge->EvaluateCommand(true);
-  uint64_t command_hash = LogEntry::HashCommand(command);
+  uint64_t command_hash = edge->HashCommand();
   for (Node* output : edge->outputs_) {
-    const std::string& path = output->path();
-    Entries::iterator i = entries_.find(path);
-    LogEntry* log_entry;
-    if (i != entries_.end()) {
-      log_entry = std::to_address(i->second);
-    } else {
-      std::unique_ptr<LogEntry> e(std::make_unique<LogEntry>(path));
+    LogEntry* log_entry = LookupByOutput(output);
+    if (!log_entry) {
+      std::unique_ptr<LogEntry> e(std::make_unique<LogEntry>(output->path()));
       log_entry = e.get();
       entries_.emplace(log_entry->output, std::move(e));
+      AttachEntry(output, log_entry);
     }
     log_entry->command_hash = command_hash;
+    log_entry->legacy_hash = false;
     log_entry->start_time = start_time;
     log_entry->end_time = end_time;
     log_entry->mtime = mtime;
@@ -167,6 +261,8 @@ BuildLog::RecordCommand(
         return false;
       }
     }
+    if (recompaction_)
+      recompaction_->tail.push_back(log_entry);
   }
   return true;
 }
@@ -177,6 +273,10 @@ BuildLog::Close() {
   if (log_file_)
     fclose(log_file_);
   log_file_ = nullptr;
+
+  std::string err;
+  if (!FinishRecompaction(&err))
+    Warning("recompacting build log: %s", err.c_str());
 }
 
 bool
@@ -205,161 +305,183 @@ BuildLog::OpenForWriteIfNeeded() {
   return true;
 }
 
-struct LineReader {
-  explicit LineReader(FILE* file)
-      : file_(file), buf_end_(buf_), line_start_(buf_), line_end_(nullptr) {
-    memset(buf_, 0, sizeof(buf_));
-  }
-
-  // Reads a \n-terminated line from the file passed to the constructor.
-  // On return, *line_start points to the beginning of the next line, and
-  // *line_end points to the \n at the end of the line. If no newline is seen
-  // in a fixed buffer size, *line_end is set to nullptr. Returns false on EOF.
-  bool
-  ReadLine(char** line_start, char** line_end) {
-    if (line_start_ >= buf_end_ || !line_end_) {
-      // Buffer empty, refill.
-      size_t size_read = fread(buf_, 1, sizeof(buf_), file_);
-      if (!size_read)
-        return false;
-      line_start_ = buf_;
-      buf_end_ = buf_ + size_read;
-    } else {
-      // Advance to next line in buffer.
-      line_start_ = line_end_ + 1;
-    }
-
-    line_end_ = (char*)memchr(line_start_, '\n', buf_end_ - line_start_);
-    if (!line_end_) {
-      // No newline. Move rest of data to start of buffer, fill rest.
-      size_t already_consumed = line_start_ - buf_;
-      size_t size_rest = (buf_end_ - buf_) - already_consumed;
-      memmove(buf_, line_start_, size_rest);
-
-      size_t read = fread(buf_ + size_rest, 1, sizeof(buf_) - size_rest, file_);
-      buf_end_ = buf_ + size_rest + read;
-      line_start_ = buf_;
-      line_end_ = (char*)memchr(line_start_, '\n', buf_end_ - line_start_);
-    }
+namespace {
 
-    *line_start = line_start_;
-    *line_end = line_end_;
-    return true;
-  }
+/// Chunks of the log smaller than this aren't worth a thread.
+const size_t kMinLoadChunkSize = 128 << 10;
 
-private:
-  FILE* file_;
-  char buf_[256 << 10];
-  char* buf_end_; // Points one past the last valid byte in |buf_|.
+/// Longer lines are ignored, as when the log was read through a buffer of
+/// this size.
+const size_t kMaxLineSize = 256 << 10;
 
-  char* line_start_;
-  // Points at the next \n in buf_ after line_start, or nullptr.
-  char* line_end_;
-};
-
-LoadStatus
-BuildLog::Load(const std::string& path, std::string* err) {
-  METRIC_RECORD(".ninja_log load");
-  FILE* file = fopen(path.c_str(), "r");
-  if (!file) {
-    if (errno == ENOENT)
-      return LOAD_NOT_FOUND;
-    *err = strerror(errno);
-    return LOAD_ERROR;
-  }
-
-  int log_version = 0;
-  int unique_entry_count = 0;
-  int total_entry_count = 0;
+/// Parse the field [start, end) into |value|, which is left alone if the
+/// field isn't a number.
+template <typename T>
+inline void
+ParseNumber(const char* start, const char* end, T* value, int base = 10) {
+  std::from_chars(start, end, *value, base);
+}
 
-  LineReader reader(file);
-  char* line_start = 0;
-  char* line_end = 0;
-  while (reader.ReadLine(&line_start, &line_end)) {
-    if (!log_version) {
-      sscanf(line_start, kFileSignature, &log_version);
-
-      if (log_version < kOldestSupportedVersion) {
-        *err =
-            ("build log version invalid, perhaps due to being too old; "
-             "starting over");
-        fclose(file);
-        unlink(path.c_str());
-        // Don't report this as a failure.  An empty build log will cause
-        // us to rebuild the outputs anyway.
-        return LOAD_SUCCESS;
-      }
-    }
+inline const char*
+FindSeparator(const char* start, const char* line_end) {
+  return static_cast<const char*>(memchr(start, '\t', line_end - start));
+}
 
-    // If no newline was found in this chunk, read the next.
+/// Parse the lines of |chunk| that end with a newline into |lines|.
+/// |chunk| starts at the beginning of a line.
+void
+ParseLogLines(
+    std::string_view chunk, int log_version, std::vector<LogLine>* lines
+) {
+  const char* p = chunk.data();
+  const char* const chunk_end = p + chunk.size();
+  while (p < chunk_end) {
+    const char* line_end =
+        static_cast<const char*>(memchr(p, '\n', chunk_end - p));
+    // A log cut off in the middle of a line, e.g. by a crash.
     if (!line_end)
-      continue;
+      break;
 
-    const char kFieldSeparator = '\t';
+    const char* start = p;
+    p = line_end + 1;
+    if (static_cast<size_t>(line_end - start) >= kMaxLineSize)
+      continue;
 
-    char* start = line_start;
-    char* end = (char*)memchr(start, kFieldSeparator, line_end - start);
+    LogLine line = {};
+    const char* end = FindSeparator(start, line_end);
     if (!end)
       continue;
-    *end = 0;
-
-    int start_time = 0, end_time = 0;
-    TimeStamp mtime = 0;
-
-    start_time = atoi(start);
+    ParseNumber(start, end, &line.start_time);
     start = end + 1;
 
-    end = (char*)memchr(start, kFieldSeparator, line_end - start);
+    end = FindSeparator(start, line_end);
     if (!end)
       continue;
-    *end = 0;
-    end_time = atoi(start);
+    ParseNumber(start, end, &line.end_time);
     start = end + 1;
 
-    end = (char*)memchr(start, kFieldSeparator, line_end - start);
+    end = FindSeparator(start, line_end);
     if (!end)
       continue;
-    *end = 0;
-    mtime = strtoll(start, nullptr, 10);
+    ParseNumber(start, end, &line.mtime);
     start = end + 1;
 
-    end = (char*)memchr(start, kFieldSeparator, line_end - start);
+    end = FindSeparator(start, line_end);
     if (!end)
       continue;
-    std::string output = std::string(start, end - start);
-
+    line.output = std::string_view(start, end - start);
     start = end + 1;
-    end = line_end;
 
-    LogEntry* entry;
-    Entries::iterator i = entries_.find(output);
-    if (i != entries_.end()) {
-      entry = std::to_address(i->second);
-    } else {
-      std::unique_ptr<LogEntry> e(std::make_unique<LogEntry>(output));
-      entry = e.get();
-      entries_.emplace(entry->output, std::move(e));
-      ++unique_entry_count;
-    }
-    ++total_entry_count;
-
-    entry->start_time = start_time;
-    entry->end_time = end_time;
-    entry->mtime = mtime;
     if (log_version >= 5) {
-      char c = *end;
-      *end = '\0';
-      entry->command_hash = (uint64_t)strtoull(start, nullptr, 16);
-      *end = c;
+      const bool prefixed = *start == kLegacyHashPrefix[0];
+      line.legacy_hash = log_version == 5 || prefixed;
+      if (prefixed)
+        ++start;
+      ParseNumber(start, line_end, &line.command_hash, 16);
     } else {
-      entry->command_hash =
-          LogEntry::HashCommand(std::string_view(start, end - start));
+      line.command_hash = BuildLog::LogEntry::HashCommand(
+          std::string_view(start, line_end - start)
+      );
     }
+    lines->push_back(line);
   }
-  fclose(file);
+}
 
-  if (!line_start) {
+} // anonymous namespace
+
+LoadStatus
+BuildLog::Load(const std::string& path, std::string* err) {
+  METRIC_RECORD(".ninja_log load");
+  FileContents contents;
+  RealDiskInterface disk;
+  std::string read_err;
+  switch (disk.ReadFileContents(path, &contents, &read_err)) {
+    case FileReader::Okay:
+      break;
+    case FileReader::NotFound:
+      return LOAD_NOT_FOUND;
+    default:
+      *err = read_err;
+      return LOAD_ERROR;
+  }
+
+  std::string_view log = contents.view();
+  if (log.empty())
     return LOAD_SUCCESS; // file was empty
+
+  // The first line holds the version.  Copy it, as sscanf() may scan
+  // through the rest of the log for its end.
+  size_t header_end = log.find('\n');
+  header_end =
+      header_end == std::string_view::npos ? log.size() : header_end + 1;
+  int log_version = 0;
+  sscanf(
+      std::string(log.substr(0, std::min<size_t>(header_end, 64))).c_str(),
+      kFileSignature, &log_version
+  );
+  if (log_version < kOldestSupportedVersion) {
+    *err =
+        ("build log version invalid, perhaps due to being too old; "
+         "starting over");
+    contents.Clear();
+    unlink(path.c_str());
+    // Don't report this as a failure.  An empty build log will cause
+    // us to rebuild the outputs anyway.
+    return LOAD_SUCCESS;
+  }
+  log.remove_prefix(header_end);
+
+  // Cut the log into chunks that start at the beginning of a line, parse them
+  // in parallel, then merge them in order so that later lines still win.
+  size_t threads = load_threads_;
+  if (!threads)
+    threads = std::max(GetProcessorCount(), 1);
+  threads = std::clamp<size_t>(log.size() / kMinLoadChunkSize, 1, threads);
+  std::vector<std::string_view> chunks;
+  for (size_t i = 0; i < threads && !log.empty(); ++i) {
+    size_t size = log.size() / (threads - i);
+    size_t line_end = log.find('\n', size ? size - 1 : 0);
+    size = line_end == std::string_view::npos ? log.size() : line_end + 1;
+    chunks.push_back(log.substr(0, size));
+    log.remove_prefix(size);
+  }
+
+  std::vector<std::vector<LogLine>> chunk_lines(chunks.size());
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < chunks.size(); ++i) {
+    workers.emplace_back(
+        ParseLogLines, chunks[i], log_version, &chunk_lines[i]
+    );
+  }
+  if (!chunks.empty())
+    ParseLogLines(chunks[0], log_version, &chunk_lines[0]);
+  for (std::thread& worker : workers)
+    worker.join();
+
+  int unique_entry_count = 0;
+  int total_entry_count = 0;
+  for (const std::vector<LogLine>& lines : chunk_lines) {
+    for (const LogLine& line : lines) {
+      LogEntry* entry;
+      Entries::iterator i = entries_.find(line.output);
+      if (i != entries_.end()) {
+        entry = std::to_address(i->second);
+      } else {
+        std::unique_ptr<LogEntry> e(
+            std::make_unique<LogEntry>(std::string(line.output))
+        );
+        entry = e.get();
+        entries_.emplace(entry->output, std::move(e));
+        ++unique_entry_count;
+      }
+      ++total_entry_count;
+
+      entry->start_time = line.start_time;
+      entry->end_time = line.end_time;
+      entry->mtime = line.mtime;
+      entry->command_hash = line.command_hash;
+      entry->legacy_hash = line.legacy_hash;
+    }
   }
 
   // Decide whether it's time to rebuild the log:
@@ -384,54 +506,128 @@ BuildLog::LookupByOutput(const std::string& path) {
   return nullptr;
 }
 
+BuildLog::LogEntry*
+BuildLog::LookupByOutput(const Node* node) {
+  // Nodes of another State may share the index, hence the check of the path,
+  // which is cheap next to hashing it as the entry is about to be read.
+  if (node->index() < node_entries_.size()) {
+    LogEntry* entry = node_entries_[node->index()];
+    if (entry && entry->output == node->path())
+      return entry;
+  }
+  LogEntry* entry = LookupByOutput(node->path());
+  if (entry)
+    AttachEntry(node, entry);
+  return entry;
+}
+
+void
+BuildLog::AttachEntry(const Node* node, LogEntry* entry) {
+  if (node->index() >= node_entries_.size())
+    node_entries_.resize(node->index() + 1);
+  node_entries_[node->index()] = entry;
+}
+
 bool
 BuildLog::WriteEntry(FILE* f, const LogEntry& entry) {
-  return fprintf(
-             f, "%d\t%d\t%" PRId64 "\t%s\t%" PRIx64 "\n", entry.start_time,
-             entry.end_time, entry.mtime, entry.output.c_str(),
-             entry.command_hash
-         )
-         > 0;
+  return WriteLogLine(f, ToLogLine(entry));
 }
 
 bool
 BuildLog::Recompact(
     const std::string& path, const BuildLogUser& user, std::string* err
 ) {
-  METRIC_RECORD(".ninja_log recompact");
-
   Close();
-  std::string temp_path = path + ".recompact";
-  FILE* f = fopen(temp_path.c_str(), "wb");
-  if (!f) {
-    *err = strerror(errno);
-    return false;
-  }
+  StartRecompaction(path, user);
+  return FinishRecompaction(err);
+}
 
-  if (fprintf(f, kFileSignature, kCurrentVersion) < 0) {
-    *err = strerror(errno);
-    fclose(f);
-    return false;
-  }
+void
+BuildLog::StartRecompaction(const std::string& path, const BuildLogUser& user) {
+  METRIC_RECORD(".ninja_log recompact");
+  needs_recompaction_ = false;
+
+  std::vector<std::string_view> outputs;
+  outputs.reserve(entries_.size());
+  for (Entries::iterator i = entries_.begin(); i != entries_.end(); ++i)
+    outputs.push_back(i->first);
+  std::vector<bool> dead;
+  user.ArePathsDead(outputs, &dead);
 
   std::vector<std::string_view> dead_outputs;
-  for (Entries::iterator i = entries_.begin(); i != entries_.end(); ++i) {
-    if (user.IsPathDead(i->first)) {
+  std::unordered_set<const LogEntry*> dead_entries;
+  auto recompaction = std::make_unique<Recompaction>();
+  recompaction->snapshot.reserve(entries_.size());
+  size_t index = 0;
+  for (Entries::iterator i = entries_.begin(); i != entries_.end();
+       ++i, ++index) {
+    if (dead[index]) {
       dead_outputs.push_back(i->first);
+      dead_entries.insert(i->second.get());
       continue;
     }
+    recompaction->snapshot.push_back(ToLogLine(*i->second));
+  }
 
-    if (!WriteEntry(f, *i->second)) {
-      *err = strerror(errno);
-      fclose(f);
-      return false;
+  if (!dead_entries.empty()) {
+    for (LogEntry*& entry : node_entries_) {
+      if (dead_entries.count(entry))
+        entry = nullptr;
     }
   }
-
   for (size_t i = 0; i < dead_outputs.size(); ++i)
     entries_.erase(dead_outputs[i]);
 
-  fclose(f);
+  // The snapshot refers to the outputs of the entries, which stay put until
+  // the recompaction is finished.
+  recompaction->path = path;
+  recompaction->temp_path = path + ".recompact";
+  Recompaction* r = recompaction.get();
+  r->thread = std::thread([r] {
+    r->ok = WriteLogFile(r->temp_path, r->snapshot, &r->err);
+  });
+  recompaction_ = std::move(recompaction);
+}
+
+bool
+BuildLog::FinishRecompaction(std::string* err) {
+  if (!recompaction_)
+    return true;
+  METRIC_RECORD(".ninja_log recompact finish");
+  std::unique_ptr<Recompaction> recompaction = std::move(recompaction_);
+  recompaction->thread.join();
+  const std::string& temp_path = recompaction->temp_path;
+  if (!recompaction->ok) {
+    *err = recompaction->err;
+    unlink(temp_path.c_str());
+    return false;
+  }
+
+  // Append the entries recorded during the recompaction.  The old log has
+  // them too, until it is replaced.
+  if (!recompaction->tail.empty()) {
+    FILE* f = fopen(temp_path.c_str(), "ab");
+    if (!f) {
+      *err = strerror(errno);
+      unlink(temp_path.c_str());
+      return false;
+    }
+    std::unordered_set<const LogEntry*> written;
+    bool ok = true;
+    for (const LogEntry* entry : recompaction->tail) {
+      if (ok && written.insert(entry).second)
+        ok = WriteEntry(f, *entry);
+    }
+    if (fclose(f) != 0)
+      ok = false;
+    if (!ok) {
+      *err = strerror(errno);
+      unlink(temp_path.c_str());
+      return false;
+    }
+  }
+
+  const std::string& path = recompaction->path;
   if (unlink(path.c_str()) < 0) {
     *err = strerror(errno);
     return false;
@@ -448,11 +644,36 @@ BuildLog::Recompact(
 bool
 BuildLog::Restat(
     const std::string_view path, const DiskInterface& disk_interface,
-    const int output_count, char** outputs, std::string* const err
+    const int output_count, char** outputs, StatProgress* progress,
+    std::string* const err
 ) {
   METRIC_RECORD(".ninja_log restat");
 
   Close();
+
+  // Stat all the outputs up front, and only then write the entries, in the
+  // same order as ever.
+  std::vector<LogEntry*> restat_entries;
+  std::vector<std::string_view> restat_paths;
+  for (const auto& entrie : entries_) {
+    bool skip = output_count > 0;
+    for (int j = 0; j < output_count; ++j) {
+      if (entrie.second->output == outputs[j]) {
+        skip = false;
+        break;
+      }
+    }
+    if (!skip) {
+      restat_entries.push_back(entrie.second.get());
+      restat_paths.push_back(entrie.second->output);
+    }
+  }
+  std::vector<TimeStamp> mtimes;
+  if (!disk_interface.StatMany(restat_paths, &mtimes, progress, err))
+    return false;
+  for (size_t i = 0; i < restat_entries.size(); ++i)
+    restat_entries[i]->mtime = mtimes[i];
+
   std::string temp_path = std::string(path) + ".restat";
   FILE* f = fopen(temp_path.c_str(), "wb");
   if (!f) {
@@ -466,22 +687,6 @@ BuildLog::Restat(
     return false;
   }
   for (const auto& entrie : entries_) {
-    bool skip = output_count > 0;
-    for (int j = 0; j < output_count; ++j) {
-      if (entrie.second->output == outputs[j]) {
-        skip = false;
-        break;
-      }
-    }
-    if (!skip) {
-      const TimeStamp mtime = disk_interface.Stat(entrie.second->output, err);
-      if (mtime == -1) {
-        fclose(f);
-        return false;
-      }
-      entrie.second->mtime = mtime;
-    }
-
     if (!WriteEntry(f, *entrie.second)) {
       *err = strerror(errno);
       fclose(f);
@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <ninja/build_log.hpp>
@@ -104,8 +105,7 @@ WriteTestData(std::string* err) {
 }
 
 int
-main() {
-  std::vector<int> times;
+main(int argc, char** argv) {
   std::string err;
 
   if (!WriteTestData(&err)) {
@@ -121,31 +121,47 @@ main() {
       return 1;
     }
   }
-  const int kNumRepetitions = 5;
-  for (int i = 0; i < kNumRepetitions; ++i) {
-    int64_t start = GetTimeMillis();
-    BuildLog log;
-    if (log.Load(kTestFilename, &err) == LOAD_ERROR) {
-      fprintf(stderr, "Failed to read test data: %s\n", err.c_str());
-      return 1;
-    }
-    int delta = (int)(GetTimeMillis() - start);
-    printf("%dms\n", delta);
-    times.push_back(delta);
-  }
 
-  int min = times[0];
-  int max = times[0];
-  float total = 0;
-  for (size_t i = 0; i < times.size(); ++i) {
-    total += times[i];
-    if (times[i] < min)
-      min = times[i];
-    else if (times[i] > max)
-      max = times[i];
+  std::string contents;
+  if (ReadFile(kTestFilename, &contents, &err) < 0) {
+    fprintf(stderr, "Failed to read test data: %s\n", err.c_str());
+    return 1;
   }
+  const double megabytes = contents.size() / (1024.0 * 1024.0);
+
+  // Measure loading with 1 to N threads, where N is the first argument or
+  // the number of processors.
+  int max_threads = argc > 1 ? atoi(argv[1]) : GetProcessorCount();
+  for (int threads = 1; threads <= std::max(max_threads, 1); ++threads) {
+    std::vector<int> times;
+    const int kNumRepetitions = 5;
+    for (int i = 0; i < kNumRepetitions; ++i) {
+      int64_t start = GetTimeMillis();
+      BuildLog log;
+      log.set_load_threads(threads);
+      if (log.Load(kTestFilename, &err) == LOAD_ERROR) {
+        fprintf(stderr, "Failed to read test data: %s\n", err.c_str());
+        return 1;
+      }
+      times.push_back((int)(GetTimeMillis() - start));
+    }
+
+    int min = times[0];
+    int max = times[0];
+    float total = 0;
+    for (size_t i = 0; i < times.size(); ++i) {
+      total += times[i];
+      if (times[i] < min)
+        min = times[i];
+      else if (times[i] > max)
+        max = times[i];
+    }
 
-  printf("min %dms  max %dms  avg %.1fms\n", min, max, total / times.size());
+    printf(
+        "%d threads: min %dms  max %dms  avg %.1fms  (%.0f MB/s)\n", threads,
+        min, max, total / times.size(), megabytes * 1000 / std::max(min, 1)
+    );
+  }
 
   unlink(kTestFilename);
 
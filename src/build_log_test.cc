@@ -12,9 +12,12 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <cassert>
+#include <cinttypes>
 #include <cstring>
 #include <ninja/build_log.hpp>
+#include <ninja/state.hpp>
 #include <ninja/test.hpp>
 #include <ninja/util.hpp>
 #include <sys/stat.h>
@@ -71,6 +74,48 @@ TEST_F(BuildLogTest, WriteRead) {
   ASSERT_EQ("out", e1->output);
 }
 
+TEST_F(BuildLogTest, LookupByNode) {
+  AssertParse(
+      &state_,
+      "build out: cat mid\n"
+      "build mid: cat in\n"
+  );
+
+  BuildLog log1;
+  std::string err;
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, *this, &err));
+  ASSERT_EQ("", err);
+  log1.RecordCommand(state_.edges_[0].get(), 15, 18);
+  log1.Close();
+
+  BuildLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+
+  Node* out = state_.LookupNode("out");
+  ASSERT_TRUE(log2.LookupByOutput(out));
+  EXPECT_EQ(log2.LookupByOutput("out"), log2.LookupByOutput(out));
+  EXPECT_EQ(15, log2.LookupByOutput(out)->start_time);
+  Node* mid = state_.LookupNode("mid");
+  EXPECT_FALSE(log2.LookupByOutput(mid));
+
+  log2.RecordCommand(state_.edges_[1].get(), 20, 25);
+  ASSERT_TRUE(log2.LookupByOutput(mid));
+  EXPECT_EQ(log2.LookupByOutput("mid"), log2.LookupByOutput(mid));
+
+  // The nodes of another State may have the same indices.
+  State state;
+  AddCatRule(&state);
+  AssertParse(&state, "build mid: cat out\n");
+  ASSERT_EQ(out->index(), state.LookupNode("mid")->index());
+  EXPECT_EQ(
+      log2.LookupByOutput("mid"), log2.LookupByOutput(state.LookupNode("mid"))
+  );
+  EXPECT_EQ(
+      log2.LookupByOutput("out"), log2.LookupByOutput(state.LookupNode("out"))
+  );
+}
+
 TEST_F(BuildLogTest, FirstWriteAddsSignature) {
   const char kExpectedVersion[] = "# ninja log vX\n";
   const size_t kVersionPos = strlen(kExpectedVersion) - 2; // Points at 'X'.
@@ -220,6 +265,116 @@ TEST_F(BuildLogTest, DuplicateVersionHeader) {
   ASSERT_NO_FATAL_FAILURE(AssertHash("command2", e->command_hash));
 }
 
+TEST_F(BuildLogTest, LegacyHashes) {
+  AssertParse(
+      &state_,
+      "build out: cat in\n"
+      "build out2: cat in2\n"
+  );
+  Edge* edge = state_.edges_[0].get();
+  Edge* edge2 = state_.edges_[1].get();
+
+  // A v5 log, whose hashes come from MurmurHash64A.
+  FILE* f = fopen(kTestFilename, "wb");
+  fprintf(f, "# ninja log v5\n");
+  fprintf(
+      f, "1\t2\t3\tout\t%" PRIx64 "\n",
+      BuildLog::LogEntry::LegacyHashCommand(edge->EvaluateCommand(true))
+  );
+  fprintf(
+      f, "1\t2\t3\tout2\t%" PRIx64 "\n",
+      BuildLog::LogEntry::LegacyHashCommand("some other command")
+  );
+  fclose(f);
+
+  std::string err;
+  {
+    BuildLog log;
+    EXPECT_TRUE(log.Load(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    BuildLog::LogEntry* e = log.LookupByOutput("out");
+    ASSERT_TRUE(e);
+    EXPECT_TRUE(e->legacy_hash);
+    EXPECT_TRUE(e->MatchesCommand(edge, edge->HashCommand()));
+    // The matching legacy hash was upgraded.
+    EXPECT_FALSE(e->legacy_hash);
+    EXPECT_EQ(edge->HashCommand(), e->command_hash);
+    EXPECT_TRUE(e->MatchesCommand(edge, edge->HashCommand()));
+
+    BuildLog::LogEntry* e2 = log.LookupByOutput("out2");
+    ASSERT_TRUE(e2);
+    EXPECT_FALSE(e2->MatchesCommand(edge2, edge2->HashCommand()));
+    EXPECT_TRUE(e2->legacy_hash);
+
+    // The upgrade to v6 keeps the legacy hash of out2.
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+    log.Close();
+  }
+
+  std::string contents;
+  ASSERT_EQ(0, ReadFile(kTestFilename, &contents, &err));
+  EXPECT_EQ(0u, contents.find("# ninja log v6\n"));
+  EXPECT_NE(std::string::npos, contents.find("\tout2\tm"));
+
+  BuildLog log;
+  EXPECT_TRUE(log.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  BuildLog::LogEntry* e = log.LookupByOutput("out");
+  ASSERT_TRUE(e);
+  EXPECT_FALSE(e->legacy_hash);
+  EXPECT_TRUE(e->MatchesCommand(edge, edge->HashCommand()));
+  BuildLog::LogEntry* e2 = log.LookupByOutput("out2");
+  ASSERT_TRUE(e2);
+  EXPECT_TRUE(e2->legacy_hash);
+  EXPECT_EQ(
+      BuildLog::LogEntry::LegacyHashCommand("some other command"),
+      e2->command_hash
+  );
+}
+
+TEST_F(BuildLogTest, HashCommandWithRspfile) {
+  AssertParse(
+      &state_,
+      "rule cat_rsp\n"
+      "  command = cat $rspfile > $out\n"
+      "  rspfile = $rspfile\n"
+      "  rspfile_content = $in\n"
+      "build out: cat_rsp in1 in2\n"
+      "  rspfile = out.rsp\n"
+  );
+  Edge* edge = state_.edges_[0].get();
+  EXPECT_EQ(
+      BuildLog::LogEntry::HashCommand(edge->EvaluateCommand(true)),
+      edge->HashCommand()
+  );
+  EXPECT_NE(
+      BuildLog::LogEntry::HashCommand(edge->EvaluateCommand(false)),
+      edge->HashCommand()
+  );
+}
+
+// Moving an edge to or from a worker changes its command.
+TEST_F(BuildLogTest, HashCommandWithWorker) {
+  AssertParse(
+      &state_,
+      "rule cc\n"
+      "  command = cc $in\n"
+      "rule cc_worker\n"
+      "  command = cc $in\n"
+      "  worker = cc-worker\n"
+      "build out1: cc in\n"
+      "build out2: cc_worker in\n"
+  );
+  Edge* edge = state_.edges_[0].get();
+  Edge* worker_edge = state_.edges_[1].get();
+  EXPECT_EQ(
+      BuildLog::LogEntry::HashCommand(worker_edge->EvaluateCommand(true)),
+      worker_edge->HashCommand()
+  );
+  EXPECT_NE(edge->HashCommand(), worker_edge->HashCommand());
+}
+
 struct TestDiskInterface : public DiskInterface {
   virtual TimeStamp
   Stat(const std::string& path, std::string* err) const {
@@ -265,12 +420,16 @@ TEST_F(BuildLogTest, Restat) {
   TestDiskInterface testDiskInterface;
   char out2[] = {'o', 'u', 't', '2', 0};
   char* filter2[] = {out2};
-  EXPECT_TRUE(log.Restat(kTestFilename, testDiskInterface, 1, filter2, &err));
+  EXPECT_TRUE(log.Restat(
+      kTestFilename, testDiskInterface, 1, filter2, nullptr, &err
+  ));
   ASSERT_EQ("", err);
   e = log.LookupByOutput("out");
   ASSERT_EQ(3, e->mtime); // unchanged, since the filter doesn't match
 
-  EXPECT_TRUE(log.Restat(kTestFilename, testDiskInterface, 0, nullptr, &err));
+  EXPECT_TRUE(log.Restat(
+      kTestFilename, testDiskInterface, 0, nullptr, nullptr, &err
+  ));
   ASSERT_EQ("", err);
   e = log.LookupByOutput("out");
   ASSERT_EQ(4, e->mtime);
@@ -304,6 +463,53 @@ TEST_F(BuildLogTest, VeryLongInputLine) {
   ASSERT_NO_FATAL_FAILURE(AssertHash("command2", e->command_hash));
 }
 
+TEST_F(BuildLogTest, LoadInChunks) {
+  // Enough lines for several chunks, where later lines for an output must
+  // win over earlier ones in other chunks.
+  const int kOutputs = 1000;
+  const int kLines = 30000;
+  FILE* f = fopen(kTestFilename, "wb");
+  fprintf(f, "# ninja log v6\n");
+  for (int i = 0; i < kLines; ++i)
+    fprintf(f, "%d\t%d\t%d\tout%d\t%x\n", i, i + 1, i + 2, i % kOutputs, i);
+  fprintf(f, "1\t2\t3\ttruncated\t");
+  fclose(f);
+
+  std::string err;
+  BuildLog log1;
+  log1.set_load_threads(1);
+  EXPECT_TRUE(log1.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  BuildLog log2;
+  log2.set_load_threads(4);
+  EXPECT_TRUE(log2.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+
+  ASSERT_EQ(static_cast<size_t>(kOutputs), log2.entries().size());
+  for (int i = 0; i < kOutputs; ++i) {
+    std::string output = "out" + std::to_string(i);
+    BuildLog::LogEntry* e1 = log1.LookupByOutput(output);
+    BuildLog::LogEntry* e2 = log2.LookupByOutput(output);
+    ASSERT_TRUE(e1);
+    ASSERT_TRUE(e2);
+    EXPECT_TRUE(*e1 == *e2);
+    EXPECT_EQ(kLines - kOutputs + i, e2->start_time);
+    EXPECT_EQ(static_cast<uint64_t>(kLines - kOutputs + i), e2->command_hash);
+  }
+  EXPECT_FALSE(log2.LookupByOutput("truncated"));
+
+  // All the lines were counted: the log is recompacted when next opened.
+  EXPECT_TRUE(log2.OpenForWrite(kTestFilename, *this, &err));
+  ASSERT_EQ("", err);
+  log2.Close();
+  std::string contents;
+  ASSERT_EQ(0, ReadFile(kTestFilename, &contents, &err));
+  EXPECT_EQ(
+      static_cast<size_t>(kOutputs + 1),
+      static_cast<size_t>(std::count(contents.begin(), contents.end(), '\n'))
+  );
+}
+
 TEST_F(BuildLogTest, MultiTargetEdge) {
   AssertParse(&state_, "build out out.d: cat\n");
 
@@ -368,4 +574,48 @@ TEST_F(BuildLogRecompactTest, Recompact) {
   ASSERT_FALSE(log2.LookupByOutput("out2"));
 }
 
+TEST_F(BuildLogRecompactTest, RecompactInBackground) {
+  AssertParse(
+      &state_,
+      "build out: cat in\n"
+      "build out2: cat in\n"
+      "build out3: cat in\n"
+  );
+
+  BuildLog log1;
+  std::string err;
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, *this, &err));
+  ASSERT_EQ("", err);
+  for (int i = 0; i < 200; ++i)
+    log1.RecordCommand(state_.edges_[0].get(), 15, 18 + i);
+  log1.RecordCommand(state_.edges_[1].get(), 21, 22);
+  log1.Close();
+
+  // Commands recorded while the log is recompacted make it into the new log.
+  BuildLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(log2.OpenForWrite(kTestFilename, *this, &err));
+  ASSERT_EQ("", err);
+  log2.RecordCommand(state_.edges_[0].get(), 30, 31);
+  log2.RecordCommand(state_.edges_[2].get(), 32, 33);
+  log2.RecordCommand(state_.edges_[2].get(), 34, 35);
+  log2.Close();
+
+  std::string contents;
+  ASSERT_EQ(0, ReadFile(kTestFilename, &contents, &err));
+  // The header, "out" from the snapshot, then "out" and "out3" once each.
+  EXPECT_EQ(4, std::count(contents.begin(), contents.end(), '\n'));
+
+  BuildLog log3;
+  EXPECT_TRUE(log3.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(2u, log3.entries().size());
+  ASSERT_TRUE(log3.LookupByOutput("out"));
+  EXPECT_EQ(30, log3.LookupByOutput("out")->start_time);
+  ASSERT_TRUE(log3.LookupByOutput("out3"));
+  EXPECT_EQ(34, log3.LookupByOutput("out3")->start_time);
+  EXPECT_FALSE(log3.LookupByOutput("out2"));
+}
+
 } // anonymous namespace
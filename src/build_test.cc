@@ -491,10 +491,12 @@ struct FakeCommandRunner : public CommandRunner {
 
   // CommandRunner impl
   virtual bool
-  CanRunMore() const;
+  CanRunMore();
   virtual bool
   StartCommand(Edge* edge);
   virtual bool
+  StartCommands(const std::vector<Edge*>& edges);
+  virtual bool
   WaitForCommand(Result* result);
   virtual std::vector<Edge*>
   GetActiveEdges();
@@ -502,6 +504,7 @@ struct FakeCommandRunner : public CommandRunner {
   Abort();
 
   std::vector<std::string> commands_ran_;
+  std::vector<size_t> batch_sizes_;
   std::vector<Edge*> active_edges_;
   size_t max_active_edges_;
   VirtualFileSystem* fs_;
@@ -608,7 +611,7 @@ BuildTest::RebuildTarget(
 }
 
 bool
-FakeCommandRunner::CanRunMore() const {
+FakeCommandRunner::CanRunMore() {
   return active_edges_.size() < max_active_edges_;
 }
 
@@ -699,6 +702,17 @@ FakeCommandRunner::StartCommand(Edge* edge) {
   return true;
 }
 
+bool
+FakeCommandRunner::StartCommands(const std::vector<Edge*>& edges) {
+  // A batch takes a single job, however many edges it has.
+  batch_sizes_.push_back(edges.size());
+  size_t max_active_edges = max_active_edges_;
+  max_active_edges_ = active_edges_.size() + edges.size();
+  bool started = CommandRunner::StartCommands(edges);
+  max_active_edges_ = max_active_edges;
+  return started;
+}
+
 bool
 FakeCommandRunner::WaitForCommand(Result* result) {
   if (active_edges_.empty())
@@ -733,6 +747,13 @@ FakeCommandRunner::WaitForCommand(Result* result) {
          in != edge->inputs_.end(); ++in) {
       result->output += prefix + (*in)->path() + '\n';
     }
+    // Spill all but the start of the output, as if past the limit.
+    if (edge->GetBindingBool("test_spill")) {
+      FILE* spill = tmpfile();
+      fputs(result->output.c_str() + 4, spill);
+      result->output.resize(4);
+      result->spilled_output.reset(spill, fclose);
+    }
   }
 
   if (edge->rule().name() == "fail"
@@ -1035,8 +1056,9 @@ TEST_F(BuildTest, DepFileOK) {
   // Expect three new edges: one generating foo.o, and two more from
   // loading the depfile.
   ASSERT_EQ(orig_edges + 3, (int)state_.edges_.size());
-  // Expect our edge to now have three inputs: foo.c and two headers.
-  ASSERT_EQ(3u, edge->inputs_.size());
+  // Expect our edge to now have foo.c as input and two headers as deps.
+  ASSERT_EQ(1u, edge->inputs_.size());
+  ASSERT_EQ(2u, edge->loaded_deps().size());
 
   // Expect the command line we generate to only use the original input.
   ASSERT_EQ("cc foo.c", edge->EvaluateCommand());
@@ -1066,7 +1088,7 @@ TEST_F(BuildTest, EncounterReadyTwice) {
       "build a: touch | b || c\n"
   ));
 
-  std::vector<Edge*> c_out = GetNode("c")->out_edges();
+  const EdgeList& c_out = GetNode("c")->out_edges();
   ASSERT_EQ(2u, c_out.size());
   EXPECT_EQ("b", c_out[0]->outputs_[0]->path());
   EXPECT_EQ("a", c_out[1]->outputs_[0]->path());
@@ -1095,16 +1117,15 @@ TEST_F(BuildTest, OrderOnlyDeps) {
   EXPECT_TRUE(builder_.AddTarget("foo.o", &err));
   ASSERT_EQ("", err);
 
-  // One explicit, two implicit, one order only.
-  ASSERT_EQ(4u, edge->inputs_.size());
-  EXPECT_EQ(2, edge->implicit_deps_);
+  // One explicit, one order only, and two implicit from the depfile.
+  ASSERT_EQ(2u, edge->inputs_.size());
+  EXPECT_EQ(0, edge->implicit_deps_);
   EXPECT_EQ(1, edge->order_only_deps_);
-  // Verify the inputs are in the order we expect
-  // (explicit then implicit then orderonly).
   EXPECT_EQ("foo.c", edge->inputs_[0]->path());
-  EXPECT_EQ("blah.h", edge->inputs_[1]->path());
-  EXPECT_EQ("bar.h", edge->inputs_[2]->path());
-  EXPECT_EQ("otherfile", edge->inputs_[3]->path());
+  EXPECT_EQ("otherfile", edge->inputs_[1]->path());
+  ASSERT_EQ(2u, edge->loaded_deps().size());
+  EXPECT_EQ("blah.h", edge->loaded_deps()[0]->path());
+  EXPECT_EQ("bar.h", edge->loaded_deps()[1]->path());
 
   // Expect the command line we generate to only use the original input.
   ASSERT_EQ("cc foo.c", edge->EvaluateCommand());
@@ -1765,6 +1786,60 @@ TEST_F(BuildWithLogTest, RestatTest) {
   ASSERT_EQ(2u, command_runner_.commands_ran_.size());
 }
 
+#ifndef _WIN32
+TEST_F(BuildWithLogTest, Builtin) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+      &state_,
+      "rule cp\n"
+      "  command = cp $in $out\n"
+      "  builtin = 1\n"
+      "build out1: cp in\n"
+      "build out2: cat out1\n"
+  ));
+  fs_.Create("in", "contents");
+
+  // Only the command that isn't builtin reaches the command runner, but both
+  // are logged.
+  std::string err;
+  EXPECT_TRUE(builder_.AddTarget("out2", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("cat out1 > out2", command_runner_.commands_ran_[0]);
+  EXPECT_EQ("contents", fs_.files_["out1"].contents);
+  EXPECT_EQ(2u, builder_.plan_.command_edge_count());
+  BuildLog::LogEntry* entry = build_log_.LookupByOutput("out1");
+  ASSERT_TRUE(entry);
+  EXPECT_EQ(BuildLog::LogEntry::HashCommand("cp in out1"), entry->command_hash);
+
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out2", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.AlreadyUpToDate());
+}
+
+TEST_F(BuildWithLogTest, BuiltinFailure) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+      &state_,
+      "rule cp\n"
+      "  command = cp missing $out\n"
+      "  builtin = 1\n"
+      "build out: cp in\n"
+  ));
+  fs_.Create("in", "");
+
+  std::string err;
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(builder_.Build(&err));
+  EXPECT_EQ("subcommand failed", err);
+  EXPECT_TRUE(command_runner_.commands_ran_.empty());
+  EXPECT_FALSE(build_log_.LookupByOutput("out"));
+}
+#endif // !_WIN32
+
 TEST_F(BuildWithLogTest, RestatMissingFile) {
   // If a restat rule doesn't create its output, and the output didn't
   // exist before the rule was run, consider that behavior equivalent
@@ -2165,6 +2240,68 @@ TEST_F(BuildWithLogTest, RspFileCmdLineChange) {
   EXPECT_EQ(1u, command_runner_.commands_ran_.size());
 }
 
+// A response file in memory never touches the disk, and the command sees
+// its path only while it starts.
+TEST_F(BuildWithLogTest, RspFileMemfd) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+      &state_,
+      "rule cat_rsp\n"
+      "  command = cat $rspfile > $out\n"
+      "  rspfile = $out.rsp\n"
+      "  rspfile_content = $long_command\n"
+      "  rspfile_memfd = 1\n"
+      "build out: cat_rsp in\n"
+      "  long_command = Some very long command\n"
+  ));
+
+  fs_.Create("in", "");
+
+  std::string err;
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  EXPECT_EQ("", err);
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("cat /dev/fd/3 > out", command_runner_.commands_ran_[0]);
+
+  EXPECT_EQ(0u, fs_.files_created_.count("out.rsp"));
+  EXPECT_EQ(0u, fs_.files_removed_.count("out.rsp"));
+  EXPECT_TRUE(fs_.memory_files_.empty());
+
+  BuildLog::LogEntry* log_entry = build_log_.LookupByOutput("out");
+  ASSERT_TRUE(nullptr != log_entry);
+  ASSERT_NO_FATAL_FAILURE(AssertHash(
+      "cat out.rsp > out;rspfile=Some very long command",
+      log_entry->command_hash
+  ));
+}
+
+// The same, with the response file bound on the build edge.
+TEST_F(BuildWithLogTest, RspFileMemfdOnEdge) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+      &state_,
+      "rule cat_rsp\n"
+      "  command = cat $rspfile > $out\n"
+      "  rspfile_memfd = 1\n"
+      "build out: cat_rsp in\n"
+      "  rspfile = $out.rsp\n"
+      "  rspfile_content = Some very long command\n"
+  ));
+
+  fs_.Create("in", "");
+
+  std::string err;
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  EXPECT_EQ("", err);
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("cat /dev/fd/3 > out", command_runner_.commands_ran_[0]);
+
+  EXPECT_EQ(0u, fs_.files_created_.count("out.rsp"));
+  EXPECT_TRUE(fs_.memory_files_.empty());
+}
+
 TEST_F(BuildTest, InterruptCleanup) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(
       &state_,
@@ -2352,6 +2489,93 @@ TEST_F(BuildWithQueryDepsLogTest, TwoOutputsDepFileMSVC) {
   EXPECT_EQ("in1", out2_deps->nodes[0]->path());
 }
 
+/// Test a MSVC-style deps log from output which went partly to a file.
+TEST_F(BuildWithQueryDepsLogTest, DepsMSVCSpilled) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+      &state_,
+      "rule cp_multi_msvc\n"
+      "    command = cp $in $out\n"
+      "    deps = msvc\n"
+      "    msvc_deps_prefix = using \n"
+      "build out: cp_multi_msvc in1 in2\n"
+      "    test_spill = 1\n"
+  ));
+
+  std::string err;
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  EXPECT_EQ("", err);
+
+  DepsLog::Deps* deps = log_.GetDeps(state_.LookupNode("out"));
+  ASSERT_EQ(2, deps->node_count);
+  EXPECT_EQ("in1", deps->nodes[0]->path());
+  EXPECT_EQ("in2", deps->nodes[1]->path());
+}
+
+/// Test a GCC-style depfile which the command writes to memory.
+TEST_F(BuildWithQueryDepsLogTest, DepFileMemfd) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+      &state_,
+      "rule generate-depfile\n"
+      "    command = generate $depfile\n"
+      "    deps = gcc\n"
+      "    depfile = $out.d\n"
+      "    depfile_memfd = 1\n"
+      "build out: generate-depfile in1\n"
+      "    test_dependency = in2\n"
+  ));
+
+  std::string err;
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  EXPECT_EQ("", err);
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("generate /dev/fd/3", command_runner_.commands_ran_[0]);
+
+  Node* out_node = state_.LookupNode("out");
+  DepsLog::Deps* out_deps = log_.GetDeps(out_node);
+  ASSERT_TRUE(out_deps);
+  EXPECT_EQ(1, out_deps->node_count);
+  EXPECT_EQ("in2", out_deps->nodes[0]->path());
+
+  EXPECT_EQ(0u, fs_.files_.count("out.d"));
+  EXPECT_EQ(0u, fs_.files_removed_.count("out.d"));
+  EXPECT_TRUE(fs_.memory_files_.empty());
+}
+
+/// The same, with the depfile bound on the build edge.
+TEST_F(BuildWithQueryDepsLogTest, DepFileMemfdOnEdge) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+      &state_,
+      "rule generate-depfile\n"
+      "    command = generate $depfile\n"
+      "    deps = gcc\n"
+      "    depfile_memfd = 1\n"
+      "build out: generate-depfile in1\n"
+      "    depfile = $out.d\n"
+      "    test_dependency = in2\n"
+  ));
+
+  std::string err;
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  EXPECT_EQ("", err);
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("generate /dev/fd/3", command_runner_.commands_ran_[0]);
+
+  Node* out_node = state_.LookupNode("out");
+  DepsLog::Deps* out_deps = log_.GetDeps(out_node);
+  ASSERT_TRUE(out_deps);
+  EXPECT_EQ(1, out_deps->node_count);
+  EXPECT_EQ("in2", out_deps->nodes[0]->path());
+
+  EXPECT_EQ(0u, fs_.files_.count("out.d"));
+  EXPECT_TRUE(fs_.memory_files_.empty());
+}
+
 /// Test a GCC-style deps log with multiple outputs.
 TEST_F(BuildWithQueryDepsLogTest, TwoOutputsDepFileGCCOneLine) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(
@@ -3073,8 +3297,13 @@ TEST_F(BuildWithDepsLogTest, DepFileOKDepsLog) {
     // Expect three new edges: one generating fo o.o, and two more from
     // loading the depfile.
     ASSERT_EQ(3u, state.edges_.size());
-    // Expect our edge to now have three inputs: foo.c and two headers.
-    ASSERT_EQ(3u, edge->inputs_.size());
+    // Expect our edge to now have foo.c as input and two headers as deps,
+    // shared with the deps log.
+    ASSERT_EQ(1u, edge->inputs_.size());
+    ASSERT_EQ(2u, edge->loaded_deps().size());
+    EXPECT_EQ(
+        deps_log.GetDeps(state.GetNode("fo o.o", 0)), edge->loaded_deps_.get()
+    );
 
     // Expect the command line we generate to only use the original input.
     ASSERT_EQ("cc foo.c", edge->EvaluateCommand());
@@ -3280,6 +3509,39 @@ TEST_F(BuildTest, Console) {
   ASSERT_EQ(1u, command_runner_.commands_ran_.size());
 }
 
+// Ready edges of a batch rule start together, but only with edges of the
+// same rule which may be batched themselves.
+TEST_F(BuildTest, Batch) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+      &state_,
+      "rule touch\n"
+      "  command = touch $out\n"
+      "  batch = 3\n"
+      "build a1: touch\n"
+      "build a2: touch\n"
+      "build a3: touch\n"
+      "build a4: touch\n"
+      "build a5: touch\n"
+      "build a6: touch\n"
+      "  batch = 1\n"
+      "build all: phony a1 a2 a3 a4 a5 a6\n"
+  ));
+
+  std::string err;
+  EXPECT_TRUE(builder_.AddTarget("all", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ(6u, command_runner_.commands_ran_.size());
+
+  std::vector<size_t> batch_sizes = command_runner_.batch_sizes_;
+  std::sort(batch_sizes.begin(), batch_sizes.end());
+  ASSERT_EQ(3u, batch_sizes.size());
+  EXPECT_EQ(1u, batch_sizes[0]);
+  EXPECT_EQ(2u, batch_sizes[1]);
+  EXPECT_EQ(3u, batch_sizes[2]);
+}
+
 TEST_F(BuildTest, DyndepMissingAndNoRule) {
   // Verify that we can diagnose when a dyndep file is missing and
   // has no rule to build it.
@@ -0,0 +1,112 @@
+// Copyright 2021 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <ninja/builtin.hpp>
+#include <ninja/disk_interface.hpp>
+#include <ninja/metrics.hpp>
+#include <ninja/subprocess.hpp>
+#include <string>
+#include <vector>
+
+namespace {
+
+/// @return whether none of |args| from |begin| on looks like an option.
+bool
+NoOptions(const std::vector<std::string>& args, size_t begin) {
+  for (size_t i = begin; i < args.size(); ++i) {
+    if (args[i][0] == '-')
+      return false;
+  }
+  return true;
+}
+
+} // anonymous namespace
+
+bool
+RunBuiltinCommand(
+    const std::string& command, DiskInterface* disk, ExitStatus* status,
+    std::string* output
+) {
+#ifdef _WIN32
+  return false;
+#else
+  std::vector<std::string> args;
+  if (!SplitSimpleCommand(command, &args))
+    return false;
+  const std::string& program = args[0];
+
+  enum { kTouch, kCopy, kMakeDirs, kSymlink } op;
+  size_t first_operand = 1;
+  if (program == "touch" && args.size() >= 2 && NoOptions(args, 1)) {
+    op = kTouch;
+  } else if (program == "cp" && args.size() == 3 && NoOptions(args, 1)) {
+    op = kCopy;
+  } else if (program == "mkdir" && args.size() >= 3 && args[1] == "-p"
+             && NoOptions(args, 2)) {
+    op = kMakeDirs;
+    first_operand = 2;
+  } else if (program == "ln" && args.size() == 4
+             && (args[1] == "-sf" || args[1] == "-fs") && NoOptions(args, 2)) {
+    op = kSymlink;
+    first_operand = 2;
+  } else {
+    return false;
+  }
+
+  if (op == kMakeDirs) {
+    // mkdir -p fails on an operand which exists but isn't a directory: leave
+    // that, and reporting it, to the shell.
+    for (size_t i = first_operand; i < args.size(); ++i) {
+      std::string err;
+      if (disk->Stat(args[i], &err) != 0 && !disk->IsDirectory(args[i]))
+        return false;
+    }
+  }
+
+  METRIC_RECORD("builtin command");
+  std::string err;
+  bool ok = true;
+  switch (op) {
+    case kTouch:
+      for (size_t i = first_operand; i < args.size() && ok; ++i)
+        ok = disk->Touch(args[i], &err);
+      break;
+    case kCopy:
+      ok = disk->CopyFile(args[1], args[2], &err);
+      break;
+    case kMakeDirs:
+      for (size_t i = first_operand; i < args.size() && ok; ++i) {
+        const std::string& dir = args[i];
+        // MakeDirs() only makes the parents.
+        ok = disk->MakeDirs(dir);
+        if (ok) {
+          TimeStamp mtime = disk->Stat(dir, &err);
+          ok = mtime > 0 || (mtime == 0 && disk->MakeDir(dir));
+        }
+        if (!ok && err.empty())
+          err = "unable to create " + dir;
+      }
+      break;
+    case kSymlink:
+      ok = disk->MakeSymlink(args[2], args[3], &err);
+      break;
+  }
+
+  *status = ok ? ExitSuccess : ExitFailure;
+  output->clear();
+  if (!ok)
+    *output = program + ": " + err + "\n";
+  return true;
+#endif
+}
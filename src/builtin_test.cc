@@ -0,0 +1,108 @@
+// Copyright 2021 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <ninja/builtin.hpp>
+#include <ninja/test.hpp>
+
+namespace {
+
+struct BuiltinTest : public testing::Test {
+  /// Run |command|, expecting it to be a builtin.
+  /// @return its output.
+  std::string
+  RunBuiltin(const std::string& command, ExitStatus expected = ExitSuccess) {
+    ExitStatus status = ExitInterrupted;
+    std::string output;
+    EXPECT_TRUE(RunBuiltinCommand(command, &fs_, &status, &output));
+    EXPECT_EQ(expected, status);
+    return output;
+  }
+
+  bool
+  IsBuiltin(const std::string& command) {
+    ExitStatus status;
+    std::string output;
+    return RunBuiltinCommand(command, &fs_, &status, &output);
+  }
+
+  VirtualFileSystem fs_;
+};
+
+} // anonymous namespace
+
+#ifndef _WIN32
+
+TEST_F(BuiltinTest, Touch) {
+  fs_.Create("old", "contents");
+  fs_.Tick();
+  EXPECT_EQ("", RunBuiltin("touch old new"));
+  EXPECT_EQ(2, fs_.files_["old"].mtime);
+  EXPECT_EQ("contents", fs_.files_["old"].contents);
+  EXPECT_EQ(2, fs_.files_["new"].mtime);
+  EXPECT_EQ("", fs_.files_["new"].contents);
+}
+
+TEST_F(BuiltinTest, Copy) {
+  fs_.Create("in", "contents");
+  EXPECT_EQ("", RunBuiltin("cp in out"));
+  EXPECT_EQ("contents", fs_.files_["out"].contents);
+
+  std::string output = RunBuiltin("cp missing out", ExitFailure);
+  EXPECT_EQ(0u, output.find("cp: missing: "));
+}
+
+TEST_F(BuiltinTest, MakeDirs) {
+  EXPECT_EQ("", RunBuiltin("mkdir -p a/b c"));
+  ASSERT_EQ(3u, fs_.directories_made_.size());
+  EXPECT_EQ("a", fs_.directories_made_[0]);
+  EXPECT_EQ("a/b", fs_.directories_made_[1]);
+  EXPECT_EQ("c", fs_.directories_made_[2]);
+}
+
+// mkdir -p fails on a file, which only the shell reports as it should.
+TEST_F(BuiltinTest, MakeDirsOverFile) {
+  fs_.Create("file", "");
+  EXPECT_FALSE(IsBuiltin("mkdir -p dir file"));
+  EXPECT_TRUE(fs_.directories_made_.empty());
+
+  fs_.Create("dir/file", "");
+  fs_.MakeDir("dir");
+  EXPECT_EQ("", RunBuiltin("mkdir -p dir"));
+}
+
+TEST_F(BuiltinTest, Symlink) {
+  EXPECT_EQ("", RunBuiltin("ln -sf ../target link"));
+  EXPECT_EQ("../target", fs_.symlinks_["link"]);
+  EXPECT_EQ("", RunBuiltin("ln -fs other link"));
+  EXPECT_EQ("other", fs_.symlinks_["link"]);
+}
+
+TEST_F(BuiltinTest, NotBuiltin) {
+  EXPECT_FALSE(IsBuiltin(""));
+  EXPECT_FALSE(IsBuiltin("cc -c foo.c"));
+  EXPECT_FALSE(IsBuiltin("touch"));
+  EXPECT_FALSE(IsBuiltin("touch -c out"));
+  EXPECT_FALSE(IsBuiltin("touch 'a b'"));
+  EXPECT_FALSE(IsBuiltin("touch out && echo done"));
+  EXPECT_FALSE(IsBuiltin("cp -r in out"));
+  EXPECT_FALSE(IsBuiltin("cp a b c"));
+  EXPECT_FALSE(IsBuiltin("mkdir dir"));
+  EXPECT_FALSE(IsBuiltin("mkdir -p"));
+  EXPECT_FALSE(IsBuiltin("ln -s target link"));
+  EXPECT_FALSE(IsBuiltin("ln -sf target"));
+  EXPECT_TRUE(fs_.files_created_.empty());
+  EXPECT_TRUE(fs_.directories_made_.empty());
+}
+
+#endif // !_WIN32
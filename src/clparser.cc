@@ -84,7 +84,6 @@ CLParser::Parse(
   // Loop over all lines in the output to process them.
   assert(&output != filtered_output);
   size_t start = 0;
-  bool seen_show_includes = false;
 
   while (start < output.size()) {
     size_t end = output.find_first_of("\r\n", start);
@@ -94,7 +93,7 @@ CLParser::Parse(
 
     std::string include = FilterShowIncludes(line, deps_prefix);
     if (!include.empty()) {
-      seen_show_includes = true;
+      seen_show_includes_ = true;
       std::string normalized;
       // TODO: should this make the path relative to cwd?
       normalized = include;
@@ -102,7 +101,7 @@ CLParser::Parse(
       CanonicalizePath(&normalized, &slash_bits);
       if (!IsSystemInclude(normalized))
         includes_.insert(normalized);
-    } else if (!seen_show_includes && FilterInputFilename(line)) {
+    } else if (!seen_show_includes_ && FilterInputFilename(line)) {
       // Drop it.
       // TODO: if we support compiling multiple output files in a single
       // cl.exe invocation, we should stash the filename.
@@ -0,0 +1,226 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstring>
+#include <ninja/command_hash.hpp>
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+// The layout follows XXH3 (https://github.com/Cyan4973/xxHash): the input is
+// cut into 64-byte stripes, each stripe is mixed into eight accumulators
+// with a different slice of a secret key, and every 16 stripes the
+// accumulators are scrambled so that the order of the stripes matters.
+
+namespace {
+
+const uint64_t kPrime32_1 = 0x9E3779B1U;
+const uint64_t kPrime32_2 = 0x85EBCA77U;
+const uint64_t kPrime32_3 = 0xC2B2AE3DU;
+const uint64_t kPrime64_1 = 0x9E3779B185EBCA87ULL;
+const uint64_t kPrime64_2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t kPrime64_3 = 0x165667B19E3779F9ULL;
+const uint64_t kPrime64_4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t kPrime64_5 = 0x27D4EB2F165667C5ULL;
+
+const size_t kStripesPerBlock = 16;
+
+/// Stripe n of a block is mixed with words [n, n + 8) of the secret.  The
+/// words after those key the scrambling, the final partial stripe and the
+/// merging of the accumulators.
+const size_t kScrambleKey = kStripesPerBlock + 7;
+const size_t kLastStripeKey = kScrambleKey + 8;
+const size_t kMergeKey = kLastStripeKey + 8;
+const size_t kSecretWords = kMergeKey + 8;
+
+struct Secret {
+  uint64_t words[kSecretWords];
+};
+
+/// Fill the secret with the output of splitmix64, rather than spell out a
+/// table of random bytes.
+constexpr Secret
+MakeSecret() {
+  Secret secret{};
+  uint64_t state = 0x6e696e6a61ULL; // "ninja"
+  for (size_t i = 0; i < kSecretWords; ++i) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    secret.words[i] = z ^ (z >> 31);
+  }
+  return secret;
+}
+
+alignas(16) constexpr Secret kSecret = MakeSecret();
+
+inline uint64_t
+Read64(const char* p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof value);
+  return value;
+}
+
+/// Mix a 64-byte stripe into the accumulators.
+inline void
+Accumulate(uint64_t* acc, const char* stripe, const uint64_t* key) {
+#ifdef __SSE2__
+  for (int i = 0; i < 4; ++i) {
+    __m128i data =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(stripe) + i);
+    __m128i data_key = _mm_xor_si128(
+        data, _mm_loadu_si128(reinterpret_cast<const __m128i*>(key) + i)
+    );
+    // Multiply the low and high halves of each 64-bit lane of data_key.
+    __m128i product = _mm_mul_epu32(
+        data_key, _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1))
+    );
+    // Add each lane of the input to the other accumulator of the pair.
+    __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+    __m128i* lanes = reinterpret_cast<__m128i*>(acc) + i;
+    _mm_store_si128(
+        lanes,
+        _mm_add_epi64(_mm_load_si128(lanes), _mm_add_epi64(product, swapped))
+    );
+  }
+#else
+  for (int i = 0; i < 8; ++i) {
+    uint64_t data = Read64(stripe + 8 * i);
+    uint64_t data_key = data ^ key[i];
+    acc[i ^ 1] += data;
+    acc[i] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+  }
+#endif
+}
+
+inline void
+Scramble(uint64_t* acc) {
+  for (int i = 0; i < 8; ++i) {
+    uint64_t a = acc[i];
+    a ^= a >> 47;
+    a ^= kSecret.words[kScrambleKey + i];
+    acc[i] = a * kPrime32_1;
+  }
+}
+
+/// @return the 128-bit product of \a a and \a b, folded to 64 bits.
+inline uint64_t
+MulFold64(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+  unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+  return static_cast<uint64_t>(product)
+         ^ static_cast<uint64_t>(product >> 64);
+#else
+  uint64_t lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+  uint64_t hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+  uint64_t lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+  uint64_t hi_hi = (a >> 32) * (b >> 32);
+  uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+  uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+  uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+  return lower ^ upper;
+#endif
+}
+
+inline uint64_t
+Avalanche(uint64_t h) {
+  h ^= h >> 37;
+  h *= 0x165667919E3779F9ULL;
+  h ^= h >> 32;
+  return h;
+}
+
+} // anonymous namespace
+
+CommandHasher::CommandHasher()
+    : acc_{kPrime32_3, kPrime64_1, kPrime64_2, kPrime64_3,
+           kPrime64_4, kPrime32_2, kPrime64_5, kPrime32_1} {}
+
+void
+CommandHasher::Consume(const char* data, size_t stripes) {
+  for (size_t i = 0; i < stripes; ++i, data += kStripeSize) {
+    Accumulate(acc_, data, kSecret.words + stripe_);
+    if (++stripe_ == kStripesPerBlock) {
+      Scramble(acc_);
+      stripe_ = 0;
+    }
+  }
+}
+
+void
+CommandHasher::Update(std::string_view data) {
+  const char* p = data.data();
+  size_t size = data.size();
+  length_ += size;
+
+  if (buffered_) {
+    size_t fill = kStripeSize - buffered_;
+    if (size < fill) {
+      memcpy(buffer_ + buffered_, p, size);
+      buffered_ += size;
+      return;
+    }
+    memcpy(buffer_ + buffered_, p, fill);
+    Consume(buffer_, 1);
+    buffered_ = 0;
+    p += fill;
+    size -= fill;
+  }
+
+  size_t stripes = size / kStripeSize;
+  Consume(p, stripes);
+  p += stripes * kStripeSize;
+  size -= stripes * kStripeSize;
+
+  memcpy(buffer_, p, size);
+  buffered_ = size;
+}
+
+uint64_t
+CommandHasher::Finish() const {
+  // Short commands never filled a stripe: mix their 16-byte chunks directly.
+  if (length_ < kStripeSize) {
+    char padded[kStripeSize] = {};
+    memcpy(padded, buffer_, buffered_);
+    uint64_t h = length_ * kPrime64_1 + kSecret.words[kMergeKey];
+    for (size_t i = 0; i < buffered_; i += 16) {
+      h += MulFold64(
+          Read64(padded + i) ^ kSecret.words[i / 8],
+          Read64(padded + i + 8) ^ kSecret.words[i / 8 + 1]
+      );
+    }
+    return Avalanche(h);
+  }
+
+  alignas(16) uint64_t acc[8];
+  memcpy(acc, acc_, sizeof acc);
+
+  // Pad the trailing bytes with zeros.  Inputs that only differ by trailing
+  // zeros still hash differently, as the length is mixed in below.
+  if (buffered_) {
+    alignas(16) char last[kStripeSize] = {};
+    memcpy(last, buffer_, buffered_);
+    Accumulate(acc, last, kSecret.words + kLastStripeKey);
+  }
+
+  uint64_t h = length_ * kPrime64_1;
+  for (int i = 0; i < 8; i += 2) {
+    h += MulFold64(
+        acc[i] ^ kSecret.words[kMergeKey + i],
+        acc[i + 1] ^ kSecret.words[kMergeKey + i + 1]
+    );
+  }
+  return Avalanche(h);
+}
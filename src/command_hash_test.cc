@@ -0,0 +1,98 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <ninja/command_hash.hpp>
+#include <ninja/test.hpp>
+#include <set>
+#include <string>
+
+namespace {
+
+/// A command long enough to span several blocks of stripes.
+std::string
+LongCommand() {
+  std::string command = "clang++ -MMD -MF obj/foo.o.d";
+  for (int i = 0; command.size() < 3000; ++i)
+    command += " -Isrc/include/dir" + std::to_string(i);
+  return command + " -c src/foo.cc -o obj/foo.o";
+}
+
+TEST(CommandHasher, Pieces) {
+  const std::string command = LongCommand();
+  const uint64_t expected = CommandHasher::Hash(command);
+
+  // Any split into two pieces hashes like the whole.
+  for (size_t split = 0; split <= command.size(); ++split) {
+    CommandHasher hasher;
+    hasher.Update(std::string_view(command).substr(0, split));
+    hasher.Update(std::string_view(command).substr(split));
+    ASSERT_EQ(expected, hasher.Finish());
+  }
+
+  // So does a split into many pieces of any size.
+  for (size_t size = 1; size < 200; ++size) {
+    CommandHasher hasher;
+    for (size_t i = 0; i < command.size(); i += size)
+      hasher.Update(std::string_view(command).substr(i, size));
+    ASSERT_EQ(expected, hasher.Finish());
+  }
+}
+
+TEST(CommandHasher, FinishThenUpdate) {
+  CommandHasher hasher;
+  hasher.Update("cc -c foo.c");
+  EXPECT_EQ(CommandHasher::Hash("cc -c foo.c"), hasher.Finish());
+  hasher.Update(" -o foo.o");
+  EXPECT_EQ(CommandHasher::Hash("cc -c foo.c -o foo.o"), hasher.Finish());
+}
+
+TEST(CommandHasher, Distinct) {
+  EXPECT_NE(CommandHasher::Hash(""), CommandHasher::Hash(std::string(1, '\0')));
+  EXPECT_NE(
+      CommandHasher::Hash(std::string(64, '\0')),
+      CommandHasher::Hash(std::string(65, '\0'))
+  );
+
+  EXPECT_NE(0u, CommandHasher::Hash(""));
+
+  // Flipping any single bit of a command changes its hash, both for short
+  // commands and for those that span several stripes.
+  for (size_t size : {40, 1100}) {
+    const std::string command = LongCommand().substr(0, size);
+    std::set<uint64_t> hashes;
+    hashes.insert(CommandHasher::Hash(command));
+    for (size_t i = 0; i < command.size(); ++i) {
+      for (int bit = 0; bit < 8; ++bit) {
+        std::string flipped = command;
+        flipped[i] ^= static_cast<char>(1 << bit);
+        hashes.insert(CommandHasher::Hash(flipped));
+      }
+    }
+    EXPECT_EQ(command.size() * 8 + 1, hashes.size());
+  }
+}
+
+TEST(CommandHasher, StripeOrder) {
+  std::string a(CommandHasher::kStripeSize, 'a');
+  std::string b(CommandHasher::kStripeSize, 'b');
+  EXPECT_NE(CommandHasher::Hash(a + b), CommandHasher::Hash(b + a));
+
+  // Also across blocks, i.e. for stripes mixed with the same key.
+  std::string block(16 * CommandHasher::kStripeSize, 'x');
+  EXPECT_NE(
+      CommandHasher::Hash(a + block + b), CommandHasher::Hash(b + block + a)
+  );
+}
+
+} // anonymous namespace
@@ -19,3 +19,13 @@ bool g_keep_depfile = false;
 bool g_keep_rsp = false;
 
 bool g_experimental_statcache = true;
+
+bool g_freeze_graph = false;
+
+bool g_verify_reload = false;
+
+bool g_use_io_uring = true;
+
+bool g_use_spawner = false;
+
+bool g_use_pidfd = false;
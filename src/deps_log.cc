@@ -21,7 +21,9 @@
 #include <ninja/metrics.hpp>
 #include <ninja/state.hpp>
 #include <ninja/util.hpp>
+#include <thread>
 #include <unistd.h>
+#include <utility>
 
 // The version is stored as 4 bytes after the signature and also serves as a
 // byte order mark. Signature and version combined are 16 bytes long.
@@ -32,13 +34,147 @@ const int kCurrentVersion = 4;
 // internal buffers having to have this size.
 const unsigned kMaxRecordSize = (1 << 19) - 1;
 
+namespace {
+
+/// Write the record that names \a path as node \a id.
+bool
+WritePathRecord(FILE* f, std::string_view path, int id) {
+  int path_size = path.size();
+  int padding = (4 - path_size % 4) % 4; // Pad path to 4 byte boundary.
+
+  unsigned size = path_size + padding + 4;
+  if (size > kMaxRecordSize) {
+    errno = ERANGE;
+    return false;
+  }
+
+  if (fwrite(&size, 4, 1, f) < 1)
+    return false;
+  if (fwrite(path.data(), path_size, 1, f) < 1) {
+    assert(!path.empty());
+    return false;
+  }
+  if (padding && fwrite("\0\0", padding, 1, f) < 1)
+    return false;
+  unsigned checksum = ~(unsigned)id;
+  return fwrite(&checksum, 4, 1, f) == 1;
+}
+
+/// Write the deps record of node \a out_id, whose inputs \a nodes have the
+/// ids returned by \a id_of.
+template <typename IdOf>
+bool
+WriteDepsRecord(
+    FILE* f, int out_id, TimeStamp mtime, int node_count, Node* const* nodes,
+    IdOf id_of
+) {
+  unsigned size = 4 * (1 + 2 + node_count);
+  if (size > kMaxRecordSize) {
+    errno = ERANGE;
+    return false;
+  }
+
+  size |= 0x80000000; // Deps record: set high bit.
+  if (fwrite(&size, 4, 1, f) < 1)
+    return false;
+  if (fwrite(&out_id, 4, 1, f) < 1)
+    return false;
+  uint32_t mtime_part = static_cast<uint32_t>(mtime & 0xffffffff);
+  if (fwrite(&mtime_part, 4, 1, f) < 1)
+    return false;
+  mtime_part = static_cast<uint32_t>((mtime >> 32) & 0xffffffff);
+  if (fwrite(&mtime_part, 4, 1, f) < 1)
+    return false;
+  for (int i = 0; i < node_count; ++i) {
+    int id = id_of(nodes[i]);
+    if (fwrite(&id, 4, 1, f) < 1)
+      return false;
+  }
+  return true;
+}
+
+} // anonymous namespace
+
+/// A recompaction of the log running on a background thread.  The thread
+/// writes the live records to a temporary file, numbering their nodes anew,
+/// while the deps recorded meanwhile still go to the old log with the old
+/// ids and are remembered in |tail|.  Once the thread is done, the nodes take
+/// their new ids, the tail is appended to the new log, and the new log
+/// replaces the old one.
+struct DepsLog::Recompaction {
+  using Record = std::pair<Node*, std::shared_ptr<Deps>>;
+
+  /// Write |snapshot| to |temp_path|, filling |nodes|.  The ids of the nodes
+  /// in |snapshot| are only read: new ids go to nodes that have none, which
+  /// aren't in |snapshot|.
+  void
+  Run();
+
+  std::string path;
+  std::string temp_path;
+  /// The live records, in the order of the ids of their outputs.
+  std::vector<Record> snapshot;
+  /// The number of ids of the old log.
+  size_t old_node_count = 0;
+  /// The nodes of the new log, by id.
+  std::vector<Node*> nodes;
+  std::vector<Record> tail;
+  std::thread thread;
+  bool ok = false;
+  std::string err;
+};
+
+void
+DepsLog::Recompaction::Run() {
+  FILE* f = fopen(temp_path.c_str(), "wb");
+  if (!f) {
+    err = strerror(errno);
+    return;
+  }
+
+  // Number the nodes in the order RecordDeps() would: each output, then its
+  // inputs.
+  std::vector<int> new_ids(old_node_count, -1);
+  auto record_id = [&](Node* node) {
+    int& id = new_ids[node->id()];
+    if (id >= 0)
+      return true;
+    id = nodes.size();
+    nodes.push_back(node);
+    return WritePathRecord(f, node->path(), id);
+  };
+  auto id_of = [&](const Node* node) { return new_ids[node->id()]; };
+
+  ok = fwrite(kFileSignature, sizeof(kFileSignature) - 1, 1, f) == 1
+       && fwrite(&kCurrentVersion, 4, 1, f) == 1;
+  for (const Record& record : snapshot) {
+    Node* out = record.first;
+    const Deps& deps = *record.second;
+    ok = ok && record_id(out);
+    for (int i = 0; ok && i < deps.node_count; ++i)
+      ok = record_id(deps.nodes[i]);
+    ok = ok
+         && WriteDepsRecord(
+             f, id_of(out), deps.mtime, deps.node_count, deps.nodes, id_of
+         );
+    if (!ok)
+      break;
+  }
+  if (fclose(f) != 0)
+    ok = false;
+  if (!ok)
+    err = strerror(errno);
+}
+
+DepsLog::DepsLog() : needs_recompaction_(false), file_(nullptr) {}
+
 DepsLog::~DepsLog() { Close(); }
 
 bool
 DepsLog::OpenForWrite(const std::string& path, std::string* err) {
   if (needs_recompaction_) {
-    if (!Recompact(path, err))
-      return false;
+    Close();
+    StartRecompaction(path);
   }
 
   assert(!file_);
@@ -96,40 +232,22 @@ DepsLog::RecordDeps(Node* node, TimeStamp mtime, int node_count, Node** nodes) {
     return true;
 
   // Update on-disk representation.
-  unsigned size = 4 * (1 + 2 + node_count);
-  if (size > kMaxRecordSize) {
-    errno = ERANGE;
-    return false;
-  }
-
   if (!OpenForWriteIfNeeded()) {
     return false;
   }
-  size |= 0x80000000; // Deps record: set high bit.
-  if (fwrite(&size, 4, 1, file_) < 1)
-    return false;
-  int id = node->id();
-  if (fwrite(&id, 4, 1, file_) < 1)
+  auto id_of = [](const Node* node) { return node->id(); };
+  if (!WriteDepsRecord(file_, node->id(), mtime, node_count, nodes, id_of))
     return false;
-  uint32_t mtime_part = static_cast<uint32_t>(mtime & 0xffffffff);
-  if (fwrite(&mtime_part, 4, 1, file_) < 1)
-    return false;
-  mtime_part = static_cast<uint32_t>((mtime >> 32) & 0xffffffff);
-  if (fwrite(&mtime_part, 4, 1, file_) < 1)
-    return false;
-  for (int i = 0; i < node_count; ++i) {
-    id = nodes[i]->id();
-    if (fwrite(&id, 4, 1, file_) < 1)
-      return false;
-  }
   if (fflush(file_) != 0)
     return false;
 
   // Update in-memory representation.
-  Deps* deps = new Deps(mtime, node_count);
+  std::shared_ptr<Deps> deps = std::make_shared<Deps>(mtime, node_count);
   for (int i = 0; i < node_count; ++i)
     deps->nodes[i] = nodes[i];
-  UpdateDeps(node->id(), deps);
+  if (recompaction_)
+    recompaction_->tail.emplace_back(node, deps);
+  UpdateDeps(node->id(), std::move(deps));
 
   return true;
 }
@@ -140,6 +258,10 @@ DepsLog::Close() {
   if (file_)
     fclose(file_);
   file_ = nullptr;
+
+  std::string err;
+  if (!FinishRecompaction(&err))
+    Warning("recompacting deps log: %s", err.c_str());
 }
 
 LoadStatus
@@ -207,7 +329,7 @@ DepsLog::Load(const std::string& path, State* state, std::string* err) {
       deps_data += 3;
       int deps_count = (size / 4) - 3;
 
-      Deps* deps = new Deps(mtime, deps_count);
+      std::shared_ptr<Deps> deps = std::make_shared<Deps>(mtime, deps_count);
       for (int i = 0; i < deps_count; ++i) {
         assert(deps_data[i] < (int)nodes_.size());
         assert(nodes_[deps_data[i]]);
@@ -215,7 +337,7 @@ DepsLog::Load(const std::string& path, State* state, std::string* err) {
       }
 
       total_dep_record_count++;
-      if (!UpdateDeps(out_id, deps))
+      if (!UpdateDeps(out_id, std::move(deps)))
         ++unique_dep_record_count;
     } else {
       int path_size = size - 4;
@@ -289,6 +411,13 @@ DepsLog::Deps*
 DepsLog::GetDeps(Node* node) {
   // Abort if the node has no id (never referenced in the deps) or if
   // there's no deps recorded for the node.
+  if (node->id() < 0 || node->id() >= (int)deps_.size())
+    return nullptr;
+  return deps_[node->id()].get();
+}
+
+std::shared_ptr<const DepsLog::Deps>
+DepsLog::ShareDeps(Node* node) {
   if (node->id() < 0 || node->id() >= (int)deps_.size())
     return nullptr;
   return deps_[node->id()];
@@ -297,7 +426,7 @@ DepsLog::GetDeps(Node* node) {
 Node*
 DepsLog::GetFirstReverseDepsNode(Node* node) {
   for (size_t id = 0; id < deps_.size(); ++id) {
-    Deps* deps = deps_[id];
+    Deps* deps = deps_[id].get();
     if (!deps)
       continue;
     for (int i = 0; i < deps->node_count; ++i) {
@@ -310,47 +439,86 @@ DepsLog::GetFirstReverseDepsNode(Node* node) {
 
 bool
 DepsLog::Recompact(const std::string& path, std::string* err) {
-  METRIC_RECORD(".ninja_deps recompact");
-
   Close();
-  std::string temp_path = path + ".recompact";
-
-  // OpenForWrite() opens for append.  Make sure it's not appending to a
-  // left-over file from a previous recompaction attempt that crashed somehow.
-  unlink(temp_path.c_str());
-
-  DepsLog new_log;
-  if (!new_log.OpenForWrite(temp_path, err))
-    return false;
+  StartRecompaction(path);
+  return FinishRecompaction(err);
+}
 
-  // Clear all known ids so that new ones can be reassigned.  The new indices
-  // will refer to the ordering in new_log, not in the current log.
-  for (Node* node : nodes_)
-    node->set_id(-1);
+void
+DepsLog::StartRecompaction(const std::string& path) {
+  METRIC_RECORD(".ninja_deps recompact");
+  needs_recompaction_ = false;
 
-  // Write out all deps again.
+  auto recompaction = std::make_unique<Recompaction>();
+  recompaction->path = path;
+  recompaction->temp_path = path + ".recompact";
+  recompaction->old_node_count = nodes_.size();
   for (int old_id = 0; old_id < (int)deps_.size(); ++old_id) {
-    Deps* deps = deps_[old_id];
-    if (!deps)
+    if (!deps_[old_id])
       continue; // If nodes_[old_id] is a leaf, it has no deps.
-
     if (!IsDepsEntryLiveFor(nodes_[old_id]))
       continue;
-
-    if (!new_log.RecordDeps(
-            nodes_[old_id], deps->mtime, deps->node_count, deps->nodes
-        )) {
-      new_log.Close();
-      return false;
-    }
+    recompaction->snapshot.emplace_back(nodes_[old_id], deps_[old_id]);
   }
 
-  new_log.Close();
+  Recompaction* r = recompaction.get();
+  r->thread = std::thread([r] { r->Run(); });
+  recompaction_ = std::move(recompaction);
+}
 
-  // All nodes now have ids that refer to new_log, so steal its data.
-  deps_.swap(new_log.deps_);
-  nodes_.swap(new_log.nodes_);
+bool
+DepsLog::FinishRecompaction(std::string* err) {
+  if (!recompaction_)
+    return true;
+  METRIC_RECORD(".ninja_deps recompact finish");
+  std::unique_ptr<Recompaction> recompaction = std::move(recompaction_);
+  recompaction->thread.join();
+  const std::string& temp_path = recompaction->temp_path;
+  if (!recompaction->ok) {
+    *err = recompaction->err;
+    unlink(temp_path.c_str());
+    return false;
+  }
+
+  // Switch to the ids of the new log.
+  for (Node* node : nodes_)
+    node->set_id(-1);
+  nodes_.swap(recompaction->nodes);
+  for (int id = 0; id < (int)nodes_.size(); ++id)
+    nodes_[id]->set_id(id);
+  deps_.clear();
+  for (Recompaction::Record& record : recompaction->snapshot)
+    UpdateDeps(record.first->id(), std::move(record.second));
+
+  // Append the deps recorded during the recompaction, giving ids to the nodes
+  // that don't have one in the new log.  The old log has them too, until it
+  // is replaced.
+  bool ok = true;
+  file_path_ = temp_path;
+  for (const Recompaction::Record& record : recompaction->tail) {
+    const Deps& deps = *record.second;
+    if (!RecordDeps(record.first, deps.mtime, deps.node_count, deps.nodes)) {
+      ok = false;
+      break;
+    }
+  }
+  if (!OpenForWriteIfNeeded() || !file_)
+    ok = false;
+  if (!ok)
+    *err = strerror(errno);
+  if (file_ && fclose(file_) != 0 && ok) {
+    *err = strerror(errno);
+    ok = false;
+  }
+  file_ = nullptr;
+  file_path_.clear();
+  if (!ok) {
+    // The ids in memory no longer match the old log: stop writing to it.
+    unlink(temp_path.c_str());
+    return false;
+  }
 
+  const std::string& path = recompaction->path;
   if (unlink(path.c_str()) < 0) {
     *err = strerror(errno);
     return false;
@@ -376,42 +544,22 @@ DepsLog::IsDepsEntryLiveFor(Node* node) {
 }
 
 bool
-DepsLog::UpdateDeps(int out_id, Deps* deps) {
+DepsLog::UpdateDeps(int out_id, std::shared_ptr<Deps> deps) {
   if (out_id >= (int)deps_.size())
     deps_.resize(out_id + 1);
 
-  bool delete_old = deps_[out_id] != nullptr;
-  if (delete_old)
-    delete deps_[out_id];
-  deps_[out_id] = deps;
-  return delete_old;
+  bool replaced = deps_[out_id] != nullptr;
+  deps_[out_id] = std::move(deps);
+  return replaced;
 }
 
 bool
 DepsLog::RecordId(Node* node) {
-  int path_size = node->path().size();
-  int padding = (4 - path_size % 4) % 4; // Pad path to 4 byte boundary.
-
-  unsigned size = path_size + padding + 4;
-  if (size > kMaxRecordSize) {
-    errno = ERANGE;
-    return false;
-  }
-
   if (!OpenForWriteIfNeeded()) {
     return false;
   }
-  if (fwrite(&size, 4, 1, file_) < 1)
-    return false;
-  if (fwrite(node->path().data(), path_size, 1, file_) < 1) {
-    assert(!node->path().empty());
-    return false;
-  }
-  if (padding && fwrite("\0\0", padding, 1, file_) < 1)
-    return false;
   int id = nodes_.size();
-  unsigned checksum = ~(unsigned)id;
-  if (fwrite(&checksum, 4, 1, file_) < 1)
+  if (!WritePathRecord(file_, node->path(), id))
     return false;
   if (fflush(file_) != 0)
     return false;
@@ -19,6 +19,7 @@
 #endif
 
 #include <cstring>
+#include <memory>
 #include <ninja/graph.hpp>
 #include <ninja/test.hpp>
 #include <ninja/util.hpp>
@@ -324,6 +325,98 @@ TEST_F(DepsLogTest, Recompact) {
   }
 }
 
+// Verify that deps recorded while the log is recompacted in the background
+// make it into the new log.
+TEST_F(DepsLogTest, RecompactInBackground) {
+  const char kManifest[] =
+      "rule cc\n"
+      "  command = cc\n"
+      "  deps = gcc\n"
+      "build out.o: cc\n"
+      "build other_out.o: cc\n";
+
+  // Replace the deps of out.o often enough to trigger a recompaction.
+  int file_size;
+  {
+    State state;
+    ASSERT_NO_FATAL_FAILURE(AssertParse(&state, kManifest));
+    DepsLog log;
+    std::string err;
+    ASSERT_TRUE(log.OpenForWrite(kTestFilename, &err));
+    ASSERT_EQ("", err);
+
+    std::vector<Node*> deps;
+    deps.push_back(state.GetNode("foo.h", 0));
+    for (int i = 0; i < 2000; ++i)
+      log.RecordDeps(state.GetNode("out.o", 0), i + 1, deps);
+    log.RecordDeps(state.GetNode("dead.o", 0), 1, deps);
+    log.Close();
+
+    struct stat st;
+    ASSERT_EQ(0, stat(kTestFilename, &st));
+    file_size = (int)st.st_size;
+  }
+
+  {
+    State state;
+    ASSERT_NO_FATAL_FAILURE(AssertParse(&state, kManifest));
+    DepsLog log;
+    std::string err;
+    ASSERT_TRUE(log.Load(kTestFilename, &state, &err));
+    ASSERT_TRUE(log.OpenForWrite(kTestFilename, &err));
+    ASSERT_EQ("", err);
+
+    // Record deps while the recompaction runs, with nodes that are new and
+    // nodes that only the dead record used.
+    Node* out = state.GetNode("out.o", 0);
+    Node* other_out = state.GetNode("other_out.o", 0);
+    std::vector<Node*> deps;
+    deps.push_back(state.GetNode("bar.h", 0));
+    log.RecordDeps(out, 3000, deps);
+    deps.push_back(state.GetNode("foo.h", 0));
+    log.RecordDeps(other_out, 3001, deps);
+    log.Close();
+
+    // The nodes have ids in the new log.
+    ASSERT_EQ(out, log.nodes()[out->id()]);
+    ASSERT_EQ(other_out, log.nodes()[other_out->id()]);
+    ASSERT_EQ(-1, state.LookupNode("dead.o")->id());
+    DepsLog::Deps* out_deps = log.GetDeps(out);
+    ASSERT_TRUE(out_deps);
+    ASSERT_EQ(3000, out_deps->mtime);
+    ASSERT_EQ(1, out_deps->node_count);
+    ASSERT_EQ("bar.h", out_deps->nodes[0]->path());
+
+    struct stat st;
+    ASSERT_EQ(0, stat(kTestFilename, &st));
+    ASSERT_LT((int)st.st_size, file_size);
+  }
+
+  {
+    State state;
+    ASSERT_NO_FATAL_FAILURE(AssertParse(&state, kManifest));
+    DepsLog log;
+    std::string err;
+    ASSERT_TRUE(log.Load(kTestFilename, &state, &err));
+    ASSERT_EQ("", err);
+
+    DepsLog::Deps* deps = log.GetDeps(state.GetNode("out.o", 0));
+    ASSERT_TRUE(deps);
+    ASSERT_EQ(3000, deps->mtime);
+    ASSERT_EQ(1, deps->node_count);
+    ASSERT_EQ("bar.h", deps->nodes[0]->path());
+
+    deps = log.GetDeps(state.GetNode("other_out.o", 0));
+    ASSERT_TRUE(deps);
+    ASSERT_EQ(3001, deps->mtime);
+    ASSERT_EQ(2, deps->node_count);
+    ASSERT_EQ("bar.h", deps->nodes[0]->path());
+    ASSERT_EQ("foo.h", deps->nodes[1]->path());
+
+    ASSERT_FALSE(log.GetDeps(state.GetNode("dead.o", 0)));
+  }
+}
+
 // Verify that invalid file headers cause a new build.
 TEST_F(DepsLogTest, InvalidHeader) {
   const char* kInvalidHeaders[] = {
@@ -400,9 +493,8 @@ TEST_F(DepsLogTest, Truncated) {
 
     // Count how many non-NULL deps entries there are.
     int new_deps_count = 0;
-    for (std::vector<DepsLog::Deps*>::const_iterator i = log.deps().begin();
-         i != log.deps().end(); ++i) {
-      if (*i)
+    for (const std::shared_ptr<DepsLog::Deps>& deps : log.deps()) {
+      if (deps)
         ++new_deps_count;
     }
     ASSERT_GE(deps_count, new_deps_count);
@@ -508,4 +600,30 @@ TEST_F(DepsLogTest, ReverseDepsNodes) {
   EXPECT_TRUE(rev_deps == state.GetNode("out.o", 0));
 }
 
+TEST_F(DepsLogTest, SharedDeps) {
+  State state;
+  DepsLog log;
+  std::string err;
+  EXPECT_TRUE(log.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+
+  Node* out = state.GetNode("out.o", 0);
+  std::vector<Node*> deps;
+  deps.push_back(state.GetNode("foo.h", 0));
+  log.RecordDeps(out, 1, deps);
+  std::shared_ptr<const DepsLog::Deps> shared = log.ShareDeps(out);
+  ASSERT_EQ(log.GetDeps(out), shared.get());
+
+  // Recording new deps replaces the record instead of changing it.
+  deps.push_back(state.GetNode("bar.h", 0));
+  log.RecordDeps(out, 2, deps);
+  log.Close();
+  EXPECT_NE(log.GetDeps(out), shared.get());
+  EXPECT_EQ(2, log.GetDeps(out)->node_count);
+  ASSERT_EQ(1, shared->node_count);
+  EXPECT_EQ("foo.h", shared->nodes[0]->path());
+
+  EXPECT_EQ(nullptr, log.ShareDeps(state.GetNode("foo.h", 0)));
+}
+
 } // anonymous namespace
@@ -13,12 +13,19 @@
 // limitations under the License.
 
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cstdio>
 #include <cstring>
+#include <ctime>
 #include <ninja/disk_interface.hpp>
 #include <ninja/metrics.hpp>
+#include <ninja/stat_ring.hpp>
 #include <ninja/util.hpp>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -44,10 +51,114 @@ MakeDir(const std::string& path) {
   return mkdir(path.c_str(), 0777);
 }
 
+/// @return |path| itself, or the entry named after |name| in it if |path|
+/// is a directory.
+std::string
+PathOrEntryIn(const std::string& path, const std::string& name) {
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0 || !S_ISDIR(st.st_mode))
+    return path;
+  std::string::size_type slash = name.find_last_of('/');
+  return path + "/"
+         + (slash == std::string::npos ? name : name.substr(slash + 1));
+}
+
 } // namespace
 
+// FileContents ----------------------------------------------------------------
+
+void
+FileContents::Assign(std::string&& buffer) {
+  Clear();
+  buffer_ = std::move(buffer);
+  view_ = buffer_;
+}
+
+bool
+FileContents::Map(int fd, size_t size) {
+  Clear();
+  // Reserve one page more than the file needs and map the file over the
+  // start of it, so that the byte after the contents is always a NUL: either
+  // from the zero-filled tail of the file's last page, or from the anonymous
+  // page behind it when the size is a multiple of the page size.
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t map_size = (size + page_size) & ~(page_size - 1);
+  void* map = mmap(
+      nullptr, map_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+  );
+  if (map == MAP_FAILED)
+    return false;
+  if (mmap(map, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0)
+      == MAP_FAILED) {
+    int saved_errno = errno;
+    munmap(map, map_size);
+    errno = saved_errno;
+    return false;
+  }
+  map_ = map;
+  map_size_ = map_size;
+  view_ = std::string_view(static_cast<const char*>(map), size);
+  return true;
+}
+
+void
+FileContents::Clear() {
+  if (map_)
+    munmap(map_, map_size_);
+  map_ = nullptr;
+  map_size_ = 0;
+  buffer_.clear();
+  view_ = std::string_view();
+}
+
+// FileReader ------------------------------------------------------------------
+
+FileReader::Status
+FileReader::ReadFileContents(
+    const std::string& path, FileContents* contents, std::string* err
+) {
+  std::string buffer;
+  Status status = ReadFile(path, &buffer, err);
+  if (status == Okay)
+    contents->Assign(std::move(buffer));
+  return status;
+}
+
 // DiskInterface ---------------------------------------------------------------
 
+namespace {
+
+/// StatMany() reports progress about every percent.
+size_t
+ProgressStep(size_t total) {
+  return std::max<size_t>(total / 100, 1);
+}
+
+} // anonymous namespace
+
+bool
+DiskInterface::StatMany(
+    const std::vector<std::string_view>& paths, std::vector<TimeStamp>* mtimes,
+    StatProgress* progress, std::string* err
+) const {
+  const size_t total = paths.size();
+  const size_t step = ProgressStep(total);
+  mtimes->resize(total);
+  bool ok = true;
+  std::string path, path_err;
+  for (size_t i = 0; i < total; ++i) {
+    path.assign(paths[i]);
+    (*mtimes)[i] = Stat(path, &path_err);
+    if ((*mtimes)[i] == -1 && ok) {
+      *err = path_err;
+      ok = false;
+    }
+    if (progress && ((i + 1) % step == 0 || i + 1 == total))
+      progress->StatProgressed(i + 1, total);
+  }
+  return ok;
+}
+
 bool
 DiskInterface::MakeDirs(const std::string& path) {
   std::string dir = DirName(path);
@@ -69,8 +180,75 @@ DiskInterface::MakeDirs(const std::string& path) {
   return MakeDir(dir);
 }
 
+bool
+DiskInterface::Touch(const std::string& path, std::string* err) {
+  std::string contents;
+  if (ReadFile(path, &contents, err) == OtherError)
+    return false;
+  if (!WriteFile(path, contents)) {
+    *err = "unable to write " + path;
+    return false;
+  }
+  return true;
+}
+
+bool
+DiskInterface::IsDirectory(const std::string&) const {
+  return false;
+}
+
+bool
+DiskInterface::CopyFile(
+    const std::string& from, const std::string& to, std::string* err
+) {
+  std::string contents;
+  if (ReadFile(from, &contents, err) != Okay) {
+    *err = from + ": " + *err;
+    return false;
+  }
+  if (!WriteFile(to, contents)) {
+    *err = "unable to write " + to;
+    return false;
+  }
+  return true;
+}
+
+bool
+DiskInterface::MakeSymlink(
+    const std::string&, const std::string&, std::string* err
+) {
+  *err = "symbolic links are not supported";
+  return false;
+}
+
+int
+DiskInterface::CreateMemoryFile(const std::string&, std::string*) {
+  return -1;
+}
+
+void
+DiskInterface::UnshareMemoryFile(int) {}
+
+bool
+DiskInterface::ReadMemoryFile(int, std::string*, std::string* err) {
+  *err = "memory files are not supported";
+  return false;
+}
+
+void
+DiskInterface::CloseMemoryFile(int) {}
+
 // RealDiskInterface -----------------------------------------------------------
 
+RealDiskInterface::RealDiskInterface()
+#ifdef _WIN32
+    : use_cache_(false)
+#endif
+{
+}
+
+RealDiskInterface::~RealDiskInterface() {}
+
 TimeStamp
 RealDiskInterface::Stat(const std::string& path, std::string* err) const {
   METRIC_RECORD("node stat");
@@ -99,6 +277,90 @@ RealDiskInterface::Stat(const std::string& path, std::string* err) const {
 #endif
 }
 
+bool
+RealDiskInterface::StatMany(
+    const std::vector<std::string_view>& paths, std::vector<TimeStamp>* mtimes,
+    StatProgress* progress, std::string* err
+) const {
+  // Threads take the paths in batches, which keeps them from contending on
+  // |next_batch| while still splitting the work evenly.  Fewer paths than a
+  // batch are not worth setting up threads or the ring for.
+  const size_t kBatchSize = 64;
+  const size_t total = paths.size();
+  if (total < kBatchSize)
+    return DiskInterface::StatMany(paths, mtimes, progress, err);
+
+  if (use_io_uring_) {
+    if (!stat_ring_probed_) {
+      stat_ring_ = StatRing::Create();
+      stat_ring_probed_ = true;
+    }
+    if (stat_ring_)
+      return stat_ring_->StatMany(paths, mtimes, progress, err);
+  }
+
+  const size_t batches = (total + kBatchSize - 1) / kBatchSize;
+  const unsigned threads =
+      static_cast<unsigned>(std::min<size_t>(stat_threads_, batches));
+  if (threads <= 1)
+    return DiskInterface::StatMany(paths, mtimes, progress, err);
+
+  METRIC_RECORD("stat many");
+  mtimes->resize(total);
+  std::atomic<size_t> next_batch{0};
+  std::atomic<size_t> done{0};
+  std::mutex error_mutex;
+  size_t first_error = total;
+
+  // Returns after each batch, so that the calling thread can report progress
+  // in between.  @return false once there is no batch left.
+  auto stat_batch = [&](std::string* path, std::string* path_err) {
+    const size_t begin = next_batch.fetch_add(1) * kBatchSize;
+    if (begin >= total)
+      return false;
+    const size_t end = std::min(begin + kBatchSize, total);
+    for (size_t i = begin; i < end; ++i) {
+      path->assign(paths[i]);
+      (*mtimes)[i] = Stat(*path, path_err);
+      if ((*mtimes)[i] == -1) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (i < first_error) {
+          first_error = i;
+          *err = *path_err;
+        }
+      }
+    }
+    done.fetch_add(end - begin);
+    return true;
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < threads; ++i) {
+    workers.emplace_back([&stat_batch] {
+      std::string path, path_err;
+      while (stat_batch(&path, &path_err)) {
+      }
+    });
+  }
+
+  const size_t step = ProgressStep(total);
+  size_t reported = 0;
+  std::string path, path_err;
+  while (stat_batch(&path, &path_err)) {
+    size_t now = done.load();
+    if (progress && now - reported >= step) {
+      progress->StatProgressed(now, total);
+      reported = now;
+    }
+  }
+  for (std::thread& worker : workers)
+    worker.join();
+  if (progress)
+    progress->StatProgressed(total, total);
+
+  return first_error == total;
+}
+
 bool
 RealDiskInterface::WriteFile(
     const std::string& path, const std::string& contents
@@ -144,6 +406,164 @@ RealDiskInterface::MakeDir(const std::string& path) {
   return true;
 }
 
+bool
+RealDiskInterface::Touch(const std::string& path, std::string* err) {
+  if (utimensat(AT_FDCWD, path.c_str(), nullptr, 0) == 0)
+    return true;
+  if (errno != ENOENT) {
+    *err = "utimensat(" + path + "): " + strerror(errno);
+    return false;
+  }
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_NOCTTY | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    *err = "open(" + path + "): " + strerror(errno);
+    return false;
+  }
+  close(fd);
+  return true;
+}
+
+bool
+RealDiskInterface::IsDirectory(const std::string& path) const {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool
+RealDiskInterface::CopyFile(
+    const std::string& from, const std::string& to, std::string* err
+) {
+  int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    *err = "open(" + from + "): " + strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(in, &st) < 0) {
+    *err = "fstat(" + from + "): " + strerror(errno);
+    close(in);
+    return false;
+  }
+  // Like cp, give a new file the permissions of the original.
+  const std::string dest = PathOrEntryIn(to, from);
+  int out = open(
+      dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777
+  );
+  if (out < 0) {
+    *err = "open(" + dest + "): " + strerror(errno);
+    close(in);
+    return false;
+  }
+
+  char buf[64 << 10];
+  bool ok = true;
+  for (;;) {
+    ssize_t len = read(in, buf, sizeof(buf));
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len < 0) {
+      *err = "read(" + from + "): " + strerror(errno);
+      ok = false;
+      break;
+    }
+    if (len == 0)
+      break;
+    for (ssize_t written = 0; written < len;) {
+      ssize_t ret = write(out, buf + written, len - written);
+      if (ret < 0 && errno == EINTR)
+        continue;
+      if (ret < 0) {
+        *err = "write(" + dest + "): " + strerror(errno);
+        ok = false;
+        break;
+      }
+      written += ret;
+    }
+    if (!ok)
+      break;
+  }
+  close(in);
+  if (close(out) < 0 && ok) {
+    *err = "close(" + dest + "): " + strerror(errno);
+    ok = false;
+  }
+  return ok;
+}
+
+bool
+RealDiskInterface::MakeSymlink(
+    const std::string& target, const std::string& path, std::string* err
+) {
+  const std::string link = PathOrEntryIn(path, target);
+  if (unlink(link.c_str()) < 0 && errno != ENOENT) {
+    *err = "unlink(" + link + "): " + strerror(errno);
+    return false;
+  }
+  if (symlink(target.c_str(), link.c_str()) < 0) {
+    *err = "symlink(" + link + "): " + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+int
+RealDiskInterface::CreateMemoryFile(
+    const std::string& contents, std::string* path
+) {
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+  // Not close-on-exec, so that the next command started inherits it.
+  int fd = memfd_create("ninja", 0);
+  if (fd < 0)
+    return -1;
+  for (size_t written = 0; written < contents.size();) {
+    ssize_t ret =
+        write(fd, contents.data() + written, contents.size() - written);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0) {
+      close(fd);
+      return -1;
+    }
+    written += ret;
+  }
+  *path = "/dev/fd/" + std::to_string(fd);
+  return fd;
+#else
+  return DiskInterface::CreateMemoryFile(contents, path);
+#endif
+}
+
+void
+RealDiskInterface::UnshareMemoryFile(int fd) {
+  SetCloseOnExec(fd);
+}
+
+bool
+RealDiskInterface::ReadMemoryFile(
+    int fd, std::string* contents, std::string* err
+) {
+  // Read from the start, whatever CreateMemoryFile() left the offset at.
+  char buf[64 << 10];
+  for (off_t offset = 0;;) {
+    ssize_t ret = pread(fd, buf, sizeof(buf), offset);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret < 0) {
+      *err = std::string("read: ") + strerror(errno);
+      return false;
+    }
+    if (ret == 0)
+      return true;
+    contents->append(buf, ret);
+    offset += ret;
+  }
+}
+
+void
+RealDiskInterface::CloseMemoryFile(int fd) {
+  close(fd);
+}
+
 FileReader::Status
 RealDiskInterface::ReadFile(
     const std::string& path, std::string* contents, std::string* err
@@ -158,6 +578,46 @@ RealDiskInterface::ReadFile(
   }
 }
 
+FileReader::Status
+RealDiskInterface::ReadFileContents(
+    const std::string& path, FileContents* contents, std::string* err
+) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    err->assign(strerror(errno));
+    return errno == ENOENT ? NotFound : OtherError;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    err->assign(strerror(errno));
+    close(fd);
+    return OtherError;
+  }
+
+  // Empty files and anything that isn't a regular file (e.g. a pipe) can't
+  // be mapped; read those instead.  Touching a mapped page past the end of a
+  // file that was truncated meanwhile raises SIGBUS, so also read files that
+  // were modified within the last couple of seconds and may still be being
+  // written, and files that changed while they were being mapped.
+  bool mapped = S_ISREG(st.st_mode) && st.st_size > 0
+                && st.st_mtime < time(nullptr) - 1
+                && contents->Map(fd, static_cast<size_t>(st.st_size));
+  if (mapped) {
+    struct stat mapped_st;
+    if (fstat(fd, &mapped_st) < 0 || mapped_st.st_ino != st.st_ino
+        || mapped_st.st_size != st.st_size
+        || mapped_st.st_mtime != st.st_mtime) {
+      contents->Clear();
+      mapped = false;
+    }
+  }
+  close(fd);
+  if (mapped)
+    return Okay;
+  return FileReader::ReadFileContents(path, contents, err);
+}
+
 int
 RealDiskInterface::RemoveFile(const std::string& path) {
   if (remove(path.c_str()) < 0) {
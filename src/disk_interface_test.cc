@@ -14,9 +14,14 @@
 
 #include <cassert>
 #include <cstdio>
+#include <fcntl.h>
 #include <ninja/disk_interface.hpp>
 #include <ninja/graph.hpp>
+#include <ninja/stat_ring.hpp>
 #include <ninja/test.hpp>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
 
 namespace {
 
@@ -98,6 +103,76 @@ TEST_F(DiskInterfaceTest, StatExistingDir) {
   );
 }
 
+struct CountingStatProgress : public StatProgress {
+  virtual void
+  StatProgressed(size_t done, size_t total) {
+    EXPECT_GE(done, last_done_);
+    last_done_ = done;
+    total_ = total;
+  }
+
+  size_t last_done_ = 0;
+  size_t total_ = 0;
+};
+
+/// Stat a mix of existing, missing and bad paths with |stat_many|, which
+/// works like DiskInterface::StatMany(), and compare to Stat().
+template <typename StatMany>
+void
+CheckStatMany(DiskInterfaceTest* test, StatMany stat_many) {
+  // Enough paths to be split across threads, some of them missing and two
+  // that can't be stat()ed at all.
+  std::vector<std::string> names;
+  for (int i = 0; i < 1000; ++i) {
+    names.push_back("file" + std::to_string(i));
+    if (i % 3)
+      ASSERT_TRUE(test->Touch(names.back().c_str()));
+  }
+  names[700] = std::string(512, 'y');
+  names[600] = std::string(512, 'x');
+  std::vector<std::string_view> paths(names.begin(), names.end());
+
+  std::vector<TimeStamp> mtimes;
+  CountingStatProgress progress;
+  std::string err;
+  EXPECT_FALSE(stat_many(paths, &mtimes, &progress, &err));
+  EXPECT_EQ("stat(" + names[600] + "): File name too long", err);
+  EXPECT_EQ(1000u, progress.last_done_);
+  EXPECT_EQ(1000u, progress.total_);
+
+  ASSERT_EQ(1000u, mtimes.size());
+  for (size_t i = 0; i < names.size(); ++i) {
+    std::string stat_err;
+    EXPECT_EQ(test->disk_.Stat(names[i], &stat_err), mtimes[i]);
+  }
+  EXPECT_EQ(0, mtimes[0]);
+  EXPECT_EQ(-1, mtimes[600]);
+  EXPECT_GT(mtimes[1], 1);
+
+  paths.resize(600);
+  err.clear();
+  EXPECT_TRUE(stat_many(paths, &mtimes, nullptr, &err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ(600u, mtimes.size());
+}
+
+TEST_F(DiskInterfaceTest, StatManyThreads) {
+  disk_.set_use_io_uring(false);
+  disk_.set_stat_threads(4);
+  CheckStatMany(this, [this](auto... args) {
+    return disk_.StatMany(args...);
+  });
+}
+
+TEST_F(DiskInterfaceTest, StatManyIoUring) {
+  std::unique_ptr<StatRing> ring = StatRing::Create();
+  if (!ring)
+    return; // Not supported here.
+  CheckStatMany(this, [&ring](auto... args) {
+    return ring->StatMany(args...);
+  });
+}
+
 TEST_F(DiskInterfaceTest, ReadFile) {
   std::string err;
   std::string content;
@@ -118,6 +193,51 @@ TEST_F(DiskInterfaceTest, ReadFile) {
   EXPECT_EQ("", err);
 }
 
+TEST_F(DiskInterfaceTest, ReadFileContents) {
+  std::string err;
+  FileContents contents;
+  ASSERT_EQ(
+      DiskInterface::NotFound,
+      disk_.ReadFileContents("foobar", &contents, &err)
+  );
+  EXPECT_NE("", err);
+  err.clear();
+
+  // Check a small file, an empty one and one whose size is a multiple of
+  // the page size, where the terminating NUL comes from the guard page.
+  // Age the files so that they get mapped.
+  const size_t kSizes[] = { 15, 0, 4096, 65536 };
+  for (size_t size : kSizes) {
+    std::string content(size, 'x');
+    ASSERT_TRUE(disk_.WriteFile("testfile", content));
+    struct timeval times[2] = { { 1000000000, 0 }, { 1000000000, 0 } };
+    ASSERT_EQ(0, utimes("testfile", times));
+    ASSERT_EQ(
+        DiskInterface::Okay,
+        disk_.ReadFileContents("testfile", &contents, &err)
+    );
+    EXPECT_EQ("", err);
+    EXPECT_EQ(size > 0, contents.mapped());
+    EXPECT_EQ(content, contents.view());
+    EXPECT_EQ('\0', contents.view().data()[size]);
+  }
+}
+
+// A file that was just written may still be being written, and could be
+// truncated under a mapping; it is read instead.
+TEST_F(DiskInterfaceTest, ReadFileContentsRecent) {
+  std::string err;
+  FileContents contents;
+  std::string content(4096, 'x');
+  ASSERT_TRUE(disk_.WriteFile("testfile", content));
+  ASSERT_EQ(
+      DiskInterface::Okay, disk_.ReadFileContents("testfile", &contents, &err)
+  );
+  EXPECT_EQ("", err);
+  EXPECT_FALSE(contents.mapped());
+  EXPECT_EQ(content, contents.view());
+}
+
 TEST_F(DiskInterfaceTest, MakeDirs) {
   std::string path = "path/with/double//slash/";
   EXPECT_TRUE(disk_.MakeDirs(path));
@@ -142,6 +262,76 @@ TEST_F(DiskInterfaceTest, RemoveDirectory) {
   EXPECT_EQ(1, disk_.RemoveFile("does not exist"));
 }
 
+TEST_F(DiskInterfaceTest, TouchFile) {
+  std::string err;
+  EXPECT_TRUE(disk_.Touch("new", &err));
+  EXPECT_EQ("", err);
+  EXPECT_GT(disk_.Stat("new", &err), 0);
+
+  EXPECT_FALSE(disk_.Touch("nosuchdir/file", &err));
+  EXPECT_NE(std::string::npos, err.find("nosuchdir/file"));
+}
+
+TEST_F(DiskInterfaceTest, CopyFile) {
+  std::string err;
+  ASSERT_TRUE(disk_.WriteFile("in", "contents"));
+  ASSERT_EQ(0, chmod("in", 0755));
+  ASSERT_TRUE(disk_.MakeDir("dir"));
+  EXPECT_TRUE(disk_.CopyFile("in", "out", &err));
+  EXPECT_TRUE(disk_.CopyFile("in", "dir", &err));
+  EXPECT_EQ("", err);
+
+  std::string contents;
+  EXPECT_EQ(FileReader::Okay, disk_.ReadFile("out", &contents, &err));
+  EXPECT_EQ("contents", contents);
+  contents.clear();
+  EXPECT_EQ(FileReader::Okay, disk_.ReadFile("dir/in", &contents, &err));
+  EXPECT_EQ("contents", contents);
+  // Permissions are copied too, short of the umask.
+  struct stat st;
+  ASSERT_EQ(0, stat("out", &st));
+  EXPECT_TRUE(st.st_mode & S_IXUSR);
+
+  EXPECT_FALSE(disk_.CopyFile("missing", "out", &err));
+  EXPECT_NE(std::string::npos, err.find("missing"));
+}
+
+TEST_F(DiskInterfaceTest, MakeSymlink) {
+  std::string err;
+  ASSERT_TRUE(disk_.WriteFile("target", "contents"));
+  ASSERT_TRUE(disk_.MakeDir("dir"));
+  EXPECT_TRUE(disk_.MakeSymlink("target", "link", &err));
+  // Replace the link, as ln -f does.
+  EXPECT_TRUE(disk_.MakeSymlink("dir", "link", &err));
+  EXPECT_TRUE(disk_.MakeSymlink("../target", "dir", &err));
+  EXPECT_EQ("", err);
+
+  char buf[64];
+  ssize_t len = readlink("link", buf, sizeof(buf));
+  EXPECT_EQ("dir", std::string(buf, len > 0 ? len : 0));
+  len = readlink("dir/target", buf, sizeof(buf));
+  EXPECT_EQ("../target", std::string(buf, len > 0 ? len : 0));
+}
+
+#ifdef __linux__
+TEST_F(DiskInterfaceTest, CreateMemoryFile) {
+  std::string path, contents, err;
+  int fd = disk_.CreateMemoryFile("in memory", &path);
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ("/dev/fd/" + std::to_string(fd), path);
+  EXPECT_EQ(FileReader::Okay, disk_.ReadFile(path, &contents, &err));
+  EXPECT_EQ("in memory", contents);
+
+  // Writes through the path replace the contents, as they would on disk.
+  ASSERT_TRUE(disk_.WriteFile(path, "rewritten"));
+  contents.clear();
+  EXPECT_TRUE(disk_.ReadMemoryFile(fd, &contents, &err));
+  EXPECT_EQ("rewritten", contents);
+  disk_.CloseMemoryFile(fd);
+  EXPECT_EQ(-1, fcntl(fd, F_GETFD));
+}
+#endif
+
 struct StatTest : public StateTestWithBuiltinRules, public DiskInterface {
   StatTest() : scan_(&state_, nullptr, nullptr, this, nullptr) {}
 
@@ -39,8 +39,8 @@ DyndepLoader::LoadDyndeps(Node* node, DyndepFile* ddf, std::string* err) const {
     return false;
 
   // Update each edge that specified this node as its dyndep binding.
-  std::vector<Edge*> const& out_edges = node->out_edges();
-  for (std::vector<Edge*>::const_iterator oe = out_edges.begin();
+  const EdgeList& out_edges = node->out_edges();
+  for (EdgeList::const_iterator oe = out_edges.begin();
        oe != out_edges.end(); ++oe) {
     Edge* const edge = *oe;
     if (edge->dyndep_ != node)
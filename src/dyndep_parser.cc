@@ -27,7 +27,7 @@ DyndepParser::DyndepParser(
 
 bool
 DyndepParser::Parse(
-    const std::string& filename, const std::string& input, std::string* err
+    const std::string& filename, std::string_view input, std::string* err
 ) {
   lexer_.Start(filename, input);
 
@@ -28,6 +28,7 @@ BindingEnv::LookupVariable(const std::string& var) {
 void
 BindingEnv::AddBinding(const std::string& key, const std::string& val) {
   bindings_[key] = val;
+  ++root_->bindings_generation_;
 }
 
 void
@@ -73,7 +74,10 @@ Rule::IsReservedBinding(const std::string& var) {
   return var == "command" || var == "depfile" || var == "dyndep"
          || var == "description" || var == "deps" || var == "generator"
          || var == "pool" || var == "restat" || var == "rspfile"
-         || var == "rspfile_content" || var == "msvc_deps_prefix";
+         || var == "rspfile_content" || var == "msvc_deps_prefix"
+         || var == "shell" || var == "worker" || var == "builtin"
+         || var == "batch" || var == "rspfile_memfd"
+         || var == "depfile_memfd";
 }
 
 const std::map<std::string, const Rule*>&
@@ -83,14 +87,14 @@ BindingEnv::GetRules() const {
 
 std::string
 BindingEnv::LookupWithFallback(
-    const std::string& var, const EvalString* eval, Env* env
+    const std::string& var, const EvalString* eval, const Rule* rule, Env* env
 ) {
   std::map<std::string, std::string>::iterator i = bindings_.find(var);
   if (i != bindings_.end())
     return i->second;
 
   if (eval)
-    return eval->Evaluate(env);
+    return LookupScopeExpansion(eval, rule, *env).Evaluate(env);
 
   if (parent_)
     return parent_->LookupVariable(var);
@@ -98,6 +102,27 @@ BindingEnv::LookupWithFallback(
   return "";
 }
 
+const EvalString&
+BindingEnv::LookupScopeExpansion(
+    const EvalString* eval, const Rule* rule, const Env& env
+) {
+  // Scopes that bind none of the referenced variables see the same values as
+  // their parent, so the expansion can be shared with it.  This skips the
+  // per-edge scopes created for edge-local bindings and lets all edges of a
+  // subninja pay for the expansion only once.
+  BindingEnv* owner = this;
+  while (owner->parent_ && !eval->ReferencesBindingsOf(*owner))
+    owner = owner->parent_;
+
+  const uint64_t generation = root_->bindings_generation_;
+  ScopeExpansion& expansion = owner->scope_expansions_[eval];
+  if (expansion.generation != generation) {
+    expansion.value = eval->ExpandScopeVariables(*rule, owner, env);
+    expansion.generation = generation;
+  }
+  return expansion.value;
+}
+
 std::string
 EvalString::Evaluate(Env* env) const {
   std::string result;
@@ -124,6 +149,32 @@ EvalString::AddSpecial(std::string_view text) {
   parsed_.push_back(make_pair(std::string(text), SPECIAL));
 }
 
+bool
+EvalString::ReferencesBindingsOf(const BindingEnv& env) const {
+  for (TokenList::const_iterator i = parsed_.begin(); i != parsed_.end(); ++i) {
+    if (i->second == SPECIAL && env.HasLocalBinding(i->first))
+      return true;
+  }
+  return false;
+}
+
+EvalString
+EvalString::ExpandScopeVariables(
+    const Rule& rule, BindingEnv* scope, const Env& env
+) const {
+  EvalString result;
+  for (TokenList::const_iterator i = parsed_.begin(); i != parsed_.end(); ++i) {
+    const std::string& var = i->first;
+    if (i->second == RAW)
+      result.AddText(var);
+    else if (env.OverridesScopeVariable(var) || rule.GetBinding(var))
+      result.AddSpecial(var);
+    else
+      result.AddText(scope->LookupVariable(var));
+  }
+  return result;
+}
+
 std::string
 EvalString::Serialize() const {
   std::string result;
@@ -17,6 +17,7 @@
 #include <cstdio>
 #include <deque>
 #include <ninja/build_log.hpp>
+#include <ninja/command_hash.hpp>
 #include <ninja/debug_flags.hpp>
 #include <ninja/depfile_parser.hpp>
 #include <ninja/deps_log.hpp>
@@ -27,29 +28,82 @@
 #include <ninja/state.hpp>
 #include <ninja/util.hpp>
 
+uint32_t
+NodeTable::Add(Node* node) {
+  uint32_t slot = size_ % kChunkSize;
+  if (slot == 0)
+    chunks_.emplace_back(new Chunk);
+  Chunk* chunk = chunks_.back().get();
+  chunk->mtimes[slot] = -1;
+  chunk->in_edges[slot] = nullptr;
+  chunk->flags[slot] = 0;
+  chunk->nodes[slot] = node;
+  return size_++;
+}
+
+void
+NodeTable::Reset() {
+  for (const std::unique_ptr<Chunk>& chunk : chunks_) {
+    std::fill(chunk->mtimes, chunk->mtimes + kChunkSize, -1);
+    for (uint8_t& flags : chunk->flags)
+      flags &= kDyndepPending;
+  }
+}
+
 bool
 Node::Stat(DiskInterface* disk_interface, std::string* err) {
   METRIC_RECORD("node stat");
-  mtime_ = disk_interface->Stat(path_, err);
-  if (mtime_ == -1) {
+  TimeStamp mtime = disk_interface->Stat(path_, err);
+  mtime_ref() = mtime;
+  if (mtime == -1) {
     return false;
   }
-  exists_ = (mtime_ != 0) ? ExistenceStatusExists : ExistenceStatusMissing;
+  SetStatResult(mtime);
   return true;
 }
 
 void
 Node::UpdatePhonyMtime(TimeStamp mtime) {
   if (!exists()) {
-    mtime_ = std::max(mtime_, mtime);
+    mtime_ref() = std::max(mtime_ref(), mtime);
   }
 }
 
+void
+EdgeList::Add(Edge* edge) {
+  // A borrowed list (capacity_ == 0) is copied to the heap first.
+  if (size_ == capacity_ || capacity_ == 0) {
+    uint32_t capacity = std::max(2 * capacity_, size_ + 1);
+    Edge** data = new Edge*[capacity];
+    std::copy(data_, data_ + size_, data);
+    if (capacity_)
+      delete[] data_;
+    data_ = data;
+    capacity_ = capacity;
+  }
+  data_[size_++] = edge;
+}
+
+void
+EdgeList::Sort() {
+  std::stable_sort(data_, data_ + size_, EdgeCmp());
+}
+
+Edge**
+EdgeList::MoveTo(Edge** storage) {
+  std::copy(data_, data_ + size_, storage);
+  if (capacity_)
+    delete[] data_;
+  data_ = storage;
+  capacity_ = 0;
+  return storage + size_;
+}
+
 bool
 DependencyScan::RecomputeDirty(
     Node* initial_node, std::vector<Node*>* validation_nodes, std::string* err
 ) {
-  std::vector<Node*> stack;
+  std::vector<Frame> stack;
   std::vector<Node*> new_validation_nodes;
 
   std::deque<Node*> nodes(1, initial_node);
@@ -85,14 +139,92 @@ DependencyScan::RecomputeDirty(
 
 bool
 DependencyScan::RecomputeNodeDirty(
-    Node* node, std::vector<Node*>* stack, std::vector<Node*>* validation_nodes,
+    Node* node, std::vector<Frame>* stack, std::vector<Node*>* validation_nodes,
     std::string* err
+) {
+  if (!PushNode(node, stack, err))
+    return false;
+
+  while (!stack->empty()) {
+    // Pushing may move the frames, so |frame| is only used until then.
+    Frame* frame = &stack->back();
+    Edge* edge = frame->node->in_edge();
+
+    if (frame->step == Frame::Start) {
+      if (!edge->deps_loaded_ && edge->dyndep_
+          && edge->dyndep_->dyndep_pending()) {
+        // This is our first encounter with this edge, and it has a pending
+        // dyndep file.  Visit it now:
+        // * If the dyndep file is ready then load it now to get any
+        //   additional inputs and outputs for this and other edges.
+        //   Once the dyndep file is loaded it will no longer be pending
+        //   if any other edges encounter it, but they will already have
+        //   been updated.
+        // * If the dyndep file is not ready then since is known to be an
+        //   input to this edge, the edge will not be considered ready below.
+        //   Later during the build the dyndep file will become ready and be
+        //   loaded to update this edge before it can possibly be scheduled.
+        frame->step = Frame::LoadDyndep;
+        if (!PushNode(edge->dyndep_, stack, err))
+          return false;
+        continue;
+      }
+      if (!PrepareEdge(frame, validation_nodes, err))
+        return false;
+    } else if (frame->step == Frame::LoadDyndep) {
+      if (!edge->dyndep_->in_edge()
+          || edge->dyndep_->in_edge()->outputs_ready()) {
+        // The dyndep file is ready, so load it now.
+        if (!LoadDyndeps(edge->dyndep_, err))
+          return false;
+      }
+      if (!PrepareEdge(frame, validation_nodes, err))
+        return false;
+    } else if (frame->visiting) {
+      InputVisited(frame, frame->visiting, frame->visiting_order_only);
+      frame->visiting = nullptr;
+    }
+
+    // Visit the remaining inputs, until one needs a frame of its own.
+    bool pushed = false;
+    bool order_only;
+    while (Node* input = NextInput(frame, &order_only)) {
+      const size_t depth = stack->size();
+      frame->visiting = input;
+      frame->visiting_order_only = order_only;
+      if (!PushNode(input, stack, err))
+        return false;
+      if (stack->size() > depth) {
+        pushed = true;
+        break;
+      }
+      InputVisited(frame, input, order_only);
+      frame->visiting = nullptr;
+    }
+    if (pushed)
+      continue;
+
+    if (!FinishEdge(frame, err))
+      return false;
+    stack->pop_back();
+  }
+
+  return true;
+}
+
+bool
+DependencyScan::PushNode(
+    Node* node, std::vector<Frame>* stack, std::string* err
 ) {
   Edge* edge = node->in_edge();
   if (!edge) {
-    // If we already visited this leaf node then we are done.
-    if (node->status_known())
+    // If we already visited this leaf node then we are done, unless
+    // StatSourceInputs() left explaining it for now.
+    if (node->status_known()) {
+      if (!missing_to_explain_.empty() && missing_to_explain_.erase(node))
+        EXPLAIN("%s has no in-edge and is missing", node->path().c_str());
       return true;
+    }
     // This node has no in-edge; it is dirty if it is missing.
     if (!node->StatIfNecessary(disk_interface_, err))
       return false;
@@ -106,42 +238,24 @@ DependencyScan::RecomputeNodeDirty(
   if (edge->mark_ == Edge::VisitDone)
     return true;
 
-  // If we encountered this edge earlier in the call stack we have a cycle.
-  if (!VerifyDAG(node, stack, err))
+  // If we encountered this edge earlier on the stack we have a cycle.
+  if (!VerifyDAG(node, *stack, err))
     return false;
 
-  // Mark the edge temporarily while in the call stack.
+  // Mark the edge temporarily while on the stack.
   edge->mark_ = Edge::VisitInStack;
-  stack->push_back(node);
+  stack->emplace_back(node);
 
-  bool dirty = false;
   edge->outputs_ready_ = true;
   edge->deps_missing_ = false;
+  return true;
+}
 
-  if (!edge->deps_loaded_) {
-    // This is our first encounter with this edge.
-    // If there is a pending dyndep file, visit it now:
-    // * If the dyndep file is ready then load it now to get any
-    //   additional inputs and outputs for this and other edges.
-    //   Once the dyndep file is loaded it will no longer be pending
-    //   if any other edges encounter it, but they will already have
-    //   been updated.
-    // * If the dyndep file is not ready then since is known to be an
-    //   input to this edge, the edge will not be considered ready below.
-    //   Later during the build the dyndep file will become ready and be
-    //   loaded to update this edge before it can possibly be scheduled.
-    if (edge->dyndep_ && edge->dyndep_->dyndep_pending()) {
-      if (!RecomputeNodeDirty(edge->dyndep_, stack, validation_nodes, err))
-        return false;
-
-      if (!edge->dyndep_->in_edge()
-          || edge->dyndep_->in_edge()->outputs_ready()) {
-        // The dyndep file is ready, so load it now.
-        if (!LoadDyndeps(edge->dyndep_, err))
-          return false;
-      }
-    }
-  }
+bool
+DependencyScan::PrepareEdge(
+    Frame* frame, std::vector<Node*>* validation_nodes, std::string* err
+) {
+  Edge* edge = frame->node->in_edge();
 
   // Load output mtimes so we can compare them to the most recent input below.
   for (Node* output : edge->outputs_) {
@@ -157,10 +271,12 @@ DependencyScan::RecomputeNodeDirty(
         return false;
       // Failed to load dependency info: rebuild to regenerate it.
       // LoadDeps() did EXPLAIN() already, no need to do it here.
-      dirty = edge->deps_missing_ = true;
+      frame->dirty = edge->deps_missing_ = true;
     }
   }
 
+  StatSourceInputs(edge);
+
   // Store any validation nodes from the edge for adding to the initial
   // nodes.  Don't recurse into them, that would trigger the dependency
   // cycle detector if the validation node depends on this node.
@@ -172,37 +288,69 @@ DependencyScan::RecomputeNodeDirty(
   );
 
   // Visit all inputs; we're dirty if any of the inputs are dirty.
-  Node* most_recent_input = nullptr;
-  for (std::vector<Node*>::iterator i = edge->inputs_.begin();
-       i != edge->inputs_.end(); ++i) {
-    // Visit this input.
-    if (!RecomputeNodeDirty(*i, stack, validation_nodes, err))
-      return false;
+  frame->step = Frame::VisitInputs;
+  frame->order_only_begin = edge->inputs_.size() - edge->order_only_deps_;
+  return true;
+}
 
-    // If an input is not ready, neither are our outputs.
-    if (Edge* in_edge = (*i)->in_edge()) {
-      if (!in_edge->outputs_ready_)
-        edge->outputs_ready_ = false;
-    }
+Node*
+DependencyScan::NextInput(Frame* frame, bool* order_only) {
+  const Edge* edge = frame->node->in_edge();
+  size_t i = frame->next_input;
+  *order_only = false;
+  if (i < frame->order_only_begin) {
+    ++frame->next_input;
+    return edge->inputs_[i];
+  }
+  const std::span<Node* const> loaded_deps = edge->loaded_deps();
+  i -= frame->order_only_begin;
+  if (i < loaded_deps.size()) {
+    ++frame->next_input;
+    return loaded_deps[i];
+  }
+  i += frame->order_only_begin - loaded_deps.size();
+  if (i < edge->inputs_.size()) {
+    ++frame->next_input;
+    *order_only = true;
+    return edge->inputs_[i];
+  }
+  return nullptr;
+}
 
-    if (!edge->is_order_only(i - edge->inputs_.begin())) {
-      // If a regular input is dirty (or missing), we're dirty.
-      // Otherwise consider mtime.
-      if ((*i)->dirty()) {
-        EXPLAIN("%s is dirty", (*i)->path().c_str());
-        dirty = true;
-      } else {
-        if (!most_recent_input || (*i)->mtime() > most_recent_input->mtime()) {
-          most_recent_input = *i;
-        }
+void
+DependencyScan::InputVisited(Frame* frame, Node* input, bool order_only) {
+  Edge* edge = frame->node->in_edge();
+
+  // If an input is not ready, neither are our outputs.
+  if (Edge* in_edge = input->in_edge()) {
+    if (!in_edge->outputs_ready_)
+      edge->outputs_ready_ = false;
+  }
+
+  if (!order_only) {
+    // If a regular input is dirty (or missing), we're dirty.
+    // Otherwise consider mtime.
+    if (input->dirty()) {
+      EXPLAIN("%s is dirty", input->path().c_str());
+      frame->dirty = true;
+    } else {
+      if (!frame->most_recent_input
+          || input->mtime() > frame->most_recent_input->mtime()) {
+        frame->most_recent_input = input;
       }
     }
   }
+}
+
+bool
+DependencyScan::FinishEdge(Frame* frame, std::string* err) {
+  Edge* edge = frame->node->in_edge();
+  bool dirty = frame->dirty;
 
   // We may also be dirty due to output state: missing outputs, out of
   // date outputs, etc.  Visit all outputs and determine whether they're dirty.
   if (!dirty)
-    if (!RecomputeOutputsDirty(edge, most_recent_input, &dirty, err))
+    if (!RecomputeOutputsDirty(edge, frame->most_recent_input, &dirty, err))
       return false;
 
   // Finally, visit each output and update their dirty state if necessary.
@@ -220,17 +368,14 @@ DependencyScan::RecomputeNodeDirty(
     edge->outputs_ready_ = false;
 
   // Mark the edge as finished during this walk now that it will no longer
-  // be in the call stack.
+  // be on the stack.
   edge->mark_ = Edge::VisitDone;
-  assert(stack->back() == node);
-  stack->pop_back();
-
   return true;
 }
 
 bool
 DependencyScan::VerifyDAG(
-    Node* node, std::vector<Node*>* stack, std::string* err
+    Node* node, const std::vector<Frame>& stack, std::string* err
 ) {
   Edge* edge = node->in_edge();
   assert(edge != nullptr);
@@ -239,11 +384,11 @@ DependencyScan::VerifyDAG(
   if (edge->mark_ != Edge::VisitInStack)
     return true;
 
-  // We have this edge earlier in the call stack.  Find it.
-  std::vector<Node*>::iterator start = stack->begin();
-  while (start != stack->end() && (*start)->in_edge() != edge)
+  // We have this edge earlier on the stack.  Find it.
+  std::vector<Frame>::const_iterator start = stack.begin();
+  while (start != stack.end() && start->node->in_edge() != edge)
     ++start;
-  assert(start != stack->end());
+  assert(start != stack.end());
 
   // Make the cycle clear by reporting its start as the node at its end
   // instead of some other output of the starting edge.  For example,
@@ -251,17 +396,17 @@ DependencyScan::VerifyDAG(
   //   build a b: cat c
   //   build c: cat a
   // should report a -> c -> a instead of b -> c -> a.
-  *start = node;
-
-  // Construct the error message rejecting the cycle.
   *err = "dependency cycle: ";
-  for (std::vector<Node*>::const_iterator i = start; i != stack->end(); ++i) {
-    err->append((*i)->path());
+  err->append(node->path());
+  err->append(" -> ");
+  for (std::vector<Frame>::const_iterator i = start + 1; i != stack.end();
+       ++i) {
+    err->append(i->node->path());
     err->append(" -> ");
   }
-  err->append((*start)->path());
+  err->append(node->path());
 
-  if ((start + 1) == stack->end() && edge->maybe_phonycycle_diagnostic()) {
+  if ((start + 1) == stack.end() && edge->maybe_phonycycle_diagnostic()) {
     // The manifest parser would have filtered out the self-referencing
     // input if it were not configured to allow the error.
     err->append(" [-w phonycycle=err]");
@@ -270,14 +415,56 @@ DependencyScan::VerifyDAG(
   return false;
 }
 
+void
+DependencyScan::StatSourceInputs(Edge* edge) {
+  stat_nodes_.clear();
+  stat_paths_.clear();
+  for (Node* input : edge->inputs_) {
+    if (!input->in_edge() && !input->status_known()) {
+      stat_nodes_.push_back(input);
+      stat_paths_.push_back(input->path());
+    }
+  }
+  // The loaded deps got phony in-edges from the dep loader, which only stat
+  // their output.
+  for (Node* input : edge->loaded_deps()) {
+    const Edge* in_edge = input->in_edge();
+    if ((!in_edge || in_edge->generated_by_dep_loader_)
+        && !input->status_known()) {
+      stat_nodes_.push_back(input);
+      stat_paths_.push_back(input->path());
+    }
+  }
+  if (stat_nodes_.size() < 2)
+    return;
+
+  // Failures are left to Node::Stat(), which reports them as the inputs are
+  // visited.
+  std::string err;
+  disk_interface_->StatMany(stat_paths_, &stat_mtimes_, nullptr, &err);
+  for (size_t i = 0; i < stat_nodes_.size(); ++i) {
+    if (stat_mtimes_[i] == -1)
+      continue;
+    // Visiting the input won't look at it again, so do what it would do.
+    Node* node = stat_nodes_[i];
+    node->SetStatResult(stat_mtimes_[i]);
+    if (node->in_edge())
+      continue;
+    // Explain it when it's visited, in the same order as without StatMany().
+    if (g_explaining && !node->exists())
+      missing_to_explain_.insert(node);
+    node->set_dirty(!node->exists());
+  }
+}
+
 bool
 DependencyScan::RecomputeOutputsDirty(
     Edge* edge, Node* most_recent_input, bool* outputs_dirty, std::string* err
 ) {
-  std::string command = edge->EvaluateCommand(/*incl_rsp_file=*/true);
+  std::optional<uint64_t> command_hash;
   for (std::vector<Node*>::iterator o = edge->outputs_.begin();
        o != edge->outputs_.end(); ++o) {
-    if (RecomputeOutputDirty(edge, most_recent_input, command, *o)) {
+    if (RecomputeOutputDirty(edge, most_recent_input, &command_hash, *o)) {
       *outputs_dirty = true;
       return true;
     }
@@ -287,8 +474,8 @@ DependencyScan::RecomputeOutputsDirty(
 
 bool
 DependencyScan::RecomputeOutputDirty(
-    const Edge* edge, const Node* most_recent_input, const std::string& command,
-    Node* output
+    const Edge* edge, const Node* most_recent_input,
+    std::optional<uint64_t>* command_hash, Node* output
 ) {
   if (edge->is_phony()) {
     // Phony edges don't write any output.  Outputs are only dirty if
@@ -327,7 +514,7 @@ DependencyScan::RecomputeOutputDirty(
   // the log against the most recent input's mtime (see below)
   bool used_restat = false;
   if (edge->GetBindingBool("restat") && build_log()
-      && (entry = build_log()->LookupByOutput(output->path()))) {
+      && (entry = build_log()->LookupByOutput(output))) {
     used_restat = true;
   }
 
@@ -345,14 +532,17 @@ DependencyScan::RecomputeOutputDirty(
 
   if (build_log()) {
     bool generator = edge->GetBindingBool("generator");
-    if (entry || (entry = build_log()->LookupByOutput(output->path()))) {
-      if (!generator
-          && BuildLog::LogEntry::HashCommand(command) != entry->command_hash) {
+    if (entry || (entry = build_log()->LookupByOutput(output))) {
+      if (!generator) {
         // May also be dirty due to the command changing since the last build.
         // But if this is a generator rule, the command changing does not make
         // us dirty.
-        EXPLAIN("command line changed for %s", output->path().c_str());
-        return true;
+        if (!*command_hash)
+          *command_hash = edge->HashCommand();
+        if (!entry->MatchesCommand(edge, **command_hash)) {
+          EXPLAIN("command line changed for %s", output->path().c_str());
+          return true;
+        }
       }
       if (most_recent_input && entry->mtime < most_recent_input->mtime()) {
         // May also be dirty due to the mtime in the log being older than the
@@ -397,6 +587,10 @@ Edge::AllInputsReady() const {
     if ((*i)->in_edge() && !(*i)->in_edge()->outputs_ready())
       return false;
   }
+  for (const Node* input : loaded_deps()) {
+    if (input->in_edge() && !input->in_edge()->outputs_ready())
+      return false;
+  }
   return true;
 }
 
@@ -408,6 +602,8 @@ struct EdgeEnv : public Env {
       : edge_(edge), escape_in_out_(escape), recursive_(false) {}
   virtual std::string
   LookupVariable(const std::string& var);
+  virtual bool
+  OverridesScopeVariable(const std::string& var) const;
 
   /// Given a span of Nodes, construct a list of paths suitable for a command
   /// line.
@@ -421,17 +617,32 @@ private:
   bool recursive_;
 };
 
+bool
+EdgeEnv::OverridesScopeVariable(const std::string& var) const {
+  // "rspfile" and "depfile" may name in-memory files of the edge.
+  return var == "in" || var == "in_newline" || var == "out"
+         || var == "rspfile" || var == "depfile";
+}
+
 std::string
 EdgeEnv::LookupVariable(const std::string& var) {
-  if (var == "in" || var == "in_newline") {
-    int explicit_deps_count =
-        edge_->inputs_.size() - edge_->implicit_deps_ - edge_->order_only_deps_;
-    return MakePathList(
-        edge_->inputs_.data(), explicit_deps_count, var == "in" ? ' ' : '\n'
-    );
-  } else if (var == "out") {
-    int explicit_outs_count = edge_->outputs_.size() - edge_->implicit_outs_;
-    return MakePathList(&edge_->outputs_[0], explicit_outs_count, ' ');
+  // Every variable this resolves itself must be overridden above, else the
+  // memoized expansions of the rule bindings would freeze the scope's value.
+  if (OverridesScopeVariable(var)) {
+    if (var == "in" || var == "in_newline") {
+      int explicit_deps_count = edge_->inputs_.size() - edge_->implicit_deps_
+                                - edge_->order_only_deps_;
+      return MakePathList(
+          edge_->inputs_.data(), explicit_deps_count, var == "in" ? ' ' : '\n'
+      );
+    } else if (var == "out") {
+      int explicit_outs_count = edge_->outputs_.size() - edge_->implicit_outs_;
+      return MakePathList(&edge_->outputs_[0], explicit_outs_count, ' ');
+    } else if (var == "rspfile" && !edge_->rspfile_memory_path_.empty()) {
+      return edge_->rspfile_memory_path_;
+    } else if (var == "depfile" && !edge_->depfile_memory_path_.empty()) {
+      return edge_->depfile_memory_path_;
+    }
   }
 
   if (recursive_) {
@@ -453,7 +664,7 @@ EdgeEnv::LookupVariable(const std::string& var) {
   // In practice, variables defined on rules never use another rule variable.
   // For performance, only start checking for cycles after the first lookup.
   recursive_ = true;
-  return edge_->env_->LookupWithFallback(var, eval, this);
+  return edge_->env_->LookupWithFallback(var, eval, edge_->rule_, this);
 }
 
 std::string
@@ -495,10 +706,30 @@ Edge::EvaluateCommand(const bool incl_rsp_file) const {
     std::string rspfile_content = GetBinding("rspfile_content");
     if (!rspfile_content.empty())
       command += ";rspfile=" + rspfile_content;
+    std::string worker = GetBinding("worker");
+    if (!worker.empty())
+      command += ";worker=" + worker;
   }
   return command;
 }
 
+uint64_t
+Edge::HashCommand() const {
+  CommandHasher hasher;
+  hasher.Update(GetBinding("command"));
+  std::string rspfile_content = GetBinding("rspfile_content");
+  if (!rspfile_content.empty()) {
+    hasher.Update(";rspfile=");
+    hasher.Update(rspfile_content);
+  }
+  std::string worker = GetBinding("worker");
+  if (!worker.empty()) {
+    hasher.Update(";worker=");
+    hasher.Update(worker);
+  }
+  return hasher.Finish();
+}
+
 std::string
 Edge::GetBinding(const std::string& key) const {
   EdgeEnv env(this, EdgeEnv::kShellEscape);
@@ -535,6 +766,8 @@ Edge::Dump(const char* prefix) const {
        i != inputs_.end() && *i != nullptr; ++i) {
     printf("%s ", (*i)->path().c_str());
   }
+  for (const Node* input : loaded_deps())
+    printf("%s ", input->path().c_str());
   printf("--%s-> ", rule_->name().c_str());
   for (std::vector<Node*>::const_iterator i = outputs_.begin();
        i != outputs_.end() && *i != nullptr; ++i) {
@@ -596,13 +829,13 @@ Node::Dump(const char* prefix) const {
     printf("no in-edge\n");
   }
   printf(" out edges:\n");
-  for (std::vector<Edge*>::const_iterator e = out_edges().begin();
+  for (EdgeList::const_iterator e = out_edges().begin();
        e != out_edges().end() && *e != nullptr; ++e) {
     (*e)->Dump(" +- ");
   }
   if (!validation_out_edges().empty()) {
     printf(" validation out edges:\n");
-    for (std::vector<Edge*>::const_iterator e = validation_out_edges().begin();
+    for (EdgeList::const_iterator e = validation_out_edges().begin();
          e != validation_out_edges().end() && *e != nullptr; ++e) {
       (*e)->Dump(" +- ");
     }
@@ -611,6 +844,9 @@ Node::Dump(const char* prefix) const {
 
 bool
 ImplicitDepLoader::LoadDeps(Edge* edge, std::string* err) {
+  // Deps loaded by a previous scan are replaced.
+  edge->loaded_deps_.reset();
+
   std::string deps_type = edge->GetBinding("deps");
   if (!deps_type.empty())
     return LoadDepsFromLog(edge, err);
@@ -710,11 +946,10 @@ bool
 ImplicitDepLoader::ProcessDepfileDeps(
     Edge* edge, std::vector<std::string_view>* depfile_ins, std::string* err
 ) {
-  // Preallocate space in edge->inputs_ to be filled in below.
-  std::vector<Node*>::iterator implicit_dep =
-      PreallocateSpace(edge, depfile_ins->size());
-
-  // Add all its in-edges.
+  // The depfile isn't in the deps log, so give the edge a record of its own.
+  std::shared_ptr<DepsLog::Deps> deps =
+      std::make_shared<DepsLog::Deps>(0, depfile_ins->size());
+  Node** implicit_dep = deps->nodes;
   for (std::vector<std::string_view>::iterator i = depfile_ins->begin();
        i != depfile_ins->end(); ++i, ++implicit_dep) {
     uint64_t slash_bits;
@@ -723,12 +958,10 @@ ImplicitDepLoader::ProcessDepfileDeps(
     // CanonicalizePath wants to edit the size.
     *i = i->substr(0, size);
 
-    Node* node = state_->GetNode(*i, slash_bits);
-    *implicit_dep = node;
-    node->AddOutEdge(edge);
-    CreatePhonyInEdge(node);
+    *implicit_dep = state_->GetNode(*i, slash_bits);
   }
 
+  SetLoadedDeps(edge, std::move(deps));
   return true;
 }
 
@@ -736,7 +969,8 @@ bool
 ImplicitDepLoader::LoadDepsFromLog(Edge* edge, std::string* err) {
   // NOTE: deps are only supported for single-target edges.
   Node* output = edge->outputs_[0];
-  DepsLog::Deps* deps = deps_log_ ? deps_log_->GetDeps(output) : nullptr;
+  std::shared_ptr<const DepsLog::Deps> deps =
+      deps_log_ ? deps_log_->ShareDeps(output) : nullptr;
   if (!deps) {
     EXPLAIN("deps for '%s' are missing", output->path().c_str());
     return false;
@@ -751,24 +985,19 @@ ImplicitDepLoader::LoadDepsFromLog(Edge* edge, std::string* err) {
     return false;
   }
 
-  std::vector<Node*>::iterator implicit_dep =
-      PreallocateSpace(edge, deps->node_count);
-  for (int i = 0; i < deps->node_count; ++i, ++implicit_dep) {
-    Node* node = deps->nodes[i];
-    *implicit_dep = node;
-    node->AddOutEdge(edge);
-    CreatePhonyInEdge(node);
-  }
+  SetLoadedDeps(edge, std::move(deps));
   return true;
 }
 
-std::vector<Node*>::iterator
-ImplicitDepLoader::PreallocateSpace(Edge* edge, int count) {
-  edge->inputs_.insert(
-      edge->inputs_.end() - edge->order_only_deps_, (size_t)count, 0
-  );
-  edge->implicit_deps_ += count;
-  return edge->inputs_.end() - edge->order_only_deps_ - count;
+void
+ImplicitDepLoader::SetLoadedDeps(
+    Edge* edge, std::shared_ptr<const DepsLog::Deps> deps
+) {
+  edge->loaded_deps_ = std::move(deps);
+  for (Node* node : edge->loaded_deps()) {
+    node->AddOutEdge(edge);
+    CreatePhonyInEdge(node);
+  }
 }
 
 void
@@ -0,0 +1,215 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures a no-op DependencyScan::RecomputeDirty() over a large synthetic
+// graph, i.e. the time ninja spends deciding that there is nothing to do.
+// Like a real build, the scan checks the commands against a build log.
+
+#include <cstdio>
+#include <cstdlib>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <ninja/build_log.hpp>
+#include <ninja/disk_interface.hpp>
+#include <ninja/graph.hpp>
+#include <ninja/metrics.hpp>
+#include <ninja/state.hpp>
+#include <ninja/util.hpp>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#  include <unistd.h>
+#endif
+
+namespace {
+
+const char kLogFilename[] = "GraphPerfTest-tempfile";
+
+struct NoDeadPaths : public BuildLogUser {
+  virtual bool
+  IsPathDead(std::string_view) const {
+    return false;
+  }
+};
+
+/// A disk where every source is older than every output, without the cost
+/// of an actual stat() call.
+struct FakeDisk : public DiskInterface {
+  virtual TimeStamp
+  Stat(const std::string& path, std::string* err) const {
+    return path[0] == 's' ? 1 : 2;
+  }
+  virtual bool
+  WriteFile(const std::string& path, const std::string& contents) {
+    return false;
+  }
+  virtual bool
+  MakeDir(const std::string& path) {
+    return false;
+  }
+  virtual Status
+  ReadFile(const std::string& path, std::string* contents, std::string* err) {
+    return NotFound;
+  }
+  virtual int
+  RemoveFile(const std::string& path) {
+    return -1;
+  }
+};
+
+/// Build a graph like that of a large C++ project: every object is compiled
+/// from one source file and a handful of headers shared by many objects, and
+/// the objects are linked into libraries which are all linked into a binary.
+/// Returns the final output.
+Node*
+CreateGraph(State* state, int num_nodes) {
+  const int kHeaders = 10000;
+  const int kHeadersPerObject = 8;
+  const int kObjectsPerLibrary = 1000;
+  const int objects = (num_nodes - kHeaders) / 2;
+  const Rule* rule = &State::kPhonyRule;
+
+  Rule* compile = new Rule("cc");
+  EvalString command;
+  command.AddText("cc -c ");
+  command.AddSpecial("in");
+  command.AddText(" -o ");
+  command.AddSpecial("out");
+  compile->AddBinding("command", command);
+  state->bindings_.AddRule(compile);
+
+  std::vector<Edge*> libraries;
+  for (int i = 0; i < objects; ++i) {
+    if (i % kObjectsPerLibrary == 0) {
+      libraries.push_back(state->AddEdge(rule));
+      state->AddOut(
+          libraries.back(), "lib" + std::to_string(libraries.size()) + ".a", 0
+      );
+    }
+    Edge* edge = state->AddEdge(compile);
+    std::string object = "obj/" + std::to_string(i) + ".o";
+    state->AddOut(edge, object, 0);
+    state->AddIn(edge, "src/" + std::to_string(i) + ".cc", 0);
+    for (int j = 0; j < kHeadersPerObject; ++j) {
+      unsigned header = (i * 7919u + j * 104729u) % kHeaders;
+      state->AddIn(edge, "src/include/" + std::to_string(header) + ".h", 0);
+    }
+    edge->implicit_deps_ = kHeadersPerObject;
+    state->AddIn(libraries.back(), object, 0);
+  }
+
+  Edge* binary = state->AddEdge(rule);
+  state->AddOut(binary, "bin", 0);
+  for (Edge* library : libraries)
+    state->AddIn(binary, library->outputs_[0]->path(), 0);
+  return binary->outputs_[0];
+}
+
+void
+PrintTimes(const char* name, const std::vector<int>& times) {
+  int min = times[0];
+  int max = times[0];
+  float total = 0;
+  for (size_t i = 0; i < times.size(); ++i) {
+    total += times[i];
+    if (times[i] < min)
+      min = times[i];
+    else if (times[i] > max)
+      max = times[i];
+  }
+
+  printf(
+      "%s: min %dms  max %dms  avg %.1fms\n", name, min, max,
+      total / times.size()
+  );
+}
+
+/// Print the number of bytes allocated on the heap, where supported.
+void
+PrintHeapUsage(const char* when) {
+#ifdef __GLIBC__
+  struct mallinfo2 info = mallinfo2();
+  printf("heap %s: %zuMB\n", when, info.uordblks >> 20);
+#endif
+}
+
+void
+Measure(State* state, BuildLog* build_log, Node* target) {
+  FakeDisk disk;
+  DependencyScan scan(state, build_log, nullptr, &disk, nullptr);
+  std::vector<int> reset_times;
+  std::vector<int> scan_times;
+  for (int i = 0; i < 5; ++i) {
+    int64_t start = GetTimeMillis();
+    state->Reset();
+    reset_times.push_back(GetTimeMillis() - start);
+
+    start = GetTimeMillis();
+    std::string err;
+    if (!scan.RecomputeDirty(target, nullptr, &err))
+      Fatal("%s", err.c_str());
+    scan_times.push_back(GetTimeMillis() - start);
+    if (target->dirty())
+      Fatal("graph should be clean");
+  }
+
+  PrintTimes("reset", reset_times);
+  PrintTimes("scan", scan_times);
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char** argv) {
+  int num_nodes = argc > 1 ? atoi(argv[1]) : 2000000;
+
+  State state;
+  Node* target = CreateGraph(&state, num_nodes);
+  printf(
+      "%zu nodes, %zu edges\n", state.paths_.size(), state.edges_.size()
+  );
+
+  // A log of the last build of every compile step.
+  {
+    BuildLog build_log;
+    NoDeadPaths no_dead_paths;
+    std::string err;
+    if (!build_log.OpenForWrite(kLogFilename, no_dead_paths, &err))
+      Fatal("%s", err.c_str());
+    for (const std::unique_ptr<Edge>& edge : state.edges_) {
+      if (!edge->is_phony())
+        build_log.RecordCommand(edge.get(), 0, 1, 2);
+    }
+    build_log.Close();
+  }
+
+  BuildLog build_log;
+  std::string err;
+  if (build_log.Load(kLogFilename, &err) != LOAD_SUCCESS)
+    Fatal("%s", err.c_str());
+  unlink(kLogFilename);
+
+  // The first scan finds the entries by path, later ones through the nodes.
+  PrintHeapUsage("after parsing");
+  Measure(&state, &build_log, target);
+
+  int64_t start = GetTimeMillis();
+  state.FreezeGraph();
+  printf("freeze: %dms\n", static_cast<int>(GetTimeMillis() - start));
+  PrintHeapUsage("after freezing");
+  Measure(&state, &build_log, target);
+  return 0;
+}
@@ -78,6 +78,55 @@ TEST_F(GraphTest, FunkyMakefilePath) {
   EXPECT_TRUE(GetNode("out.o")->dirty());
 }
 
+namespace {
+
+/// Records the paths of each DiskInterface::StatMany() call.
+struct StatManyRecorder : public VirtualFileSystem {
+  virtual bool
+  StatMany(
+      const std::vector<std::string_view>& paths,
+      std::vector<TimeStamp>* mtimes, StatProgress* progress,
+      std::string* err
+  ) const {
+    calls_.emplace_back(paths.begin(), paths.end());
+    return VirtualFileSystem::StatMany(paths, mtimes, progress, err);
+  }
+
+  mutable std::vector<std::vector<std::string>> calls_;
+};
+
+} // anonymous namespace
+
+// The source inputs and the loaded deps of an edge are stat()ed together,
+// and a missing loaded dep still makes the output dirty.
+TEST_F(GraphTest, StatManyLoadedDeps) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+      &state_,
+      "rule catdep\n"
+      "  depfile = $out.d\n"
+      "  command = cat $in > $out\n"
+      "build out.o: catdep foo.cc\n"
+  ));
+  StatManyRecorder fs;
+  DependencyScan scan(&state_, nullptr, nullptr, &fs, nullptr);
+  fs.Create("foo.cc", "");
+  fs.Create("a.h", "");
+  fs.Create("out.o.d", "out.o: a.h b.h\n");
+  fs.Tick();
+  fs.Create("out.o", "");
+
+  std::string err;
+  EXPECT_TRUE(scan.RecomputeDirty(GetNode("out.o"), nullptr, &err));
+  ASSERT_EQ("", err);
+
+  ASSERT_EQ(1u, fs.calls_.size());
+  std::vector<std::string> expected = {"foo.cc", "a.h", "b.h"};
+  EXPECT_EQ(expected, fs.calls_[0]);
+  EXPECT_TRUE(GetNode("a.h")->exists());
+  EXPECT_FALSE(GetNode("b.h")->exists());
+  EXPECT_TRUE(GetNode("out.o")->dirty());
+}
+
 TEST_F(GraphTest, ExplicitImplicit) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(
       &state_,
@@ -347,6 +396,37 @@ TEST_F(GraphTest, DepfileOverrideParent) {
   EXPECT_EQ("depfile is y", edge->GetBinding("command"));
 }
 
+// Check that memoized expansions of scope variables in rule bindings honor
+// edge-local overrides and later changes to the scope.
+TEST_F(GraphTest, ScopeVariablesInRuleBindings) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+      &state_,
+      "flags = -a\n"
+      "rule r\n"
+      "  command = r $flags $in > $out\n"
+      "  description = R $flags\n"
+      "build out1: r in1\n"
+      "build out2: r in2\n"
+      "  flags = -b\n"
+      "build out3: r in3\n"
+      "  unrelated = x\n"
+  ));
+  Edge* edge1 = GetNode("out1")->in_edge();
+  Edge* edge2 = GetNode("out2")->in_edge();
+  Edge* edge3 = GetNode("out3")->in_edge();
+  EXPECT_EQ("r -a in1 > out1", edge1->EvaluateCommand());
+  EXPECT_EQ("r -b in2 > out2", edge2->EvaluateCommand());
+  EXPECT_EQ("r -a in3 > out3", edge3->EvaluateCommand());
+  EXPECT_EQ("R -a", edge1->GetBinding("description"));
+  EXPECT_EQ("R -b", edge2->GetBinding("description"));
+
+  state_.bindings_.AddBinding("flags", "-c");
+  EXPECT_EQ("r -c in1 > out1", edge1->EvaluateCommand());
+  EXPECT_EQ("r -b in2 > out2", edge2->EvaluateCommand());
+  EXPECT_EQ("r -c in3 > out3", edge3->EvaluateCommand());
+  EXPECT_EQ("R -c", edge3->GetBinding("description"));
+}
+
 // Verify that building a nested phony rule prints "no work to do"
 TEST_F(GraphTest, NestedPhonyPrintsDone) {
   AssertParse(
@@ -390,6 +470,29 @@ TEST_F(GraphTest, DependencyCycle) {
   ASSERT_EQ("dependency cycle: out -> mid -> in -> pre -> out", err);
 }
 
+TEST_F(GraphTest, VeryDeepChain) {
+  // Far deeper than the call stack would allow if the scan recursed.
+  const int kDepth = 1000000;
+  const Rule* rule = state_.bindings_.LookupRule("cat");
+  std::string input = "in";
+  for (int i = 0; i < kDepth; ++i) {
+    std::string output = "out" + std::to_string(i);
+    Edge* edge = state_.AddEdge(rule);
+    state_.AddIn(edge, input, 0);
+    ASSERT_TRUE(state_.AddOut(edge, output, 0));
+    input = output;
+  }
+  fs_.Create("in", "");
+
+  std::string err;
+  EXPECT_TRUE(scan_.RecomputeDirty(GetNode(input), nullptr, &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(GetNode("in")->dirty());
+  EXPECT_TRUE(GetNode("out0")->dirty());
+  EXPECT_TRUE(GetNode(input)->dirty());
+  EXPECT_FALSE(GetNode(input)->in_edge()->outputs_ready());
+}
+
 TEST_F(GraphTest, CycleInEdgesButNotInNodes1) {
   std::string err;
   AssertParse(&state_, "build a b: cat a\n");
@@ -449,8 +552,9 @@ TEST_F(GraphTest, CycleWithLengthZeroFromDepfile) {
   // but the depfile also adds b as an input), the deps should have been loaded
   // only once:
   Edge* edge = GetNode("a")->in_edge();
-  EXPECT_EQ(1, edge->inputs_.size());
-  EXPECT_EQ("b", edge->inputs_[0]->path());
+  EXPECT_EQ(0, edge->inputs_.size());
+  ASSERT_EQ(1, edge->loaded_deps().size());
+  EXPECT_EQ("b", edge->loaded_deps()[0]->path());
 }
 
 // Like CycleWithLengthZeroFromDepfile but with a higher cycle length.
@@ -475,8 +579,9 @@ TEST_F(GraphTest, CycleWithLengthOneFromDepfile) {
   // but c's in_edge has b as input but the depfile also adds |edge| as
   // output)), the deps should have been loaded only once:
   Edge* edge = GetNode("a")->in_edge();
-  EXPECT_EQ(1, edge->inputs_.size());
-  EXPECT_EQ("c", edge->inputs_[0]->path());
+  EXPECT_EQ(0, edge->inputs_.size());
+  ASSERT_EQ(1, edge->loaded_deps().size());
+  EXPECT_EQ("c", edge->loaded_deps()[0]->path());
 }
 
 // Like CycleWithLengthOneFromDepfile but building a node one hop away from
@@ -503,8 +608,9 @@ TEST_F(GraphTest, CycleWithLengthOneFromDepfileOneHopAway) {
   // but c's in_edge has b as input but the depfile also adds |edge| as
   // output)), the deps should have been loaded only once:
   Edge* edge = GetNode("a")->in_edge();
-  EXPECT_EQ(1, edge->inputs_.size());
-  EXPECT_EQ("c", edge->inputs_[0]->path());
+  EXPECT_EQ(0, edge->inputs_.size());
+  ASSERT_EQ(1, edge->loaded_deps().size());
+  EXPECT_EQ("c", edge->loaded_deps()[0]->path());
 }
 
 TEST_F(GraphTest, DyndepLoadTrivial) {
@@ -932,12 +1038,13 @@ TEST_F(GraphTest, DyndepFileCircular) {
 
   // Verify that "out.d" was loaded exactly once despite
   // circular reference discovered from dyndep file.
-  ASSERT_EQ(3u, edge->inputs_.size());
+  ASSERT_EQ(2u, edge->inputs_.size());
   EXPECT_EQ("in", edge->inputs_[0]->path());
-  EXPECT_EQ("inimp", edge->inputs_[1]->path());
-  EXPECT_EQ("dd", edge->inputs_[2]->path());
-  EXPECT_EQ(1u, edge->implicit_deps_);
+  EXPECT_EQ("dd", edge->inputs_[1]->path());
+  EXPECT_EQ(0u, edge->implicit_deps_);
   EXPECT_EQ(1u, edge->order_only_deps_);
+  ASSERT_EQ(1u, edge->loaded_deps().size());
+  EXPECT_EQ("inimp", edge->loaded_deps()[0]->path());
 }
 
 TEST_F(GraphTest, Validation) {
@@ -17,6 +17,11 @@
 #include <cstring>
 #include <ctime>
 #include <ninja/build_log.hpp>
+#include <ninja/metrics.hpp>
+#include <string>
+#include <string_view>
+
+namespace {
 
 int
 random(int low, int high) {
@@ -32,25 +37,24 @@ RandomCommand(char** s) {
   (*s)[len] = '\0';
 }
 
-int
-main() {
-  const int N = 20 * 1000 * 1000;
+/// Count the distinct commands among \a n that share a hash under \a hash,
+/// and print it together with the time hashing took.
+void
+CountCollisions(
+    const char* name, uint64_t (*hash)(std::string_view), char** commands,
+    int n
+) {
+  std::pair<uint64_t, int>* hashes = new std::pair<uint64_t, int>[n];
 
-  // Leak these, else 10% of the runtime is spent destroying strings.
-  char** commands = new char*[N];
-  std::pair<uint64_t, int>* hashes = new std::pair<uint64_t, int>[N];
+  int64_t start = GetTimeMillis();
+  for (int i = 0; i < n; ++i)
+    hashes[i] = std::make_pair(hash(commands[i]), i);
+  int64_t elapsed = GetTimeMillis() - start;
 
-  srand((int)time(nullptr));
-
-  for (int i = 0; i < N; ++i) {
-    RandomCommand(&commands[i]);
-    hashes[i] = std::make_pair(BuildLog::LogEntry::HashCommand(commands[i]), i);
-  }
-
-  sort(hashes, hashes + N);
+  std::sort(hashes, hashes + n);
 
   int collision_count = 0;
-  for (int i = 1; i < N; ++i) {
+  for (int i = 1; i < n; ++i) {
     if (hashes[i - 1].first == hashes[i].first) {
       if (strcmp(commands[hashes[i - 1].second], commands[hashes[i].second])
           != 0) {
@@ -62,5 +66,66 @@ main() {
       }
     }
   }
-  printf("\n\n%d collisions after %d runs\n", collision_count, N);
+  printf(
+      "%s: %d collisions after %d runs, hashing took %dms\n", name,
+      collision_count, n, static_cast<int>(elapsed)
+  );
+  delete[] hashes;
+}
+
+/// Print the throughput of \a hash on commands of \a length bytes.
+void
+MeasureThroughput(
+    const char* name, uint64_t (*hash)(std::string_view), int length
+) {
+  std::string command;
+  while ((int)command.size() < length)
+    command += " -Isome/include/directory";
+  command.resize(length);
+
+  const int64_t kBytes = 2000LL * 1000 * 1000;
+  const int64_t iterations = kBytes / length;
+  uint64_t optimization_guard = 0;
+  int64_t start = GetTimeMillis();
+  for (int64_t i = 0; i < iterations; ++i) {
+    command[i % length] = (char)i;
+    optimization_guard += hash(command);
+  }
+  int64_t elapsed = GetTimeMillis() - start;
+  printf(
+      "%s, %5d byte commands: %6.2f GB/s, %6.1f ns/hash (guard %x)\n", name,
+      length, elapsed ? kBytes / (elapsed * 1e6) : 0.0,
+      elapsed * 1e6 / iterations, (unsigned)optimization_guard
+  );
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char** argv) {
+  const int N = argc > 1 ? atoi(argv[1]) : 20 * 1000 * 1000;
+
+  const struct {
+    const char* name;
+    uint64_t (*hash)(std::string_view);
+  } kHashes[] = {
+    {"MurmurHash64A (log v5)", BuildLog::LogEntry::LegacyHashCommand},
+    {"CommandHasher (log v6)", BuildLog::LogEntry::HashCommand},
+  };
+
+  for (int length : {32, 200, 1000, 10000}) {
+    for (const auto& hash : kHashes)
+      MeasureThroughput(hash.name, hash.hash, length);
+  }
+
+  // Leak these, else 10% of the runtime is spent destroying strings.
+  char** commands = new char*[N];
+
+  srand((int)time(nullptr));
+
+  for (int i = 0; i < N; ++i)
+    RandomCommand(&commands[i]);
+
+  for (const auto& hash : kHashes)
+    CountCollisions(hash.name, hash.hash, commands, N);
 }
@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <cctype>
+#include <cstdint>
 #include <cstdio>
 #include <ninja/json.hpp>
 #include <string>
@@ -52,3 +54,193 @@ PrintJSONString(const std::string& in) {
   std::string out = EncodeJSONString(in);
   fwrite(out.c_str(), 1, out.length(), stdout);
 }
+
+namespace {
+
+struct JSONDecoder {
+  explicit JSONDecoder(const std::string& in) : in_(in), pos_(0) {}
+
+  void
+  SkipSpace() {
+    while (pos_ < in_.size()
+           && (in_[pos_] == ' ' || in_[pos_] == '\t' || in_[pos_] == '\n'
+               || in_[pos_] == '\r'))
+      ++pos_;
+  }
+
+  bool
+  Expect(char c, std::string* err) {
+    SkipSpace();
+    if (pos_ < in_.size() && in_[pos_] == c) {
+      ++pos_;
+      return true;
+    }
+    *err = std::string("expected '") + c + "' at offset "
+           + std::to_string(pos_);
+    return false;
+  }
+
+  bool
+  ReadHex4(uint32_t* value) {
+    if (in_.size() - pos_ < 4)
+      return false;
+    *value = 0;
+    for (int i = 0; i < 4; ++i) {
+      char c = in_[pos_++];
+      *value <<= 4;
+      if (c >= '0' && c <= '9')
+        *value |= c - '0';
+      else if (c >= 'a' && c <= 'f')
+        *value |= c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F')
+        *value |= c - 'A' + 10;
+      else
+        return false;
+    }
+    return true;
+  }
+
+  static void
+  AppendUTF8(uint32_t c, std::string* out) {
+    if (c < 0x80) {
+      *out += static_cast<char>(c);
+    } else if (c < 0x800) {
+      *out += static_cast<char>(0xc0 | (c >> 6));
+      *out += static_cast<char>(0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+      *out += static_cast<char>(0xe0 | (c >> 12));
+      *out += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+      *out += static_cast<char>(0x80 | (c & 0x3f));
+    } else {
+      *out += static_cast<char>(0xf0 | (c >> 18));
+      *out += static_cast<char>(0x80 | ((c >> 12) & 0x3f));
+      *out += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+      *out += static_cast<char>(0x80 | (c & 0x3f));
+    }
+  }
+
+  bool
+  ReadString(std::string* out, std::string* err) {
+    if (!Expect('"', err))
+      return false;
+    out->clear();
+    while (pos_ < in_.size()) {
+      char c = in_[pos_++];
+      if (c == '"')
+        return true;
+      if (c != '\\') {
+        *out += c;
+        continue;
+      }
+      if (pos_ == in_.size())
+        break;
+      c = in_[pos_++];
+      switch (c) {
+        case '"':
+        case '\\':
+        case '/':
+          *out += c;
+          break;
+        case 'b':
+          *out += '\b';
+          break;
+        case 'f':
+          *out += '\f';
+          break;
+        case 'n':
+          *out += '\n';
+          break;
+        case 'r':
+          *out += '\r';
+          break;
+        case 't':
+          *out += '\t';
+          break;
+        case 'u': {
+          uint32_t code;
+          if (!ReadHex4(&code)) {
+            *err = "bad \\u escape at offset " + std::to_string(pos_);
+            return false;
+          }
+          if (code >= 0xd800 && code < 0xdc00 && in_.size() - pos_ >= 6
+              && in_[pos_] == '\\' && in_[pos_ + 1] == 'u') {
+            // A surrogate pair.
+            size_t start = pos_;
+            pos_ += 2;
+            uint32_t low;
+            if (ReadHex4(&low) && low >= 0xdc00 && low < 0xe000)
+              code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+            else
+              pos_ = start;
+          }
+          AppendUTF8(code, out);
+          break;
+        }
+        default:
+          *err = "bad escape at offset " + std::to_string(pos_ - 1);
+          return false;
+      }
+    }
+    *err = "unterminated string";
+    return false;
+  }
+
+  bool
+  ReadValue(std::string* out, std::string* err) {
+    SkipSpace();
+    if (pos_ < in_.size() && in_[pos_] == '"')
+      return ReadString(out, err);
+    size_t start = pos_;
+    while (pos_ < in_.size()
+           && (isalnum(static_cast<unsigned char>(in_[pos_]))
+               || in_[pos_] == '-' || in_[pos_] == '+' || in_[pos_] == '.'))
+      ++pos_;
+    if (pos_ == start) {
+      *err = "expected a value at offset " + std::to_string(pos_);
+      return false;
+    }
+    out->assign(in_, start, pos_ - start);
+    return true;
+  }
+
+  const std::string& in_;
+  size_t pos_;
+};
+
+} // anonymous namespace
+
+bool
+DecodeJSONObject(
+    const std::string& in, std::map<std::string, std::string>* values,
+    std::string* err
+) {
+  JSONDecoder decoder(in);
+  values->clear();
+  if (!decoder.Expect('{', err))
+    return false;
+  decoder.SkipSpace();
+  if (decoder.pos_ < in.size() && in[decoder.pos_] == '}') {
+    ++decoder.pos_;
+  } else {
+    for (;;) {
+      std::string key;
+      if (!decoder.ReadString(&key, err) || !decoder.Expect(':', err)
+          || !decoder.ReadValue(&(*values)[key], err))
+        return false;
+      decoder.SkipSpace();
+      if (decoder.pos_ < in.size() && in[decoder.pos_] == ',') {
+        ++decoder.pos_;
+        continue;
+      }
+      if (!decoder.Expect('}', err))
+        return false;
+      break;
+    }
+  }
+  decoder.SkipSpace();
+  if (decoder.pos_ != in.size()) {
+    *err = "trailing data at offset " + std::to_string(decoder.pos_);
+    return false;
+  }
+  return true;
+}
@@ -39,3 +39,46 @@ TEST(JSONTest, UTF8) {
   const char* utf8str = "\xe4\xbd\xa0\xe5\xa5\xbd";
   EXPECT_EQ(EncodeJSONString(utf8str), utf8str);
 }
+
+TEST(JSONTest, DecodeObject) {
+  std::map<std::string, std::string> values;
+  std::string err;
+  EXPECT_TRUE(DecodeJSONObject(
+      " { \"id\": 3, \"output\" : \"a\\\"b\\\\c\\n\", \"ok\":true,"
+      "\"none\":null, \"neg\": -1.5e3 } ",
+      &values, &err
+  ));
+  EXPECT_EQ("", err);
+  EXPECT_EQ(5u, values.size());
+  EXPECT_EQ("3", values["id"]);
+  EXPECT_EQ("a\"b\\c\n", values["output"]);
+  EXPECT_EQ("true", values["ok"]);
+  EXPECT_EQ("null", values["none"]);
+  EXPECT_EQ("-1.5e3", values["neg"]);
+
+  EXPECT_TRUE(DecodeJSONObject("{}", &values, &err));
+  EXPECT_TRUE(values.empty());
+}
+
+TEST(JSONTest, DecodeUnicodeEscapes) {
+  std::map<std::string, std::string> values;
+  std::string err;
+  EXPECT_TRUE(DecodeJSONObject(
+      "{\"s\": \"\\u0041\\u00e9\\u4f60\\ud83d\\ude00\"}", &values, &err
+  ));
+  EXPECT_EQ("A\xc3\xa9\xe4\xbd\xa0\xf0\x9f\x98\x80", values["s"]);
+}
+
+TEST(JSONTest, DecodeErrors) {
+  std::map<std::string, std::string> values;
+  std::string err;
+  EXPECT_FALSE(DecodeJSONObject("", &values, &err));
+  EXPECT_FALSE(DecodeJSONObject("{\"a\": 1", &values, &err));
+  EXPECT_FALSE(DecodeJSONObject("{\"a\": \"b}", &values, &err));
+  EXPECT_EQ("unterminated string", err);
+  EXPECT_FALSE(DecodeJSONObject("{\"a\": [1]}", &values, &err));
+  EXPECT_FALSE(DecodeJSONObject("{\"a\": \"\\x\"}", &values, &err));
+  EXPECT_FALSE(DecodeJSONObject("{\"a\": \"\\u12\"}", &values, &err));
+  EXPECT_FALSE(DecodeJSONObject("{\"a\": 1} x", &values, &err));
+  EXPECT_EQ("trailing data at offset 9", err);
+}
@@ -17,6 +17,128 @@
 #include <ninja/lexer.hpp>
 #include <ninja/util.hpp>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  include <immintrin.h>
+#  define NINJA_LEXER_SIMD 1
+#endif
+
+namespace {
+
+/// @return true if @a c ends a run of literal text in ReadEvalString, i.e.
+/// it starts a $-escape or is one of the path and value delimiters.
+inline bool
+IsLiteralTextEnd(unsigned char c) {
+  return c == '$' || c == ' ' || c == ':' || c == '|' || c == '\r'
+         || c == '\n' || c == '\0';
+}
+
+/// Return the end of the run of literal text starting at @a p.  The input
+/// is NUL-terminated at @a end, which also ends any run.
+const char*
+ScanLiteralTextScalar(const char* p, const char* /*end*/) {
+  while (!IsLiteralTextEnd(static_cast<unsigned char>(*p)))
+    ++p;
+  return p;
+}
+
+#ifdef NINJA_LEXER_SIMD
+// The vectorized scanners only load whole blocks that lie before the
+// terminating NUL and leave the remainder to the scalar loop.
+
+__attribute__((target("sse2"))) const char*
+ScanLiteralTextSSE2(const char* p, const char* end) {
+  const __m128i dollar = _mm_set1_epi8('$');
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i colon = _mm_set1_epi8(':');
+  const __m128i pipe = _mm_set1_epi8('|');
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i nul = _mm_setzero_si128();
+  while (end - p >= 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i hits = _mm_or_si128(
+        _mm_or_si128(
+            _mm_or_si128(
+                _mm_cmpeq_epi8(chunk, dollar), _mm_cmpeq_epi8(chunk, space)
+            ),
+            _mm_or_si128(
+                _mm_cmpeq_epi8(chunk, colon), _mm_cmpeq_epi8(chunk, pipe)
+            )
+        ),
+        _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf)),
+            _mm_cmpeq_epi8(chunk, nul)
+        )
+    );
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 16;
+  }
+  return ScanLiteralTextScalar(p, end);
+}
+
+__attribute__((target("avx2"))) const char*
+ScanLiteralTextAVX2(const char* p, const char* end) {
+  const __m256i dollar = _mm256_set1_epi8('$');
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i colon = _mm256_set1_epi8(':');
+  const __m256i pipe = _mm256_set1_epi8('|');
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i nul = _mm256_setzero_si256();
+  while (end - p >= 32) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i hits = _mm256_or_si256(
+        _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_cmpeq_epi8(chunk, dollar),
+                _mm256_cmpeq_epi8(chunk, space)
+            ),
+            _mm256_or_si256(
+                _mm256_cmpeq_epi8(chunk, colon), _mm256_cmpeq_epi8(chunk, pipe)
+            )
+        ),
+        _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_cmpeq_epi8(chunk, cr), _mm256_cmpeq_epi8(chunk, lf)
+            ),
+            _mm256_cmpeq_epi8(chunk, nul)
+        )
+    );
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hits));
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 32;
+  }
+  return ScanLiteralTextSSE2(p, end);
+}
+#endif // NINJA_LEXER_SIMD
+
+using ScanLiteralTextFunc = const char* (*)(const char*, const char*);
+
+ScanLiteralTextFunc
+SelectScanLiteralText() {
+#ifdef NINJA_LEXER_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return ScanLiteralTextAVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return ScanLiteralTextSSE2;
+#endif
+  return ScanLiteralTextScalar;
+}
+
+/// Find the end of the run of literal text starting at @a p with the best
+/// scanner the CPU supports.
+const char*
+ScanLiteralText(const char* p, const char* end) {
+  static const ScanLiteralTextFunc scan = SelectScanLiteralText();
+  return scan(p, end);
+}
+
+} // namespace
+
 bool
 Lexer::Error(const std::string& message, std::string* err) {
   // Compute line/column.
@@ -231,8 +353,16 @@ Lexer::ReadEvalString(EvalString* eval, bool path, std::string* err) {
   const char* p = ofs_;
   const char* q;
   const char* start;
+  const char* end = input_.data() + input_.size();
   for (;;) {
     start = p;
+    // Hand whole runs of literal text to the vectorized scanner; this is
+    // the same match as the first rule below.
+    p = ScanLiteralText(p, end);
+    if (p != start) {
+      eval->AddText(std::string_view(start, p - start));
+      continue;
+    }
     /*!re2c
     [^$ :\r\n|\000]+ {
       eval->AddText(std::string_view(start, p - start));
@@ -34,6 +34,29 @@ TEST(Lexer, ReadEvalStringEscapes) {
   EXPECT_EQ("[ $ab c: cde]", eval.Serialize());
 }
 
+TEST(Lexer, ReadEvalStringLongText) {
+  // Put each delimiter at every offset of a text run longer than the blocks
+  // consumed by the vectorized scanners.
+  const char* kDelimiters[] = { "$$", " ", ":", "|", "\r\n", "\n" };
+  for (const char* delim : kDelimiters) {
+    for (size_t len = 0; len < 70; ++len) {
+      std::string text(len, 'a');
+      std::string input = text + delim + "b\n";
+      Lexer lexer(input.c_str());
+      EvalString eval;
+      std::string err;
+      EXPECT_TRUE(lexer.ReadPath(&eval, &err));
+      EXPECT_EQ("", err);
+      if (delim[0] == '$')
+        EXPECT_EQ("[" + text + "$b]", eval.Serialize());
+      else if (len == 0)
+        EXPECT_EQ("", eval.Serialize());
+      else
+        EXPECT_EQ("[" + text + "]", eval.Serialize());
+    }
+  }
+}
+
 TEST(Lexer, ReadIdent) {
   Lexer lexer("foo baR baz_123 foo-bar");
   std::string ident;
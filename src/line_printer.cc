@@ -84,7 +84,7 @@ LinePrinter::PrintOrBuffer(const char* data, size_t size) {
 }
 
 void
-LinePrinter::PrintOnNewLine(const std::string& to_print) {
+LinePrinter::PrintOnNewLine(std::string_view to_print) {
   if (console_locked_ && !line_buffer_.empty()) {
     output_buffer_.append(line_buffer_);
     output_buffer_.append(1, '\n');
@@ -94,9 +94,9 @@ LinePrinter::PrintOnNewLine(const std::string& to_print) {
     PrintOrBuffer("\n", 1);
   }
   if (!to_print.empty()) {
-    PrintOrBuffer(&to_print[0], to_print.size());
+    PrintOrBuffer(to_print.data(), to_print.size());
   }
-  have_blank_line_ = to_print.empty() || *to_print.rbegin() == '\n';
+  have_blank_line_ = to_print.empty() || to_print.back() == '\n';
 }
 
 void
@@ -16,6 +16,7 @@
 #include <cstdlib>
 #include <ninja/graph.hpp>
 #include <ninja/manifest_parser.hpp>
+#include <ninja/manifest_reload.hpp>
 #include <ninja/state.hpp>
 #include <ninja/util.hpp>
 #include <ninja/version.hpp>
@@ -24,15 +25,18 @@
 ManifestParser::ManifestParser(
     State* state, FileReader* file_reader, ManifestParserOptions options
 )
-    : Parser(state, file_reader), options_(options), quiet_(false) {
+    : Parser(state, file_reader), options_(options), quiet_(false),
+      reloader_(nullptr) {
   env_ = &state->bindings_;
 }
 
 bool
 ManifestParser::Parse(
-    const std::string& filename, const std::string& input, std::string* err
+    const std::string& filename, std::string_view input, std::string* err
 ) {
   lexer_.Start(filename, input);
+  if (reloader_)
+    reloader_->FileLoaded(filename, input);
 
   for (;;) {
     Lexer::Token token = lexer_.ReadToken();
@@ -64,6 +68,8 @@ ManifestParser::Parse(
         // before encountering any syntactic surprises.
         if (name == "ninja_required_version")
           CheckNinjaVersion(value);
+        if (reloader_)
+          reloader_->ScopeChanged(env_);
         env_->AddBinding(name, value);
         break;
       }
@@ -124,6 +130,8 @@ ManifestParser::ParsePool(std::string* err) {
   if (depth < 0)
     return lexer_.Error("expected 'depth =' line", err);
 
+  if (reloader_)
+    reloader_->PoolAdded();
   state_->AddPool(new Pool(name, depth));
   return true;
 }
@@ -169,6 +177,8 @@ ManifestParser::ParseRule(std::string* err) {
   if (rule->bindings_["command"].empty())
     return lexer_.Error("expected 'command =' line", err);
 
+  if (reloader_)
+    reloader_->ScopeChanged(env_);
   env_->AddRule(rule);
   return true;
 }
@@ -353,6 +363,8 @@ ManifestParser::ParseEdge(std::string* err) {
               path.c_str()
           );
         }
+        if (reloader_)
+          reloader_->DuplicateOutput();
         if (e - i <= static_cast<size_t>(implicit_outs))
           --implicit_outs;
       }
@@ -442,9 +454,14 @@ ManifestParser::ParseFileInclude(bool new_scope, std::string* err) {
   } else {
     subparser.env_ = env_;
   }
+  subparser.reloader_ = reloader_;
 
+  if (reloader_ && new_scope)
+    reloader_->SubninjaBegin(subparser.env_);
   if (!subparser.Load(path, err, &lexer_))
     return false;
+  if (reloader_ && new_scope)
+    reloader_->SubninjaEnd();
 
   if (!ExpectToken(Lexer::NEWLINE, err))
     return false;
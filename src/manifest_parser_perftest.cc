@@ -27,6 +27,7 @@
 #  include <unistd.h>
 #else
 #  include <getopt.h>
+#  include <sys/resource.h>
 #  include <unistd.h>
 #endif
 
@@ -120,4 +121,16 @@ main(int argc, char* argv[]) {
   int max = *max_element(times.begin(), times.end());
   float total = accumulate(times.begin(), times.end(), 0.0f);
   printf("min %dms  max %dms  avg %.1fms\n", min, max, total / times.size());
+
+#ifndef _AIX
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#  ifdef __APPLE__
+    long max_rss_kb = usage.ru_maxrss / 1024;
+#  else
+    long max_rss_kb = usage.ru_maxrss;
+#  endif
+    printf("peak RSS %ldKB\n", max_rss_kb);
+  }
+#endif
 }
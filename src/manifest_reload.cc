@@ -0,0 +1,526 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cassert>
+#include <ninja/build_log.hpp>
+#include <ninja/disk_interface.hpp>
+#include <ninja/graph.hpp>
+#include <ninja/manifest_reload.hpp>
+#include <ninja/metrics.hpp>
+#include <ninja/state.hpp>
+#include <unordered_map>
+
+ManifestReloader::ManifestReloader(
+    State* state, DiskInterface* disk_interface, ManifestParserOptions options
+)
+    : state_(state), disk_interface_(disk_interface), options_(options),
+      root_(new Unit), current_(root_.get()), version_(0), pools_version_(0),
+      parsed_edges_(0), parsed_files_(0), duplicate_outputs_(false) {
+  root_->env = &state_->bindings_;
+  root_->edges_begin = root_->edges_end = state_->edges_.size();
+}
+
+ManifestReloader::~ManifestReloader() = default;
+
+void
+ManifestReloader::FileLoaded(
+    const std::string& path, std::string_view contents
+) {
+  std::string err;
+  File file;
+  file.path = path;
+  // A failed stat just means the file will be reparsed next time.
+  file.mtime = disk_interface_->Stat(path, &err);
+  file.hash = BuildLog::LogEntry::HashCommand(contents);
+  current_->files.push_back(file);
+  ++parsed_files_;
+}
+
+void
+ManifestReloader::SubninjaBegin(BindingEnv* env) {
+  std::unique_ptr<Unit> unit(new Unit);
+  unit->parent = current_;
+  unit->env = env;
+  unit->edges_begin = state_->edges_.size();
+  unit->version = ++version_;
+  unit->pools_at_begin = state_->pools_.size();
+  unit->defaults_at_begin = state_->defaults_.size();
+  current_->children.push_back(std::move(unit));
+  current_ = current_->children.back().get();
+}
+
+void
+ManifestReloader::SubninjaEnd() {
+  current_->edges_end = state_->edges_.size();
+  current_->self_contained =
+      state_->pools_.size() == current_->pools_at_begin
+      && state_->defaults_.size() == current_->defaults_at_begin;
+  current_ = current_->parent;
+}
+
+void
+ManifestReloader::ScopeChanged(BindingEnv* env) {
+  scope_versions_[env] = ++version_;
+}
+
+void
+ManifestReloader::PoolAdded() {
+  pools_version_ = ++version_;
+}
+
+void
+ManifestReloader::DuplicateOutput() {
+  duplicate_outputs_ = true;
+}
+
+void
+ManifestReloader::ParseFinished() {
+  assert(current_ == root_.get());
+  root_->edges_end = state_->edges_.size();
+  parsed_edges_ = state_->edges_.size();
+  parsed_implicit_deps_.resize(parsed_edges_);
+  for (size_t i = 0; i < parsed_edges_; ++i)
+    parsed_implicit_deps_[i] = state_->edges_[i]->implicit_deps_;
+}
+
+bool
+ManifestReloader::Reload(std::string* err) {
+  METRIC_RECORD("manifest reload");
+  parsed_files_ = 0;
+
+  if (duplicate_outputs_) {
+    *err = "several edges generate the same output";
+    return false;
+  }
+
+  for (size_t i = 0; i < parsed_edges_; ++i) {
+    Edge* edge = state_->edges_[i].get();
+    if (edge->dyndep_ && !edge->dyndep_->dyndep_pending()) {
+      *err = "dyndep file '" + edge->dyndep_->path() + "' has been loaded";
+      return false;
+    }
+  }
+
+  for (const File& file : root_->files) {
+    if (FileChanged(file)) {
+      *err = "'" + file.path + "' changed";
+      return false;
+    }
+  }
+
+  std::vector<Unit*> changed;
+  for (const std::unique_ptr<Unit>& child : root_->children)
+    CollectChangedUnits(child.get(), &changed);
+  for (const Unit* unit : changed) {
+    if (!CanReparse(unit, err))
+      return false;
+  }
+
+  std::set<Node*> touched;
+  RevertBuildChanges(&touched);
+
+  // Reparse from the back so that the edge ranges of the units still to be
+  // reparsed stay valid.
+  std::sort(changed.begin(), changed.end(), [](const Unit* a, const Unit* b) {
+    return a->edges_begin > b->edges_begin;
+  });
+  for (Unit* unit : changed) {
+    if (!Reparse(unit, &touched, err))
+      return false;
+    // The reparsed file may clash with one that comes after it, which would
+    // keep the output in a full parse.
+    if (duplicate_outputs_) {
+      *err = "several edges generate the same output";
+      return false;
+    }
+  }
+
+  if (!FixNodes(touched, err))
+    return false;
+
+  ParseFinished();
+  state_->Reset();
+  return true;
+}
+
+void
+ManifestReloader::CollectChangedUnits(
+    Unit* unit, std::vector<Unit*>* changed
+) const {
+  for (const File& file : unit->files) {
+    if (FileChanged(file)) {
+      changed->push_back(unit);
+      return;
+    }
+  }
+  for (const std::unique_ptr<Unit>& child : unit->children)
+    CollectChangedUnits(child.get(), changed);
+}
+
+bool
+ManifestReloader::FileChanged(const File& file) const {
+  // If the file can't be checked, parsing it again reports the problem.
+  std::string err;
+  TimeStamp mtime = disk_interface_->Stat(file.path, &err);
+  if (mtime <= 0)
+    return true;
+  if (mtime == file.mtime)
+    return false;
+
+  // Generators commonly rewrite all of their output, so look at the
+  // contents before deciding that the file needs to be parsed again.
+  std::string contents;
+  std::string read_err;
+  if (disk_interface_->ReadFile(file.path, &contents, &read_err)
+      != FileReader::Okay)
+    return true;
+  return BuildLog::LogEntry::HashCommand(contents) != file.hash;
+}
+
+bool
+ManifestReloader::CanReparse(const Unit* unit, std::string* err) const {
+  const std::string& path = unit->files.front().path;
+  if (!unit->self_contained) {
+    *err = "'" + path + "' declares pools or default targets";
+    return false;
+  }
+  if (pools_version_ > unit->version) {
+    *err = "pools are declared after '" + path + "'";
+    return false;
+  }
+  // Parsing the file again would see bindings and rules of the enclosing
+  // scopes which were added after the subninja statement.
+  for (const Unit* parent = unit->parent; parent; parent = parent->parent) {
+    std::map<BindingEnv*, uint64_t>::const_iterator i =
+        scope_versions_.find(parent->env);
+    if (i != scope_versions_.end() && i->second > unit->version) {
+      *err = "scope of '" + path + "' changes after it is loaded";
+      return false;
+    }
+  }
+  return true;
+}
+
+void
+ManifestReloader::RevertBuildChanges(std::set<Node*>* touched) {
+  // Drop the phony edges that were created for the dependencies of edges
+  // with depfiles.
+  for (size_t i = parsed_edges_; i < state_->edges_.size(); ++i) {
+    Edge* edge = state_->edges_[i].get();
+    assert(edge->generated_by_dep_loader_);
+    for (Node* output : edge->outputs_) {
+      if (output->in_edge() == edge)
+        output->set_in_edge(nullptr);
+      touched->insert(output);
+    }
+  }
+  state_->edges_.resize(parsed_edges_);
+
+  // Remove the dependencies that were loaded by the build, and those that
+  // dyndep files inserted after the implicit dependencies from the manifest.
+  std::unordered_map<Node*, std::unordered_map<const Edge*, int>> removed;
+  for (size_t i = 0; i < parsed_edges_; ++i) {
+    Edge* edge = state_->edges_[i].get();
+    edge->deps_missing_ = false;
+    edge->command_start_time_ = 0;
+    for (Node* n : edge->loaded_deps())
+      ++removed[n][edge];
+    edge->loaded_deps_.reset();
+    int loaded = edge->implicit_deps_ - parsed_implicit_deps_[i];
+    if (loaded == 0)
+      continue;
+    std::vector<Node*>::iterator end =
+        edge->inputs_.end() - edge->order_only_deps_;
+    for (std::vector<Node*>::iterator n = end - loaded; n != end; ++n)
+      ++removed[*n][edge];
+    edge->inputs_.erase(end - loaded, end);
+    edge->implicit_deps_ = parsed_implicit_deps_[i];
+  }
+  for (auto& node : removed) {
+    std::unordered_map<const Edge*, int>& edges = node.second;
+    node.first->RemoveOutEdgesIf([&edges](const Edge* edge) {
+      std::unordered_map<const Edge*, int>::iterator i = edges.find(edge);
+      if (i == edges.end() || i->second == 0)
+        return false;
+      --i->second;
+      return true;
+    });
+    touched->insert(node.first);
+  }
+}
+
+bool
+ManifestReloader::Reparse(
+    Unit* unit, std::set<Node*>* touched, std::string* err
+) {
+  const size_t begin = unit->edges_begin;
+  const size_t end = unit->edges_end;
+  RemoveEdges(begin, end, touched);
+
+  Unit* parent = unit->parent;
+  const size_t slot = std::find_if(
+                          parent->children.begin(), parent->children.end(),
+                          [unit](const std::unique_ptr<Unit>& child) {
+                            return child.get() == unit;
+                          }
+                      )
+                      - parent->children.begin();
+  assert(slot < parent->children.size());
+  std::string path = unit->files.front().path;
+
+  // Parse the file the same way ManifestParser::ParseFileInclude does, at
+  // the end of the edge list.
+  const size_t parse_begin = state_->edges_.size();
+  ManifestParser parser(state_, disk_interface_, options_);
+  parser.env_ = new BindingEnv(parent->env);
+  parser.reloader_ = this;
+  current_ = parent;
+  SubninjaBegin(parser.env_);
+  bool loaded = parser.Load(path, err);
+  SubninjaEnd();
+  std::unique_ptr<Unit> reparsed = std::move(parent->children.back());
+  parent->children.pop_back();
+  current_ = root_.get();
+  if (!loaded)
+    return false;
+  if (!reparsed->self_contained) {
+    *err = "'" + path + "' declares pools or default targets";
+    return false;
+  }
+
+  // Move the new edges to where the old ones were.
+  const size_t count = state_->edges_.size() - parse_begin;
+  std::rotate(
+      state_->edges_.begin() + begin, state_->edges_.begin() + parse_begin,
+      state_->edges_.end()
+  );
+  for (size_t i = begin; i < state_->edges_.size(); ++i)
+    state_->edges_[i]->id_ = i;
+  for (size_t i = begin; i < begin + count; ++i) {
+    const Edge* edge = state_->edges_[i].get();
+    touched->insert(edge->inputs_.begin(), edge->inputs_.end());
+    touched->insert(edge->outputs_.begin(), edge->outputs_.end());
+    touched->insert(edge->validations_.begin(), edge->validations_.end());
+  }
+
+  ShiftEdges(
+      reparsed.get(),
+      static_cast<ptrdiff_t>(begin) - static_cast<ptrdiff_t>(parse_begin)
+  );
+  const ptrdiff_t shift =
+      static_cast<ptrdiff_t>(count) - static_cast<ptrdiff_t>(end - begin);
+  reparsed->version = unit->version;
+  parent->children[slot] = std::move(reparsed);
+  unit = parent->children[slot].get();
+
+  for (Unit* p = parent; p; p = p->parent)
+    p->edges_end += shift;
+  bool after = false;
+  ShiftFollowingEdges(root_.get(), unit, shift, &after);
+  return true;
+}
+
+void
+ManifestReloader::RemoveEdges(
+    size_t begin, size_t end, std::set<Node*>* touched
+) {
+  std::set<Node*> nodes;
+  for (size_t i = begin; i < end; ++i) {
+    Edge* edge = state_->edges_[i].get();
+    for (Node* node : edge->inputs_)
+      nodes.insert(node);
+    for (Node* node : edge->validations_)
+      nodes.insert(node);
+    for (Node* node : edge->outputs_) {
+      if (node->in_edge() == edge)
+        node->set_in_edge(nullptr);
+      touched->insert(node);
+    }
+  }
+
+  // Edge ids are indices into State::edges_.
+  auto in_range = [begin, end](const Edge* edge) {
+    return edge->id_ >= begin && edge->id_ < end;
+  };
+  for (Node* node : nodes) {
+    node->RemoveOutEdgesIf(in_range);
+    node->RemoveValidationOutEdgesIf(in_range);
+    touched->insert(node);
+  }
+  state_->edges_.erase(
+      state_->edges_.begin() + begin, state_->edges_.begin() + end
+  );
+}
+
+void
+ManifestReloader::ShiftEdges(Unit* unit, ptrdiff_t shift) {
+  unit->edges_begin += shift;
+  unit->edges_end += shift;
+  for (const std::unique_ptr<Unit>& child : unit->children)
+    ShiftEdges(child.get(), shift);
+}
+
+void
+ManifestReloader::ShiftFollowingEdges(
+    Unit* unit, const Unit* replaced, ptrdiff_t shift, bool* after
+) {
+  if (unit == replaced) {
+    *after = true;
+    return;
+  }
+  if (*after) {
+    ShiftEdges(unit, shift);
+    return;
+  }
+  for (const std::unique_ptr<Unit>& child : unit->children)
+    ShiftFollowingEdges(child.get(), replaced, shift, after);
+}
+
+bool
+ManifestReloader::FixNodes(const std::set<Node*>& touched, std::string* err) {
+  for (Node* node : touched) {
+    node->SortOutEdges();
+
+    bool dyndep_pending = false;
+    for (const Edge* edge : node->out_edges())
+      dyndep_pending = dyndep_pending || edge->dyndep_ == node;
+    node->set_dyndep_pending(dyndep_pending);
+
+    // Nodes known to the deps log must stay, a full parse would have
+    // created them when loading it.
+    if (node->in_edge() || !node->out_edges().empty()
+        || !node->validation_out_edges().empty() || node->id() >= 0)
+      continue;
+    if (std::find(state_->defaults_.begin(), state_->defaults_.end(), node)
+        != state_->defaults_.end()) {
+      *err = "default target '" + node->path() + "' no longer exists";
+      return false;
+    }
+    state_->paths_.Erase(node->path(), HashPath(node->path()));
+  }
+  return true;
+}
+
+namespace {
+
+std::string
+DescribeNodes(const std::vector<Node*>& nodes) {
+  std::string result;
+  for (const Node* node : nodes) {
+    if (!result.empty())
+      result += ' ';
+    result += node->path();
+  }
+  return result;
+}
+
+std::string
+DescribeEdges(const EdgeList& edges) {
+  std::string result;
+  for (const Edge* edge : edges) {
+    if (!result.empty())
+      result += ' ';
+    result += std::to_string(edge->id_);
+  }
+  return result;
+}
+
+std::string
+DescribeEdge(const Edge* edge) {
+  std::string result = edge->rule().name() + " " + edge->pool()->name() + " "
+                       + std::to_string(edge->implicit_deps_) + " "
+                       + std::to_string(edge->order_only_deps_) + " "
+                       + std::to_string(edge->implicit_outs_) + "\n";
+  result += DescribeNodes(edge->outputs_) + "\n";
+  result += DescribeNodes(edge->inputs_) + "\n";
+  result += DescribeNodes(edge->validations_) + "\n";
+  if (edge->dyndep_)
+    result += edge->dyndep_->path();
+  result += "\n" + edge->EvaluateCommand(true);
+  return result;
+}
+
+} // anonymous namespace
+
+bool
+ManifestReloader::Verify(std::string* err) const {
+  State state;
+  ManifestParser parser(&state, disk_interface_, options_);
+  parser.quiet_ = true;
+  if (!parser.Load(root_->files.front().path, err))
+    return false;
+
+  if (state.edges_.size() != state_->edges_.size()) {
+    *err = "expected " + std::to_string(state.edges_.size())
+           + " edges, got " + std::to_string(state_->edges_.size());
+    return false;
+  }
+  for (size_t i = 0; i < state.edges_.size(); ++i) {
+    std::string expected = DescribeEdge(state.edges_[i].get());
+    std::string actual = DescribeEdge(state_->edges_[i].get());
+    if (expected != actual) {
+      *err = "edge " + std::to_string(i) + " differs:\n" + expected
+             + "\n---\n" + actual;
+      return false;
+    }
+  }
+
+  for (const auto& path : state_->paths_) {
+    const Node* node = path.second.get();
+    const Node* expected = state.LookupNode(path.first, path.hash);
+    if (!expected) {
+      if (node->id() >= 0 && !node->in_edge() && node->out_edges().empty()
+          && node->validation_out_edges().empty())
+        continue;
+      *err = "unexpected node '" + node->path() + "'";
+      return false;
+    }
+    if (DescribeEdges(node->out_edges())
+            != DescribeEdges(expected->out_edges())
+        || DescribeEdges(node->validation_out_edges())
+               != DescribeEdges(expected->validation_out_edges())
+        || (node->in_edge() ? node->in_edge()->id_ : -1)
+               != (expected->in_edge() ? expected->in_edge()->id_ : -1)
+        || node->dyndep_pending() != expected->dyndep_pending()) {
+      *err = "node '" + node->path() + "' differs";
+      return false;
+    }
+  }
+  for (const auto& path : state.paths_) {
+    if (!state_->LookupNode(path.first, path.hash)) {
+      *err = "missing node '" + path.second->path() + "'";
+      return false;
+    }
+  }
+
+  if (DescribeNodes(state.defaults_) != DescribeNodes(state_->defaults_)) {
+    *err = "default targets differ";
+    return false;
+  }
+  if (state.pools_.size() != state_->pools_.size()) {
+    *err = "pools differ";
+    return false;
+  }
+  for (const auto& pool : state.pools_) {
+    const Pool* actual = state_->pools_.count(pool.first)
+                             ? state_->pools_.at(pool.first)
+                             : nullptr;
+    if (!actual || actual->depth() != pool.second->depth()) {
+      *err = "pool '" + pool.first + "' differs";
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,213 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <memory>
+#include <ninja/graph.hpp>
+#include <ninja/manifest_parser.hpp>
+#include <ninja/manifest_reload.hpp>
+#include <ninja/state.hpp>
+#include <ninja/test.hpp>
+
+namespace {
+
+struct ManifestReloadTest : public testing::Test {
+  ManifestReloadTest() {
+    options_.dupe_edge_action_ = kDupeEdgeActionError;
+  }
+
+  void
+  Load() {
+    reloader_.reset(new ManifestReloader(&state_, &fs_, options_));
+    ManifestParser parser(&state_, &fs_, options_);
+    parser.set_reloader(reloader_.get());
+    std::string err;
+    EXPECT_TRUE(parser.Load("build.ninja", &err));
+    ASSERT_EQ("", err);
+    reloader_->ParseFinished();
+  }
+
+  /// Reload and check that the result matches a full parse.
+  void
+  AssertReload(int parsed_files) {
+    std::string err;
+    EXPECT_TRUE(reloader_->Reload(&err));
+    ASSERT_EQ("", err);
+    EXPECT_EQ(parsed_files, reloader_->parsed_files());
+    EXPECT_TRUE(reloader_->Verify(&err));
+    ASSERT_EQ("", err);
+    VerifyGraph(state_);
+  }
+
+  ManifestParserOptions options_;
+  State state_;
+  VirtualFileSystem fs_;
+  std::unique_ptr<ManifestReloader> reloader_;
+};
+
+const char kRoot[] =
+    "rule cat\n"
+    "  command = cat $in > $out\n"
+    "subninja a.ninja\n"
+    "subninja b.ninja\n"
+    "build all: phony a1 b1\n"
+    "default all\n";
+
+TEST_F(ManifestReloadTest, Unchanged) {
+  fs_.Create("build.ninja", kRoot);
+  fs_.Create("a.ninja", "build a1: cat in\n");
+  fs_.Create("b.ninja", "build b1: cat a1\n");
+  ASSERT_NO_FATAL_FAILURE(Load());
+
+  // Rewriting a file with the same contents doesn't require parsing it.
+  fs_.Tick();
+  fs_.Create("build.ninja", kRoot);
+  fs_.Create("a.ninja", "build a1: cat in\n");
+  ASSERT_NO_FATAL_FAILURE(AssertReload(0));
+}
+
+TEST_F(ManifestReloadTest, ChangedSubninja) {
+  fs_.Create("build.ninja", kRoot);
+  fs_.Create(
+      "a.ninja",
+      "build a1: cat in\n"
+      "build a2: cat a1 |@ b1\n"
+  );
+  fs_.Create(
+      "b.ninja",
+      "x = 1\n"
+      "include b_inc.ninja\n"
+      "build b1: cat a2 in\n"
+  );
+  fs_.Create("b_inc.ninja", "build b$x$x: cat a1\n");
+  ASSERT_NO_FATAL_FAILURE(Load());
+
+  fs_.Tick();
+  fs_.Create(
+      "a.ninja",
+      "build a1: cat in other\n"
+      "build a3: cat a1\n"
+      "build a2: cat a3\n"
+  );
+  ASSERT_NO_FATAL_FAILURE(AssertReload(1));
+  EXPECT_EQ(3u, state_.LookupNode("a1")->out_edges().size());
+  EXPECT_TRUE(state_.LookupNode("b1")->validation_out_edges().empty());
+
+  fs_.Tick();
+  fs_.Create("b_inc.ninja", "build b$x$x: cat a3\n");
+  ASSERT_NO_FATAL_FAILURE(AssertReload(2));
+  EXPECT_EQ(2u, state_.LookupNode("a1")->out_edges().size());
+}
+
+TEST_F(ManifestReloadTest, NestedSubninja) {
+  fs_.Create("build.ninja", kRoot);
+  fs_.Create(
+      "a.ninja",
+      "build a1: cat in\n"
+      "subninja c.ninja\n"
+      "build a2: cat c1\n"
+  );
+  fs_.Create("b.ninja", "build b1: cat a2\n");
+  fs_.Create("c.ninja", "build c1: cat a1\n");
+  ASSERT_NO_FATAL_FAILURE(Load());
+
+  fs_.Tick();
+  fs_.Create(
+      "c.ninja",
+      "build c0: cat in\n"
+      "build c1: cat c0\n"
+  );
+  ASSERT_NO_FATAL_FAILURE(AssertReload(1));
+
+  fs_.Tick();
+  fs_.Create(
+      "a.ninja",
+      "subninja c.ninja\n"
+      "build a1: cat c1\n"
+      "build a2: cat c1\n"
+  );
+  fs_.Create("b.ninja", "build b1: cat a2 c0\n");
+  ASSERT_NO_FATAL_FAILURE(AssertReload(3));
+}
+
+TEST_F(ManifestReloadTest, LoadedDeps) {
+  fs_.Create(
+      "build.ninja",
+      "rule cc\n"
+      "  command = cc $in\n"
+      "  depfile = $out.d\n"
+      "subninja a.ninja\n"
+  );
+  fs_.Create("a.ninja", "build out: cc in\n");
+  fs_.Create("out.d", "out: in in.h\n");
+  ASSERT_NO_FATAL_FAILURE(Load());
+
+  DependencyScan scan(&state_, nullptr, nullptr, &fs_, nullptr);
+  std::string err;
+  EXPECT_TRUE(scan.RecomputeDirty(state_.LookupNode("out"), nullptr, &err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(2u, state_.LookupNode("out")->in_edge()->loaded_deps().size());
+  ASSERT_EQ(3u, state_.edges_.size());
+
+  fs_.Tick();
+  fs_.Create("a.ninja", "build out: cc in in2\n");
+  ASSERT_NO_FATAL_FAILURE(AssertReload(1));
+  EXPECT_EQ(nullptr, state_.LookupNode("in.h"));
+  EXPECT_FALSE(state_.LookupNode("out")->status_known());
+}
+
+TEST_F(ManifestReloadTest, Fallback) {
+  fs_.Create(
+      "build.ninja",
+      "rule cat\n"
+      "  command = cat $in > $out\n"
+      "subninja a.ninja\n"
+      "x = 1\n"
+  );
+  fs_.Create("a.ninja", "build a1: cat in\n");
+  ASSERT_NO_FATAL_FAILURE(Load());
+
+  // The scope of a.ninja changed after it was loaded.
+  std::string err;
+  fs_.Tick();
+  fs_.Create("a.ninja", "build a1: cat in$x\n");
+  EXPECT_FALSE(reloader_->Reload(&err));
+  EXPECT_EQ("scope of 'a.ninja' changes after it is loaded", err);
+
+  // The top-level file always requires a full parse.
+  fs_.Create("build.ninja", "");
+  EXPECT_FALSE(reloader_->Reload(&err));
+  EXPECT_EQ("'build.ninja' changed", err);
+}
+
+// With -w dupbuild=warn, files are reloaded unless edges clash.
+TEST_F(ManifestReloadTest, DupbuildWarn) {
+  options_.dupe_edge_action_ = kDupeEdgeActionWarn;
+  fs_.Create("build.ninja", kRoot);
+  fs_.Create("a.ninja", "build a1: cat in\n");
+  fs_.Create("b.ninja", "build b1: cat a1\n");
+  ASSERT_NO_FATAL_FAILURE(Load());
+
+  fs_.Tick();
+  fs_.Create("a.ninja", "build a1: cat in other\n");
+  ASSERT_NO_FATAL_FAILURE(AssertReload(1));
+
+  // In a full parse, a.ninja would keep b1.
+  std::string err;
+  fs_.Tick();
+  fs_.Create("a.ninja", "build a1 b1: cat in\n");
+  EXPECT_FALSE(reloader_->Reload(&err));
+  EXPECT_EQ("several edges generate the same output", err);
+}
+
+} // namespace
@@ -86,17 +86,20 @@ ScopedMetric::ScopedMetric(Metric* metric) {
 ScopedMetric::~ScopedMetric() {
   if (!metric_)
     return;
-  metric_->count++;
+  metric_->count.fetch_add(1, std::memory_order_relaxed);
   int64_t dt = TimerToMicros(HighResTimer() - start_);
-  metric_->sum += dt;
+  metric_->sum.fetch_add(dt, std::memory_order_relaxed);
 }
 
+Metrics::Metrics() : start_millis_(GetTimeMillis()) {}
+
 Metric*
 Metrics::NewMetric(const std::string& name) {
   Metric* metric = new Metric;
   metric->name = name;
   metric->count = 0;
   metric->sum = 0;
+  std::lock_guard<std::mutex> lock(mutex_);
   metrics_.push_back(metric);
   return metric;
 }
@@ -113,13 +116,36 @@ Metrics::Report() {
       "total (ms)"
   );
   for (Metric* metric : metrics_) {
+    int count = metric->count;
     double total = metric->sum / (double)1000;
-    double avg = metric->sum / (double)metric->count;
+    double avg = metric->sum / (double)count;
     printf(
-        "%-*s\t%-6d\t%-8.1f\t%.1f\n", width, metric->name.c_str(),
-        metric->count, avg, total
+        "%-*s\t%-6d\t%-8.1f\t%.1f\n", width, metric->name.c_str(), count,
+        avg, total
     );
   }
+
+  for (const Series& series : series_) {
+    printf("\n%s\n%-9s\t%s\n", series.name.c_str(), "time (ms)", "value");
+    for (const auto& value : series.values) {
+      printf(
+          "%-9lld\t%lld\n", (long long)value.first, (long long)value.second
+      );
+    }
+  }
+}
+
+void
+Metrics::RecordValue(const std::string& name, int64_t value) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<Series>::iterator series = std::find_if(
+      series_.begin(), series_.end(),
+      [&name](const Series& s) { return s.name == name; }
+  );
+  if (series == series_.end())
+    series = series_.insert(series_.end(), Series{name, {}});
+  if (series->values.empty() || series->values.back().second != value)
+    series->values.emplace_back(GetTimeMillis() - start_millis_, value);
 }
 
 uint64_t
@@ -18,6 +18,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
 
 #ifdef _AIX
 #  include "getopt.h"
@@ -39,11 +40,14 @@
 #include <ninja/graph.hpp>
 #include <ninja/graphviz.hpp>
 #include <ninja/json.hpp>
+#include <ninja/line_printer.hpp>
 #include <ninja/manifest_parser.hpp>
+#include <ninja/manifest_reload.hpp>
 #include <ninja/metrics.hpp>
 #include <ninja/missing_deps.hpp>
 #include <ninja/state.hpp>
 #include <ninja/status.hpp>
+#include <ninja/subprocess.hpp>
 #include <ninja/util.hpp>
 #include <ninja/version.hpp>
 
@@ -74,7 +78,9 @@ struct Options {
 struct NinjaMain : public BuildLogUser {
   NinjaMain(const char* ninja_command, const BuildConfig& config)
       : ninja_command_(ninja_command), config_(config),
-        start_time_millis_(GetTimeMillis()) {}
+        start_time_millis_(GetTimeMillis()) {
+    disk_interface_.set_use_io_uring(g_use_io_uring);
+  }
 
   /// Command line used to run Ninja.
   const char* ninja_command_;
@@ -94,6 +100,9 @@ struct NinjaMain : public BuildLogUser {
   BuildLog build_log_;
   DepsLog deps_log_;
 
+  /// Keeps track of the manifest files, for ReloadManifest().
+  std::unique_ptr<ManifestReloader> reloader_;
+
   /// The type of functions that are the entry points to tools (subcommands).
   typedef int (NinjaMain::*ToolFunc)(const Options*, int, char**);
 
@@ -154,17 +163,38 @@ struct NinjaMain : public BuildLogUser {
   bool
   OpenDepsLog(bool recompact_only = false);
 
+  /// Close the build and deps logs, waiting for the recompaction of either
+  /// to finish if it ran in the background.
+  void
+  CloseLogs() {
+    build_log_.Close();
+    deps_log_.Close();
+  }
+
   /// Ensure the build directory exists, creating it if necessary.
   /// @return false on error.
   bool
   EnsureBuildDirExists();
 
+  /// Load the manifest into |state_|.
+  /// @return false on error.
+  bool
+  LoadManifest(
+      const char* input_file, ManifestParserOptions options, std::string* err
+  );
+
   /// Rebuild the manifest, if necessary.
   /// Fills in \a err on error.
   /// @return true if the manifest was rebuilt.
   bool
   RebuildManifest(const char* input_file, std::string* err, Status* status);
 
+  /// Update |state_| after the manifest was rebuilt, parsing only the files
+  /// that changed.
+  /// @return false if the manifest has to be loaded from scratch.
+  bool
+  ReloadManifest();
+
   /// Build the targets listed on the command line.
   /// @return an exit code.
   int
@@ -195,6 +225,29 @@ struct NinjaMain : public BuildLogUser {
     return mtime == 0;
   }
 
+  /// Like IsPathDead(), but stats all the candidates at once.
+  virtual void
+  ArePathsDead(
+      const std::vector<std::string_view>& paths, std::vector<bool>* dead
+  ) const {
+    dead->assign(paths.size(), false);
+    std::vector<size_t> candidates;
+    std::vector<std::string_view> candidate_paths;
+    for (size_t i = 0; i < paths.size(); ++i) {
+      Node* n = state_.LookupNode(paths[i]);
+      if (n && n->in_edge())
+        continue;
+      candidates.push_back(i);
+      candidate_paths.push_back(paths[i]);
+    }
+    std::vector<TimeStamp> mtimes;
+    std::string err;
+    if (!disk_interface_.StatMany(candidate_paths, &mtimes, nullptr, &err))
+      Error("%s", err.c_str()); // Log and ignore Stat() errors.
+    for (size_t i = 0; i < candidates.size(); ++i)
+      (*dead)[candidates[i]] = mtimes[i] == 0;
+  }
+
   int64_t start_time_millis_;
 };
 
@@ -236,6 +289,14 @@ Usage(const BuildConfig& config) {
       "  --version      print ninja version (\"%s\")\n"
       "  -v, --verbose  show all command lines while building\n"
       "  --quiet        don't show progress status, just command output\n"
+      "  --output-limit=MB  keep at most MB of each command's output in memory,\n"
+      "                     the rest in a temporary file (0 means infinity)\n"
+      "                     [default=%d]\n"
+      "  --drain-grace=MS   with -d pidfd, read a command's output for at most\n"
+      "                     MS after it exits [default=%d]\n"
+      "  --pressure=N       run between N and -j jobs, fewer as Linux reports\n"
+      "                     more tasks stalling on the CPU, memory or IO; -j0\n"
+      "                     means the default -j here\n"
       "\n"
       "  -C DIR   change to DIR before doing anything else\n"
       "  -f FILE  specify input build file [default=build.ninja]\n"
@@ -249,7 +310,8 @@ Usage(const BuildConfig& config) {
       "  -t TOOL  run a subtool (use '-t list' to list subtools)\n"
       "    terminates toplevel options; further flags are passed to the tool\n"
       "  -w FLAG  adjust warnings (use '-w list' to list warnings)\n",
-      kNinjaVersion, config.parallelism
+      kNinjaVersion, static_cast<int>(config.max_output_size >> 20),
+      config.drain_grace_millis, config.parallelism
   );
 }
 
@@ -267,6 +329,21 @@ GuessParallelism() {
   }
 }
 
+bool
+NinjaMain::LoadManifest(
+    const char* input_file, ManifestParserOptions options, std::string* err
+) {
+  reloader_.reset(new ManifestReloader(&state_, &disk_interface_, options));
+  ManifestParser parser(&state_, &disk_interface_, options);
+  parser.set_reloader(reloader_.get());
+  if (!parser.Load(input_file, err))
+    return false;
+  reloader_->ParseFinished();
+  if (g_freeze_graph)
+    state_.FreezeGraph();
+  return true;
+}
+
 /// Rebuild the build manifest, if necessary.
 /// Returns true if the manifest was rebuilt.
 bool
@@ -309,6 +386,23 @@ NinjaMain::RebuildManifest(
   return true;
 }
 
+bool
+NinjaMain::ReloadManifest() {
+  std::string err;
+  if (!reloader_->Reload(&err)) {
+    EXPLAIN("loading manifest from scratch: %s", err.c_str());
+    return false;
+  }
+  EXPLAIN(
+      "reloaded manifest, %d file(s) parsed again", reloader_->parsed_files()
+  );
+  if (g_verify_reload && !reloader_->Verify(&err))
+    Fatal("reloaded manifest differs from a full parse: %s", err.c_str());
+  if (g_freeze_graph)
+    state_.FreezeGraph();
+  return true;
+}
+
 Node*
 NinjaMain::CollectTarget(const char* cpath, std::string* err) {
   std::string path = cpath;
@@ -446,7 +540,7 @@ NinjaMain::ToolQuery(const Options* options, int argc, char* argv[]) {
         printf("    %s\n", output->path().c_str());
       }
     }
-    const std::vector<Edge*> validation_edges = node->validation_out_edges();
+    const EdgeList& validation_edges = node->validation_out_edges();
     if (!validation_edges.empty()) {
       printf("  validation for:\n");
       for (Edge* validation_edge : validation_edges) {
@@ -1021,6 +1115,27 @@ NinjaMain::ToolRecompact(const Options* options, int argc, char* argv[]) {
   return 0;
 }
 
+/// Shows how far "-t restat" got stat()ing outputs.  Logs that aren't going
+/// to a terminal get a line every ten percent.
+struct RestatProgress : public StatProgress {
+  virtual void
+  StatProgressed(size_t done, size_t total) {
+    size_t percent = done * 100 / total;
+    if (!printer_.is_smart_terminal() && percent < next_percent_)
+      return;
+    next_percent_ = percent / 10 * 10 + 10;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "restat: %zu/%zu outputs", done, total);
+    printer_.Print(buf, LinePrinter::ELIDE);
+    if (done == total)
+      printer_.PrintOnNewLine("");
+  }
+
+private:
+  LinePrinter printer_;
+  size_t next_percent_ = 0;
+};
+
 int
 NinjaMain::ToolRestat(const Options* options, int argc, char* argv[]) {
   // The restat tool uses getopt, and expects argv[0] to contain the name of the
@@ -1064,7 +1179,9 @@ NinjaMain::ToolRestat(const Options* options, int argc, char* argv[]) {
     err.clear();
   }
 
-  bool success = build_log_.Restat(log_path, disk_interface_, argc, argv, &err);
+  RestatProgress progress;
+  bool success =
+      build_log_.Restat(log_path, disk_interface_, argc, argv, &progress, &err);
   if (!success) {
     Error("failed recompaction: %s", err.c_str());
     return EXIT_FAILURE;
@@ -1182,6 +1299,11 @@ DebugEnable(const std::string& name) {
         "  explain      explain what caused a command to execute\n"
         "  keepdepfile  don't delete depfiles after they're read by ninja\n"
         "  keeprsp      don't delete @response files on success\n"
+        "  freezegraph  pack the out-edges of all nodes together once parsed\n"
+        "  verifyreload check reloaded manifests against a full parse\n"
+        "  nouring      stat files with threads rather than io_uring\n"
+        "  spawner      start commands from a process forked at startup\n"
+        "  pidfd        notice commands exit even if their output stays open\n"
         "multiple modes can be enabled via -d FOO -d BAR\n"
     );
     return false;
@@ -1200,10 +1322,26 @@ DebugEnable(const std::string& name) {
   } else if (name == "nostatcache") {
     g_experimental_statcache = false;
     return true;
+  } else if (name == "freezegraph") {
+    g_freeze_graph = true;
+    return true;
+  } else if (name == "verifyreload") {
+    g_verify_reload = true;
+    return true;
+  } else if (name == "nouring") {
+    g_use_io_uring = false;
+    return true;
+  } else if (name == "spawner") {
+    g_use_spawner = true;
+    return true;
+  } else if (name == "pidfd") {
+    g_use_pidfd = true;
+    return true;
   } else {
     const char* suggestion = SpellcheckString(
         name.c_str(), "stats", "explain", "keepdepfile", "keeprsp",
-        "nostatcache", nullptr
+        "nostatcache", "freezegraph", "verifyreload", "nouring", "spawner",
+        "pidfd", nullptr
     );
     if (suggestion) {
       Error(
@@ -1343,10 +1481,10 @@ NinjaMain::DumpMetrics() {
 
   printf("\n");
   int count = (int)state_.paths_.size();
-  int buckets = (int)state_.paths_.bucket_count();
+  int slots = (int)state_.paths_.capacity();
   printf(
-      "path->node hash load %.2f (%d entries / %d buckets)\n",
-      count / (double)buckets, count, buckets
+      "path->node hash load %.2f (%d entries / %d slots)\n",
+      slots ? count / (double)slots : 0.0, count, slots
   );
 }
 
@@ -1454,12 +1592,21 @@ int
 ReadFlags(int* argc, char*** argv, Options* options, BuildConfig* config) {
   DeferGuessParallelism deferGuessParallelism(config);
 
-  enum { OPT_VERSION = 1, OPT_QUIET = 2 };
+  enum {
+    OPT_VERSION = 1,
+    OPT_QUIET = 2,
+    OPT_OUTPUT_LIMIT = 3,
+    OPT_DRAIN_GRACE = 4,
+    OPT_PRESSURE = 5
+  };
   const option kLongOptions[] = {
       {"help", no_argument, nullptr, 'h'},
       {"version", no_argument, nullptr, OPT_VERSION},
       {"verbose", no_argument, nullptr, 'v'},
       {"quiet", no_argument, nullptr, OPT_QUIET},
+      {"output-limit", required_argument, nullptr, OPT_OUTPUT_LIMIT},
+      {"drain-grace", required_argument, nullptr, OPT_DRAIN_GRACE},
+      {"pressure", required_argument, nullptr, OPT_PRESSURE},
       {nullptr, 0, nullptr, 0}};
 
   int opt;
@@ -1521,6 +1668,30 @@ ReadFlags(int* argc, char*** argv, Options* options, BuildConfig* config) {
       case OPT_QUIET:
         config->verbosity = BuildConfig::NO_STATUS_UPDATE;
         break;
+      case OPT_OUTPUT_LIMIT: {
+        char* end;
+        long value = strtol(optarg, &end, 10);
+        if (*end != 0 || value < 0)
+          Fatal("invalid --output-limit parameter");
+        config->max_output_size = static_cast<size_t>(value) << 20;
+        break;
+      }
+      case OPT_DRAIN_GRACE: {
+        char* end;
+        long value = strtol(optarg, &end, 10);
+        if (*end != 0 || value < 0 || value > INT_MAX)
+          Fatal("invalid --drain-grace parameter");
+        config->drain_grace_millis = static_cast<int>(value);
+        break;
+      }
+      case OPT_PRESSURE: {
+        char* end;
+        long value = strtol(optarg, &end, 10);
+        if (*end != 0 || value <= 0 || value > INT_MAX)
+          Fatal("invalid --pressure parameter");
+        config->pressure_floor = static_cast<int>(value);
+        break;
+      }
       case 'w':
         if (!WarningEnable(optarg, options))
           return 1;
@@ -1541,6 +1712,11 @@ ReadFlags(int* argc, char*** argv, Options* options, BuildConfig* config) {
   *argv += optind;
   *argc -= optind;
 
+  // Between the floor and an unlimited -j, the number of jobs would take
+  // ages to drop under pressure, and jump back up after a quiet moment.
+  if (config->pressure_floor && config->parallelism == INT_MAX)
+    config->parallelism = GuessParallelism();
+
   return -1;
 }
 
@@ -1582,53 +1758,65 @@ real_main(int argc, char** argv) {
     exit((ninja.*options.tool->func)(&options, argc, argv));
   }
 
+#ifndef _WIN32
+  // Fork the spawner before the manifest makes ninja big.
+  if (g_use_spawner)
+    SubprocessSet::StartSpawner();
+#endif
+
   // Limit number of rebuilds, to prevent infinite loops.
   const int kCycleLimit = 100;
+  std::unique_ptr<NinjaMain> ninja;
   for (int cycle = 1; cycle <= kCycleLimit; ++cycle) {
-    NinjaMain ninja(ninja_command, config);
-
-    ManifestParserOptions parser_opts;
-    if (options.dupe_edges_should_err) {
-      parser_opts.dupe_edge_action_ = kDupeEdgeActionError;
-    }
-    if (options.phony_cycle_should_err) {
-      parser_opts.phony_cycle_action_ = kPhonyCycleActionError;
-    }
-    ManifestParser parser(&ninja.state_, &ninja.disk_interface_, parser_opts);
     std::string err;
-    if (!parser.Load(options.input_file, &err)) {
-      status->Error("%s", err.c_str());
-      exit(1);
-    }
+    if (!ninja) {
+      ninja.reset(new NinjaMain(ninja_command, config));
 
-    if (options.tool && options.tool->when == Tool::RUN_AFTER_LOAD)
-      exit((ninja.*options.tool->func)(&options, argc, argv));
+      ManifestParserOptions parser_opts;
+      if (options.dupe_edges_should_err) {
+        parser_opts.dupe_edge_action_ = kDupeEdgeActionError;
+      }
+      if (options.phony_cycle_should_err) {
+        parser_opts.phony_cycle_action_ = kPhonyCycleActionError;
+      }
+      if (!ninja->LoadManifest(options.input_file, parser_opts, &err)) {
+        status->Error("%s", err.c_str());
+        exit(1);
+      }
 
-    if (!ninja.EnsureBuildDirExists())
-      exit(1);
+      if (options.tool && options.tool->when == Tool::RUN_AFTER_LOAD)
+        exit((ninja.get()->*options.tool->func)(&options, argc, argv));
 
-    if (!ninja.OpenBuildLog() || !ninja.OpenDepsLog())
-      exit(1);
+      if (!ninja->EnsureBuildDirExists())
+        exit(1);
 
-    if (options.tool && options.tool->when == Tool::RUN_AFTER_LOGS)
-      exit((ninja.*options.tool->func)(&options, argc, argv));
+      if (!ninja->OpenBuildLog() || !ninja->OpenDepsLog())
+        exit(1);
+
+      if (options.tool && options.tool->when == Tool::RUN_AFTER_LOGS)
+        exit((ninja.get()->*options.tool->func)(&options, argc, argv));
+    }
 
     // Attempt to rebuild the manifest before building anything else
-    if (ninja.RebuildManifest(options.input_file, &err, status)) {
+    if (ninja->RebuildManifest(options.input_file, &err, status)) {
       // In dry_run mode the regeneration will succeed without changing the
       // manifest forever. Better to return immediately.
       if (config.dry_run)
         exit(0);
-      // Start the build over with the new manifest.
+      // Start the build over with the new manifest.  Usually only a few of
+      // its files changed, so try to keep the loaded state and logs.
+      if (!ninja->ReloadManifest())
+        ninja.reset();
       continue;
     } else if (!err.empty()) {
       status->Error("rebuilding '%s': %s", options.input_file, err.c_str());
       exit(1);
     }
 
-    int result = ninja.RunBuild(argc, argv, status);
+    int result = ninja->RunBuild(argc, argv, status);
+    ninja->CloseLogs();
     if (g_metrics)
-      ninja.DumpMetrics();
+      ninja->DumpMetrics();
     exit(result);
   }
 
@@ -19,9 +19,9 @@
 bool
 Parser::Load(const std::string& filename, std::string* err, Lexer* parent) {
   METRIC_RECORD(".ninja parse");
-  std::string contents;
+  FileContents contents;
   std::string read_err;
-  if (file_reader_->ReadFile(filename, &contents, &read_err)
+  if (file_reader_->ReadFileContents(filename, &contents, &read_err)
       != FileReader::Okay) {
     *err = "loading '" + filename + "': " + read_err;
     if (parent)
@@ -29,7 +29,7 @@ Parser::Load(const std::string& filename, std::string* err, Lexer* parent) {
     return false;
   }
 
-  return Parse(filename, contents, err);
+  return Parse(filename, contents.view(), err);
 }
 
 bool
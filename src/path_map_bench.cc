@@ -0,0 +1,135 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares path lookups in PathMap, as done by State::LookupNode(), with the
+// std::unordered_map that State::paths_ used to be.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ninja/metrics.hpp>
+#include <ninja/path_map.hpp>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+/// Paths shaped like those of a large build: deep, with long shared prefixes.
+std::vector<std::string>
+CreatePaths(int count, const char* prefix) {
+  std::vector<std::string> paths;
+  paths.reserve(count);
+  for (int i = 0; i < count; ++i) {
+    paths.push_back(
+        std::string(prefix) + "obj/third_party/module" + std::to_string(i % 997)
+        + "/src/component" + std::to_string(i % 31) + "/file"
+        + std::to_string(i) + ".o"
+    );
+  }
+  return paths;
+}
+
+void
+Report(const char* name, int64_t millis, size_t ops, int found) {
+  printf(
+      "%-28s %6.1f ns/op  (%d found)\n", name, millis * 1e6 / ops, found
+  );
+}
+
+template <typename Lookup>
+void
+Measure(
+    const char* name, const std::vector<std::string_view>& keys, Lookup lookup
+) {
+  int64_t best = -1;
+  int found = 0;
+  for (int run = 0; run < 5; ++run) {
+    found = 0;
+    int64_t start = GetTimeMillis();
+    for (std::string_view key : keys)
+      found += lookup(key);
+    int64_t elapsed = GetTimeMillis() - start;
+    if (best < 0 || elapsed < best)
+      best = elapsed;
+  }
+  Report(name, best, keys.size(), found);
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char** argv) {
+  int count = argc > 1 ? atoi(argv[1]) : 1000000;
+
+  std::vector<std::string> paths = CreatePaths(count, "out/Release/");
+  std::vector<std::string> missing = CreatePaths(count, "out/Debug/");
+
+  // Look up copies of the paths in random order.  The copies are allocated
+  // in the order they are looked up, so that, like the path a parser has just
+  // canonicalized, the key itself is usually in the cache.
+  std::mt19937 rng(42);
+  std::vector<int> order(count);
+  for (int i = 0; i < count; ++i)
+    order[i] = i;
+  std::shuffle(order.begin(), order.end(), rng);
+  std::vector<std::string> hit_strings;
+  hit_strings.reserve(count);
+  for (int i : order)
+    hit_strings.push_back(paths[i]);
+  std::vector<std::string_view> hits(hit_strings.begin(), hit_strings.end());
+  std::vector<std::string_view> misses(missing.begin(), missing.end());
+
+  int64_t start = GetTimeMillis();
+  std::unordered_map<std::string_view, int> unordered;
+  for (int i = 0; i < count; ++i)
+    unordered[paths[i]] = i;
+  Report("unordered_map insert", GetTimeMillis() - start, count, count);
+
+  start = GetTimeMillis();
+  PathMap<int> path_map;
+  for (int i = 0; i < count; ++i)
+    path_map.Insert(paths[i], HashPath(paths[i])).second = i;
+  Report("PathMap insert", GetTimeMillis() - start, count, count);
+
+  Measure("unordered_map hit", hits, [&](std::string_view key) {
+    return unordered.find(key) != unordered.end();
+  });
+  Measure("PathMap hit", hits, [&](std::string_view key) {
+    return path_map.Find(key, HashPath(key)) != nullptr;
+  });
+  Measure("unordered_map miss", misses, [&](std::string_view key) {
+    return unordered.find(key) != unordered.end();
+  });
+  Measure("PathMap miss", misses, [&](std::string_view key) {
+    return path_map.Find(key, HashPath(key)) != nullptr;
+  });
+
+  // The cost of hashing alone, which a caller that already holds the hash
+  // of a path saves.
+  std::vector<uint64_t> hashes;
+  hashes.reserve(hits.size());
+  for (std::string_view key : hits)
+    hashes.push_back(HashPath(key));
+  Measure("HashPath", hits, [&](std::string_view key) {
+    return HashPath(key) == 0;
+  });
+  size_t i = 0;
+  Measure("PathMap hit, hash known", hits, [&](std::string_view key) {
+    return path_map.Find(key, hashes[i++ % hashes.size()]) != nullptr;
+  });
+  return 0;
+}
@@ -0,0 +1,135 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <ninja/path_map.hpp>
+#include <ninja/test.hpp>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+TEST(PathMap, HashPath) {
+  EXPECT_EQ(HashPath("foo/bar.o"), HashPath(std::string("foo/bar.o")));
+  // Paths that only differ past the first word, or in their last byte.
+  EXPECT_NE(HashPath("out/obj/a.o"), HashPath("out/obj/b.o"));
+  EXPECT_NE(HashPath("out/obj/ab"), HashPath("out/obj/ac"));
+  // The length is hashed too, so a trailing NUL makes a difference.
+  EXPECT_NE(
+      HashPath(std::string_view("a", 1)), HashPath(std::string_view("a\0", 2))
+  );
+  EXPECT_NE(HashPath(""), HashPath(std::string_view("\0", 1)));
+}
+
+TEST(PathMap, InsertFind) {
+  PathMap<int> map;
+  EXPECT_TRUE(map.empty());
+  EXPECT_EQ(nullptr, map.Find("foo", HashPath("foo")));
+
+  PathMap<int>::Entry& entry = map.Insert("foo", HashPath("foo"));
+  EXPECT_EQ("foo", entry.first);
+  EXPECT_EQ(0, entry.second);
+  entry.second = 1;
+  map.Insert("bar", HashPath("bar")).second = 2;
+
+  EXPECT_EQ(2u, map.size());
+  ASSERT_NE(nullptr, map.Find("foo", HashPath("foo")));
+  EXPECT_EQ(1, map.Find("foo", HashPath("foo"))->second);
+  ASSERT_NE(nullptr, map.Find("bar", HashPath("bar")));
+  EXPECT_EQ(2, map.Find("bar", HashPath("bar"))->second);
+  EXPECT_EQ(nullptr, map.Find("baz", HashPath("baz")));
+}
+
+TEST(PathMap, Grow) {
+  std::vector<std::string> paths;
+  for (int i = 0; i < 10000; ++i)
+    paths.push_back("obj/" + std::to_string(i) + ".o");
+
+  PathMap<int> map;
+  for (int i = 0; i < (int)paths.size(); ++i)
+    map.Insert(paths[i], HashPath(paths[i])).second = i;
+  EXPECT_EQ(paths.size(), map.size());
+  EXPECT_LE(map.size(), map.capacity() - map.capacity() / 8);
+
+  for (int i = 0; i < (int)paths.size(); ++i) {
+    PathMap<int>::Entry* entry = map.Find(paths[i], HashPath(paths[i]));
+    ASSERT_NE(nullptr, entry);
+    EXPECT_EQ(i, entry->second);
+    EXPECT_EQ(HashPath(paths[i]), entry->hash);
+  }
+
+  int count = 0;
+  for (const auto& entry : map) {
+    EXPECT_EQ(paths[entry.second], entry.first);
+    ++count;
+  }
+  EXPECT_EQ((int)paths.size(), count);
+}
+
+/// Keys whose hashes collide completely must still be told apart.
+TEST(PathMap, Collisions) {
+  PathMap<int> map;
+  std::vector<std::string> paths;
+  for (int i = 0; i < 100; ++i)
+    paths.push_back(std::to_string(i));
+  for (int i = 0; i < 100; ++i)
+    map.Insert(paths[i], 42).second = i;
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_NE(nullptr, map.Find(paths[i], 42));
+    EXPECT_EQ(i, map.Find(paths[i], 42)->second);
+  }
+  EXPECT_EQ(nullptr, map.Find("100", 42));
+}
+
+TEST(PathMap, Erase) {
+  std::vector<std::string> paths;
+  for (int i = 0; i < 1000; ++i)
+    paths.push_back("src/" + std::to_string(i) + ".cc");
+
+  PathMap<int> map;
+  for (int i = 0; i < (int)paths.size(); ++i)
+    map.Insert(paths[i], HashPath(paths[i])).second = i;
+
+  EXPECT_FALSE(map.Erase("missing", HashPath("missing")));
+  for (int i = 0; i < (int)paths.size(); i += 2)
+    EXPECT_TRUE(map.Erase(paths[i], HashPath(paths[i])));
+  EXPECT_EQ(paths.size() / 2, map.size());
+
+  for (int i = 0; i < (int)paths.size(); ++i) {
+    PathMap<int>::Entry* entry = map.Find(paths[i], HashPath(paths[i]));
+    if (i % 2 == 0) {
+      EXPECT_EQ(nullptr, entry);
+    } else {
+      ASSERT_NE(nullptr, entry);
+      EXPECT_EQ(i, entry->second);
+    }
+  }
+  std::set<int> seen;
+  for (const auto& entry : map)
+    seen.insert(entry.second);
+  EXPECT_EQ(paths.size() / 2, seen.size());
+
+  // Churning through the tombstones left behind doesn't grow the table.
+  size_t capacity = map.capacity();
+  for (int round = 0; round < 20; ++round) {
+    for (int i = 0; i < (int)paths.size(); i += 2)
+      map.Insert(paths[i], HashPath(paths[i])).second = i;
+    for (int i = 0; i < (int)paths.size(); i += 2)
+      EXPECT_TRUE(map.Erase(paths[i], HashPath(paths[i])));
+  }
+  EXPECT_EQ(capacity, map.capacity());
+  EXPECT_EQ(paths.size() / 2, map.size());
+}
+
+} // anonymous namespace
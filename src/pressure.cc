@@ -0,0 +1,202 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ninja/metrics.hpp>
+#include <ninja/pressure.hpp>
+
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <ninja/util.hpp>
+#  include <unistd.h>
+#endif
+
+namespace {
+
+/// Beyond these fractions of stalled time, run fewer jobs.  Memory stalls
+/// mean swapping or reclaim, which more jobs only make worse, so the limit
+/// drops faster for them.
+const double kMemoryHigh = 0.10;
+const double kCpuHigh = 0.60;
+const double kIoHigh = 0.40;
+
+/// Below all of these, run more jobs.
+const double kMemoryLow = 0.02;
+const double kCpuLow = 0.30;
+const double kIoLow = 0.20;
+
+const char* const kMetricName = "job limit";
+
+#ifdef __linux__
+const char* const kResourceNames[] = {"cpu", "memory", "io"};
+
+/// @return the directory of ninja's cgroup in the cgroup v2 hierarchy, or
+/// an empty string if it isn't in one.
+std::string
+CgroupDirectory() {
+  std::string contents, err;
+  if (ReadFile("/proc/self/cgroup", &contents, &err) < 0)
+    return std::string();
+  // The cgroup v2 line is "0::/path".
+  size_t start = 0;
+  while (start < contents.size()) {
+    size_t end = contents.find('\n', start);
+    if (end == std::string::npos)
+      end = contents.size();
+    if (contents.compare(start, 3, "0::") == 0)
+      return "/sys/fs/cgroup" + contents.substr(start + 3, end - start - 3);
+    start = end + 1;
+  }
+  return std::string();
+}
+
+/// @return the stall total in |fd|, or -1 if it can't be read.
+int64_t
+ReadPressure(int fd) {
+  char buf[256];
+  ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+  if (len <= 0)
+    return -1;
+  int64_t total;
+  if (!ParsePressure(std::string(buf, len), &total))
+    return -1;
+  return total;
+}
+#endif
+
+} // anonymous namespace
+
+bool
+ParsePressure(const std::string& text, int64_t* some_total) {
+  // Each line is like "some avg10=0.00 avg60=0.00 avg300=0.00 total=0".
+  if (text.compare(0, 5, "some ") != 0)
+    return false;
+  size_t end = text.find('\n');
+  size_t total = text.find(" total=");
+  if (total == std::string::npos || total > end)
+    return false;
+  const char* start = text.c_str() + total + strlen(" total=");
+  char* stop;
+  long long value = strtoll(start, &stop, 10);
+  if (stop == start || value < 0)
+    return false;
+  *some_total = value;
+  return true;
+}
+
+PressureLimiter::PressureLimiter(int floor, int ceiling)
+    : floor_(std::max(std::min(floor, ceiling), 1)),
+      ceiling_(std::max(ceiling, 1)), limit_(ceiling_), last_read_millis_(0) {
+  for (int i = 0; i < kResources; ++i) {
+    fds_[i] = -1;
+    totals_[i] = 0;
+  }
+  if (g_metrics)
+    g_metrics->RecordValue(kMetricName, limit_);
+}
+
+PressureLimiter::~PressureLimiter() {
+#ifdef __linux__
+  for (int fd : fds_) {
+    if (fd >= 0)
+      close(fd);
+  }
+#endif
+}
+
+#ifdef __linux__
+std::unique_ptr<PressureLimiter>
+PressureLimiter::Create(int floor, int ceiling) {
+  std::unique_ptr<PressureLimiter> limiter(
+      new PressureLimiter(floor, ceiling)
+  );
+  const std::string cgroup = CgroupDirectory();
+  bool any = false;
+  for (int i = 0; i < kResources; ++i) {
+    // A cgroup has pressure files only if the kernel accounts them per
+    // cgroup; the root cgroup never has them.
+    int fd = -1;
+    if (!cgroup.empty()) {
+      std::string path = cgroup + "/" + kResourceNames[i] + ".pressure";
+      fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+      std::string path = std::string("/proc/pressure/") + kResourceNames[i];
+      fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    // The files exist even when pressure stall information is disabled, but
+    // reading them fails.
+    if (fd >= 0 && (limiter->totals_[i] = ReadPressure(fd)) < 0) {
+      close(fd);
+      fd = -1;
+    }
+    limiter->fds_[i] = fd;
+    any = any || fd >= 0;
+  }
+  if (!any)
+    return nullptr;
+  limiter->last_read_millis_ = GetTimeMillis();
+  return limiter;
+}
+
+int
+PressureLimiter::Limit() {
+  const int64_t now = GetTimeMillis();
+  const int64_t elapsed = now - last_read_millis_;
+  if (elapsed < kSampleMillis)
+    return limit_;
+  last_read_millis_ = now;
+
+  // The average stall over just the last interval, rather than the kernel's
+  // 10 seconds at the least.
+  double stalled[kResources];
+  for (int i = 0; i < kResources; ++i) {
+    stalled[i] = 0.0;
+    int64_t total;
+    if (fds_[i] < 0 || (total = ReadPressure(fds_[i])) < 0)
+      continue;
+    stalled[i] = static_cast<double>(total - totals_[i]) / (elapsed * 1000.0);
+    totals_[i] = total;
+  }
+  Adjust(stalled[kCpu], stalled[kMemory], stalled[kIo]);
+  return limit_;
+}
+#else
+std::unique_ptr<PressureLimiter>
+PressureLimiter::Create(int, int) {
+  return nullptr;
+}
+
+int
+PressureLimiter::Limit() {
+  return limit_;
+}
+#endif // __linux__
+
+void
+PressureLimiter::Adjust(double cpu, double memory, double io) {
+  if (memory > kMemoryHigh) {
+    limit_ = std::max(limit_ / 2, floor_);
+  } else if (cpu > kCpuHigh || io > kIoHigh) {
+    limit_ = std::max(std::min(limit_ - limit_ / 4, limit_ - 1), floor_);
+  } else if (cpu < kCpuLow && io < kIoLow && memory < kMemoryLow) {
+    // Climb back in a few steps, in case the pressure comes back.
+    int step = std::max(ceiling_ / 8, 1);
+    limit_ = ceiling_ - limit_ > step ? limit_ + step : ceiling_;
+  }
+  if (g_metrics)
+    g_metrics->RecordValue(kMetricName, limit_);
+}
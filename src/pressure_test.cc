@@ -0,0 +1,77 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <ninja/pressure.hpp>
+#include <ninja/test.hpp>
+
+TEST(ParsePressure, Basic) {
+  int64_t total = 0;
+  EXPECT_TRUE(ParsePressure(
+      "some avg10=1.50 avg60=0.20 avg300=0.05 total=123456\n"
+      "full avg10=0.00 avg60=0.00 avg300=0.00 total=789\n",
+      &total
+  ));
+  EXPECT_EQ(123456, total);
+
+  // The cpu file of older kernels has no "full" line.
+  EXPECT_TRUE(
+      ParsePressure("some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n", &total)
+  );
+  EXPECT_EQ(0, total);
+}
+
+TEST(ParsePressure, Errors) {
+  int64_t total = 0;
+  EXPECT_FALSE(ParsePressure("", &total));
+  EXPECT_FALSE(ParsePressure("full avg10=0.00 total=5\n", &total));
+  EXPECT_FALSE(ParsePressure(
+      "some avg10=0.00 avg60=0.00\nfull avg10=0.00 total=5\n", &total
+  ));
+  EXPECT_FALSE(ParsePressure("some avg10=0.00 total=\n", &total));
+}
+
+// The limit drops under pressure, never below the floor, and climbs back to
+// the ceiling once it's gone.
+TEST(PressureLimiter, Adjust) {
+  PressureLimiter limiter(2, 16);
+  EXPECT_EQ(16, limiter.limit());
+
+  limiter.Adjust(0.9, 0.0, 0.0);
+  EXPECT_EQ(12, limiter.limit());
+  limiter.Adjust(0.0, 0.0, 0.5);
+  EXPECT_EQ(9, limiter.limit());
+  limiter.Adjust(0.0, 0.5, 0.0);
+  EXPECT_EQ(4, limiter.limit());
+  limiter.Adjust(0.0, 0.5, 0.0);
+  EXPECT_EQ(2, limiter.limit());
+  limiter.Adjust(1.0, 1.0, 1.0);
+  EXPECT_EQ(2, limiter.limit());
+
+  // Moderate pressure holds the limit.
+  limiter.Adjust(0.45, 0.0, 0.0);
+  EXPECT_EQ(2, limiter.limit());
+
+  limiter.Adjust(0.0, 0.0, 0.0);
+  EXPECT_EQ(4, limiter.limit());
+  for (int i = 0; i < 10; ++i)
+    limiter.Adjust(0.0, 0.0, 0.0);
+  EXPECT_EQ(16, limiter.limit());
+}
+
+// A floor above -j is -j.
+TEST(PressureLimiter, FloorAboveCeiling) {
+  PressureLimiter limiter(8, 4);
+  limiter.Adjust(0.0, 1.0, 0.0);
+  EXPECT_EQ(4, limiter.limit());
+}
@@ -0,0 +1,274 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <ninja/stat_ring.hpp>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#  define NINJA_HAVE_IO_URING
+#endif
+
+#ifdef NINJA_HAVE_IO_URING
+#  include <algorithm>
+#  include <atomic>
+#  include <cerrno>
+#  include <cstring>
+#  include <fcntl.h>
+#  include <linux/io_uring.h>
+#  include <ninja/disk_interface.hpp>
+#  include <ninja/metrics.hpp>
+#  include <ninja/util.hpp>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+
+namespace {
+
+/// Enough statx() calls in flight to keep a network file system busy.
+const unsigned kRingEntries = 256;
+
+int
+IoUringSetup(unsigned entries, io_uring_params* params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int
+IoUringEnter(int fd, unsigned to_submit, unsigned min_complete) {
+  return static_cast<int>(syscall(
+      __NR_io_uring_enter, fd, to_submit, min_complete,
+      IORING_ENTER_GETEVENTS, nullptr, 0
+  ));
+}
+
+/// @return whether the kernel supports IORING_OP_STATX.
+bool
+ProbeStatx(int fd) {
+  const size_t size =
+      sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op);
+  std::unique_ptr<char[]> buffer(new char[size]());
+  io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(buffer.get());
+  if (syscall(
+          __NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe,
+          IORING_OP_LAST
+      )
+      < 0)
+    return false;
+  return IORING_OP_STATX <= probe->last_op
+         && (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+}
+
+unsigned
+LoadAcquire(unsigned* p) {
+  return std::atomic_ref<unsigned>(*p).load(std::memory_order_acquire);
+}
+
+void
+StoreRelease(unsigned* p, unsigned value) {
+  std::atomic_ref<unsigned>(*p).store(value, std::memory_order_release);
+}
+
+template <typename T>
+T*
+RingField(void* ring, uint32_t offset) {
+  return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+}
+
+} // anonymous namespace
+
+std::unique_ptr<StatRing>
+StatRing::Create() {
+  std::unique_ptr<StatRing> ring(new StatRing);
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->fd_ = IoUringSetup(kRingEntries, &params);
+  if (ring->fd_ < 0)
+    return nullptr;
+  ring->sq_entries_ = params.sq_entries;
+
+  const size_t sq_size =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  const size_t cq_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+
+  ring->sq_ring_size_ = single_mmap ? std::max(sq_size, cq_size) : sq_size;
+  void* sq_ring = mmap(
+      nullptr, ring->sq_ring_size_, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring->fd_, IORING_OFF_SQ_RING
+  );
+  if (sq_ring == MAP_FAILED)
+    return nullptr;
+  ring->sq_ring_ = sq_ring;
+
+  void* cq_ring = sq_ring;
+  if (!single_mmap) {
+    cq_ring = mmap(
+        nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring->fd_, IORING_OFF_CQ_RING
+    );
+    if (cq_ring == MAP_FAILED)
+      return nullptr;
+    ring->cq_ring_ = cq_ring;
+    ring->cq_ring_size_ = cq_size;
+  }
+
+  ring->sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = mmap(
+      nullptr, ring->sqes_size_, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring->fd_, IORING_OFF_SQES
+  );
+  if (sqes == MAP_FAILED)
+    return nullptr;
+  ring->sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+  ring->sq_head_ = RingField<unsigned>(sq_ring, params.sq_off.head);
+  ring->sq_tail_ = RingField<unsigned>(sq_ring, params.sq_off.tail);
+  ring->sq_mask_ = *RingField<unsigned>(sq_ring, params.sq_off.ring_mask);
+  ring->sq_array_ = RingField<unsigned>(sq_ring, params.sq_off.array);
+  ring->cq_head_ = RingField<unsigned>(cq_ring, params.cq_off.head);
+  ring->cq_tail_ = RingField<unsigned>(cq_ring, params.cq_off.tail);
+  ring->cq_mask_ = *RingField<unsigned>(cq_ring, params.cq_off.ring_mask);
+  ring->cqes_ = RingField<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+
+  if (!ProbeStatx(ring->fd_))
+    return nullptr;
+  return ring;
+}
+
+StatRing::~StatRing() {
+  if (sqes_)
+    munmap(sqes_, sqes_size_);
+  if (cq_ring_)
+    munmap(cq_ring_, cq_ring_size_);
+  if (sq_ring_)
+    munmap(sq_ring_, sq_ring_size_);
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+bool
+StatRing::StatMany(
+    const std::vector<std::string_view>& paths, std::vector<TimeStamp>* mtimes,
+    StatProgress* progress, std::string* err
+) {
+  METRIC_RECORD("io_uring statx");
+  const size_t total = paths.size();
+  const size_t step = std::max<size_t>(total / 100, 1);
+  mtimes->resize(total);
+
+  // Each statx() in flight owns a slot, which keeps its path and result
+  // alive until its completion is reaped.  There are no more slots than
+  // submission queue entries, so the completion queue can't overflow.
+  struct Slot {
+    std::string path;
+    struct statx result;
+    size_t index;
+  };
+  std::vector<Slot> slots(sq_entries_);
+  std::vector<unsigned> free_slots;
+  for (unsigned i = 0; i < sq_entries_; ++i)
+    free_slots.push_back(sq_entries_ - 1 - i);
+
+  size_t next = 0;
+  size_t done = 0;
+  size_t reported = 0;
+  size_t first_error = total;
+  unsigned sq_tail = *sq_tail_;
+  while (done < total) {
+    while (next < total && !free_slots.empty()) {
+      const unsigned slot_index = free_slots.back();
+      free_slots.pop_back();
+      Slot& slot = slots[slot_index];
+      slot.path.assign(paths[next]);
+      slot.index = next++;
+
+      const unsigned sqe_index = sq_tail & sq_mask_;
+      io_uring_sqe* sqe = &sqes_[sqe_index];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_STATX;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = reinterpret_cast<uintptr_t>(slot.path.c_str());
+      sqe->len = STATX_TYPE | STATX_MTIME;
+      sqe->off = reinterpret_cast<uintptr_t>(&slot.result);
+      sqe->user_data = slot_index;
+      sq_array_[sqe_index] = sqe_index;
+      ++sq_tail;
+    }
+    StoreRelease(sq_tail_, sq_tail);
+
+    // The kernel may take fewer entries than offered, or be interrupted:
+    // whatever it left in the queue is offered again next time around.
+    const unsigned to_submit = sq_tail - LoadAcquire(sq_head_);
+    if (IoUringEnter(fd_, to_submit, 1) < 0 && errno != EINTR
+        && errno != EAGAIN && errno != EBUSY)
+      Fatal("io_uring_enter: %s", strerror(errno));
+
+    unsigned cq_head = *cq_head_;
+    const unsigned cq_tail = LoadAcquire(cq_tail_);
+    for (; cq_head != cq_tail; ++cq_head) {
+      const io_uring_cqe& cqe = cqes_[cq_head & cq_mask_];
+      const unsigned slot_index = static_cast<unsigned>(cqe.user_data);
+      const Slot& slot = slots[slot_index];
+      TimeStamp& mtime = (*mtimes)[slot.index];
+      if (cqe.res < 0) {
+        if (cqe.res == -ENOENT || cqe.res == -ENOTDIR) {
+          mtime = 0;
+        } else {
+          mtime = -1;
+          if (slot.index < first_error) {
+            first_error = slot.index;
+            *err = "stat(" + slot.path + "): " + strerror(-cqe.res);
+          }
+        }
+      } else if (slot.result.stx_mtime.tv_sec == 0) {
+        // See RealDiskInterface::Stat().
+        mtime = 1;
+      } else {
+        const struct statx_timestamp& t = slot.result.stx_mtime;
+        mtime = static_cast<int64_t>(t.tv_sec) * 1000000000LL + t.tv_nsec;
+      }
+      free_slots.push_back(slot_index);
+      ++done;
+    }
+    StoreRelease(cq_head_, cq_head);
+
+    if (progress && done - reported >= step && done < total) {
+      progress->StatProgressed(done, total);
+      reported = done;
+    }
+  }
+  if (progress && total)
+    progress->StatProgressed(total, total);
+
+  return first_error == total;
+}
+
+#else
+
+std::unique_ptr<StatRing>
+StatRing::Create() {
+  return nullptr;
+}
+
+StatRing::~StatRing() {}
+
+bool
+StatRing::StatMany(
+    const std::vector<std::string_view>&, std::vector<TimeStamp>*,
+    StatProgress*, std::string*
+) {
+  return false;
+}
+
+#endif // NINJA_HAVE_IO_URING
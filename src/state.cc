@@ -98,20 +98,25 @@ State::AddEdge(const Rule* rule) {
 
 Node*
 State::GetNode(std::string_view path, uint64_t slash_bits) {
-  Node* node = LookupNode(path);
-  if (node)
-    return node;
-  std::unique_ptr<Node> node_ptr = std::make_unique<Node>(std::string(path), slash_bits);
-  node = node_ptr.get();
-  paths_[node->path()] = std::move(node_ptr);
-  return node;
+  const uint64_t hash = HashPath(path);
+  if (Paths::Entry* entry = paths_.Find(path, hash))
+    return entry->second.get();
+  std::unique_ptr<Node> node =
+      std::make_unique<Node>(std::string(path), slash_bits, &node_table_);
+  Paths::Entry& entry = paths_.Insert(node->path(), hash);
+  entry.second = std::move(node);
+  return entry.second.get();
 }
 
 Node*
 State::LookupNode(std::string_view path) const {
-  Paths::const_iterator i = paths_.find(path);
-  if (i != paths_.end())
-    return i->second.get();
+  return LookupNode(path, HashPath(path));
+}
+
+Node*
+State::LookupNode(std::string_view path, uint64_t hash) const {
+  if (Paths::Entry* entry = paths_.Find(path, hash))
+    return entry->second.get();
   return nullptr;
 }
 
@@ -192,8 +197,7 @@ State::DefaultNodes(std::string* err) const {
 
 void
 State::Reset() {
-  for (const auto& path : paths_)
-    path.second->ResetState();
+  node_table_.Reset();
   for (std::unique_ptr<Edge>& edge : edges_) {
     edge->outputs_ready_ = false;
     edge->deps_loaded_ = false;
@@ -201,6 +205,29 @@ State::Reset() {
   }
 }
 
+void
+State::FreezeGraph() {
+  // Visit the nodes in index order rather than in the random order of
+  // |paths_|, which is both faster and lays out the lists of nodes created
+  // together next to each other.
+  size_t total = 0;
+  for (uint32_t i = 0; i < node_table_.size(); ++i) {
+    if (Node* node = node_table_.node(i))
+      total += node->out_edges().size() + node->validation_out_edges().size();
+  }
+
+  // The old storage may still hold some of the lists, so release it only
+  // once they have all been copied.
+  std::unique_ptr<Edge*[]> storage(new Edge*[total]);
+  Edge** next = storage.get();
+  for (uint32_t i = 0; i < node_table_.size(); ++i) {
+    if (Node* node = node_table_.node(i))
+      next = node->FreezeOutEdges(next);
+  }
+  assert(next == storage.get() + total);
+  frozen_out_edges_ = std::move(storage);
+}
+
 void
 State::Dump() {
   for (Paths::iterator i = paths_.begin(); i != paths_.end(); ++i) {
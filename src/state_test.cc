@@ -43,4 +43,41 @@ TEST(State, Basic) {
   EXPECT_FALSE(state.GetNode("out", 0)->dirty());
 }
 
+TEST(State, FreezeGraph) {
+  State state;
+  Edge* e1 = state.AddEdge(&State::kPhonyRule);
+  state.AddIn(e1, "in", 0);
+  state.AddOut(e1, "mid", 0);
+  Edge* e2 = state.AddEdge(&State::kPhonyRule);
+  state.AddIn(e2, "in", 0);
+  state.AddIn(e2, "mid", 0);
+  state.AddValidation(e2, "in", 0);
+  state.AddOut(e2, "out", 0);
+  state.FreezeGraph();
+
+  Node* in = state.LookupNode("in");
+  ASSERT_EQ(2u, in->out_edges().size());
+  EXPECT_EQ(e1, in->out_edges()[0]);
+  EXPECT_EQ(e2, in->out_edges()[1]);
+  ASSERT_EQ(1u, in->validation_out_edges().size());
+  EXPECT_EQ(e2, in->validation_out_edges()[0]);
+  EXPECT_TRUE(state.LookupNode("out")->out_edges().empty());
+
+  // Edges can still be added and removed after freezing.
+  Edge* e3 = state.AddEdge(&State::kPhonyRule);
+  state.AddIn(e3, "in", 0);
+  state.AddOut(e3, "out2", 0);
+  in->RemoveOutEdgesIf([e1](const Edge* edge) { return edge == e1; });
+  ASSERT_EQ(2u, in->out_edges().size());
+  EXPECT_EQ(e2, in->out_edges()[0]);
+  EXPECT_EQ(e3, in->out_edges()[1]);
+  EXPECT_EQ(e2, state.LookupNode("mid")->out_edges()[0]);
+
+  // Freezing again picks up the changes.
+  state.FreezeGraph();
+  ASSERT_EQ(2u, in->out_edges().size());
+  EXPECT_EQ(e3, in->out_edges()[1]);
+  EXPECT_EQ(e2, in->validation_out_edges()[0]);
+}
+
 } // namespace
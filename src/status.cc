@@ -51,7 +51,8 @@ StatusPrinter::BuildEdgeStarted(const Edge* edge, int64_t start_time_millis) {
 
 void
 StatusPrinter::BuildEdgeFinished(
-    Edge* edge, int64_t end_time_millis, bool success, const std::string& output
+    Edge* edge, int64_t end_time_millis, bool success,
+    const std::string& output, FILE* spilled_output
 ) {
   time_millis_ = end_time_millis;
   ++finished_edges_;
@@ -87,26 +88,68 @@ StatusPrinter::BuildEdgeFinished(
     printer_.PrintOnNewLine(edge->EvaluateCommand() + "\n");
   }
 
-  if (!output.empty()) {
-    // ninja sets stdout and stderr of subprocesses to a pipe, to be able to
-    // check if the output is empty. Some compilers, e.g. clang, check
-    // isatty(stderr) to decide if they should print colored output.
-    // To make it possible to use colored output with ninja, subprocesses should
-    // be run with a flag that forces them to always print color escape codes.
-    // To make sure these escape codes don't show up in a file if ninja's output
-    // is piped to a file, ninja strips ansi escape codes again if it's not
-    // writing to a |smart_terminal_|.
-    // (Launching subprocesses in pseudo ttys doesn't work because there are
-    // only a few hundred available on some systems, and ninja can launch
-    // thousands of parallel compile commands.)
-    std::string final_output;
+  if (!output.empty() || spilled_output)
+    PrintCommandOutput(output, spilled_output);
+}
+
+void
+StatusPrinter::PrintCommandOutput(
+    const std::string& output, FILE* spilled_output
+) {
+  // ninja sets stdout and stderr of subprocesses to a pipe, to be able to
+  // check if the output is empty. Some compilers, e.g. clang, check
+  // isatty(stderr) to decide if they should print colored output.
+  // To make it possible to use colored output with ninja, subprocesses should
+  // be run with a flag that forces them to always print color escape codes.
+  // To make sure these escape codes don't show up in a file if ninja's output
+  // is piped to a file, ninja strips ansi escape codes again if it's not
+  // writing to a |smart_terminal_|.
+  // (Launching subprocesses in pseudo ttys doesn't work because there are
+  // only a few hundred available on some systems, and ninja can launch
+  // thousands of parallel compile commands.)
+  auto print = [this](std::string_view lines) {
     if (!printer_.supports_color())
-      final_output = StripAnsiEscapeCodes(output);
+      printer_.PrintOnNewLine(StripAnsiEscapeCodes(lines));
     else
-      final_output = output;
+      printer_.PrintOnNewLine(lines);
+  };
+  if (!spilled_output) {
+    print(output);
+    return;
+  }
 
-    printer_.PrintOnNewLine(final_output);
+  // Print a huge output a piece at a time.  Pieces end with whole lines, so
+  // that they join up and no escape code is cut in two, unless a line is
+  // too long to hold.
+  const size_t kMaxPiece = 1 << 20;
+  std::string piece;
+  auto print_lines = [&](bool all) {
+    size_t end = piece.rfind('\n');
+    if (all || (end == std::string::npos && piece.size() >= kMaxPiece))
+      end = piece.size();
+    else
+      end = end == std::string::npos ? 0 : end + 1;
+    if (!end)
+      return;
+    print(std::string_view(piece).substr(0, end));
+    piece.erase(0, end);
+  };
+  // The output in memory is printed in place, but for the end of its last
+  // line, which the spilled output continues.
+  size_t end = output.rfind('\n');
+  end = end == std::string::npos ? 0 : end + 1;
+  if (output.size() - end >= kMaxPiece)
+    end = output.size();
+  if (end)
+    print(std::string_view(output).substr(0, end));
+  piece.assign(output, end);
+  rewind(spilled_output);
+  char buf[64 << 10];
+  while (size_t len = fread(buf, 1, sizeof(buf), spilled_output)) {
+    piece.append(buf, len);
+    print_lines(false);
   }
+  print_lines(true);
 }
 
 void
@@ -12,16 +12,24 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
+#include <map>
+#include <ninja/debug_flags.hpp>
+#include <ninja/json.hpp>
+#include <ninja/metrics.hpp>
 #include <ninja/subprocess.hpp>
 #include <spawn.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <vector>
 
 #if defined(USE_PPOLL)
 #  include <poll.h>
@@ -29,44 +37,76 @@
 #  include <sys/select.h>
 #endif
 
+#if defined(__linux__) && __has_include(<sys/signalfd.h>)
+#  include <sys/syscall.h>
+#  ifdef SYS_pidfd_open
+#    define NINJA_HAVE_PIDFD
+#    include <poll.h>
+#    include <sys/signalfd.h>
+#  endif
+#endif
+
 extern char** environ;
 
 #include <ninja/util.hpp>
 
-Subprocess::Subprocess(bool use_console)
-    : fd_(-1), pid_(-1), use_console_(use_console) {}
+namespace {
 
-Subprocess::~Subprocess() {
-  if (fd_ >= 0)
-    close(fd_);
-  // Reap child if forgotten.
-  if (pid_ != -1)
-    Finish();
-}
+/// Words that mean something else to the shell as the name of the program
+/// than as a program on the PATH.  /bin/sh is bash on some systems, so its
+/// reserved words and builtins count too, as do builtins which behave
+/// differently from the program of the same name, like echo and pwd.
+const char* const kShellWords[] = {
+  "!", ".", ":", "[[", "]]", "{", "}", "alias", "bg", "bind", "break",
+  "builtin", "caller", "case", "cd", "command", "compgen", "complete",
+  "compopt", "continue", "coproc", "declare", "dirs", "disown", "do", "done",
+  "echo", "elif", "else", "enable", "esac", "eval", "exec", "exit", "export",
+  "fc", "fg", "fi", "for", "function", "getopts", "hash", "help", "history",
+  "if", "in", "jobs", "kill", "let", "local", "logout", "mapfile", "popd",
+  "printf", "pushd", "pwd", "read", "readarray", "readonly", "return",
+  "select", "set", "shift", "shopt", "source", "suspend", "then", "time",
+  "times", "trap", "type", "typeset", "ulimit", "umask", "unalias", "unset",
+  "until", "wait", "while",
+};
 
+/// @return whether |c| has no special meaning to the shell anywhere in a
+/// word.  Bytes of multibyte characters are fine.
 bool
-Subprocess::Start(SubprocessSet* set, const std::string& command) {
-  int output_pipe[2];
-  if (pipe(output_pipe) < 0)
-    Fatal("pipe: %s", strerror(errno));
-  fd_ = output_pipe[0];
-#if !defined(USE_PPOLL)
-  // If available, we use ppoll in DoWork(); otherwise we use pselect
-  // and so must avoid overly-large FDs.
-  if (fd_ >= static_cast<int>(FD_SETSIZE))
-    Fatal("pipe: %s", strerror(EMFILE));
-#endif // !USE_PPOLL
-  SetCloseOnExec(fd_);
+IsPlainWordChar(unsigned char c) {
+  if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+      || (c >= '0' && c <= '9') || c >= 0x80)
+    return true;
+  switch (c) {
+    case '+':
+    case ',':
+    case '-':
+    case '.':
+    case '/':
+    case ':':
+    case '=':
+    case '@':
+    case '_':
+    case '%':
+      return true;
+  }
+  return false;
+}
 
+/// Spawn |command| with |mask| as its signal mask.  Outside the console, its
+/// stdin is |input_fd|, or /dev/null if that is -1, and its stdout and
+/// stderr are |output_fd| and |error_fd|.  In the console, it only inherits
+/// |output_fd|.  The caller's ends of any pipes must be close-on-exec.
+/// @return the pid of the child.
+pid_t
+SpawnCommand(
+    const std::string& command, bool use_console, bool use_shell,
+    const sigset_t& mask, int input_fd, int output_fd, int error_fd
+) {
   posix_spawn_file_actions_t action;
   int err = posix_spawn_file_actions_init(&action);
   if (err != 0)
     Fatal("posix_spawn_file_actions_init: %s", strerror(err));
 
-  err = posix_spawn_file_actions_addclose(&action, output_pipe[0]);
-  if (err != 0)
-    Fatal("posix_spawn_file_actions_addclose: %s", strerror(err));
-
   posix_spawnattr_t attr;
   err = posix_spawnattr_init(&attr);
   if (err != 0)
@@ -75,35 +115,47 @@ Subprocess::Start(SubprocessSet* set, const std::string& command) {
   short flags = 0;
 
   flags |= POSIX_SPAWN_SETSIGMASK;
-  err = posix_spawnattr_setsigmask(&attr, &set->old_mask_);
+  err = posix_spawnattr_setsigmask(&attr, &mask);
   if (err != 0)
     Fatal("posix_spawnattr_setsigmask: %s", strerror(err));
   // Signals which are set to be caught in the calling process image are set to
   // default action in the new process image, so no explicit
   // POSIX_SPAWN_SETSIGDEF parameter is needed.
 
-  if (!use_console_) {
+  if (!use_console) {
     // Put the child in its own process group, so ctrl-c won't reach it.
     flags |= POSIX_SPAWN_SETPGROUP;
     // No need to posix_spawnattr_setpgroup(&attr, 0), it's the default.
 
-    // Open /dev/null over stdin.
-    err =
-        posix_spawn_file_actions_addopen(&action, 0, "/dev/null", O_RDONLY, 0);
-    if (err != 0) {
-      Fatal("posix_spawn_file_actions_addopen: %s", strerror(err));
+    if (input_fd == -1) {
+      // Open /dev/null over stdin.
+      err = posix_spawn_file_actions_addopen(
+          &action, 0, "/dev/null", O_RDONLY, 0
+      );
+      if (err != 0) {
+        Fatal("posix_spawn_file_actions_addopen: %s", strerror(err));
+      }
+    } else {
+      err = posix_spawn_file_actions_adddup2(&action, input_fd, 0);
+      if (err != 0)
+        Fatal("posix_spawn_file_actions_adddup2: %s", strerror(err));
     }
 
-    err = posix_spawn_file_actions_adddup2(&action, output_pipe[1], 1);
+    err = posix_spawn_file_actions_adddup2(&action, output_fd, 1);
     if (err != 0)
       Fatal("posix_spawn_file_actions_adddup2: %s", strerror(err));
-    err = posix_spawn_file_actions_adddup2(&action, output_pipe[1], 2);
+    err = posix_spawn_file_actions_adddup2(&action, error_fd, 2);
     if (err != 0)
       Fatal("posix_spawn_file_actions_adddup2: %s", strerror(err));
-    err = posix_spawn_file_actions_addclose(&action, output_pipe[1]);
-    if (err != 0)
-      Fatal("posix_spawn_file_actions_addclose: %s", strerror(err));
-    // In the console case, output_pipe is still inherited by the child and
+    const int originals[] = {input_fd, output_fd, error_fd};
+    for (size_t i = 0; i < 3; ++i) {
+      if (originals[i] <= 2 || (i == 2 && error_fd == output_fd))
+        continue;
+      err = posix_spawn_file_actions_addclose(&action, originals[i]);
+      if (err != 0)
+        Fatal("posix_spawn_file_actions_addclose: %s", strerror(err));
+    }
+    // In the console case, output_fd is still inherited by the child and
     // closed when the subprocess finishes, which then notifies ninja.
   }
 #ifdef POSIX_SPAWN_USEVFORK
@@ -114,13 +166,27 @@ Subprocess::Start(SubprocessSet* set, const std::string& command) {
   if (err != 0)
     Fatal("posix_spawnattr_setflags: %s", strerror(err));
 
-  const char* spawned_args[] = {"/bin/sh", "-c", command.c_str(), nullptr};
-  err = posix_spawn(
-      &pid_, "/bin/sh", &action, &attr, const_cast<char**>(spawned_args),
-      environ
-  );
-  if (err != 0)
-    Fatal("posix_spawn: %s", strerror(err));
+  // Spawn simple commands directly.  If that fails, as when the program is
+  // not found, let the shell run the command and report the error.
+  pid_t pid = -1;
+  std::vector<std::string> args;
+  err = -1;
+  if (!use_shell && SplitSimpleCommand(command, &args)) {
+    std::vector<char*> argv;
+    for (std::string& arg : args)
+      argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+    err = posix_spawnp(&pid, argv[0], &action, &attr, argv.data(), environ);
+  }
+  if (err != 0) {
+    const char* spawned_args[] = {"/bin/sh", "-c", command.c_str(), nullptr};
+    err = posix_spawn(
+        &pid, "/bin/sh", &action, &attr, const_cast<char**>(spawned_args),
+        environ
+    );
+    if (err != 0)
+      Fatal("posix_spawn: %s", strerror(err));
+  }
 
   err = posix_spawnattr_destroy(&attr);
   if (err != 0)
@@ -128,17 +194,525 @@ Subprocess::Start(SubprocessSet* set, const std::string& command) {
   err = posix_spawn_file_actions_destroy(&action);
   if (err != 0)
     Fatal("posix_spawn_file_actions_destroy: %s", strerror(err));
+  return pid;
+}
+
+// The spawner is a small process forked from ninja before it loads the
+// manifest, which spawns commands on its behalf: even with vfork, spawning
+// from a process with gigabytes of address space can be slow.  Ninja sends
+// it a SpawnRequest followed by the command, over a socket.  The spawner
+// replies with a SpawnReply, passing the read end of the output pipe along
+// with it, and sends another SpawnReply when the command exits.
+
+struct SpawnRequest {
+  sigset_t mask;
+  uint32_t command_size;
+  bool use_console;
+  bool use_shell;
+};
+
+struct SpawnReply {
+  enum { kStarted, kExited } kind;
+  pid_t pid;
+  /// The wait status of an exited command.
+  int status;
+};
 
-  close(output_pipe[1]);
+#ifdef MSG_NOSIGNAL
+const int kSendFlags = MSG_NOSIGNAL;
+#else
+const int kSendFlags = 0;
+#endif
+
+/// Write |size| bytes to the socket |fd|, passing |pass_fd| along with them
+/// unless it is -1.
+void
+SendAll(int fd, const void* data, size_t size, int pass_fd) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0) {
+    iovec iov = {const_cast<char*>(p), size};
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    if (pass_fd != -1) {
+      memset(control, 0, sizeof(control));
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+    }
+    ssize_t len = sendmsg(fd, &msg, kSendFlags);
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      Fatal("spawner: sendmsg: %s", strerror(errno));
+    }
+    p += len;
+    size -= len;
+    pass_fd = -1;
+  }
+}
+
+/// Read |size| bytes from the socket |fd|.  If a file descriptor is passed
+/// along with them, store it in |passed_fd|.
+/// @return false if the other end closed the socket first.
+bool
+ReceiveAll(int fd, void* data, size_t size, int* passed_fd) {
+  char* p = static_cast<char*>(data);
+  while (size > 0) {
+    iovec iov = {p, size};
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t len = recvmsg(fd, &msg, 0);
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      Fatal("spawner: recvmsg: %s", strerror(errno));
+    }
+    if (len == 0)
+      return false;
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(passed_fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    p += len;
+    size -= len;
+  }
+  return true;
+}
+
+void
+OnSpawnerChildExited(int) {}
+
+/// The spawner's main loop: serve requests from ninja on |fd| until it
+/// closes the socket.
+[[noreturn]] void
+RunSpawner(int fd) {
+  SetCloseOnExec(fd);
+#if !defined(USE_PPOLL)
+  if (fd >= static_cast<int>(FD_SETSIZE))
+    Fatal("spawner: %s", strerror(EMFILE));
+#endif
+
+  // Keep running when ctrl-c reaches ninja's process group: ninja still
+  // needs to know how its commands exited.  Only wake up for SIGCHLD.
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGTERM);
+  sigaddset(&set, SIGHUP);
+  sigaddset(&set, SIGCHLD);
+  sigset_t wait_mask;
+  if (sigprocmask(SIG_BLOCK, &set, &wait_mask) < 0)
+    Fatal("sigprocmask: %s", strerror(errno));
+  sigaddset(&wait_mask, SIGINT);
+  sigaddset(&wait_mask, SIGTERM);
+  sigaddset(&wait_mask, SIGHUP);
+  sigdelset(&wait_mask, SIGCHLD);
+  struct sigaction act;
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = OnSpawnerChildExited;
+  if (sigaction(SIGCHLD, &act, nullptr) < 0)
+    Fatal("sigaction: %s", strerror(errno));
+
+  std::string command;
+  for (;;) {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+      SpawnReply reply = {SpawnReply::kExited, pid, status};
+      SendAll(fd, &reply, sizeof(reply), -1);
+    }
+
+    fd_set read_set;
+    FD_ZERO(&read_set);
+    FD_SET(fd, &read_set);
+    if (pselect(fd + 1, &read_set, nullptr, nullptr, nullptr, &wait_mask)
+        < 0) {
+      if (errno == EINTR)
+        continue;
+      Fatal("spawner: pselect: %s", strerror(errno));
+    }
+
+    SpawnRequest request;
+    int unused_fd = -1;
+    if (!ReceiveAll(fd, &request, sizeof(request), &unused_fd))
+      _exit(0); // Ninja is gone.
+    command.resize(request.command_size);
+    if (!ReceiveAll(fd, &command[0], command.size(), &unused_fd))
+      _exit(0);
+
+    int output_pipe[2];
+    if (pipe(output_pipe) < 0)
+      Fatal("pipe: %s", strerror(errno));
+    SetCloseOnExec(output_pipe[0]);
+    SpawnReply reply = {SpawnReply::kStarted, -1, 0};
+    reply.pid = SpawnCommand(
+        command, request.use_console, request.use_shell, request.mask, -1,
+        output_pipe[1], output_pipe[1]
+    );
+    close(output_pipe[1]);
+    SendAll(fd, &reply, sizeof(reply), output_pipe[0]);
+    close(output_pipe[0]);
+  }
+}
+
+/// Ninja's end of the connection to the spawner.
+struct Spawner {
+  pid_t pid;
+  int fd;
+  /// Exit statuses received before their Subprocess::Finish().
+  std::map<pid_t, int> exit_statuses;
+
+  /// Start |command| in the spawner, storing the read end of its output pipe
+  /// in |output_fd|.
+  /// @return the pid of the command.
+  pid_t
+  Spawn(
+      const std::string& command, bool use_console, bool use_shell,
+      const sigset_t& mask, int* output_fd
+  );
+
+  /// @return the wait status of the command with |pid|, once it exits.
+  int
+  Wait(pid_t pid);
+
+  /// Receive the next reply, storing exit statuses.
+  void
+  ReceiveReply(SpawnReply* reply, int* passed_fd);
+};
+
+Spawner* g_spawner = nullptr;
+
+pid_t
+Spawner::Spawn(
+    const std::string& command, bool use_console, bool use_shell,
+    const sigset_t& mask, int* output_fd
+) {
+  SpawnRequest request;
+  memset(&request, 0, sizeof(request));
+  request.mask = mask;
+  request.command_size = static_cast<uint32_t>(command.size());
+  request.use_console = use_console;
+  request.use_shell = use_shell;
+  SendAll(fd, &request, sizeof(request), -1);
+  SendAll(fd, command.data(), command.size(), -1);
+
+  SpawnReply reply;
+  do {
+    *output_fd = -1;
+    ReceiveReply(&reply, output_fd);
+  } while (reply.kind != SpawnReply::kStarted);
+  if (*output_fd < 0)
+    Fatal("spawner: no output pipe for '%s'", command.c_str());
+  return reply.pid;
+}
+
+int
+Spawner::Wait(pid_t pid) {
+  std::map<pid_t, int>::iterator i;
+  while ((i = exit_statuses.find(pid)) == exit_statuses.end()) {
+    SpawnReply reply;
+    int unused_fd = -1;
+    ReceiveReply(&reply, &unused_fd);
+  }
+  int status = i->second;
+  exit_statuses.erase(i);
+  return status;
+}
+
+void
+Spawner::ReceiveReply(SpawnReply* reply, int* passed_fd) {
+  if (!ReceiveAll(fd, reply, sizeof(*reply), passed_fd))
+    Fatal("spawner exited unexpectedly");
+  if (reply->kind == SpawnReply::kExited)
+    exit_statuses[reply->pid] = reply->status;
+}
+
+/// Frame a request to a persistent worker: its length in bytes as a decimal
+/// number and a newline, then a JSON object with the request's id and
+/// arguments.
+std::string
+EncodeWorkerRequest(int id, const std::vector<std::string>& args) {
+  std::string body = "{\"id\":" + std::to_string(id) + ",\"arguments\":[";
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (i)
+      body += ',';
+    body += '"' + EncodeJSONString(args[i]) + '"';
+  }
+  body += "]}";
+  return std::to_string(body.size()) + "\n" + body;
+}
+
+/// Describe a worker's wait |status|.
+std::string
+DescribeWorkerExit(int status) {
+  if (WIFSIGNALED(status))
+    return "was killed by signal " + std::to_string(WTERMSIG(status));
+  return "exited with status " + std::to_string(WEXITSTATUS(status));
+}
+
+/// Don't keep more than this much of a worker's stderr.
+const size_t kMaxWorkerErrors = 64 << 10;
+
+/// How long a worker asked to stop may take before it's killed.
+const int64_t kStopWorkerMillis = 1000;
+
+/// @return true if the child |pid| has exited, without reaping it.
+bool
+ChildExited(pid_t pid) {
+  siginfo_t info;
+  info.si_pid = 0;
+  return waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0
+         && info.si_pid != 0;
+}
+
+} // anonymous namespace
+
+/// A long-lived process which runs one request at a time: ninja writes
+/// requests to its stdin, and reads responses framed the same way from its
+/// stdout.  A response is a JSON object with the id of the request, its
+/// "exit_code" and optionally its "output".
+struct PersistentWorker {
+  std::string command;
+  pid_t pid;
+  /// A socket, so a worker which exits doesn't send SIGPIPE to ninja.
+  int input_fd;
+  int output_fd;
+  /// -1 once the worker closes its stderr.
+  int error_fd;
+  /// The bytes read of the current response.
+  std::string response;
+  /// What the worker wrote to stderr during the current request, which is
+  /// shown if it crashes.
+  std::string errors;
+  /// The request in flight, if any.
+  Subprocess* request;
+};
+
+bool
+SplitSimpleCommand(
+    const std::string& command, std::vector<std::string>* args
+) {
+  args->clear();
+  size_t i = 0;
+  while (i < command.size()) {
+    if (command[i] == ' ' || command[i] == '\t') {
+      ++i;
+      continue;
+    }
+    size_t start = i;
+    while (i < command.size() && IsPlainWordChar(command[i]))
+      ++i;
+    if (i < command.size() && command[i] != ' ' && command[i] != '\t')
+      return false;
+    args->emplace_back(command, start, i - start);
+  }
+  if (args->empty())
+    return false;
+
+  const std::string& program = args->front();
+  if (program.find('=') != std::string::npos)
+    return false; // A variable assignment.
+  for (const char* word : kShellWords) {
+    if (program == word)
+      return false;
+  }
+  return true;
+}
+
+std::string
+MakeBatchScript(
+    const std::vector<std::string>& commands, const std::string& marker,
+    bool stop_on_failure
+) {
+  // A command killed by a signal exits its subshell with 128 plus the
+  // signal; see BatchExitStatus().
+  std::string stop = "case $s in " + std::to_string(128 + SIGINT) + "|"
+                     + std::to_string(128 + SIGTERM) + "|"
+                     + std::to_string(128 + SIGHUP) + ") exit $s;; esac\n";
+  if (stop_on_failure)
+    stop = "[ $s -eq 0 ] || exit $s\n";
+  // Commands go on lines of their own, so that a comment at the end of one
+  // can't swallow the closing parenthesis.  An empty subshell is a syntax
+  // error, hence the ':' for empty commands.
+  std::string script;
+  for (size_t i = 0; i < commands.size(); ++i) {
+    script += "(\n";
+    script += commands[i].empty() ? ":" : commands[i];
+    script += "\n)\ns=$?\nprintf '" + marker + ":" + std::to_string(i)
+              + ":%d\\n' $s\n" + stop;
+  }
+  return script;
+}
+
+namespace {
+
+/// @return the status of a command of a batch from its exit |code|.
+ExitStatus
+BatchExitStatus(int code) {
+  if (code == 0)
+    return ExitSuccess;
+  if (code == 128 + SIGINT || code == 128 + SIGTERM || code == 128 + SIGHUP)
+    return ExitInterrupted;
+  return ExitFailure;
+}
+
+} // anonymous namespace
+
+size_t
+SplitBatchOutput(
+    const std::string& output, const std::string& marker, size_t count,
+    std::vector<std::string>* outputs, std::vector<ExitStatus>* statuses
+) {
+  BatchOutputSplitter splitter(marker, count, 0);
+  splitter.Feed(output.data(), output.size());
+  size_t finished = splitter.Finish();
+  *outputs = std::move(splitter.outputs_);
+  *statuses = std::move(splitter.statuses_);
+  return finished;
+}
+
+BatchOutputSplitter::BatchOutputSplitter(
+    const std::string& marker, size_t count, size_t max_output_size
+)
+    : outputs_(count), spills_(count, nullptr), marker_(marker),
+      tag_(marker + ":0:"), count_(count), memory_left_(max_output_size),
+      limited_(max_output_size != 0) {}
+
+BatchOutputSplitter::~BatchOutputSplitter() {
+  for (FILE* spill : spills_) {
+    if (spill)
+      fclose(spill);
+  }
+}
+
+void
+BatchOutputSplitter::Feed(const char* data, size_t size) {
+  pending_.append(data, size);
+  size_t pos = 0;
+  while (statuses_.size() < count_) {
+    size_t end = pending_.find(tag_, pos);
+    if (end == std::string::npos) {
+      // Keep what could be the start of the marker.
+      size_t keep = std::min(pending_.size() - pos, tag_.size() - 1);
+      AppendOutput(pending_.data() + pos, pending_.size() - pos - keep);
+      pos = pending_.size() - keep;
+      break;
+    }
+    size_t eol = pending_.find('\n', end + tag_.size());
+    AppendOutput(pending_.data() + pos, end - pos);
+    pos = end;
+    if (eol == std::string::npos)
+      break;
+    const char* code = pending_.c_str() + end + tag_.size();
+    statuses_.push_back(BatchExitStatus(atoi(code)));
+    tag_ = marker_ + ":" + std::to_string(statuses_.size()) + ":";
+    pos = eol + 1;
+  }
+  // Nothing follows the last marker.
+  if (statuses_.size() == count_)
+    pos = pending_.size();
+  pending_.erase(0, pos);
+}
+
+size_t
+BatchOutputSplitter::Finish() {
+  if (statuses_.size() < count_)
+    AppendOutput(pending_.data(), pending_.size());
+  pending_.clear();
+  return statuses_.size();
+}
+
+void
+BatchOutputSplitter::AppendOutput(const char* data, size_t size) {
+  const size_t i = statuses_.size();
+  size_t keep = limited_ ? std::min(size, memory_left_) : size;
+  outputs_[i].append(data, keep);
+  if (limited_)
+    memory_left_ -= keep;
+  if (keep == size)
+    return;
+  if (!spills_[i] && !(spills_[i] = tmpfile()))
+    Fatal("tmpfile: %s", strerror(errno));
+  if (fwrite(data + keep, 1, size - keep, spills_[i]) != size - keep)
+    Fatal("write: %s", strerror(errno));
+}
+
+Subprocess::Subprocess(bool use_console, bool use_shell)
+    : spill_(nullptr), max_output_size_(0), fd_(-1), pid_(-1), pidfd_(-1),
+      reaped_(false), wait_status_(0), drain_deadline_(-1), request_id_(0),
+      worker_(nullptr), request_retried_(false), worker_exit_code_(0),
+      use_console_(use_console), use_shell_(use_shell) {}
+
+Subprocess::~Subprocess() {
+  if (spill_)
+    fclose(spill_);
+  if (fd_ >= 0)
+    close(fd_);
+  if (pidfd_ >= 0)
+    close(pidfd_);
+  // Reap child if forgotten.
+  if (pid_ != -1)
+    Finish();
+}
+
+bool
+Subprocess::Start(SubprocessSet* set, const std::string& command) {
+  if (g_spawner) {
+    pid_ = g_spawner->Spawn(
+        command, use_console_, use_shell_, set->old_mask_, &fd_
+    );
+  } else {
+    int output_pipe[2];
+    if (pipe(output_pipe) < 0)
+      Fatal("pipe: %s", strerror(errno));
+    fd_ = output_pipe[0];
+    SetCloseOnExec(fd_);
+    pid_ = SpawnCommand(
+        command, use_console_, use_shell_, set->old_mask_, -1, output_pipe[1],
+        output_pipe[1]
+    );
+    close(output_pipe[1]);
+  }
+#ifdef NINJA_HAVE_PIDFD
+  // Commands of the spawner are its children, which only it can reap.
+  if (set->use_pidfd_ && !g_spawner) {
+    pidfd_ = static_cast<int>(syscall(SYS_pidfd_open, pid_, 0));
+    if (pidfd_ < 0)
+      Fatal("pidfd_open: %s", strerror(errno));
+    SetCloseOnExec(pidfd_);
+  }
+#endif
+#if !defined(USE_PPOLL)
+  // If available, we use ppoll in DoWork(); otherwise we use pselect
+  // and so must avoid overly-large FDs.
+  if (!set->use_pidfd_ && fd_ >= static_cast<int>(FD_SETSIZE))
+    Fatal("pipe: %s", strerror(EMFILE));
+#endif // !USE_PPOLL
+  SetCloseOnExec(fd_);
   return true;
 }
 
 void
 Subprocess::OnPipeReady() {
-  char buf[4 << 10];
+  // Read as much as a pipe holds at once, so that a command printing a lot
+  // costs fewer wakeups.
+  char buf[64 << 10];
   ssize_t len = read(fd_, buf, sizeof(buf));
   if (len > 0) {
-    buf_.append(buf, len);
+    AppendOutput(buf, len);
   } else {
     if (len < 0)
       Fatal("read: %s", strerror(errno));
@@ -147,11 +721,30 @@ Subprocess::OnPipeReady() {
   }
 }
 
+void
+Subprocess::OnExited(int grace_millis) {
+  if (waitpid(pid_, &wait_status_, WNOHANG) <= 0)
+    Fatal("waitpid(%d): %s", pid_, strerror(errno));
+  reaped_ = true;
+  close(pidfd_);
+  pidfd_ = -1;
+  if (fd_ >= 0)
+    drain_deadline_ = GetTimeMillis() + grace_millis;
+}
+
 ExitStatus
 Subprocess::Finish() {
+  if (!worker_command_.empty()) {
+    assert(!worker_);
+    return worker_exit_code_ == 0 ? ExitSuccess : ExitFailure;
+  }
   assert(pid_ != -1);
   int status;
-  if (waitpid(pid_, &status, 0) < 0)
+  if (reaped_)
+    status = wait_status_;
+  else if (g_spawner)
+    status = g_spawner->Wait(pid_);
+  else if (waitpid(pid_, &status, 0) < 0)
     Fatal("waitpid(%d): %s", pid_, strerror(errno));
   pid_ = -1;
 
@@ -179,7 +772,23 @@ Subprocess::Finish() {
 
 bool
 Subprocess::Done() const {
-  return fd_ == -1;
+  if (!worker_command_.empty())
+    return !worker_;
+  return fd_ == -1 && pidfd_ == -1;
+}
+
+void
+Subprocess::AppendOutput(const char* data, size_t size) {
+  size_t keep = size;
+  if (max_output_size_ && buf_.size() + size > max_output_size_)
+    keep = buf_.size() < max_output_size_ ? max_output_size_ - buf_.size() : 0;
+  buf_.append(data, keep);
+  if (keep == size)
+    return;
+  if (!spill_ && !(spill_ = tmpfile()))
+    Fatal("tmpfile: %s", strerror(errno));
+  if (fwrite(data + keep, 1, size - keep, spill_) != size - keep)
+    Fatal("write: %s", strerror(errno));
 }
 
 const std::string&
@@ -187,6 +796,18 @@ Subprocess::GetOutput() const {
   return buf_;
 }
 
+std::string
+Subprocess::TakeOutput() {
+  return std::move(buf_);
+}
+
+FILE*
+Subprocess::TakeSpilledOutput() {
+  FILE* spill = spill_;
+  spill_ = nullptr;
+  return spill;
+}
+
 int SubprocessSet::interrupted_;
 
 void
@@ -210,7 +831,9 @@ SubprocessSet::HandlePendingInterruption() {
     interrupted_ = SIGHUP;
 }
 
-SubprocessSet::SubprocessSet() {
+SubprocessSet::SubprocessSet()
+    : max_output_size_(0), drain_grace_millis_(1000), next_request_id_(1),
+      use_pidfd_(false), signal_fd_(-1) {
   sigset_t set;
   sigemptyset(&set);
   sigaddset(&set, SIGINT);
@@ -228,10 +851,34 @@ SubprocessSet::SubprocessSet() {
     Fatal("sigaction: %s", strerror(errno));
   if (sigaction(SIGHUP, &act, &old_hup_act_) < 0)
     Fatal("sigaction: %s", strerror(errno));
+
+#ifdef NINJA_HAVE_PIDFD
+  // The signals stay blocked, and wait for DoWorkWithPidfds() to read them
+  // from the signalfd.  Without one, fall back to pselect().
+  if (g_use_pidfd) {
+    signal_fd_ = signalfd(-1, &set, SFD_CLOEXEC);
+    use_pidfd_ = signal_fd_ >= 0;
+  }
+  // Kernels before 5.3 lack pidfd_open(), even if the C library knows it.
+  if (use_pidfd_) {
+    int pidfd = static_cast<int>(syscall(SYS_pidfd_open, getpid(), 0));
+    if (pidfd >= 0) {
+      close(pidfd);
+    } else {
+      close(signal_fd_);
+      signal_fd_ = -1;
+      use_pidfd_ = false;
+    }
+  }
+#endif
 }
 
 SubprocessSet::~SubprocessSet() {
   Clear();
+  while (!workers_.empty())
+    StopWorker(workers_.back(), SIGTERM);
+  if (signal_fd_ >= 0)
+    close(signal_fd_);
 
   if (sigaction(SIGINT, &old_int_act_, 0) < 0)
     Fatal("sigaction: %s", strerror(errno));
@@ -243,10 +890,51 @@ SubprocessSet::~SubprocessSet() {
     Fatal("sigprocmask: %s", strerror(errno));
 }
 
+void
+SubprocessSet::StartSpawner() {
+  if (g_spawner)
+    return;
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    Fatal("socketpair: %s", strerror(errno));
+  pid_t pid = fork();
+  if (pid < 0)
+    Fatal("fork: %s", strerror(errno));
+  if (pid == 0) {
+    close(fds[0]);
+    RunSpawner(fds[1]);
+  }
+  close(fds[1]);
+  SetCloseOnExec(fds[0]);
+  g_spawner = new Spawner{pid, fds[0], {}};
+}
+
+void
+SubprocessSet::StopSpawner() {
+  if (!g_spawner)
+    return;
+  close(g_spawner->fd);
+  if (waitpid(g_spawner->pid, nullptr, 0) < 0)
+    Fatal("waitpid(%d): %s", g_spawner->pid, strerror(errno));
+  delete g_spawner;
+  g_spawner = nullptr;
+}
+
 Subprocess*
-SubprocessSet::Add(const std::string& command, bool use_console) {
-  Subprocess* subprocess = new Subprocess(use_console);
-  if (!subprocess->Start(this, command)) {
+SubprocessSet::Add(
+    const std::string& command, bool use_console, bool use_shell,
+    const std::string& worker_command
+) {
+  Subprocess* subprocess = new Subprocess(use_console, use_shell);
+  subprocess->max_output_size_ = max_output_size_;
+  std::vector<std::string> args;
+  if (!worker_command.empty() && !use_console
+      && SplitSimpleCommand(command, &args)) {
+    subprocess->worker_command_ = worker_command;
+    subprocess->request_id_ = next_request_id_++;
+    subprocess->request_ = EncodeWorkerRequest(subprocess->request_id_, args);
+    SendRequest(subprocess);
+  } else if (!subprocess->Start(this, command)) {
     delete subprocess;
     return 0;
   }
@@ -254,24 +942,356 @@ SubprocessSet::Add(const std::string& command, bool use_console) {
   return subprocess;
 }
 
+PersistentWorker*
+SubprocessSet::StartWorker(const std::string& command) {
+  int input[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, input) < 0)
+    Fatal("socketpair: %s", strerror(errno));
+  int output[2];
+  if (pipe(output) < 0)
+    Fatal("pipe: %s", strerror(errno));
+  int errors[2];
+  if (pipe(errors) < 0)
+    Fatal("pipe: %s", strerror(errno));
+#if !defined(USE_PPOLL)
+  if (output[0] >= static_cast<int>(FD_SETSIZE)
+      || errors[0] >= static_cast<int>(FD_SETSIZE))
+    Fatal("pipe: %s", strerror(EMFILE));
+#endif // !USE_PPOLL
+  SetCloseOnExec(input[0]);
+  SetCloseOnExec(output[0]);
+  SetCloseOnExec(errors[0]);
+#ifdef SO_NOSIGPIPE
+  int on = 1;
+  setsockopt(input[0], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+  PersistentWorker* worker = new PersistentWorker;
+  worker->command = command;
+  worker->pid = SpawnCommand(
+      command, false, false, old_mask_, input[1], output[1], errors[1]
+  );
+  worker->input_fd = input[0];
+  worker->output_fd = output[0];
+  worker->error_fd = errors[0];
+  worker->request = nullptr;
+  close(input[1]);
+  close(output[1]);
+  close(errors[1]);
+  workers_.push_back(worker);
+  return worker;
+}
+
+void
+SubprocessSet::SendRequest(Subprocess* subproc) {
+  PersistentWorker* worker = nullptr;
+  for (size_t i = 0; i < workers_.size() && !worker;) {
+    PersistentWorker* w = workers_[i];
+    if (w->request || w->command != subproc->worker_command_) {
+      ++i;
+    } else if (ChildExited(w->pid)) {
+      // A worker which died while idle mustn't use up the retry of the
+      // request.
+      StopWorker(w, SIGKILL);
+    } else {
+      worker = w;
+    }
+  }
+  const bool reused = worker != nullptr;
+  if (!worker)
+    worker = StartWorker(subproc->worker_command_);
+  worker->request = subproc;
+  worker->response.clear();
+  worker->errors.clear();
+  subproc->worker_ = worker;
+
+  const char* p = subproc->request_.data();
+  size_t size = subproc->request_.size();
+  while (size > 0) {
+    ssize_t len = send(worker->input_fd, p, size, kSendFlags);
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      // The worker is gone.  If it was idle, it didn't get the request.
+      if (reused) {
+        StopWorker(worker, SIGKILL);
+        SendRequest(subproc);
+      } else {
+        WorkerFailed(worker, "");
+      }
+      return;
+    }
+    p += len;
+    size -= len;
+  }
+}
+
+void
+SubprocessSet::OnWorkerOutput(PersistentWorker* worker) {
+  char buf[4 << 10];
+  ssize_t len = read(worker->output_fd, buf, sizeof(buf));
+  if (len < 0) {
+    if (errno == EINTR || errno == EAGAIN)
+      return;
+    Fatal("read: %s", strerror(errno));
+  }
+  if (len == 0) {
+    WorkerFailed(worker, "");
+    return;
+  }
+  std::string& response = worker->response;
+  response.append(buf, len);
+
+  // Wait for the length and the whole JSON object.
+  size_t newline = response.find('\n');
+  if (newline == std::string::npos) {
+    if (response.size() > 20)
+      WorkerFailed(worker, "sent a response without a length");
+    return;
+  }
+  size_t size = 0;
+  for (size_t i = 0; i < newline; ++i) {
+    if (response[i] < '0' || response[i] > '9' || newline > 20) {
+      WorkerFailed(worker, "sent a response without a length");
+      return;
+    }
+    size = size * 10 + (response[i] - '0');
+  }
+  if (response.size() - newline - 1 < size)
+    return;
+  if (response.size() - newline - 1 > size) {
+    WorkerFailed(worker, "sent more than one response");
+    return;
+  }
+
+  std::map<std::string, std::string> values;
+  std::string err;
+  if (!DecodeJSONObject(response.substr(newline + 1), &values, &err)) {
+    WorkerFailed(worker, "sent a bad response: " + err);
+    return;
+  }
+  Subprocess* subproc = worker->request;
+  if (values["id"] != std::to_string(subproc->request_id_)) {
+    WorkerFailed(worker, "responded to the wrong request");
+    return;
+  }
+  const std::string& exit_code = values["exit_code"];
+  char* end = nullptr;
+  long code = strtol(exit_code.c_str(), &end, 10);
+  if (exit_code.empty() || *end) {
+    WorkerFailed(worker, "sent a response without an exit_code");
+    return;
+  }
+  subproc->worker_exit_code_ = static_cast<int>(code);
+  const std::string& output = values["output"];
+  subproc->AppendOutput(output.data(), output.size());
+  subproc->worker_ = nullptr;
+  worker->request = nullptr;
+  response.clear();
+}
+
+void
+SubprocessSet::OnWorkerErrors(PersistentWorker* worker) {
+  char buf[4 << 10];
+  ssize_t len = read(worker->error_fd, buf, sizeof(buf));
+  if (len < 0) {
+    if (errno == EINTR || errno == EAGAIN)
+      return;
+    Fatal("read: %s", strerror(errno));
+  }
+  if (len == 0) {
+    close(worker->error_fd);
+    worker->error_fd = -1;
+    return;
+  }
+  if (worker->errors.size() < kMaxWorkerErrors)
+    worker->errors.append(buf, len);
+}
+
+void
+SubprocessSet::WorkerFailed(
+    PersistentWorker* worker, const std::string& error
+) {
+  Subprocess* subproc = worker->request;
+  std::string command = worker->command;
+  std::string errors = worker->errors;
+  int status = StopWorker(worker, SIGKILL);
+  if (!subproc->request_retried_) {
+    // Give the request another chance with a fresh worker.
+    subproc->request_retried_ = true;
+    SendRequest(subproc);
+    return;
+  }
+  subproc->worker_exit_code_ = 1;
+  subproc->buf_ = "ninja: worker '" + command + "' "
+                  + (error.empty() ? DescribeWorkerExit(status) : error)
+                  + "\n" + errors;
+}
+
+int
+SubprocessSet::StopWorker(PersistentWorker* worker, int signal) {
+  close(worker->input_fd);
+  kill(-worker->pid, signal);
+  // A worker which handles the signal gets a moment to exit, then is killed,
+  // so that it can't hang ninja.
+  int status;
+  int flags = signal == SIGKILL ? 0 : WNOHANG;
+  const int64_t deadline = GetTimeMillis() + kStopWorkerMillis;
+  for (;;) {
+    pid_t pid = waitpid(worker->pid, &status, flags);
+    if (pid == worker->pid)
+      break;
+    if (pid < 0) {
+      if (errno != EINTR)
+        Fatal("waitpid(%d): %s", worker->pid, strerror(errno));
+    } else if (GetTimeMillis() >= deadline) {
+      kill(-worker->pid, SIGKILL);
+      flags = 0;
+    } else {
+      usleep(10 * 1000);
+    }
+  }
+  close(worker->output_fd);
+  if (worker->error_fd >= 0)
+    close(worker->error_fd);
+  if (worker->request)
+    worker->request->worker_ = nullptr;
+  workers_.erase(std::find(workers_.begin(), workers_.end(), worker));
+  delete worker;
+  return status;
+}
+
+bool
+SubprocessSet::CollectFinished() {
+  bool any = false;
+  for (std::vector<Subprocess*>::iterator i = running_.begin();
+       i != running_.end();) {
+    if ((*i)->Done()) {
+      finished_.push(*i);
+      i = running_.erase(i);
+      any = true;
+    } else {
+      ++i;
+    }
+  }
+  return any;
+}
+
+#ifdef NINJA_HAVE_PIDFD
+bool
+SubprocessSet::DoWorkWithPidfds() {
+  // Wait for the signalfd, then the pipe and pidfd of each command, then the
+  // stderr and stdout of each busy worker.  Negative fds are ignored.
+  std::vector<pollfd> fds;
+  pollfd signal_pfd = {signal_fd_, POLLIN, 0};
+  fds.push_back(signal_pfd);
+  int64_t deadline = -1;
+  for (Subprocess* i : running_) {
+    pollfd pipe_pfd = {i->fd_, POLLIN | POLLPRI, 0};
+    fds.push_back(pipe_pfd);
+    pollfd pid_pfd = {i->pidfd_, POLLIN, 0};
+    fds.push_back(pid_pfd);
+    if (i->fd_ >= 0 && i->drain_deadline_ >= 0
+        && (deadline < 0 || i->drain_deadline_ < deadline))
+      deadline = i->drain_deadline_;
+  }
+  std::vector<PersistentWorker*> busy;
+  for (PersistentWorker* i : workers_) {
+    if (!i->request)
+      continue;
+    busy.push_back(i);
+    pollfd error_pfd = {i->error_fd, POLLIN | POLLPRI, 0};
+    fds.push_back(error_pfd);
+    pollfd output_pfd = {i->output_fd, POLLIN | POLLPRI, 0};
+    fds.push_back(output_pfd);
+  }
+
+  int timeout = -1;
+  if (deadline >= 0) {
+    timeout =
+        static_cast<int>(std::max<int64_t>(deadline - GetTimeMillis(), 0));
+  }
+
+  interrupted_ = 0;
+  int ret = poll(&fds.front(), fds.size(), timeout);
+  if (ret == -1) {
+    if (errno != EINTR) {
+      perror("ninja: poll");
+      return false;
+    }
+    return IsInterrupted();
+  }
+
+  if (fds[0].revents) {
+    signalfd_siginfo info;
+    if (read(signal_fd_, &info, sizeof(info)) == sizeof(info))
+      interrupted_ = static_cast<int>(info.ssi_signo);
+    if (IsInterrupted())
+      return true;
+  }
+
+  const int64_t now = GetTimeMillis();
+  size_t cur_nfd = 1;
+  for (Subprocess* i : running_) {
+    const bool pipe_ready = fds[cur_nfd++].revents;
+    const bool exited = fds[cur_nfd++].revents;
+    if (pipe_ready)
+      i->OnPipeReady();
+    if (exited)
+      i->OnExited(drain_grace_millis_);
+    // Whatever still holds the pipe open outlived the command: stop reading
+    // from it once the grace period is over, even if it keeps writing.
+    else if (i->fd_ >= 0 && i->drain_deadline_ >= 0
+             && now >= i->drain_deadline_) {
+      close(i->fd_);
+      i->fd_ = -1;
+    }
+  }
+  for (PersistentWorker* i : busy) {
+    // Read stderr first: a failure on stdout deletes the worker.
+    if (fds[cur_nfd++].revents)
+      OnWorkerErrors(i);
+    if (fds[cur_nfd++].revents)
+      OnWorkerOutput(i);
+  }
+  CollectFinished();
+
+  return IsInterrupted();
+}
+#endif // NINJA_HAVE_PIDFD
+
 #ifdef USE_PPOLL
 bool
 SubprocessSet::DoWork() {
-  vector<pollfd> fds;
-  nfds_t nfds = 0;
+  // A request can fail without waiting, when its worker fails to start.
+  if (CollectFinished())
+    return false;
+#ifdef NINJA_HAVE_PIDFD
+  if (use_pidfd_)
+    return DoWorkWithPidfds();
+#endif
 
-  for (vector<Subprocess*>::iterator i = running_.begin(); i != running_.end();
-       ++i) {
-    int fd = (*i)->fd_;
-    if (fd < 0)
+  std::vector<pollfd> fds;
+  for (Subprocess* i : running_) {
+    if (i->fd_ < 0)
       continue;
-    pollfd pfd = {fd, POLLIN | POLLPRI, 0};
+    pollfd pfd = {i->fd_, POLLIN | POLLPRI, 0};
     fds.push_back(pfd);
-    ++nfds;
+  }
+  // Negative fds are ignored.
+  std::vector<PersistentWorker*> busy;
+  for (PersistentWorker* i : workers_) {
+    if (!i->request)
+      continue;
+    busy.push_back(i);
+    pollfd error_pfd = {i->error_fd, POLLIN | POLLPRI, 0};
+    fds.push_back(error_pfd);
+    pollfd output_pfd = {i->output_fd, POLLIN | POLLPRI, 0};
+    fds.push_back(output_pfd);
   }
 
   interrupted_ = 0;
-  int ret = ppoll(&fds.front(), nfds, nullptr, &old_mask_);
+  int ret = ppoll(&fds.front(), fds.size(), nullptr, &old_mask_);
   if (ret == -1) {
     if (errno != EINTR) {
       perror("ninja: ppoll");
@@ -284,23 +1304,22 @@ SubprocessSet::DoWork() {
   if (IsInterrupted())
     return true;
 
-  nfds_t cur_nfd = 0;
-  for (vector<Subprocess*>::iterator i = running_.begin();
-       i != running_.end();) {
-    int fd = (*i)->fd_;
-    if (fd < 0)
+  size_t cur_nfd = 0;
+  for (Subprocess* i : running_) {
+    if (i->fd_ < 0)
       continue;
-    assert(fd == fds[cur_nfd].fd);
-    if (fds[cur_nfd++].revents) {
-      (*i)->OnPipeReady();
-      if ((*i)->Done()) {
-        finished_.push(*i);
-        i = running_.erase(i);
-        continue;
-      }
-    }
-    ++i;
+    assert(i->fd_ == fds[cur_nfd].fd);
+    if (fds[cur_nfd++].revents)
+      i->OnPipeReady();
   }
+  for (PersistentWorker* i : busy) {
+    // Read stderr first: a failure on stdout deletes the worker.
+    if (fds[cur_nfd++].revents)
+      OnWorkerErrors(i);
+    if (fds[cur_nfd++].revents)
+      OnWorkerOutput(i);
+  }
+  CollectFinished();
 
   return IsInterrupted();
 }
@@ -308,12 +1327,30 @@ SubprocessSet::DoWork() {
 #else // !defined(USE_PPOLL)
 bool
 SubprocessSet::DoWork() {
+  // A request can fail without waiting, when its worker fails to start.
+  if (CollectFinished())
+    return false;
+#ifdef NINJA_HAVE_PIDFD
+  if (use_pidfd_)
+    return DoWorkWithPidfds();
+#endif
+
   fd_set set;
   int nfds = 0;
   FD_ZERO(&set);
 
-  for (Subprocess* i : running_) {
-    int fd = i->fd_;
+  std::vector<int> fds;
+  for (Subprocess* i : running_)
+    fds.push_back(i->fd_);
+  std::vector<PersistentWorker*> busy;
+  for (PersistentWorker* i : workers_) {
+    if (!i->request)
+      continue;
+    busy.push_back(i);
+    fds.push_back(i->error_fd);
+    fds.push_back(i->output_fd);
+  }
+  for (int fd : fds) {
     if (fd >= 0) {
       FD_SET(fd, &set);
       if (nfds < fd + 1)
@@ -335,19 +1372,19 @@ SubprocessSet::DoWork() {
   if (IsInterrupted())
     return true;
 
-  for (std::vector<Subprocess*>::iterator i = running_.begin();
-       i != running_.end();) {
-    int fd = (*i)->fd_;
-    if (fd >= 0 && FD_ISSET(fd, &set)) {
-      (*i)->OnPipeReady();
-      if ((*i)->Done()) {
-        finished_.push(*i);
-        i = running_.erase(i);
-        continue;
-      }
-    }
-    ++i;
+  for (Subprocess* i : running_) {
+    int fd = i->fd_;
+    if (fd >= 0 && FD_ISSET(fd, &set))
+      i->OnPipeReady();
   }
+  for (PersistentWorker* i : busy) {
+    // Read stderr first: a failure on stdout deletes the worker.
+    if (i->error_fd >= 0 && FD_ISSET(i->error_fd, &set))
+      OnWorkerErrors(i);
+    if (FD_ISSET(i->output_fd, &set))
+      OnWorkerOutput(i);
+  }
+  CollectFinished();
 
   return IsInterrupted();
 }
@@ -364,11 +1401,15 @@ SubprocessSet::NextFinished() {
 
 void
 SubprocessSet::Clear() {
-  for (Subprocess* i : running_)
+  for (Subprocess* i : running_) {
+    // A worker in the middle of a request can't be reused.
+    if (i->worker_)
+      StopWorker(i->worker_, interrupted_ ? interrupted_ : SIGTERM);
     // Since the foreground process is in our process group, it will receive
     // the interruption signal (i.e. SIGINT or SIGTERM) at the same time as us.
-    if (!i->use_console_)
+    else if (!i->use_console_ && i->pid_ != -1)
       kill(-i->pid_, interrupted_);
+  }
   for (Subprocess* i : running_)
     delete i;
   running_.clear();
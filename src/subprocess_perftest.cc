@@ -0,0 +1,86 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdio>
+#include <cstdlib>
+#include <ninja/metrics.hpp>
+#include <ninja/subprocess.hpp>
+#include <ninja/util.hpp>
+#include <vector>
+
+namespace {
+
+/// Run |count| copies of |command|, |parallelism| at a time.
+/// @return the time taken in milliseconds.
+int
+RunCommands(
+    const char* command, bool use_shell, int count, size_t parallelism
+) {
+  SubprocessSet subprocs;
+  int started = 0;
+  int64_t start = GetTimeMillis();
+  while (started < count || !subprocs.running_.empty()) {
+    while (started < count && subprocs.running_.size() < parallelism) {
+      if (!subprocs.Add(command, false, use_shell))
+        Fatal("failed to start '%s'", command);
+      ++started;
+    }
+    subprocs.DoWork();
+    while (Subprocess* subproc = subprocs.NextFinished()) {
+      if (subproc->Finish() != ExitSuccess)
+        Fatal("'%s' failed", command);
+      delete subproc;
+    }
+  }
+  return static_cast<int>(GetTimeMillis() - start);
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char** argv) {
+  const char* command = argc > 1 ? argv[1] : "true";
+  const size_t heap_mb = argc > 2 ? strtoul(argv[2], nullptr, 10) : 0;
+  const int kNumCommands = 2000;
+  const size_t kParallelism = 8;
+
+  // Like ninja, fork the spawner while still small, then optionally grow
+  // the process as loading a big manifest would.
+  enum { kSpawner, kShell, kDirect, kNumModes };
+  const char* kModeNames[] = {"spawner", "shell", "direct"};
+  int first_mode = kShell;
+#ifndef _WIN32
+  SubprocessSet::StartSpawner();
+  first_mode = kSpawner;
+#endif
+  std::vector<char> heap(heap_mb << 20, 1);
+
+  for (int mode = first_mode; mode < kNumModes; ++mode) {
+    int best = 0;
+    for (int j = 0; j < 5; ++j) {
+      int delta =
+          RunCommands(command, mode == kShell, kNumCommands, kParallelism);
+      if (j == 0 || delta < best)
+        best = delta;
+    }
+    printf(
+        "%-7s %dms for %d commands, %.0f commands/s\n", kModeNames[mode],
+        best, kNumCommands, kNumCommands * 1000.0 / (best ? best : 1)
+    );
+#ifndef _WIN32
+    if (mode == kSpawner)
+      SubprocessSet::StopSpawner();
+#endif
+  }
+}
@@ -12,14 +12,18 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <ninja/debug_flags.hpp>
+#include <ninja/metrics.hpp>
 #include <ninja/subprocess.hpp>
 #include <ninja/test.hpp>
 
 #ifndef _WIN32
 // SetWithLots need setrlimit.
+#  include <csignal>
 #  include <cstdio>
 #  include <sys/resource.h>
 #  include <sys/time.h>
+#  include <sys/wait.h>
 #  include <unistd.h>
 #endif
 
@@ -246,4 +250,493 @@ TEST_F(SubprocessTest, ReadStdin) {
   ASSERT_EQ(ExitSuccess, subproc->Finish());
   ASSERT_EQ(1u, subprocs_.finished_.size());
 }
+
+TEST_F(SubprocessTest, SplitSimpleCommand) {
+  std::vector<std::string> args;
+  EXPECT_TRUE(SplitSimpleCommand("cc -c foo.c -o foo.o", &args));
+  ASSERT_EQ(5u, args.size());
+  EXPECT_EQ("cc", args[0]);
+  EXPECT_EQ("-c", args[1]);
+  EXPECT_EQ("foo.o", args[4]);
+
+  EXPECT_TRUE(SplitSimpleCommand("  ld\t-Wl,--as-needed  @out.rsp ", &args));
+  ASSERT_EQ(3u, args.size());
+  EXPECT_EQ("ld", args[0]);
+  EXPECT_EQ("-Wl,--as-needed", args[1]);
+  EXPECT_EQ("@out.rsp", args[2]);
+
+  EXPECT_TRUE(SplitSimpleCommand("/usr/bin/ar rcs -DFOO=1 lib.a", &args));
+  ASSERT_EQ(4u, args.size());
+  EXPECT_EQ("-DFOO=1", args[2]);
+
+  EXPECT_FALSE(SplitSimpleCommand("", &args));
+  EXPECT_FALSE(SplitSimpleCommand("   ", &args));
+  EXPECT_FALSE(SplitSimpleCommand("echo 'a b'", &args));
+  EXPECT_FALSE(SplitSimpleCommand("echo \"a\"", &args));
+  EXPECT_FALSE(SplitSimpleCommand("echo a\\ b", &args));
+  EXPECT_FALSE(SplitSimpleCommand("echo $HOME", &args));
+  EXPECT_FALSE(SplitSimpleCommand("echo `pwd`", &args));
+  EXPECT_FALSE(SplitSimpleCommand("cc *.c", &args));
+  EXPECT_FALSE(SplitSimpleCommand("ls ~", &args));
+  EXPECT_FALSE(SplitSimpleCommand("cc -c a.c > log", &args));
+  EXPECT_FALSE(SplitSimpleCommand("cat < in", &args));
+  EXPECT_FALSE(SplitSimpleCommand("a | b", &args));
+  EXPECT_FALSE(SplitSimpleCommand("a && b", &args));
+  EXPECT_FALSE(SplitSimpleCommand("a; b", &args));
+  EXPECT_FALSE(SplitSimpleCommand("a\nb", &args));
+  EXPECT_FALSE(SplitSimpleCommand("cc foo.c #comment", &args));
+  EXPECT_FALSE(SplitSimpleCommand("CC=gcc make", &args));
+  EXPECT_FALSE(SplitSimpleCommand("cd out", &args));
+  EXPECT_FALSE(SplitSimpleCommand("exec cc", &args));
+  EXPECT_FALSE(SplitSimpleCommand("if true", &args));
+  EXPECT_FALSE(SplitSimpleCommand("time cc -c a.c", &args));
+  EXPECT_FALSE(SplitSimpleCommand("local x", &args));
+  EXPECT_FALSE(SplitSimpleCommand("echo -e a", &args));
+  EXPECT_FALSE(SplitSimpleCommand("pwd", &args));
+}
+
+// A simple command runs directly but behaves as it would in a shell.
+TEST_F(SubprocessTest, DirectCommand) {
+  Subprocess* subproc = subprocs_.Add("/bin/echo  direct   command");
+  ASSERT_NE((Subprocess*)0, subproc);
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+  ASSERT_EQ(ExitSuccess, subproc->Finish());
+  EXPECT_EQ("direct command\n", subproc->GetOutput());
+}
+
+// The shell reports programs that can't be found.
+TEST_F(SubprocessTest, DirectCommandNotFound) {
+  Subprocess* subproc = subprocs_.Add("ninja_no_such_command arg");
+  ASSERT_NE((Subprocess*)0, subproc);
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+  EXPECT_EQ(ExitFailure, subproc->Finish());
+  EXPECT_NE(
+      std::string::npos, subproc->GetOutput().find("ninja_no_such_command")
+  );
+}
+
+// use_shell still runs simple commands, with the shell.
+TEST_F(SubprocessTest, UseShell) {
+  Subprocess* subproc =
+      subprocs_.Add("echo  with   shell", /*use_console=*/false, true);
+  ASSERT_NE((Subprocess*)0, subproc);
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+  ASSERT_EQ(ExitSuccess, subproc->Finish());
+  EXPECT_EQ("with shell\n", subproc->GetOutput());
+}
+
+// Output beyond the limit goes to a temporary file, in order.
+TEST_F(SubprocessTest, SpillOutput) {
+  subprocs_.max_output_size_ = 10;
+  Subprocess* subproc = subprocs_.Add("seq 1 1000");
+  ASSERT_NE((Subprocess*)0, subproc);
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+  ASSERT_EQ(ExitSuccess, subproc->Finish());
+
+  std::string output = subproc->TakeOutput();
+  EXPECT_EQ(10u, output.size());
+  FILE* spill = subproc->TakeSpilledOutput();
+  ASSERT_TRUE(spill);
+  rewind(spill);
+  char buf[1024];
+  while (size_t len = fread(buf, 1, sizeof(buf), spill))
+    output.append(buf, len);
+  fclose(spill);
+
+  std::string expected;
+  for (int i = 1; i <= 1000; ++i)
+    expected += std::to_string(i) + "\n";
+  EXPECT_EQ(expected, output);
+}
+
+#ifdef __linux__
+// With -d pidfd, a command is done once it exits and the grace period is
+// over, even if a process it left behind still holds its output open.
+TEST_F(SubprocessTest, PidfdDaemonizedChild) {
+  g_use_pidfd = true;
+  SubprocessSet subprocs;
+  g_use_pidfd = false;
+  subprocs.drain_grace_millis_ = 100;
+  Subprocess* subproc = subprocs.Add("echo started; sleep 5 &", false, true);
+  ASSERT_NE((Subprocess*)0, subproc);
+
+  const int64_t start = GetTimeMillis();
+  while (!subproc->Done()) {
+    subprocs.DoWork();
+  }
+  EXPECT_LT(GetTimeMillis() - start, 3000);
+  ASSERT_EQ(ExitSuccess, subproc->Finish());
+  EXPECT_EQ("started\n", subproc->GetOutput());
+}
+
+// The grace period is a hard limit, even for a leftover process that keeps
+// writing to the pipe.
+TEST_F(SubprocessTest, PidfdDaemonizedWriter) {
+  g_use_pidfd = true;
+  SubprocessSet subprocs;
+  g_use_pidfd = false;
+  subprocs.drain_grace_millis_ = 100;
+  subprocs.max_output_size_ = 1 << 16;
+  Subprocess* subproc = subprocs.Add("echo started; yes &", false, true);
+  ASSERT_NE((Subprocess*)0, subproc);
+
+  const int64_t start = GetTimeMillis();
+  while (!subproc->Done() && GetTimeMillis() - start < 1000) {
+    subprocs.DoWork();
+  }
+  ASSERT_TRUE(subproc->Done());
+  ASSERT_EQ(ExitSuccess, subproc->Finish());
+  EXPECT_EQ(0u, subproc->GetOutput().find("started\n"));
+}
+
+// With -d pidfd, interruptions arrive through a signalfd.
+TEST_F(SubprocessTest, PidfdInterruptParent) {
+  g_use_pidfd = true;
+  SubprocessSet subprocs;
+  g_use_pidfd = false;
+  Subprocess* subproc = subprocs.Add("kill -TERM $PPID ; sleep 1");
+  ASSERT_NE((Subprocess*)0, subproc);
+
+  while (!subproc->Done()) {
+    bool interrupted = subprocs.DoWork();
+    if (interrupted)
+      return;
+  }
+
+  ASSERT_FALSE("We should have been interrupted");
+}
+#endif // __linux__
+
+// Each command of a batch gets its own output and status, even if it exits
+// the shell or doesn't end its output with a newline.
+TEST_F(SubprocessTest, Batch) {
+  const std::string kMarker = "ninja-batch-test";
+  std::vector<std::string> commands;
+  commands.push_back("echo one");
+  commands.push_back("printf two; exit 3");
+  commands.push_back("");
+  commands.push_back("echo four # comment");
+  Subprocess* subproc =
+      subprocs_.Add(MakeBatchScript(commands, kMarker, false), false, true);
+  ASSERT_NE((Subprocess*)0, subproc);
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+  ASSERT_EQ(ExitSuccess, subproc->Finish());
+
+  std::vector<std::string> outputs;
+  std::vector<ExitStatus> statuses;
+  ASSERT_EQ(
+      4u, SplitBatchOutput(
+              subproc->GetOutput(), kMarker, commands.size(), &outputs,
+              &statuses
+          )
+  );
+  EXPECT_EQ("one\n", outputs[0]);
+  EXPECT_EQ(ExitSuccess, statuses[0]);
+  EXPECT_EQ("two", outputs[1]);
+  EXPECT_EQ(ExitFailure, statuses[1]);
+  EXPECT_EQ("", outputs[2]);
+  EXPECT_EQ(ExitSuccess, statuses[2]);
+  EXPECT_EQ("four\n", outputs[3]);
+  EXPECT_EQ(ExitSuccess, statuses[3]);
+}
+
+// With stop_on_failure, a batch stops after its first failed command.
+TEST_F(SubprocessTest, BatchStopOnFailure) {
+  const std::string kMarker = "ninja-batch-test";
+  std::vector<std::string> commands;
+  commands.push_back("echo one");
+  commands.push_back("echo two; false");
+  commands.push_back("echo three");
+  Subprocess* subproc =
+      subprocs_.Add(MakeBatchScript(commands, kMarker, true), false, true);
+  ASSERT_NE((Subprocess*)0, subproc);
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+  EXPECT_EQ(ExitFailure, subproc->Finish());
+
+  std::vector<std::string> outputs;
+  std::vector<ExitStatus> statuses;
+  ASSERT_EQ(
+      2u, SplitBatchOutput(
+              subproc->GetOutput(), kMarker, commands.size(), &outputs,
+              &statuses
+          )
+  );
+  EXPECT_EQ(ExitFailure, statuses[1]);
+  EXPECT_EQ("two\n", outputs[1]);
+  EXPECT_EQ("", outputs[2]);
+}
+
+// A command of a batch killed by SIGINT is interrupted, and stops the batch.
+TEST_F(SubprocessTest, BatchInterrupted) {
+  const std::string kMarker = "ninja-batch-test";
+  std::vector<std::string> commands;
+  commands.push_back("sh -c 'kill -INT $$'");
+  commands.push_back("echo two");
+  Subprocess* subproc =
+      subprocs_.Add(MakeBatchScript(commands, kMarker, false), false, true);
+  ASSERT_NE((Subprocess*)0, subproc);
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+  subproc->Finish();
+
+  std::vector<std::string> outputs;
+  std::vector<ExitStatus> statuses;
+  ASSERT_EQ(
+      1u, SplitBatchOutput(
+              subproc->GetOutput(), kMarker, commands.size(), &outputs,
+              &statuses
+          )
+  );
+  EXPECT_EQ(ExitInterrupted, statuses[0]);
+  EXPECT_EQ("", outputs[1]);
+}
+
+// The output of a batch which stopped early goes to its unfinished command.
+TEST_F(SubprocessTest, SplitBatchOutputUnfinished) {
+  std::vector<std::string> outputs;
+  std::vector<ExitStatus> statuses;
+  EXPECT_EQ(
+      1u, SplitBatchOutput("a\nm:0:0\nb\n", "m", 3, &outputs, &statuses)
+  );
+  ASSERT_EQ(3u, outputs.size());
+  EXPECT_EQ("a\n", outputs[0]);
+  EXPECT_EQ("b\n", outputs[1]);
+  EXPECT_EQ("", outputs[2]);
+  ASSERT_EQ(1u, statuses.size());
+  EXPECT_EQ(ExitSuccess, statuses[0]);
+}
+
+// Fed a byte at a time, markers are still found, and the outputs past the
+// limit, shared by all commands, go to a file for each command.
+TEST_F(SubprocessTest, BatchOutputSplitterStreaming) {
+  const std::string output = "one\nm:0:0\ntwo\nm:1:3\nthree\n";
+  BatchOutputSplitter splitter("m", 3, 5);
+  for (char c : output)
+    splitter.Feed(&c, 1);
+  EXPECT_EQ(2u, splitter.Finish());
+
+  ASSERT_EQ(2u, splitter.statuses_.size());
+  EXPECT_EQ(ExitSuccess, splitter.statuses_[0]);
+  EXPECT_EQ(ExitFailure, splitter.statuses_[1]);
+  EXPECT_EQ("one\n", splitter.outputs_[0]);
+  EXPECT_FALSE(splitter.spills_[0]);
+  EXPECT_EQ("t", splitter.outputs_[1]);
+  EXPECT_EQ("", splitter.outputs_[2]);
+
+  const char* const kSpilled[] = {"", "wo\n", "three\n"};
+  for (size_t i = 1; i < 3; ++i) {
+    FILE* spill = splitter.spills_[i];
+    ASSERT_TRUE(spill);
+    rewind(spill);
+    char buf[64];
+    size_t len = fread(buf, 1, sizeof(buf), spill);
+    EXPECT_EQ(kSpilled[i], std::string(buf, len));
+  }
+}
+
+namespace {
+
+struct ScopedSpawner {
+  ScopedSpawner() { SubprocessSet::StartSpawner(); }
+  ~ScopedSpawner() { SubprocessSet::StopSpawner(); }
+};
+
+} // anonymous namespace
+
+// Commands started by the spawner behave as if ninja started them.
+TEST_F(SubprocessTest, Spawner) {
+  ScopedSpawner spawner;
+  const char* kCommands[] = {
+    "echo spawned",
+    "echo 'through the shell' >&2",
+    "exit 1",
+    "kill -INT $$",
+  };
+  const size_t kNumCommands = sizeof(kCommands) / sizeof(kCommands[0]);
+  Subprocess* processes[kNumCommands];
+  for (size_t i = 0; i < kNumCommands; ++i) {
+    processes[i] = subprocs_.Add(kCommands[i]);
+    ASSERT_NE((Subprocess*)0, processes[i]);
+  }
+  while (!subprocs_.running_.empty())
+    subprocs_.DoWork();
+  ASSERT_EQ(kNumCommands, subprocs_.finished_.size());
+
+  // Collect the exit statuses in reverse, so the spawner reports some of
+  // them before they're asked for.
+  EXPECT_EQ(ExitInterrupted, processes[3]->Finish());
+  EXPECT_EQ(ExitFailure, processes[2]->Finish());
+  EXPECT_EQ(ExitSuccess, processes[1]->Finish());
+  EXPECT_EQ("through the shell\n", processes[1]->GetOutput());
+  EXPECT_EQ(ExitSuccess, processes[0]->Finish());
+  EXPECT_EQ("spawned\n", processes[0]->GetOutput());
+  while (Subprocess* subproc = subprocs_.NextFinished())
+    delete subproc;
+}
+
+namespace {
+
+// A persistent worker which responds with its pid, fails requests that
+// mention "fail", dies on those that mention "crash", and on the first that
+// mentions "flaky" in the current directory.
+const char kWorker[] =
+    "while read len; do"
+    "  body=$(dd bs=1 count=$len 2>/dev/null);"
+    "  id=${body#*\\\"id\\\":}; id=${id%%,*};"
+    "  code=0;"
+    "  case $body in"
+    "    *crash*) echo dying >&2; exit 3;;"
+    "    *flaky*) [ -e crashed ] || { touch crashed; exit 4; };;"
+    "    *fail*) code=1;;"
+    "  esac;"
+    "  resp=\"{\\\"id\\\":$id,\\\"exit_code\\\":$code,"
+    "\\\"output\\\":\\\"pid $$\\\\n\\\"}\";"
+    "  printf '%d\\n%s' ${#resp} \"$resp\";"
+    "done";
+
+} // anonymous namespace
+
+TEST_F(SubprocessTest, WorkerReused) {
+  std::string pid;
+  for (const char* command : {"tool a", "tool b"}) {
+    Subprocess* subproc = subprocs_.Add(command, false, false, kWorker);
+    ASSERT_NE((Subprocess*)0, subproc);
+    while (!subproc->Done())
+      subprocs_.DoWork();
+    ASSERT_EQ(subproc, subprocs_.NextFinished());
+    EXPECT_EQ(ExitSuccess, subproc->Finish());
+    const std::string& output = subproc->GetOutput();
+    EXPECT_EQ(0u, output.find("pid "));
+    if (pid.empty())
+      pid = output;
+    EXPECT_EQ(pid, output);
+    delete subproc;
+  }
+  EXPECT_EQ(1u, subprocs_.workers_.size());
+}
+
+TEST_F(SubprocessTest, WorkerParallel) {
+  Subprocess* first = subprocs_.Add("tool a", false, false, kWorker);
+  Subprocess* second = subprocs_.Add("tool fail", false, false, kWorker);
+  ASSERT_NE((Subprocess*)0, first);
+  ASSERT_NE((Subprocess*)0, second);
+  EXPECT_EQ(2u, subprocs_.workers_.size());
+  while (!subprocs_.running_.empty())
+    subprocs_.DoWork();
+  EXPECT_EQ(ExitSuccess, first->Finish());
+  EXPECT_EQ(ExitFailure, second->Finish());
+  EXPECT_NE(first->GetOutput(), second->GetOutput());
+  while (Subprocess* subproc = subprocs_.NextFinished())
+    delete subproc;
+}
+
+// A worker which dies is replaced, and the request retried once.
+TEST_F(SubprocessTest, WorkerCrash) {
+  Subprocess* subproc = subprocs_.Add("tool crash", false, false, kWorker);
+  ASSERT_NE((Subprocess*)0, subproc);
+  while (!subproc->Done())
+    subprocs_.DoWork();
+  EXPECT_EQ(ExitFailure, subproc->Finish());
+  const std::string& output = subproc->GetOutput();
+  EXPECT_NE(std::string::npos, output.find("exited with status 3\n"));
+  EXPECT_NE(std::string::npos, output.find("dying\n"));
+  EXPECT_EQ(0u, subprocs_.workers_.size());
+
+  subproc = subprocs_.Add("tool a", false, false, kWorker);
+  ASSERT_NE((Subprocess*)0, subproc);
+  while (!subproc->Done())
+    subprocs_.DoWork();
+  EXPECT_EQ(ExitSuccess, subproc->Finish());
+  EXPECT_EQ(0u, subproc->GetOutput().find("pid "));
+  while ((subproc = subprocs_.NextFinished()))
+    delete subproc;
+}
+
+// A worker which dies while idle is replaced without using up the retry.
+TEST_F(SubprocessTest, WorkerDiedIdle) {
+  ScopedTempDir temp_dir;
+  temp_dir.CreateAndEnter("WorkerDiedIdle");
+  Subprocess* subproc = subprocs_.Add("tool a", false, false, kWorker);
+  ASSERT_NE((Subprocess*)0, subproc);
+  while (!subproc->Done())
+    subprocs_.DoWork();
+  EXPECT_EQ(ExitSuccess, subproc->Finish());
+  pid_t pid = atoi(subproc->GetOutput().c_str() + strlen("pid "));
+  ASSERT_LT(0, pid);
+  ASSERT_EQ(0, kill(pid, SIGKILL));
+  siginfo_t info;
+  ASSERT_EQ(0, waitid(P_PID, pid, &info, WEXITED | WNOWAIT));
+
+  Subprocess* flaky = subprocs_.Add("tool flaky", false, false, kWorker);
+  ASSERT_NE((Subprocess*)0, flaky);
+  while (!flaky->Done())
+    subprocs_.DoWork();
+  EXPECT_EQ(ExitSuccess, flaky->Finish());
+  EXPECT_EQ(0u, flaky->GetOutput().find("pid "));
+  while ((subproc = subprocs_.NextFinished()))
+    delete subproc;
+  temp_dir.Cleanup();
+}
+
+// A worker which ignores SIGTERM is killed when the build ends.
+TEST_F(SubprocessTest, WorkerIgnoresTerm) {
+  const std::string worker = std::string("trap '' TERM; ") + kWorker;
+  int64_t start;
+  {
+    SubprocessSet subprocs;
+    Subprocess* subproc = subprocs.Add("tool a", false, false, worker);
+    ASSERT_NE((Subprocess*)0, subproc);
+    while (!subproc->Done())
+      subprocs.DoWork();
+    EXPECT_EQ(ExitSuccess, subproc->Finish());
+    delete subprocs.NextFinished();
+    start = GetTimeMillis();
+  }
+  EXPECT_LT(GetTimeMillis() - start, 3000);
+}
+
+// Commands which need a shell run as usual.
+TEST_F(SubprocessTest, WorkerShellCommand) {
+  Subprocess* subproc =
+      subprocs_.Add("echo 'not for a worker'", false, false, kWorker);
+  ASSERT_NE((Subprocess*)0, subproc);
+  while (!subproc->Done())
+    subprocs_.DoWork();
+  EXPECT_EQ(ExitSuccess, subproc->Finish());
+  EXPECT_EQ("not for a worker\n", subproc->GetOutput());
+  EXPECT_EQ(0u, subprocs_.workers_.size());
+}
+
+// The spawner doesn't get in the way of interrupting ninja.
+TEST_F(SubprocessTest, SpawnerInterruptParent) {
+  ScopedSpawner spawner;
+  // The command's parent is the spawner, so name ninja explicitly.
+  char command[64];
+  snprintf(command, sizeof(command), "kill -INT %d ; sleep 1", getpid());
+  Subprocess* subproc = subprocs_.Add(command);
+  ASSERT_NE((Subprocess*)0, subproc);
+
+  while (!subproc->Done()) {
+    bool interrupted = subprocs_.DoWork();
+    if (interrupted) {
+      subprocs_.Clear();
+      return;
+    }
+  }
+
+  ASSERT_FALSE("We should have been interrupted");
+}
 #endif // _WIN32
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <algorithm>
+#include <cassert>
 #include <cerrno>
 #include <cstdlib>
 #include <cstring>
@@ -83,8 +84,11 @@ VerifyGraph(const State& state) {
     EXPECT_FALSE(edge->outputs_.empty());
     // Check that the edge's inputs have the edge as out-edge.
     for (Node* in_node : edge->inputs_) {
-      const std::vector<Edge*>& out_edges = in_node->out_edges();
-      EXPECT_NE(find(out_edges.begin(), out_edges.end(), edge.get()), out_edges.end());
+      const EdgeList& out_edges = in_node->out_edges();
+      EXPECT_NE(
+          std::find(out_edges.begin(), out_edges.end(), edge.get()),
+          out_edges.end()
+      );
     }
     // Check that the edge's outputs have the edge as in-edge.
     for (Node* out_node : edge->outputs_) {
@@ -140,6 +144,12 @@ VirtualFileSystem::MakeDir(const std::string& path) {
   return true; // success
 }
 
+bool
+VirtualFileSystem::IsDirectory(const std::string& path) const {
+  return std::find(directories_made_.begin(), directories_made_.end(), path)
+         != directories_made_.end();
+}
+
 FileReader::Status
 VirtualFileSystem::ReadFile(
     const std::string& path, std::string* contents, std::string* err
@@ -154,6 +164,45 @@ VirtualFileSystem::ReadFile(
   return NotFound;
 }
 
+bool
+VirtualFileSystem::MakeSymlink(
+    const std::string& target, const std::string& path, std::string* err
+) {
+  Create(path, "");
+  symlinks_[path] = target;
+  return true;
+}
+
+int
+VirtualFileSystem::CreateMemoryFile(
+    const std::string& contents, std::string* path
+) {
+  int fd = next_memory_fd_++;
+  *path = "/dev/fd/" + std::to_string(fd);
+  files_[*path].mtime = now_;
+  files_[*path].contents = contents;
+  memory_files_[fd] = *path;
+  return fd;
+}
+
+bool
+VirtualFileSystem::ReadMemoryFile(
+    int fd, std::string* contents, std::string* err
+) {
+  std::map<int, std::string>::iterator i = memory_files_.find(fd);
+  assert(i != memory_files_.end());
+  contents->append(files_[i->second].contents);
+  return true;
+}
+
+void
+VirtualFileSystem::CloseMemoryFile(int fd) {
+  std::map<int, std::string>::iterator i = memory_files_.find(fd);
+  assert(i != memory_files_.end());
+  files_.erase(i->second);
+  memory_files_.erase(i);
+}
+
 int
 VirtualFileSystem::RemoveFile(const std::string& path) {
   if (find(directories_made_.begin(), directories_made_.end(), path)
@@ -395,7 +395,7 @@ islatinalpha(int c) {
 }
 
 std::string
-StripAnsiEscapeCodes(const std::string& in) {
+StripAnsiEscapeCodes(std::string_view in) {
   std::string stripped;
   stripped.reserve(in.size());
 